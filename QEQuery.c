@@ -23,6 +23,31 @@
 #include "QEQuery.h"
 #include "kext_tools_util.h"
 
+/*******************************************************************************
+* A complete query is compiled into a flat program the first time it's
+* evaluated (see _QEQueryCompile()). Each element becomes an Evaluate op with
+* its callback already looked up; each group becomes a GroupStart, its
+* elements each followed by an AndTest or OrTest, and a GroupEnd. Groups
+* keep their running result on a small stack, and the tests jump straight
+* to their group's GroupEnd when short-circuiting.
+*******************************************************************************/
+typedef enum {
+    kQEQueryOpEvaluate = 0,
+    kQEQueryOpGroupStart,
+    kQEQueryOpAndTest,
+    kQEQueryOpOrTest,
+    kQEQueryOpGroupEnd
+} QEQueryOpcode;
+
+typedef struct {
+    QEQueryOpcode             opcode;
+    Boolean                   negated;   // Evaluate, GroupEnd
+    Boolean                   value;     // GroupStart: result if no test changes it
+    uint32_t                  jump;      // AndTest, OrTest: the group's GroupEnd
+    QEQueryEvaluationCallback callback;  // Evaluate; NULL if none was set
+    CFDictionaryRef           element;   // Evaluate; owned by the query tree
+} QEQueryOp;
+
 /*******************************************************************************
 * The internal query engine object definition.
 *******************************************************************************/
@@ -71,6 +96,15 @@ struct __QEQuery {
    /* Client-defined data passed to all callbacks.
     */
     void *                     userData;
+
+   /* The compiled query, or NULL if it must be (re)compiled before the next
+    * evaluation; groupResults holds a running result per open group.
+    */
+    QEQueryOp *                program;
+    uint32_t                   programLength;
+    uint32_t                   programCapacity;
+    uint32_t                   programDepth;
+    Boolean *                  groupResults;
 };
 
 /*******************************************************************************
@@ -129,6 +163,18 @@ QEQueryEvaluationCallback _QEQueryEvaluationCallbackForPredicate(
 Boolean _QEQueryElementIsNegated(CFDictionaryRef element);
 void _QEQueryElementNegate(CFMutableDictionaryRef element);
 
+Boolean _QEQueryRunProgram(QEQueryRef query, void * object);
+Boolean _QEQueryCompile(QEQueryRef query);
+Boolean _QEQueryCompileElement(
+    QEQueryRef query,
+    CFDictionaryRef element,
+    uint32_t depth);
+Boolean _QEQueryEmitOp(
+    QEQueryRef query,
+    QEQueryOpcode opcode,
+    uint32_t * index);
+void _QEQueryDiscardProgram(QEQueryRef query);
+
 #pragma mark Creation/Setup/Destruction
 
 /*******************************************************************************
@@ -219,6 +265,7 @@ QEQueryFree(QEQueryRef query)
     if (query->parseCallbacks) CFRelease(query->parseCallbacks);
     if (query->evaluationCallbacks) CFRelease(query->evaluationCallbacks);
     if (query->synonyms)       CFRelease(query->synonyms);
+    _QEQueryDiscardProgram(query);
     free(query);
     return;
 }
@@ -232,6 +279,7 @@ QEQueryEmptyParseDictionaries(QEQueryRef query)
     CFDictionaryRemoveAllValues(query->parseCallbacks);
     CFDictionaryRemoveAllValues(query->evaluationCallbacks);
     CFDictionaryRemoveAllValues(query->synonyms);
+    _QEQueryDiscardProgram(query);
     return;
 }
 
@@ -298,6 +346,8 @@ QEQuerySetEvaluationCallbackForPredicate(
 {
     CFDataRef eCallback = NULL;
 
+    _QEQueryDiscardProgram(query);
+
     if (evaluationCallback) {
         eCallback = CFDataCreate(kCFAllocatorDefault,
             (void *)&evaluationCallback, sizeof(QEQueryEvaluationCallback));
@@ -378,116 +428,262 @@ QEQueryGetShortCircuits(QEQueryRef query)
 }
 
 /*******************************************************************************
+* Runs the compiled query. This gives the same results, and makes the same
+* callbacks in the same order, as recursively evaluating the query tree:
 *
+* - An AND group is false if short-circuiting and an element is false,
+*   otherwise true.
+* - An OR group is true if any element evaluated is true, or if it's empty.
+* - Any element evaluated after an error is false.
 *******************************************************************************/
 Boolean
-_QEQueryElementEvaluate(
+_QEQueryRunProgram(
+    QEQueryRef query,
+    void * object)
+{
+    Boolean result = false;
+    Boolean * groupResult = query->groupResults - 1;  // none open yet
+    uint32_t pc = 0;
+
+    while (pc < query->programLength) {
+        const QEQueryOp * op = &query->program[pc++];
+
+        switch (op->opcode) {
+          case kQEQueryOpEvaluate:
+            if (op->callback) {
+                result = op->callback(op->element, object, query->userData,
+                    &query->lastError);
+            } else {
+                query->lastError = kQEQueryErrorNoEvaluationCallback;
+                result = false;
+            }
+            if (op->negated) {
+                result = !result;
+            }
+            if (query->lastError != kQEQueryErrorNone) {
+                result = false;
+            }
+            break;
+
+          case kQEQueryOpGroupStart:
+            *++groupResult = op->value;
+            break;
+
+          case kQEQueryOpAndTest:
+            if (!result && query->shortCircuitEval) {
+                *groupResult = false;
+                pc = op->jump;
+            }
+            break;
+
+          case kQEQueryOpOrTest:
+            if (result) {
+                *groupResult = true;
+                if (query->shortCircuitEval) {
+                    pc = op->jump;
+                }
+            }
+            break;
+
+          case kQEQueryOpGroupEnd:
+            result = *groupResult--;
+            if (op->negated) {
+                result = !result;
+            }
+            if (query->lastError != kQEQueryErrorNone) {
+                result = false;
+            }
+            break;
+        }
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+*
+*******************************************************************************/
+Boolean
+QEQueryEvaluate(
     QEQueryRef query,
-    CFDictionaryRef element,
     void * object)
+{
+    Boolean result = false;
+    if (!QEQueryIsComplete(query) || query->lastError != kQEQueryErrorNone) {
+        goto finish;
+    }
+    if (!query->program && !_QEQueryCompile(query)) {
+        // called function sets query->lastError
+        goto finish;
+    }
+    result = _QEQueryRunProgram(query, object);
+finish:
+    return result;
+}
+
+/*******************************************************************************
+* _QEQueryCompile() lowers the query tree into query->program. It's done once,
+* on the first evaluation of a complete query; anything that changes the tree
+* or the evaluation callbacks discards the program so that it's redone.
+*******************************************************************************/
+Boolean
+_QEQueryCompile(QEQueryRef query)
+{
+    Boolean result = false;
+
+    _QEQueryDiscardProgram(query);
+
+    if (!_QEQueryCompileElement(query, query->queryRoot, 0)) {
+        goto finish;
+    }
+
+   /* A query with no groups still gets a slot so malloc() can't return NULL.
+    */
+    query->groupResults = (Boolean *)malloc(
+        (query->programDepth ? query->programDepth : 1) * sizeof(Boolean));
+    if (!query->groupResults) {
+        query->lastError = kQEQueryErrorNoMemory;
+        goto finish;
+    }
+
+    result = true;
+
+finish:
+    if (!result) {
+        _QEQueryDiscardProgram(query);
+    }
+    return result;
+}
+
+/*******************************************************************************
+* Each test in a group is emitted with its jump linking to the group's
+* previous test, and the chain is patched to the GroupEnd once that's known.
+*******************************************************************************/
+Boolean
+_QEQueryCompileElement(
+    QEQueryRef query,
+    CFDictionaryRef element,
+    uint32_t depth)
 {
     Boolean result = false;
     CFStringRef predicate = NULL;
     CFArrayRef elements = NULL;
+    Boolean andFlag = false;
+    uint32_t index = 0;
+    uint32_t testChain = UINT32_MAX;
     CFIndex count, i;
 
     predicate = CFDictionaryGetValue(element, kQEQueryKeyPredicate);
+    andFlag = CFEqual(predicate, kQEQueryPredicateAnd);
 
+    if (!andFlag && !CFEqual(predicate, kQEQueryPredicateOr)) {
+        if (!_QEQueryEmitOp(query, kQEQueryOpEvaluate, &index)) {
+            goto finish;
+        }
+        query->program[index].negated = _QEQueryElementIsNegated(element);
+        query->program[index].element = element;
+        query->program[index].callback =
+            _QEQueryEvaluationCallbackForPredicate(query, predicate);
+        result = true;
+        goto finish;
+    }
 
-    if (CFEqual(predicate, kQEQueryPredicateAnd)) {
-        elements = QEQueryElementGetArguments(element);
+    elements = QEQueryElementGetArguments(element);
+    count = CFArrayGetCount(elements);
 
-       /* Empty groups can't normally be created, except for the
-        * root query, but empty groups are trivially true; basically,
-        * an empty group is true.
-        */
-        count = CFArrayGetCount(elements);        if (!count) {
-            result = true;
-        }
+    if (depth + 1 > query->programDepth) {
+        query->programDepth = depth + 1;
+    }
 
-       /* If any element in an AND group is false, stop evaluating the
-        * group and return false, else return true.
-        */
-        for (i = 0; i < count; i++) {
-            CFDictionaryRef thisElement = CFArrayGetValueAtIndex(elements, i);
-            if (!_QEQueryElementEvaluate(query, thisElement, object)) {
-                if (query->shortCircuitEval) {
-                    goto finish;
-                }
-            }
-        }
-        result = true;
-    } else if (CFEqual(predicate, kQEQueryPredicateOr)) {
-        elements = QEQueryElementGetArguments(element);
+   /* Empty groups are trivially true; otherwise an AND group starts out
+    * true and an OR group false.
+    */
+    if (!_QEQueryEmitOp(query, kQEQueryOpGroupStart, &index)) {
+        goto finish;
+    }
+    query->program[index].value = andFlag || !count;
 
-       /* Empty groups can't normally be created, except for the
-        * root query, but empty groups are trivially true; basically,
-        * an empty group is true.
-        */
-        count = CFArrayGetCount(elements);
-        if (!count) {
-            result = true;
-        }
+    for (i = 0; i < count; i++) {
+        if (!_QEQueryCompileElement(query,
+            CFArrayGetValueAtIndex(elements, i), depth + 1)) {
 
-       /* If any element in an OR group is true, stop evaluating the
-        * group and return true, else return false.
-        */
-        for (i = 0; i < count; i++) {
-            CFDictionaryRef thisElement = CFArrayGetValueAtIndex(elements, i);
-            if (_QEQueryElementEvaluate(query, thisElement, object)) {
-                result = true;
-                if (query->shortCircuitEval) {
-                    goto finish;
-                }
-            }
+            goto finish;
         }
-    } else {
+        if (!_QEQueryEmitOp(query,
+            andFlag ? kQEQueryOpAndTest : kQEQueryOpOrTest, &index)) {
 
-       /* Look for a client callback.
-        */
-        QEQueryEvaluationCallback evalCallback =
-            _QEQueryEvaluationCallbackForPredicate(query, predicate);
-        if (evalCallback) {
-            result = evalCallback(element, object, query->userData,
-                &query->lastError);
-        } else {
-            query->lastError = kQEQueryErrorNoEvaluationCallback;
+            goto finish;
         }
+        query->program[index].jump = testChain;
+        testChain = index;
     }
 
-finish:
-
-   /* Flip the result if the element is negated.
-     */
-    if (_QEQueryElementIsNegated(element)) {
-        result = !result;
+    if (!_QEQueryEmitOp(query, kQEQueryOpGroupEnd, &index)) {
+        goto finish;
     }
+    query->program[index].negated = _QEQueryElementIsNegated(element);
 
-   /* Set the result to false upon any error.
-    */
-    if (query->lastError != kQEQueryErrorNone) {
-        result = false;
+    while (testChain != UINT32_MAX) {
+        uint32_t next = query->program[testChain].jump;
+        query->program[testChain].jump = index;
+        testChain = next;
     }
+
+    result = true;
+
+finish:
     return result;
 }
 
 /*******************************************************************************
-*
+* Appends a zeroed op to the program and returns its index.
 *******************************************************************************/
 Boolean
-QEQueryEvaluate(
+_QEQueryEmitOp(
     QEQueryRef query,
-    void * object)
+    QEQueryOpcode opcode,
+    uint32_t * index)
 {
     Boolean result = false;
-    if (!QEQueryIsComplete(query) || query->lastError != kQEQueryErrorNone) {
-        goto finish;
+
+    if (query->programLength == query->programCapacity) {
+        uint32_t newCapacity = query->programCapacity ?
+            2 * query->programCapacity : 32;
+        QEQueryOp * newProgram = (QEQueryOp *)realloc(query->program,
+            newCapacity * sizeof(QEQueryOp));
+        if (!newProgram) {
+            query->lastError = kQEQueryErrorNoMemory;
+            goto finish;
+        }
+        query->program = newProgram;
+        query->programCapacity = newCapacity;
     }
-    result = _QEQueryElementEvaluate(query, query->queryRoot, object);
+
+    *index = query->programLength++;
+    bzero(&query->program[*index], sizeof(QEQueryOp));
+    query->program[*index].opcode = opcode;
+
+    result = true;
 finish:
     return result;
 }
 
+/*******************************************************************************
+*
+*******************************************************************************/
+void
+_QEQueryDiscardProgram(QEQueryRef query)
+{
+    if (query->program)      free(query->program);
+    if (query->groupResults) free(query->groupResults);
+    query->program = NULL;
+    query->groupResults = NULL;
+    query->programLength = 0;
+    query->programCapacity = 0;
+    query->programDepth = 0;
+    return;
+}
+
 #pragma mark Command-Line Argument Processing
 
 /*******************************************************************************
@@ -687,6 +883,7 @@ QEQueryAppendElement(
     elements = (CFMutableArrayRef)CFDictionaryGetValue(
         query->queryStackTop, kQEQueryKeyArguments);
 
+    _QEQueryDiscardProgram(query);
     CFArrayAppendValue(elements, (const void *)element);
     query->logicOpActive = false;
 
@@ -1235,6 +1432,8 @@ _QEQueryPushGroup(
         CFDictionarySetValue(newGroup, kQEQueryKeyNegated, kCFBooleanTrue);
     }
 
+    _QEQueryDiscardProgram(query);
+
     if (andFlag) {
         yankedElement = _QEQueryYankElement(query);
     } else {
@@ -1274,6 +1473,7 @@ _QEQueryPopGroup(QEQueryRef query)
         query->lastError = kQEQueryErrorGroupNesting;
         goto finish;
     }
+    _QEQueryDiscardProgram(query);
     CFArrayRemoveValueAtIndex(query->queryStack, stackDepth - 1);
     query->queryStackTop = (CFMutableDictionaryRef)CFArrayGetValueAtIndex(
         query->queryStack, stackDepth - 2);
@@ -152,6 +152,11 @@ typedef struct __QEQuery * QEQueryRef;
 * as well as just checking them against a query predicate. For example, you
 * could define a '-print' predicate that just prints data from the object
 * and returns true.
+*
+* The first evaluation of a complete query compiles it into a flat program,
+* looking up each element's evaluation callback once. Adding to the query or
+* changing evaluation callbacks causes it to be recompiled, but changing an
+* element's predicate after evaluation has begun does not.
 ********************************************************************************
 * TO DO:
 * XXX: Add functions that take CF strings?
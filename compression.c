@@ -21,34 +21,250 @@
  * @APPLE_LICENSE_HEADER_END@
  */
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include "compression.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 /*******************************************************************************
+* adler32
+*
+* ADLER_NMAX is the largest n such that 255n(n+1)/2 + (n+1)(ADLER_BASE-1)
+* fits in 32 bits, i.e. how many bytes can be summed before reducing.
+* The vector paths consume whole 16- or 32-byte blocks and leave any tail
+* to adler32_scalar(); all paths produce the same value.
 *******************************************************************************/
-u_int32_t local_adler32(u_int8_t * buffer, int32_t length)
+#define ADLER_BASE  65521U
+#define ADLER_NMAX  5552
+
+static u_int32_t adler32_scalar(
+    u_int32_t        adler,
+    const u_int8_t * buf,
+    size_t           len)
+{
+    u_int32_t s1 = adler & 0xffff;
+    u_int32_t s2 = adler >> 16;
+    size_t    n;
+
+    while (len) {
+        n = (len < ADLER_NMAX) ? len : ADLER_NMAX;
+        len -= n;
+        while (n--) {
+            s1 += *buf++;
+            s2 += s1;
+        }
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+
+    return (s2 << 16) | s1;
+}
+
+/* Folds one vector run of n bytes into (s1, s2). byteSum is the plain sum
+ * of the run, weightSum the sum weighted by (blockSize - i) within each
+ * block, and prefixSum the sum over blocks of all bytes in earlier blocks.
+ */
+static inline u_int32_t adler32_fold(
+    u_int32_t adler,
+    size_t    n,
+    size_t    blockSize,
+    u_int64_t byteSum,
+    u_int64_t weightSum,
+    u_int64_t prefixSum)
+{
+    u_int64_t s1 = adler & 0xffff;
+    u_int64_t s2 = adler >> 16;
+
+    s2 = (s2 + s1 * n + blockSize * (prefixSum % ADLER_BASE) + weightSum) % ADLER_BASE;
+    s1 = (s1 + byteSum) % ADLER_BASE;
+
+    return (u_int32_t)((s2 << 16) | s1);
+}
+
+#if defined(__AVX2__)
+
+static inline u_int64_t hsum_epi32_256(__m256i v)
+{
+    u_int32_t lanes[8];
+    u_int64_t sum = 0;
+    int       i;
+
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    for (i = 0; i < 8; i++) sum += lanes[i];
+    return sum;
+}
+
+static u_int32_t adler32_vector(
+    u_int32_t        adler,
+    const u_int8_t * buf,
+    size_t           len)
+{
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i ones    = _mm256_set1_epi16(1);
+    const __m256i weights = _mm256_setr_epi8(
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1);
+
+    while (len >= 32) {
+        size_t  n  = ((len < ADLER_NMAX) ? len : ADLER_NMAX) & ~(size_t)31;
+        size_t  i;
+        __m256i vs1 = zero, vs2 = zero, vps = zero;
+
+        for (i = 0; i < n; i += 32) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i *)(buf + i));
+
+            vps = _mm256_add_epi32(vps, vs1);
+            vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(bytes, zero));
+            vs2 = _mm256_add_epi32(vs2,
+                _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+        }
+        adler = adler32_fold(adler, n, 32,
+            hsum_epi32_256(vs1), hsum_epi32_256(vs2), hsum_epi32_256(vps));
+        buf += n;
+        len -= n;
+    }
+
+    return adler32_scalar(adler, buf, len);
+}
+
+#elif defined(__SSE2__)
+
+static inline u_int64_t hsum_epi32_128(__m128i v)
 {
-    int32_t cnt;
-    u_int32_t  result, lowHalf, highHalf;
+    u_int32_t lanes[4];
 
-    lowHalf = 1;
-    highHalf = 0;
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return (u_int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static u_int32_t adler32_vector(
+    u_int32_t        adler,
+    const u_int8_t * buf,
+    size_t           len)
+{
+    const __m128i zero     = _mm_setzero_si128();
+    const __m128i weightLo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weightHi = _mm_setr_epi16( 8,  7,  6,  5,  4,  3,  2, 1);
+
+    while (len >= 16) {
+        size_t  n  = ((len < ADLER_NMAX) ? len : ADLER_NMAX) & ~(size_t)15;
+        size_t  i;
+        __m128i vs1 = zero, vs2 = zero, vps = zero;
 
-    for (cnt = 0; cnt < length; cnt++) {
-        if ((cnt % 5000) == 0) {
-            lowHalf  %= 65521L;
-            highHalf %= 65521L;
+        for (i = 0; i < n; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(buf + i));
+
+            vps = _mm_add_epi32(vps, vs1);
+            vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+            vs2 = _mm_add_epi32(vs2,
+                _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightLo));
+            vs2 = _mm_add_epi32(vs2,
+                _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightHi));
         }
+        adler = adler32_fold(adler, n, 16,
+            hsum_epi32_128(vs1), hsum_epi32_128(vs2), hsum_epi32_128(vps));
+        buf += n;
+        len -= n;
+    }
+
+    return adler32_scalar(adler, buf, len);
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline u_int64_t hsum_u32x4(uint32x4_t v)
+{
+    return (u_int64_t)vgetq_lane_u32(v, 0) + vgetq_lane_u32(v, 1) +
+           vgetq_lane_u32(v, 2) + vgetq_lane_u32(v, 3);
+}
+
+static u_int32_t adler32_vector(
+    u_int32_t        adler,
+    const u_int8_t * buf,
+    size_t           len)
+{
+    static const u_int8_t weightBytes[16] = {
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+    const uint8x8_t weightLo = vld1_u8(&weightBytes[0]);
+    const uint8x8_t weightHi = vld1_u8(&weightBytes[8]);
+
+    while (len >= 16) {
+        size_t     n  = ((len < ADLER_NMAX) ? len : ADLER_NMAX) & ~(size_t)15;
+        size_t     i;
+        uint32x4_t vs1 = vdupq_n_u32(0);
+        uint32x4_t vs2 = vdupq_n_u32(0);
+        uint32x4_t vps = vdupq_n_u32(0);
+
+        for (i = 0; i < n; i += 16) {
+            uint8x16_t bytes = vld1q_u8(buf + i);
 
-        lowHalf += buffer[cnt];
-        highHalf += lowHalf;
+            vps = vaddq_u32(vps, vs1);
+            vs1 = vpadalq_u16(vs1, vpaddlq_u8(bytes));
+            vs2 = vpadalq_u16(vs2, vmull_u8(vget_low_u8(bytes), weightLo));
+            vs2 = vpadalq_u16(vs2, vmull_u8(vget_high_u8(bytes), weightHi));
+        }
+        adler = adler32_fold(adler, n, 16,
+            hsum_u32x4(vs1), hsum_u32x4(vs2), hsum_u32x4(vps));
+        buf += n;
+        len -= n;
     }
 
-    lowHalf  %= 65521L;
-    highHalf %= 65521L;
+    return adler32_scalar(adler, buf, len);
+}
 
-    result = (highHalf << 16) | lowHalf;
+#else
 
-    return result;
+static u_int32_t adler32_vector(
+    u_int32_t        adler,
+    const u_int8_t * buf,
+    size_t           len)
+{
+    return adler32_scalar(adler, buf, len);
+}
+
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+u_int32_t local_adler32(u_int8_t * buffer, int32_t length)
+{
+    if (length <= 0) {
+        return 1;
+    }
+    return adler32_vector(1, buffer, (size_t)length);
+}
+
+/*******************************************************************************
+* Returns the adler32 of A followed by B given adler32(A), adler32(B) and the
+* length of B, so that pieces can be checksummed independently.
+*******************************************************************************/
+u_int32_t local_adler32_combine(
+    u_int32_t adler1,
+    u_int32_t adler2,
+    u_int32_t length2)
+{
+    u_int32_t base = ADLER_BASE;
+    u_int32_t rem, sum1, sum2;
+
+    rem  = length2 % base;
+    sum1 = adler1 & 0xffff;
+    sum2 = (rem * sum1) % base;
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+
+    if (sum1 >= base) sum1 -= base;
+    if (sum1 >= base) sum1 -= base;
+    if (sum2 >= (base << 1)) sum2 -= (base << 1);
+    if (sum2 >= base) sum2 -= base;
+
+    return (sum2 << 16) | sum1;
 }
 
 /**************************************************************
@@ -105,6 +321,11 @@ int decompress_lzss(
     dst = dststart;
     for (i = 0; i < N - F; i++)
         text_buf[i] = ' ';
+    /* Valid streams never read these before writing them, but keep the
+     * output of malformed ones deterministic (see decompress_lzss_fast()).
+     */
+    for ( ; i < N; i++)
+        text_buf[i] = 0;
     r = N - F;
     flags = 0;
     for ( ; ; ) {
@@ -134,6 +355,86 @@ int decompress_lzss(
     return (int)(dst - dststart);
 }
 
+/*******************************************************************************
+* decompress_lzss_fast
+*
+* Same input and output as decompress_lzss(), but resolves back-references
+* directly from bytes already written to dst rather than through a ring
+* buffer. Ring position r corresponds to output offset o where
+* r == (o + N - F) mod N, so a reference to ring position i at output
+* offset o is a copy from distance ((r - i - 1) mod N) + 1. Copies that
+* would read before dst come from the decoder's initial ring contents.
+*******************************************************************************/
+static inline u_int8_t lzss_initial_ring_byte(ssize_t index)
+{
+    /* index < 0: the slot the decoder preset before any output */
+    return (index >= -(N - F)) ? ' ' : 0;
+}
+
+int decompress_lzss_fast(
+    u_int8_t       * dst,
+    u_int32_t        dstlen,
+    u_int8_t       * src,
+    u_int32_t        srclen)
+{
+    const u_int8_t * srcend = src + srclen;
+    size_t           o      = 0;
+    unsigned int     flags, bit;
+    u_int32_t        pos, len, dist;
+    size_t           k;
+
+    while (src < srcend) {
+        flags = *src++;
+
+        for (bit = 0; bit < 8; bit++, flags >>= 1) {
+            if (flags & 1) {
+                if (src >= srcend || o >= dstlen) goto finish;
+                dst[o++] = *src++;
+                continue;
+            }
+
+            if (srcend - src < 2) goto finish;
+            pos = src[0] | ((src[1] & 0xF0) << 4);
+            len = (src[1] & 0x0F) + THRESHOLD + 1;
+            src += 2;
+
+            dist = (u_int32_t)((((o + N - F) & (N - 1)) - pos - 1) & (N - 1)) + 1;
+
+            if (dist <= o && o + 24 <= dstlen && dist >= 8) {
+                /* Non-overlapping within each word: copy 8 bytes at a time.
+                 * len <= F (18), so three words always suffice; the excess
+                 * lands in output not yet decoded.
+                 */
+                u_int8_t * out = dst + o;
+                u_int64_t  w;
+
+                memcpy(&w, out - dist, 8);      memcpy(out, &w, 8);
+                memcpy(&w, out - dist + 8, 8);  memcpy(out + 8, &w, 8);
+                memcpy(&w, out - dist + 16, 8); memcpy(out + 16, &w, 8);
+                o += len;
+            } else if (dist <= o && o + len <= dstlen) {
+                /* Overlapping run; must go byte by byte. */
+                u_int8_t * out = dst + o;
+
+                for (k = 0; k < len; k++) {
+                    out[k] = out[k - dist];
+                }
+                o += len;
+            } else {
+                /* Safe tail: near the start or the end of the output. */
+                for (k = 0; k < len && o < dstlen; k++, o++) {
+                    ssize_t from = (ssize_t)o - (ssize_t)dist;
+
+                    dst[o] = (from >= 0) ? dst[from] : lzss_initial_ring_byte(from);
+                }
+            }
+        }
+    }
+
+finish:
+    return (int)o;
+}
+
 /*
  * initialize state, mostly the trees
  *
@@ -248,6 +549,221 @@ static void delete_node(struct encode_state *sp, int p)
     sp->parent[p] = NIL;
 }
 
+/*
+ * The tree encoder, restartable so it can be fed input in pieces.
+ *
+ * compress_lzss() runs it once over the whole input; the streaming
+ * interface runs it as input arrives. TREE_FILL reads the first F bytes,
+ * TREE_EMIT sends one unit of code, and TREE_SHIFT slides the ring by the
+ * length of that unit, reading new bytes as it goes. Running out of input
+ * in TREE_FILL or TREE_SHIFT just returns unless the caller says this is
+ * the end of the input, so the output is the same however the input is
+ * split up.
+ */
+enum { TREE_FILL, TREE_EMIT, TREE_SHIFT, TREE_DONE };
+
+/* One unit of code as the tree encoder chose it: a literal if length is 1,
+ * otherwise a match at ring position ringPos.
+ */
+struct lzss_unit {
+    u_int8_t   length;
+    u_int16_t  ringPos;
+};
+
+struct tree_encoder {
+    /* Encoding state, mostly tree but some current match stuff */
+    struct encode_state tree;
+
+    int  phase;
+    int  r, s, len, i, last_match_length;
+
+    /*
+     * code_buf[1..16] saves eight units of code, and code_buf[0] works
+     * as eight flags, "1" representing that the unit is an unencoded
+     * letter (1 byte), "0" a position-and-length pair (2 bytes).
+     * Thus, eight units require at most 16 bytes of code.
+     */
+    u_int8_t code_buf[17], mask;
+    int  code_buf_ptr;
+
+    /*
+     * If units is set, each unit is recorded there instead of being sent,
+     * and tree_encode() returns when unitCapacity have been recorded.
+     */
+    struct lzss_unit * units;
+    u_int32_t unitCount, unitCapacity;
+};
+
+static void tree_encoder_init(struct tree_encoder *te)
+{
+    init_state(&te->tree);
+
+    te->phase = TREE_FILL;
+    te->code_buf[0] = 0;
+    te->code_buf_ptr = te->mask = 1;
+    te->units = NULL;
+    te->unitCount = te->unitCapacity = 0;
+
+    /* Clear the buffer with any character that will appear often. */
+    te->s = 0;  te->r = N - F;
+    te->len = 0;
+}
+
+/*
+ * Consumes input from *srcp up to srcend, returning the new end of the
+ * output, or NULL if dstend was reached.
+ */
+static u_int8_t * tree_encode(
+    struct tree_encoder  * te,
+    const u_int8_t      ** srcp,
+    const u_int8_t       * srcend,
+    int                    final,
+    u_int8_t             * dst,
+    u_int8_t             * dstend)
+{
+    struct encode_state *sp = &te->tree;
+    const u_int8_t *src = *srcp;
+    int  i, c;
+
+    for ( ; ; ) {
+        switch (te->phase) {
+        case TREE_FILL:
+            /* Read F bytes into the last F bytes of the buffer */
+            for ( ; te->len < F && src < srcend; te->len++)
+                sp->text_buf[te->r + te->len] = *src++;
+            if (te->len < F && !final)
+                goto out;
+            if (!te->len) {
+                te->phase = TREE_DONE;  /* text of size zero */
+                goto out;
+            }
+
+            /*
+             * Insert the F strings, each of which begins with one or more
+             * 'space' characters.  Note the order in which these strings are
+             * inserted.  This way, degenerate trees will be less likely to occur.
+             */
+            for (i = 1; i <= F; i++)
+                insert_node(sp, te->r - i);
+
+            /*
+             * Finally, insert the whole string just read.
+             * The global variables match_length and match_position are set.
+             */
+            insert_node(sp, te->r);
+            te->phase = TREE_EMIT;
+            break;
+
+        case TREE_EMIT:
+            if (te->units && te->unitCount == te->unitCapacity)
+                goto out;   /* wait for the units to be taken */
+
+            /* match_length may be spuriously long near the end of text. */
+            if (sp->match_length > te->len)
+                sp->match_length = te->len;
+            if (te->units) {
+                if (sp->match_length <= THRESHOLD)
+                    sp->match_length = 1;
+                te->units[te->unitCount].length = (u_int8_t) sp->match_length;
+                te->units[te->unitCount].ringPos = (u_int16_t) sp->match_position;
+                te->unitCount++;
+            } else if (sp->match_length <= THRESHOLD) {
+                sp->match_length = 1;  /* Not long enough match.  Send one byte. */
+                te->code_buf[0] |= te->mask;  /* 'send one byte' flag */
+                te->code_buf[te->code_buf_ptr++] = sp->text_buf[te->r];  /* Send uncoded. */
+            } else {
+                /* Send position and length pair. Note match_length > THRESHOLD. */
+                te->code_buf[te->code_buf_ptr++] = (u_int8_t) sp->match_position;
+                te->code_buf[te->code_buf_ptr++] = (u_int8_t)
+                    ( ((sp->match_position >> 4) & 0xF0)
+                    |  (sp->match_length - (THRESHOLD + 1)) );
+            }
+            if (!te->units && (te->mask <<= 1) == 0) {  /* Shift mask left one bit. */
+                    /* Send at most 8 units of code together */
+                for (i = 0; i < te->code_buf_ptr; i++)
+                    if (dst < dstend)
+                        *dst++ = te->code_buf[i];
+                    else {
+                        dst = NULL;
+                        goto out;
+                    }
+                te->code_buf[0] = 0;
+                te->code_buf_ptr = te->mask = 1;
+            }
+            te->last_match_length = sp->match_length;
+            te->i = 0;
+            te->phase = TREE_SHIFT;
+            break;
+
+        case TREE_SHIFT:
+            for ( ; te->i < te->last_match_length && src < srcend; te->i++) {
+                delete_node(sp, te->s);    /* Delete old strings and */
+                c = *src++;
+                sp->text_buf[te->s] = c;    /* read new bytes */
+
+                /*
+                 * If the position is near the end of buffer, extend the buffer
+                 * to make string comparison easier.
+                 */
+                if (te->s < F - 1)
+                    sp->text_buf[te->s + N] = c;
+
+                /* Since this is a ring buffer, increment the position modulo N. */
+                te->s = (te->s + 1) & (N - 1);
+                te->r = (te->r + 1) & (N - 1);
+
+                /* Register the string in text_buf[r..r+F-1] */
+                insert_node(sp, te->r);
+            }
+            if (te->i < te->last_match_length) {
+                if (!final)
+                    goto out;   /* wait for more input */
+                while (te->i++ < te->last_match_length) {
+                    delete_node(sp, te->s);
+
+                    /* After the end of text, no need to read, */
+                    te->s = (te->s + 1) & (N - 1);
+                    te->r = (te->r + 1) & (N - 1);
+                    /* but buffer may not be empty. */
+                    if (--te->len)
+                        insert_node(sp, te->r);
+                }
+            }
+            /* until length of string to be processed is zero */
+            te->phase = (te->len > 0) ? TREE_EMIT : TREE_DONE;
+            break;
+
+        case TREE_DONE:
+            goto out;
+        }
+    }
+
+out:
+    *srcp = src;
+    return dst;
+}
+
+/* Sends any remaining code once tree_encode() has reached TREE_DONE. */
+static u_int8_t * tree_encode_finish(
+    struct tree_encoder * te,
+    u_int8_t            * dst,
+    u_int8_t            * dstend)
+{
+    int i;
+
+    if (te->code_buf_ptr > 1) {    /* Send remaining code. */
+        for (i = 0; i < te->code_buf_ptr; i++)
+            if (dst < dstend)
+                *dst++ = te->code_buf[i];
+            else
+                return NULL;
+        te->code_buf[0] = 0;
+        te->code_buf_ptr = te->mask = 1;
+    }
+
+    return dst;
+}
+
 /*******************************************************************************
 *******************************************************************************/
 u_int8_t * compress_lzss(
@@ -257,120 +773,1399 @@ u_int8_t * compress_lzss(
     u_int32_t        srclen)
 {
     u_int8_t * result = NULL;
-    /* Encoding state, mostly tree but some current match stuff */
-    struct encode_state *sp;
-
-    int  i, c, len, r, s, last_match_length, code_buf_ptr;
-    u_int8_t code_buf[17], mask;
-    u_int8_t * srcend = src + srclen;
+    struct tree_encoder *te;
+    const u_int8_t * srcp = src;
     u_int8_t *dstend = dst + dstlen;
 
     /* initialize trees */
-    sp = (struct encode_state *) malloc(sizeof(*sp));
-    if (!sp) goto finish;
+    te = (struct tree_encoder *) malloc(sizeof(*te));
+    if (!te || !srclen) goto finish;
 
-    init_state(sp);
+    tree_encoder_init(te);
 
-    /*
-     * code_buf[1..16] saves eight units of code, and code_buf[0] works
-     * as eight flags, "1" representing that the unit is an unencoded
-     * letter (1 byte), "0" a position-and-length pair (2 bytes).
-     * Thus, eight units require at most 16 bytes of code.
-     */
-    code_buf[0] = 0;
-    code_buf_ptr = mask = 1;
+    dst = tree_encode(te, &srcp, src + srclen, /* final */ 1, dst, dstend);
+    if (!dst) goto finish;
 
-    /* Clear the buffer with any character that will appear often. */
-    s = 0;  r = N - F;
+    result = tree_encode_finish(te, dst, dstend);
 
-    /* Read F bytes into the last F bytes of the buffer */
-    for (len = 0; len < F && src < srcend; len++)
-        sp->text_buf[r + len] = *src++;
-    if (!len)
-        goto finish;
+finish:
+    if (te) free(te);
 
-    /*
-     * Insert the F strings, each of which begins with one or more
-     * 'space' characters.  Note the order in which these strings are
-     * inserted.  This way, degenerate trees will be less likely to occur.
-     */
-    for (i = 1; i <= F; i++)
-        insert_node(sp, r - i);
+    return result;
+}
 
-    /*
-     * Finally, insert the whole string just read.
-     * The global variables match_length and match_position are set.
-     */
-    insert_node(sp, r);
-    do {
-        /* match_length may be spuriously long near the end of text. */
-        if (sp->match_length > len)
-            sp->match_length = len;
-        if (sp->match_length <= THRESHOLD) {
-            sp->match_length = 1;  /* Not long enough match.  Send one byte. */
-            code_buf[0] |= mask;  /* 'send one byte' flag */
-            code_buf[code_buf_ptr++] = sp->text_buf[r];  /* Send uncoded. */
-        } else {
-            /* Send position and length pair. Note match_length > THRESHOLD. */
-            code_buf[code_buf_ptr++] = (u_int8_t) sp->match_position;
-            code_buf[code_buf_ptr++] = (u_int8_t)
-                ( ((sp->match_position >> 4) & 0xF0)
-                |  (sp->match_length - (THRESHOLD + 1)) );
-        }
-        if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
-                /* Send at most 8 units of code together */
-            for (i = 0; i < code_buf_ptr; i++)
-                if (dst < dstend)
-                    *dst++ = code_buf[i];
-                else
-                    goto finish;
-            code_buf[0] = 0;
-            code_buf_ptr = mask = 1;
-        }
-        last_match_length = sp->match_length;
-        for (i = 0; i < last_match_length && src < srcend; i++) {
-            delete_node(sp, s);    /* Delete old strings and */
-            c = *src++;
-            sp->text_buf[s] = c;    /* read new bytes */
+/**************************************************************
+ Hash-chain LZSS encoder.
 
-            /*
-             * If the position is near the end of buffer, extend the buffer
-             * to make string comparison easier.
-             */
-            if (s < F - 1)
-                sp->text_buf[s + N] = c;
+ Produces the same bit stream as compress_lzss() (and so is read by
+ decompress_lzss() and the booter), but finds matches by walking a
+ bounded chain of earlier positions sharing a 3-byte hash instead of
+ maintaining the binary search trees. Matches are only taken from
+ real input within N - F bytes of the current position, never from
+ the space-filled preamble of the decoder's ring buffer, so a few
+ percent of ratio is given up in exchange for encode throughput.
+**************************************************************/
+
+#define HC_HASH_BITS   13
+#define HC_HASH_SIZE   (1 << HC_HASH_BITS)
+#define HC_NIL         0    /* head[]/prev[] store position + 1 */
+
+struct hc_encode_state {
+    u_int32_t head[HC_HASH_SIZE];  /* most recent position for each hash */
+    u_int32_t prev[N];             /* previous position with the same hash */
+};
+
+static inline u_int32_t hc_hash(const u_int8_t * p)
+{
+    u_int32_t v = ((u_int32_t)p[0] << 16) | ((u_int32_t)p[1] << 8) | p[2];
+    return (v * 2654435761U) >> (32 - HC_HASH_BITS);
+}
+
+static inline void hc_insert(
+    struct hc_encode_state * sp,
+    const u_int8_t         * src,
+    u_int32_t                pos)
+{
+    u_int32_t h = hc_hash(src + pos);
 
-            /* Since this is a ring buffer, increment the position modulo N. */
-            s = (s + 1) & (N - 1);
-            r = (r + 1) & (N - 1);
+    sp->prev[pos & (N - 1)] = sp->head[h];
+    sp->head[h] = pos + 1;
+}
+
+struct hc_encoder {
+    struct hc_encode_state chains;
+    u_int32_t  maxChainDepth;
+    u_int32_t  pos;                /* next input position to encode */
+    u_int8_t   code_buf[17], mask; /* same framing as compress_lzss() */
+    int        code_buf_ptr;
+};
+
+static void hc_encoder_init(struct hc_encoder * hc, u_int32_t maxChainDepth)
+{
+    bzero(&hc->chains, sizeof(hc->chains));
+    hc->maxChainDepth = maxChainDepth ? maxChainDepth : LZSS_HASHCHAIN_DEFAULT_DEPTH;
+    hc->pos = 0;
+    hc->code_buf[0] = 0;
+    hc->code_buf_ptr = hc->mask = 1;
+}
+
+/*******************************************************************************
+* Returns the length of the longest match for src[pos..pos+maxLen) found in
+* at most maxChainDepth candidates, setting *matchPos. maxLen must be more
+* than THRESHOLD.
+*******************************************************************************/
+static u_int32_t hc_longest_match(
+    struct hc_encode_state * sp,
+    const u_int8_t         * src,
+    u_int32_t                pos,
+    u_int32_t                maxLen,
+    u_int32_t                maxChainDepth,
+    u_int32_t              * matchPos)
+{
+    u_int32_t cand, depth, len;
+    u_int32_t matchLen = 0;
 
-            /* Register the string in text_buf[r..r+F-1] */
-            insert_node(sp, r);
+    *matchPos = 0;
+    cand = sp->head[hc_hash(src + pos)];
+    for (depth = maxChainDepth; cand != HC_NIL && depth; depth--) {
+        u_int32_t candPos = cand - 1;
+
+        /* Stop once we leave the window the decoder's ring keeps. */
+        if (candPos >= pos || pos - candPos > N - F) {
+            break;
         }
-        while (i++ < last_match_length) {
-        delete_node(sp, s);
 
-            /* After the end of text, no need to read, */
-            s = (s + 1) & (N - 1);
-            r = (r + 1) & (N - 1);
-            /* but buffer may not be empty. */
-            if (--len)
-                insert_node(sp, r);
+        /* Cheap reject: a better match must extend the current one. */
+        if (src[candPos + matchLen] == src[pos + matchLen] &&
+            src[candPos] == src[pos]) {
+
+            for (len = 1; len < maxLen; len++) {
+                if (src[candPos + len] != src[pos + len]) {
+                    break;
+                }
+            }
+            if (len > matchLen) {
+                matchLen = len;
+                *matchPos = candPos;
+                if (len == maxLen) {
+                    break;
+                }
+            }
         }
-    } while (len > 0);   /* until length of string to be processed is zero */
+        cand = sp->prev[candPos & (N - 1)];
+    }
+
+    return matchLen;
+}
+
+/*******************************************************************************
+* Adds one unit of code, a literal if matchLen <= THRESHOLD, sending each
+* group of eight as it fills. Returns the new end of the output, or NULL
+* if dstend was reached.
+*******************************************************************************/
+static u_int8_t * hc_put_unit(
+    struct hc_encoder * hc,
+    u_int8_t            literal,
+    u_int32_t           matchLen,
+    u_int32_t           matchPos,
+    u_int8_t          * dst,
+    u_int8_t          * dstend)
+{
+    int i;
+
+    if (matchLen <= THRESHOLD) {
+        hc->code_buf[0] |= hc->mask;
+        hc->code_buf[hc->code_buf_ptr++] = literal;
+    } else {
+        /* Positions are ring-buffer indices: input byte 0 sits at N - F.
+         * Streams rebase pos by multiples of N, which leaves this alone.
+         */
+        u_int32_t ringPos = (matchPos + N - F) & (N - 1);
+
+        hc->code_buf[hc->code_buf_ptr++] = (u_int8_t) ringPos;
+        hc->code_buf[hc->code_buf_ptr++] = (u_int8_t)
+            ( ((ringPos >> 4) & 0xF0)
+            |  (matchLen - (THRESHOLD + 1)) );
+    }
+
+    if ((hc->mask <<= 1) == 0) {
+        for (i = 0; i < hc->code_buf_ptr; i++)
+            if (dst < dstend)
+                *dst++ = hc->code_buf[i];
+            else
+                return NULL;
+        hc->code_buf[0] = 0;
+        hc->code_buf_ptr = hc->mask = 1;
+    }
+
+    return dst;
+}
+
+/* Sends a partly filled group at the end of the input. */
+static u_int8_t * hc_flush(
+    struct hc_encoder * hc,
+    u_int8_t          * dst,
+    u_int8_t          * dstend)
+{
+    int i;
 
-    if (code_buf_ptr > 1) {    /* Send remaining code. */
-        for (i = 0; i < code_buf_ptr; i++)
+    if (hc->code_buf_ptr > 1) {
+        for (i = 0; i < hc->code_buf_ptr; i++)
             if (dst < dstend)
-                *dst++ = code_buf[i];
+                *dst++ = hc->code_buf[i];
             else
-                goto finish;
+                return NULL;
+        hc->code_buf[0] = 0;
+        hc->code_buf_ptr = hc->mask = 1;
     }
 
-    result = dst;
+    return dst;
+}
+
+/*******************************************************************************
+* Encodes src[hc->pos..srclen). Unless final is set, positions within
+* F + THRESHOLD bytes of srclen are left for a later call, since their
+* matches could reach past the input seen so far; the output is therefore
+* the same however the input is split up. Returns the new end of the
+* output, or NULL if dstend was reached.
+*******************************************************************************/
+static u_int8_t * hc_encode(
+    struct hc_encoder * hc,
+    const u_int8_t    * src,
+    u_int32_t           srclen,
+    int                 final,
+    u_int8_t          * dst,
+    u_int8_t          * dstend)
+{
+    struct hc_encode_state *sp = &hc->chains;
+    u_int32_t pos = hc->pos;
+    u_int32_t matchPos, matchLen, maxLen, k;
+
+    while (pos < srclen && (final || srclen - pos >= F + THRESHOLD)) {
+        matchLen = 0;
+        matchPos = 0;
+        maxLen = srclen - pos;
+        if (maxLen > F) {
+            maxLen = F;
+        }
+
+        if (maxLen > THRESHOLD) {
+            matchLen = hc_longest_match(sp, src, pos, maxLen,
+                hc->maxChainDepth, &matchPos);
+            hc_insert(sp, src, pos);
+        }
+
+        if (matchLen <= THRESHOLD) {
+            matchLen = 1;
+        } else {
+            /* Register the positions the match skips over. */
+            for (k = 1; k < matchLen; k++) {
+                if (srclen - (pos + k) > THRESHOLD) {
+                    hc_insert(sp, src, pos + k);
+                }
+            }
+        }
+
+        dst = hc_put_unit(hc, src[pos], matchLen, matchPos, dst, dstend);
+        if (!dst) {
+            return NULL;
+        }
+
+        pos += matchLen;
+    }
+    hc->pos = pos;
+
+    if (final) {
+        dst = hc_flush(hc, dst, dstend);
+    }
+
+    return dst;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+u_int8_t * compress_lzss_hashchain(
+    u_int8_t       * dst,
+    u_int32_t        dstlen,
+    u_int8_t       * src,
+    u_int32_t        srclen,
+    u_int32_t        maxChainDepth)
+{
+    u_int8_t * result = NULL;
+    struct hc_encoder *hc;
+
+    hc = (struct hc_encoder *) malloc(sizeof(*hc));
+    if (!hc || !srclen) goto finish;
+
+    hc_encoder_init(hc, maxChainDepth);
+    result = hc_encode(hc, src, srclen, /* final */ 1, dst, dst + dstlen);
 
 finish:
-    if (sp) free(sp);
+    if (hc) free(hc);
 
     return result;
 }
+
+/**************************************************************
+ Optimal-parse LZSS encoder.
+
+ Picks, for each block of input, the sequence of literals and
+ matches with the fewest bits (9 per literal, 17 per match)
+ rather than taking the longest match at each position. The
+ longest match at every position is found first with a deep
+ hash-chain search; since any shorter prefix of a match is also
+ a match, a backward pass then finds the cheapest way to reach
+ the end of the block from each position.
+
+ The hash chains alone can't see everything compress_lzss()
+ does (the spaces the decoder's ring starts with, for one), and
+ cutting the input into blocks loses matches across the cuts,
+ so a tree encoder is run alongside to supply compress_lzss()'s
+ own parse. Its matches are offered to the backward pass, and
+ each block ends where one of its units does, so every block
+ costs no more than compress_lzss() spends on the same bytes
+ and the whole output is never larger.
+**************************************************************/
+
+#define OPT_BLOCK_SIZE    (16 * 1024)
+#define OPT_CHAIN_DEPTH   (256)
+#define OPT_MAX_SPAN      (OPT_BLOCK_SIZE + F)   /* a block ends on a unit */
+
+struct opt_encoder {
+    struct hc_encoder hc;  /* match finder and framing */
+    struct tree_encoder greedy;            /* compress_lzss()'s parse */
+    u_int32_t greedyAhead;                 /* input it has read past hc.pos */
+    struct lzss_unit units[OPT_BLOCK_SIZE];  /* its units from hc.pos on */
+    u_int32_t cost[OPT_MAX_SPAN + 1];      /* bits from here to block end */
+    u_int32_t matchPos[OPT_MAX_SPAN];
+    u_int8_t  matchLen[OPT_MAX_SPAN];      /* longest match here */
+    u_int8_t  choice[OPT_MAX_SPAN];        /* length to take; 1 for a literal */
+};
+
+static void opt_encoder_init(struct opt_encoder * opt)
+{
+    hc_encoder_init(&opt->hc, OPT_CHAIN_DEPTH);
+    tree_encoder_init(&opt->greedy);
+    opt->greedy.units = opt->units;
+    opt->greedy.unitCapacity = OPT_BLOCK_SIZE;
+    opt->greedyAhead = 0;
+}
+
+/*******************************************************************************
+* Encodes whole blocks of src from opt->hc.pos, stopping short of a
+* partial block unless final is set. Returns the new end of the output,
+* or NULL if dstend was reached.
+*******************************************************************************/
+static u_int8_t * opt_encode(
+    struct opt_encoder * opt,
+    const u_int8_t     * src,
+    u_int32_t            srclen,
+    int                  final,
+    u_int8_t           * dst,
+    u_int8_t           * dstend)
+{
+    struct hc_encoder      *hc = &opt->hc;
+    struct hc_encode_state *sp = &hc->chains;
+    struct tree_encoder    *te = &opt->greedy;
+    const u_int8_t *greedySrc;
+    u_int32_t start, n, k, u, len, maxLen, bits;
+
+    while (hc->pos < srclen) {
+        start = hc->pos;
+
+        /* Let the tree encoder run ahead as far as the input and its
+         * unit buffer allow.
+         */
+        greedySrc = src + start + opt->greedyAhead;
+        (void)tree_encode(te, &greedySrc, src + srclen, final, NULL, NULL);
+        opt->greedyAhead = (u_int32_t)(greedySrc - src) - start;
+
+        /* The block runs to the end of the first of its units to reach
+         * OPT_BLOCK_SIZE bytes, or to the end of the input.
+         */
+        for (n = 0, u = 0; u < te->unitCount && n < OPT_BLOCK_SIZE; u++) {
+            n += opt->units[u].length;
+        }
+        if (n < OPT_BLOCK_SIZE && te->phase != TREE_DONE) {
+            break;  /* wait for more input */
+        }
+
+        for (k = 0; k < n; k++) {
+            opt->matchLen[k] = 0;
+            opt->matchPos[k] = 0;
+            maxLen = n - k;
+            if (maxLen > F) {
+                maxLen = F;
+            }
+            if (srclen - (start + k) > THRESHOLD) {
+                if (maxLen > THRESHOLD) {
+                    opt->matchLen[k] = (u_int8_t)hc_longest_match(sp, src,
+                        start + k, maxLen, OPT_CHAIN_DEPTH, &opt->matchPos[k]);
+                }
+                hc_insert(sp, src, start + k);
+            }
+        }
+
+        /* Offer the tree encoder's matches too. matchPos only matters
+         * modulo N, as hc_put_unit() turns it into a ring position.
+         */
+        for (k = 0, u = 0; k < n; k += opt->units[u++].length) {
+            len = opt->units[u].length;
+            if (len > THRESHOLD && len > opt->matchLen[k]) {
+                opt->matchLen[k] = (u_int8_t)len;
+                opt->matchPos[k] = (opt->units[u].ringPos + F) & (N - 1);
+            }
+        }
+
+        /* Ties go to the longer match, which means fewer flag bits later. */
+        opt->cost[n] = 0;
+        for (k = n; k-- > 0; ) {
+            opt->cost[k] = 9 + opt->cost[k + 1];
+            opt->choice[k] = 1;
+            for (len = THRESHOLD + 1; len <= opt->matchLen[k]; len++) {
+                bits = 17 + opt->cost[k + len];
+                if (bits <= opt->cost[k]) {
+                    opt->cost[k] = bits;
+                    opt->choice[k] = (u_int8_t)len;
+                }
+            }
+        }
+
+        for (k = 0; k < n; k += opt->choice[k]) {
+            dst = hc_put_unit(hc, src[start + k], opt->choice[k],
+                opt->matchPos[k], dst, dstend);
+            if (!dst) {
+                return NULL;
+            }
+        }
+        hc->pos = start + n;
+        opt->greedyAhead -= n;
+
+        memmove(opt->units, opt->units + u,
+            (te->unitCount - u) * sizeof(opt->units[0]));
+        te->unitCount -= u;
+    }
+
+    if (final) {
+        dst = hc_flush(hc, dst, dstend);
+    }
+
+    return dst;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+u_int8_t * compress_lzss_optimal(
+    u_int8_t       * dst,
+    u_int32_t        dstlen,
+    u_int8_t       * src,
+    u_int32_t        srclen)
+{
+    u_int8_t * result = NULL;
+    struct opt_encoder *opt;
+
+    opt = (struct opt_encoder *) malloc(sizeof(*opt));
+    if (!opt || !srclen) goto finish;
+
+    opt_encoder_init(opt);
+    result = opt_encode(opt, src, srclen, /* final */ 1, dst, dst + dstlen);
+
+finish:
+    if (opt) free(opt);
+
+    return result;
+}
+
+/**************************************************************
+ LZVN
+
+ Portable encoder and decoder for the LZVN format used by
+ COMP_TYPE_FASTLIB kernelcaches, for hosts without FastCompression.
+ Each opcode carries up to L literal bytes (which follow the opcode)
+ and then a match of M bytes at distance D:
+
+   sml_d  LLMMMDDD DDDDDDDD              L 0-3, M 3-10, D < 1536
+   med_d  101LLMMM DDDDDDMM DDDDDDDD     L 0-3, M 3-34, D < 16384
+   lrg_d  LLMMM111 DDDDDDDD DDDDDDDD     L 0-3, M 3-10, D < 65536
+   pre_d  LLMMM110                       L 1-3, M 3-10, previous D
+   sml_m  1111MMMM                       M 1-15, previous D
+   lrg_m  11110000 MMMMMMMM              M 16-271, previous D
+   sml_l  1110LLLL                       L 1-15
+   lrg_l  11100000 LLLLLLLL              L 16-271
+   nop    00001110, 00010110
+   eos    00000110 followed by 7 zero bytes
+
+ sml_d/pre_d/lrg_d are limited to L + M <= 10 - L, which leaves
+ room in the opcode space for med_d and the literal/match forms;
+ the remaining opcodes are invalid.
+**************************************************************/
+
+#define LZVN_HASH_BITS      14
+#define LZVN_HASH_SIZE      (1 << LZVN_HASH_BITS)
+#define LZVN_MIN_MATCH      4
+#define LZVN_MAX_DISTANCE   0xFFFF
+#define LZVN_EOS_SIZE       8
+#define LZVN_MAX_MATCH      4096
+#define LZVN_LITERAL_FLUSH  (16 * 271)
+
+static inline u_int32_t lzvn_load4(const u_int8_t * p)
+{
+    u_int32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u_int32_t lzvn_hash4(const u_int8_t * p)
+{
+    return (lzvn_load4(p) * 2654435761U) >> (32 - LZVN_HASH_BITS);
+}
+
+/*******************************************************************************
+* Emits L literals (taken from lit) followed by a match of M bytes at D.
+* Returns the new output position, or NULL if the output (less room for
+* the end-of-stream marker) is full.
+*******************************************************************************/
+static u_int8_t * lzvn_emit(
+    u_int8_t       * q,
+    u_int8_t       * qend,
+    const u_int8_t * lit,
+    size_t           L,
+    size_t           M,
+    size_t           D,
+    size_t           D_prev)
+{
+    size_t x;
+
+    if ((size_t)(qend - q) < L + 2 * (L / 271 + 1) + 3 + 2 * (M / 271 + 1) +
+        LZVN_EOS_SIZE) {
+        return NULL;
+    }
+
+    /* Literal runs longer than an opcode's own literal field go first. */
+    if (L > 3) {
+        while (L > 15) {
+            x = (L < 271) ? L : 271;
+            *q++ = 0xE0;
+            *q++ = (u_int8_t)(x - 16);
+            memcpy(q, lit, x);
+            q += x; lit += x; L -= x;
+        }
+        if (L > 3) {
+            *q++ = (u_int8_t)(0xE0 + L);
+            memcpy(q, lit, L);
+            q += L; lit += L; L = 0;
+        }
+    }
+
+    if (!M) {
+        if (L) {
+            *q++ = (u_int8_t)(0xE0 + L);
+            memcpy(q, lit, L);
+            q += L;
+        }
+        return q;
+    }
+
+    x = M <= 10 - 2 * L ? M : 10 - 2 * L;
+    M -= x;
+    x -= 3;
+
+    if (D == D_prev) {
+        if (L == 0) {
+            *q++ = (u_int8_t)(0xF0 + x + 3);
+        } else {
+            *q++ = (u_int8_t)((L << 6) + (x << 3) + 6);
+        }
+    } else if (D < 2048 - 2 * 256) {
+        *q++ = (u_int8_t)((L << 6) + (x << 3) + (D >> 8));
+        *q++ = (u_int8_t)D;
+    } else if (D >= (1 << 14) || M == 0 || (x + 3) + M > 34) {
+        *q++ = (u_int8_t)((L << 6) + (x << 3) + 7);
+        *q++ = (u_int8_t)D;
+        *q++ = (u_int8_t)(D >> 8);
+    } else {
+        /* Medium distance absorbs the rest of the match. */
+        x += M;
+        M = 0;
+        *q++ = (u_int8_t)(0xA0 + (x >> 2) + (L << 3));
+        *q++ = (u_int8_t)((x & 3) + ((D & 0x3F) << 2));
+        *q++ = (u_int8_t)(D >> 6);
+    }
+    memcpy(q, lit, L);
+    q += L;
+
+    while (M > 15) {
+        x = (M < 271) ? M : 271;
+        *q++ = 0xF0;
+        *q++ = (u_int8_t)(x - 16);
+        M -= x;
+    }
+    if (M > 0) {
+        *q++ = (u_int8_t)(0xF0 + M);
+    }
+
+    return q;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+size_t local_lzvn_encode_work_size(void)
+{
+    return LZVN_HASH_SIZE * sizeof(u_int32_t);
+}
+
+struct lzvn_cursor {
+    size_t i;          /* next input position to encode */
+    size_t litStart;   /* first literal not yet emitted */
+    size_t D_prev;     /* distance of the last match emitted */
+};
+
+/*******************************************************************************
+* Greedy single-probe encoder. It tries the previous distance first, since
+* that costs one opcode byte and decodes without a distance fetch, and
+* otherwise takes the hash table's candidate.
+*
+* Encodes in[c->i..end). Matches are capped at LZVN_MAX_MATCH bytes and
+* literal runs are sent every LZVN_LITERAL_FLUSH bytes (a whole number of
+* lrg_l opcodes, so the output is unchanged), which lets a caller that
+* doesn't set final keep only a bounded window of input; positions that
+* could match past end are left for a later call. Returns the new end of
+* the output, or NULL if qend was reached.
+*******************************************************************************/
+static u_int8_t * lzvn_encode_core(
+    u_int32_t          * table,
+    struct lzvn_cursor * c,
+    const u_int8_t     * in,
+    size_t               end,
+    int                  final,
+    u_int8_t           * q,
+    u_int8_t           * qend)
+{
+    size_t i        = c->i;
+    size_t litStart = c->litStart;
+    size_t D_prev   = c->D_prev;
+    size_t lookahead = final ? LZVN_MIN_MATCH : LZVN_MAX_MATCH + LZVN_MIN_MATCH;
+    size_t D, M, cand;
+
+    while (end >= lookahead && i <= end - lookahead) {
+        u_int32_t h = lzvn_hash4(in + i);
+
+        if (i - litStart >= LZVN_LITERAL_FLUSH) {
+            q = lzvn_emit(q, qend, in + litStart, LZVN_LITERAL_FLUSH, 0, 0, D_prev);
+            if (!q) {
+                return NULL;
+            }
+            litStart += LZVN_LITERAL_FLUSH;
+        }
+
+        cand = table[h];
+        table[h] = (u_int32_t)(i + 1);
+
+        D = 0;
+        if (D_prev && D_prev <= i &&
+            lzvn_load4(in + i - D_prev) == lzvn_load4(in + i)) {
+            D = D_prev;
+        } else if (cand && i - (cand - 1) <= LZVN_MAX_DISTANCE &&
+            lzvn_load4(in + cand - 1) == lzvn_load4(in + i)) {
+            D = i - (cand - 1);
+        }
+        if (!D) {
+            i++;
+            continue;
+        }
+
+        for (M = LZVN_MIN_MATCH; i + M < end && M < LZVN_MAX_MATCH; M++) {
+            if (in[i + M] != in[i + M - D]) {
+                break;
+            }
+        }
+
+        q = lzvn_emit(q, qend, in + litStart, i - litStart, M, D, D_prev);
+        if (!q) {
+            return NULL;
+        }
+        D_prev = D;
+
+        /* Keep the table warm for the tail of the match. */
+        if (i + M <= end - LZVN_MIN_MATCH) {
+            table[lzvn_hash4(in + i + M - 2)] = (u_int32_t)(i + M - 2 + 1);
+        }
+        i += M;
+        litStart = i;
+    }
+
+    if (final) {
+        q = lzvn_emit(q, qend, in + litStart, end - litStart, 0, 0, D_prev);
+        if (!q) {
+            return NULL;
+        }
+
+        bzero(q, LZVN_EOS_SIZE);
+        q[0] = 0x06;
+        q += LZVN_EOS_SIZE;
+
+        i = litStart = end;
+    }
+
+    c->i = i;
+    c->litStart = litStart;
+    c->D_prev = D_prev;
+
+    return q;
+}
+
+/*******************************************************************************
+* Returns the number of bytes written, or 0 if dst is too small.
+*******************************************************************************/
+size_t local_lzvn_encode(
+    void       * dst,
+    size_t       dst_size,
+    const void * src,
+    size_t       src_size,
+    void       * work)
+{
+    struct lzvn_cursor cursor = { 0, 0, 0 };
+    u_int8_t * q;
+
+    if (src_size >= UINT32_MAX || dst_size < LZVN_EOS_SIZE) {
+        return 0;
+    }
+    bzero(work, local_lzvn_encode_work_size());
+
+    q = lzvn_encode_core((u_int32_t *)work, &cursor, (const u_int8_t *)src,
+        src_size, /* final */ 1, (u_int8_t *)dst, (u_int8_t *)dst + dst_size);
+    if (!q) {
+        return 0;
+    }
+
+    return (size_t)(q - (u_int8_t *)dst);
+}
+
+/*******************************************************************************
+* Returns the number of bytes decoded. Decoding stops at the end-of-stream
+* marker, at the end of src, when dst is full, or at the first invalid
+* opcode or distance.
+*******************************************************************************/
+size_t local_lzvn_decode(
+    void       * dst,
+    size_t       dst_size,
+    const void * src,
+    size_t       src_size)
+{
+    const u_int8_t * p    = (const u_int8_t *)src;
+    const u_int8_t * pend = p + src_size;
+    u_int8_t       * out  = (u_int8_t *)dst;
+    size_t           o    = 0;
+    size_t           D    = 0;
+    size_t           L, M, k, avail;
+    u_int8_t         opc;
+
+    while (p < pend) {
+        opc = p[0];
+
+        if (opc >= 0xF0) {                                  /* lrg_m, sml_m */
+            L = 0;
+            if (opc == 0xF0) {
+                if (pend - p < 2) break;
+                M = p[1] + 16;
+                p += 2;
+            } else {
+                M = opc & 0xF;
+                p += 1;
+            }
+        } else if (opc >= 0xE0) {                           /* lrg_l, sml_l */
+            M = 0;
+            if (opc == 0xE0) {
+                if (pend - p < 2) break;
+                L = p[1] + 16;
+                p += 2;
+            } else {
+                L = opc & 0xF;
+                p += 1;
+            }
+        } else if (opc >= 0xD0 || (opc & 0xF0) == 0x70) {   /* undefined */
+            break;
+        } else if ((opc & 0xE0) == 0xA0) {                  /* med_d */
+            if (pend - p < 3) break;
+            L = (opc >> 3) & 3;
+            M = (((opc & 7) << 2) | (p[1] & 3)) + 3;
+            D = (p[1] >> 2) | ((size_t)p[2] << 6);
+            p += 3;
+        } else if ((opc & 7) == 7) {                        /* lrg_d */
+            if (pend - p < 3) break;
+            L = opc >> 6;
+            M = ((opc >> 3) & 7) + 3;
+            D = p[1] | ((size_t)p[2] << 8);
+            p += 3;
+        } else if ((opc & 7) == 6) {
+            if (opc == 0x06) {                              /* eos */
+                break;
+            }
+            if (opc == 0x0E || opc == 0x16) {               /* nop */
+                p += 1;
+                continue;
+            }
+            if (opc < 0x40) {                               /* undefined */
+                break;
+            }
+            L = opc >> 6;                                   /* pre_d */
+            M = ((opc >> 3) & 7) + 3;
+            p += 1;
+        } else {                                            /* sml_d */
+            if (pend - p < 2) break;
+            L = opc >> 6;
+            M = ((opc >> 3) & 7) + 3;
+            D = ((size_t)(opc & 7) << 8) | p[1];
+            p += 2;
+        }
+
+        if (L) {
+            if ((size_t)(pend - p) < L) break;
+            avail = dst_size - o;
+            if (L > avail) {
+                memcpy(out + o, p, avail);
+                o += avail;
+                break;
+            }
+            memcpy(out + o, p, L);
+            o += L;
+            p += L;
+        }
+
+        if (M) {
+            if (D == 0 || D > o) break;
+
+            if (D >= 8 && dst_size - o >= M + 8) {
+                /* Whole words; any overrun is rewritten by later output. */
+                for (k = 0; k < M; k += 8) {
+                    u_int64_t w;
+
+                    memcpy(&w, out + o + k - D, 8);
+                    memcpy(out + o + k, &w, 8);
+                }
+                o += M;
+            } else {
+                avail = dst_size - o;
+                for (k = 0; k < M && k < avail; k++) {
+                    out[o + k] = out[o + k - D];
+                }
+                o += k;
+                if (k < M) break;
+            }
+        }
+    }
+
+    return o;
+}
+
+/**************************************************************
+ Codec registry
+
+ One entry per encoder that can produce a compressed slice or
+ mkext entry, so that tools select and benchmark codecs by type
+ or name rather than each carrying its own if/else. Streaming
+ encoders are fed at most COMPRESSION_STREAM_INPUT_MAX bytes per
+ call and keep whatever window they need in their own state.
+**************************************************************/
+
+/*******************************************************************************
+* Whole-buffer adapters to the CompressionCodec encode/decode signatures.
+*******************************************************************************/
+static size_t lzss_codec_encode(
+    void       * dst,
+    size_t       dstSize,
+    const void * src,
+    size_t       srcSize,
+    void       * work)
+{
+    u_int8_t * end;
+
+    (void)work;
+
+    if (dstSize > UINT32_MAX || srcSize > UINT32_MAX) {
+        return 0;
+    }
+    end = compress_lzss((u_int8_t *)dst, (u_int32_t)dstSize,
+        (u_int8_t *)src, (u_int32_t)srcSize);
+    return end ? (size_t)(end - (u_int8_t *)dst) : 0;
+}
+
+static size_t lzss_hashchain_codec_encode(
+    void       * dst,
+    size_t       dstSize,
+    const void * src,
+    size_t       srcSize,
+    void       * work)
+{
+    u_int8_t * end;
+
+    (void)work;
+
+    if (dstSize > UINT32_MAX || srcSize > UINT32_MAX) {
+        return 0;
+    }
+    end = compress_lzss_hashchain((u_int8_t *)dst, (u_int32_t)dstSize,
+        (u_int8_t *)src, (u_int32_t)srcSize, LZSS_HASHCHAIN_DEFAULT_DEPTH);
+    return end ? (size_t)(end - (u_int8_t *)dst) : 0;
+}
+
+static size_t lzss_optimal_codec_encode(
+    void       * dst,
+    size_t       dstSize,
+    const void * src,
+    size_t       srcSize,
+    void       * work)
+{
+    u_int8_t * end;
+
+    (void)work;
+
+    if (dstSize > UINT32_MAX || srcSize > UINT32_MAX) {
+        return 0;
+    }
+    end = compress_lzss_optimal((u_int8_t *)dst, (u_int32_t)dstSize,
+        (u_int8_t *)src, (u_int32_t)srcSize);
+    return end ? (size_t)(end - (u_int8_t *)dst) : 0;
+}
+
+static size_t lzss_codec_decode(
+    void       * dst,
+    size_t       dstSize,
+    const void * src,
+    size_t       srcSize)
+{
+    int result;
+
+    if (dstSize > UINT32_MAX || srcSize > UINT32_MAX) {
+        return 0;
+    }
+    result = decompress_lzss_fast((u_int8_t *)dst, (u_int32_t)dstSize,
+        (u_int8_t *)src, (u_int32_t)srcSize);
+    return result > 0 ? (size_t)result : 0;
+}
+
+static size_t no_encode_work_size(void)
+{
+    return 0;
+}
+
+/*******************************************************************************
+* Streaming LZSS with the tree encoder. tree_encode() already consumes its
+* input a byte at a time, so it needs no window beyond its own ring.
+*******************************************************************************/
+static void * lzss_stream_create(void)
+{
+    struct tree_encoder * te = malloc(sizeof(*te));
+
+    if (te) {
+        tree_encoder_init(te);
+    }
+    return te;
+}
+
+static size_t lzss_stream_encode(
+    void       * state,
+    const void * src,
+    size_t       srcSize,
+    int          final,
+    void       * dst,
+    size_t       dstSize)
+{
+    struct tree_encoder * te   = (struct tree_encoder *)state;
+    const u_int8_t      * srcp = (const u_int8_t *)src;
+    u_int8_t            * q    = (u_int8_t *)dst;
+    u_int8_t            * qend = q + dstSize;
+
+    q = tree_encode(te, &srcp, srcp + srcSize, final, q, qend);
+    if (q && final) {
+        q = tree_encode_finish(te, q, qend);
+    }
+    return q ? (size_t)(q - (u_int8_t *)dst) : COMPRESSION_STREAM_ERROR;
+}
+
+/*******************************************************************************
+* Streaming LZSS with the hash-chain and optimal-parse encoders. Input is
+* gathered in a window; when it fills, everything more than N bytes behind
+* the encoder is dropped and the chains are rebased to match. Dropping a
+* multiple of N keeps the ring positions the encoder emits unchanged.
+*******************************************************************************/
+#define HC_STREAM_WINDOW  (16 * N)
+
+struct lzss_window {
+    u_int32_t length;
+    u_int8_t  data[HC_STREAM_WINDOW];
+};
+
+typedef u_int8_t * (*lzss_window_encode_fn)(void * encoder,
+    const u_int8_t * src, u_int32_t srclen, int final,
+    u_int8_t * dst, u_int8_t * dstend);
+
+static void lzss_window_slide(
+    struct hc_encoder  * hc,
+    struct lzss_window * w)
+{
+    struct hc_encode_state * sp = &hc->chains;
+    u_int32_t delta, i;
+
+    if (hc->pos < N) {
+        return;
+    }
+    delta = (hc->pos - N) & ~(N - 1);
+    if (!delta) {
+        return;
+    }
+
+    memmove(w->data, w->data + delta, w->length - delta);
+    w->length -= delta;
+    hc->pos -= delta;
+
+    for (i = 0; i < HC_HASH_SIZE; i++) {
+        sp->head[i] = sp->head[i] > delta ? sp->head[i] - delta : HC_NIL;
+    }
+    for (i = 0; i < N; i++) {
+        sp->prev[i] = sp->prev[i] > delta ? sp->prev[i] - delta : HC_NIL;
+    }
+}
+
+static size_t lzss_window_encode(
+    struct hc_encoder     * hc,
+    struct lzss_window    * w,
+    lzss_window_encode_fn   encode,
+    void                  * encoder,
+    const void            * src,
+    size_t                  srcSize,
+    int                     final,
+    void                  * dst,
+    size_t                  dstSize)
+{
+    const u_int8_t * in   = (const u_int8_t *)src;
+    u_int8_t       * q    = (u_int8_t *)dst;
+    u_int8_t       * qend = q + dstSize;
+    size_t           n;
+
+    do {
+        if (w->length == HC_STREAM_WINDOW) {
+            lzss_window_slide(hc, w);
+        }
+        n = HC_STREAM_WINDOW - w->length;
+        if (n > srcSize) {
+            n = srcSize;
+        }
+        if (n) {
+            memcpy(w->data + w->length, in, n);
+        }
+        w->length += n;
+        in += n;
+        srcSize -= n;
+
+        q = encode(encoder, w->data, w->length, final && !srcSize, q, qend);
+        if (!q) {
+            return COMPRESSION_STREAM_ERROR;
+        }
+    } while (srcSize);
+
+    return (size_t)(q - (u_int8_t *)dst);
+}
+
+struct hc_stream {
+    struct hc_encoder  encoder;
+    struct lzss_window window;
+};
+
+static void * lzss_hashchain_stream_create(void)
+{
+    struct hc_stream * hs = malloc(sizeof(*hs));
+
+    if (hs) {
+        hc_encoder_init(&hs->encoder, LZSS_HASHCHAIN_DEFAULT_DEPTH);
+        hs->window.length = 0;
+    }
+    return hs;
+}
+
+static u_int8_t * hc_stream_encode_fn(
+    void           * encoder,
+    const u_int8_t * src,
+    u_int32_t        srclen,
+    int              final,
+    u_int8_t       * dst,
+    u_int8_t       * dstend)
+{
+    return hc_encode((struct hc_encoder *)encoder, src, srclen, final, dst, dstend);
+}
+
+static size_t lzss_hashchain_stream_encode(
+    void       * state,
+    const void * src,
+    size_t       srcSize,
+    int          final,
+    void       * dst,
+    size_t       dstSize)
+{
+    struct hc_stream * hs = (struct hc_stream *)state;
+
+    return lzss_window_encode(&hs->encoder, &hs->window, &hc_stream_encode_fn,
+        &hs->encoder, src, srcSize, final, dst, dstSize);
+}
+
+struct opt_stream {
+    struct opt_encoder encoder;
+    struct lzss_window window;
+};
+
+static void * lzss_optimal_stream_create(void)
+{
+    struct opt_stream * os = malloc(sizeof(*os));
+
+    if (os) {
+        opt_encoder_init(&os->encoder);
+        os->window.length = 0;
+    }
+    return os;
+}
+
+static u_int8_t * opt_stream_encode_fn(
+    void           * encoder,
+    const u_int8_t * src,
+    u_int32_t        srclen,
+    int              final,
+    u_int8_t       * dst,
+    u_int8_t       * dstend)
+{
+    return opt_encode((struct opt_encoder *)encoder, src, srclen, final, dst, dstend);
+}
+
+static size_t lzss_optimal_stream_encode(
+    void       * state,
+    const void * src,
+    size_t       srcSize,
+    int          final,
+    void       * dst,
+    size_t       dstSize)
+{
+    struct opt_stream * os = (struct opt_stream *)state;
+
+    return lzss_window_encode(&os->encoder.hc, &os->window, &opt_stream_encode_fn,
+        &os->encoder, src, srcSize, final, dst, dstSize);
+}
+
+/*******************************************************************************
+* Streaming LZVN, windowed the same way. The window keeps the last
+* LZVN_MAX_DISTANCE bytes and any literals not yet emitted.
+*******************************************************************************/
+#define LZVN_STREAM_WINDOW  (256 * 1024)
+#define LZVN_STREAM_ALIGN   (4096)
+
+struct lzvn_stream {
+    u_int32_t          table[LZVN_HASH_SIZE];
+    struct lzvn_cursor cursor;
+    size_t             length;
+    u_int8_t           window[LZVN_STREAM_WINDOW];
+};
+
+static void * lzvn_stream_create(void)
+{
+    struct lzvn_stream * ls = calloc(1, sizeof(*ls));
+
+    return ls;
+}
+
+static void lzvn_stream_slide(struct lzvn_stream * ls)
+{
+    size_t    keep = ls->cursor.litStart;
+    u_int32_t delta, i;
+
+    if (ls->cursor.i > LZVN_MAX_DISTANCE &&
+        ls->cursor.i - LZVN_MAX_DISTANCE < keep) {
+        keep = ls->cursor.i - LZVN_MAX_DISTANCE;
+    }
+    delta = (u_int32_t)(keep & ~(size_t)(LZVN_STREAM_ALIGN - 1));
+    if (!delta) {
+        return;
+    }
+
+    memmove(ls->window, ls->window + delta, ls->length - delta);
+    ls->length -= delta;
+    ls->cursor.i -= delta;
+    ls->cursor.litStart -= delta;
+
+    for (i = 0; i < LZVN_HASH_SIZE; i++) {
+        ls->table[i] = ls->table[i] > delta ? ls->table[i] - delta : 0;
+    }
+}
+
+static size_t lzvn_stream_encode(
+    void       * state,
+    const void * src,
+    size_t       srcSize,
+    int          final,
+    void       * dst,
+    size_t       dstSize)
+{
+    struct lzvn_stream * ls   = (struct lzvn_stream *)state;
+    const u_int8_t     * in   = (const u_int8_t *)src;
+    u_int8_t           * q    = (u_int8_t *)dst;
+    u_int8_t           * qend = q + dstSize;
+    size_t               n;
+
+    do {
+        if (ls->length == LZVN_STREAM_WINDOW) {
+            lzvn_stream_slide(ls);
+        }
+        n = LZVN_STREAM_WINDOW - ls->length;
+        if (n > srcSize) {
+            n = srcSize;
+        }
+        if (n) {
+            memcpy(ls->window + ls->length, in, n);
+        }
+        ls->length += n;
+        in += n;
+        srcSize -= n;
+
+        q = lzvn_encode_core(ls->table, &ls->cursor, ls->window, ls->length,
+            final && !srcSize, q, qend);
+        if (!q) {
+            return COMPRESSION_STREAM_ERROR;
+        }
+    } while (srcSize);
+
+    return (size_t)(q - (u_int8_t *)dst);
+}
+
+#define COMPRESSION_MAX_CODECS  (8)
+
+static CompressionCodec sCodecs[COMPRESSION_MAX_CODECS] = {
+    {
+        COMP_TYPE_LZSS, COMP_TYPE_LZSS, "lzss",
+        &no_encode_work_size, &lzss_codec_encode, &lzss_codec_decode,
+        &lzss_stream_create, &lzss_stream_encode, &free
+    },
+    {
+        COMP_TYPE_LZSS_FAST, COMP_TYPE_LZSS, "lzss-fast",
+        &no_encode_work_size, &lzss_hashchain_codec_encode, &lzss_codec_decode,
+        &lzss_hashchain_stream_create, &lzss_hashchain_stream_encode, &free
+    },
+    {
+        COMP_TYPE_LZSS_OPTIMAL, COMP_TYPE_LZSS, "lzss-optimal",
+        &no_encode_work_size, &lzss_optimal_codec_encode, &lzss_codec_decode,
+        &lzss_optimal_stream_create, &lzss_optimal_stream_encode, &free
+    },
+    {
+        COMP_TYPE_FASTLIB, COMP_TYPE_FASTLIB, "lzvn",
+        &local_lzvn_encode_work_size, &local_lzvn_encode, &local_lzvn_decode,
+        &lzvn_stream_create, &lzvn_stream_encode, &free
+    },
+};
+static int sCodecCount = 4;
+
+/*******************************************************************************
+*******************************************************************************/
+const CompressionCodec * compression_codec_for_type(u_int32_t type)
+{
+    int i;
+
+    for (i = 0; i < sCodecCount; i++) {
+        if (sCodecs[i].type == type) {
+            return &sCodecs[i];
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+const CompressionCodec * compression_codec_for_name(const char * name)
+{
+    int i;
+
+    for (i = 0; i < sCodecCount; i++) {
+        if (0 == strcasecmp(sCodecs[i].name, name)) {
+            return &sCodecs[i];
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* Replaces the codec with the same type, or adds a new one. Entries that
+* leave the stream functions NULL can't be used with compression_stream_*.
+*******************************************************************************/
+int compression_codec_register(const CompressionCodec * codec)
+{
+    int i;
+
+    for (i = 0; i < sCodecCount; i++) {
+        if (sCodecs[i].type == codec->type) {
+            sCodecs[i] = *codec;
+            return 0;
+        }
+    }
+    if (sCodecCount == COMPRESSION_MAX_CODECS) {
+        return -1;
+    }
+    sCodecs[sCodecCount++] = *codec;
+    return 0;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+struct compression_stream {
+    const CompressionCodec * codec;
+    void                   * state;
+    CompressionWriteFunc     writer;
+    void                   * context;
+    u_int32_t                adler32;
+    u_int64_t                totalIn;
+    u_int64_t                totalOut;
+    int                      finished;
+    u_int8_t                 output[COMPRESSION_STREAM_OUTPUT_MIN];
+};
+
+CompressionStream * compression_stream_create(
+    const CompressionCodec * codec,
+    CompressionWriteFunc     writer,
+    void                   * context)
+{
+    CompressionStream * stream;
+
+    if (!codec || !codec->streamCreate || !codec->streamEncode || !writer) {
+        return NULL;
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        return NULL;
+    }
+    stream->codec = codec;
+    stream->writer = writer;
+    stream->context = context;
+    stream->adler32 = 1;
+    stream->state = codec->streamCreate();
+    if (!stream->state) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static int compression_stream_run(
+    CompressionStream * stream,
+    const u_int8_t    * buf,
+    size_t              length,
+    int                 final)
+{
+    size_t n, out;
+
+    do {
+        n = length < COMPRESSION_STREAM_INPUT_MAX ?
+            length : COMPRESSION_STREAM_INPUT_MAX;
+
+        stream->adler32 = adler32_vector(stream->adler32, buf, n);
+        out = stream->codec->streamEncode(stream->state, buf, n,
+            final && n == length, stream->output, sizeof(stream->output));
+        if (out == COMPRESSION_STREAM_ERROR) {
+            return -1;
+        }
+        if (out && stream->writer(stream->context, stream->output, out)) {
+            return -1;
+        }
+        stream->totalIn += n;
+        stream->totalOut += out;
+        buf += n;
+        length -= n;
+    } while (length);
+
+    return 0;
+}
+
+int compression_stream_write(
+    CompressionStream * stream,
+    const void        * buf,
+    size_t              length)
+{
+    if (stream->finished) {
+        return -1;
+    }
+    if (!length) {
+        return 0;
+    }
+    return compression_stream_run(stream, (const u_int8_t *)buf, length, 0);
+}
+
+int compression_stream_finish(CompressionStream * stream)
+{
+    if (stream->finished) {
+        return -1;
+    }
+    stream->finished = 1;
+    return compression_stream_run(stream, NULL, 0, 1);
+}
+
+u_int32_t compression_stream_adler32(CompressionStream * stream)
+{
+    return stream->adler32;
+}
+
+u_int64_t compression_stream_total_in(CompressionStream * stream)
+{
+    return stream->totalIn;
+}
+
+u_int64_t compression_stream_total_out(CompressionStream * stream)
+{
+    return stream->totalOut;
+}
+
+void compression_stream_destroy(CompressionStream * stream)
+{
+    if (stream) {
+        if (stream->state && stream->codec->streamDestroy) {
+            stream->codec->streamDestroy(stream->state);
+        }
+        free(stream);
+    }
+}
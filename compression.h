@@ -24,22 +24,154 @@
 #ifndef __COMPRESSION_H__
 #define __COMPRESSION_H__
 
+#include <sys/types.h>
 #include <stdlib.h>
 
+/* Compression types. COMP_TYPE_LZSS and COMP_TYPE_FASTLIB are also the
+ * compressType values stored in compressed prelinked kernel headers.
+ */
+#define COMP_TYPE_LZSS      'lzss'
+#define COMP_TYPE_FASTLIB   'lzvn'
+#define COMP_TYPE_LZSS_FAST 'lzsf'  // hash-chain encoder, stored as COMP_TYPE_LZSS
+#define COMP_TYPE_LZSS_OPTIMAL 'lzso'  // optimal-parse encoder, stored as COMP_TYPE_LZSS
+
 u_int32_t local_adler32(
     u_int8_t * buffer,
     int32_t    length);
 
+u_int32_t local_adler32_combine(
+    u_int32_t adler1,
+    u_int32_t adler2,
+    u_int32_t length2);
+
 int decompress_lzss(
     u_int8_t       * dst,
     u_int32_t        dstlen,
     u_int8_t * src,
     u_int32_t        srclen);
 
+/* Decodes the same streams as decompress_lzss() with identical results,
+ * but requires all of dst to be addressable and copies back-references
+ * straight from earlier output.
+ */
+int decompress_lzss_fast(
+    u_int8_t       * dst,
+    u_int32_t        dstlen,
+    u_int8_t * src,
+    u_int32_t        srclen);
+
 u_int8_t * compress_lzss(
     u_int8_t       * dst,
     u_int32_t        dstlen,
     u_int8_t * src,
     u_int32_t        srclen);
 
+/* Hash-chain variant of compress_lzss(). Emits a stream readable by
+ * decompress_lzss(); maxChainDepth bounds the candidates examined per
+ * position (0 selects LZSS_HASHCHAIN_DEFAULT_DEPTH).
+ */
+#define LZSS_HASHCHAIN_DEFAULT_DEPTH  (16)
+
+u_int8_t * compress_lzss_hashchain(
+    u_int8_t       * dst,
+    u_int32_t        dstlen,
+    u_int8_t * src,
+    u_int32_t        srclen,
+    u_int32_t        maxChainDepth);
+
+/* Optimal-parse variant of compress_lzss(), for caches built off the boot
+ * path. Much slower; picks the cheapest parse one block at a time over its
+ * own matches and compress_lzss()'s, so its output is never larger than
+ * compress_lzss() gives for the same input.
+ */
+u_int8_t * compress_lzss_optimal(
+    u_int8_t       * dst,
+    u_int32_t        dstlen,
+    u_int8_t * src,
+    u_int32_t        srclen);
+
+/* Portable LZVN codec (COMP_TYPE_FASTLIB). Same contracts as lzvn_encode(),
+ * lzvn_decode() and lzvn_encode_work_size() from FastCompression.
+ */
+size_t local_lzvn_encode_work_size(void);
+
+size_t local_lzvn_encode(
+    void       * dst,
+    size_t       dst_size,
+    const void * src,
+    size_t       src_size,
+    void       * work);
+
+size_t local_lzvn_decode(
+    void       * dst,
+    size_t       dst_size,
+    const void * src,
+    size_t       src_size);
+
+/* Codec registry. encode() returns the number of bytes written to dst, or
+ * 0 if it didn't fit; work points to encodeWorkSize() bytes. decode()
+ * returns the number of bytes written to dst. storedType is what a
+ * compressed prelinked kernel header records for the codec's output.
+ *
+ * streamEncode() consumes all of src, which is never more than
+ * COMPRESSION_STREAM_INPUT_MAX bytes, and writes at most dstSize
+ * (at least COMPRESSION_STREAM_OUTPUT_MIN) bytes, returning the count or
+ * COMPRESSION_STREAM_ERROR. final is set on the last call.
+ */
+#define COMPRESSION_STREAM_INPUT_MAX   (16 * 1024)
+#define COMPRESSION_STREAM_OUTPUT_MIN  (64 * 1024)
+#define COMPRESSION_STREAM_ERROR       ((size_t)-1)
+
+typedef struct compression_codec {
+    u_int32_t    type;
+    u_int32_t    storedType;
+    const char * name;
+
+    size_t   (*encodeWorkSize)(void);
+    size_t   (*encode)(void * dst, size_t dstSize,
+                       const void * src, size_t srcSize, void * work);
+    size_t   (*decode)(void * dst, size_t dstSize,
+                       const void * src, size_t srcSize);
+
+    void   * (*streamCreate)(void);
+    size_t   (*streamEncode)(void * state, const void * src, size_t srcSize,
+                             int final, void * dst, size_t dstSize);
+    void     (*streamDestroy)(void * state);
+} CompressionCodec;
+
+const CompressionCodec * compression_codec_for_type(u_int32_t type);
+const CompressionCodec * compression_codec_for_name(const char * name);
+
+/* Replaces the registered codec of the same type, or adds one.
+ * Returns 0 on success.
+ */
+int compression_codec_register(const CompressionCodec * codec);
+
+/* Compresses a byte stream with a registered codec, handing output to
+ * writer as it is produced. writer returns 0 on success. The adler32
+ * covers the uncompressed input. Functions returning int return 0 on
+ * success and -1 on failure, after which the stream can only be destroyed.
+ */
+typedef int (*CompressionWriteFunc)(void * context, const void * buf, size_t length);
+
+typedef struct compression_stream CompressionStream;
+
+CompressionStream * compression_stream_create(
+    const CompressionCodec * codec,
+    CompressionWriteFunc     writer,
+    void                   * context);
+
+int compression_stream_write(
+    CompressionStream * stream,
+    const void        * buf,
+    size_t              length);
+
+int compression_stream_finish(CompressionStream * stream);
+
+u_int32_t compression_stream_adler32(CompressionStream * stream);
+u_int64_t compression_stream_total_in(CompressionStream * stream);
+u_int64_t compression_stream_total_out(CompressionStream * stream);
+
+void compression_stream_destroy(CompressionStream * stream);
+
 #endif /* __COMPRESSION_H__ */
@@ -70,6 +70,7 @@
 
 #include "kcgen_main.h"
 #include "compression.h"
+#include "prelink_info.h"
 
 /*******************************************************************************
 * Program Globals
@@ -230,6 +231,7 @@ ExitStatus readArgs(
     int32_t      i              = 0;
     int          optchar        = 0;
     int          longindex      = -1;
+    const CompressionCodec * codec = NULL;  // do not free
 
     bzero(toolArgs, sizeof(*toolArgs));
 
@@ -381,16 +383,17 @@ ExitStatus readArgs(
                         toolArgs->compress = true;
                         if (optarg == NULL) {
                             toolArgs->compressionType = COMP_TYPE_LZSS;
-                        } else if (0 == strcasecmp(optarg, "lzvn")) {
-                            if (!supportsFastLibCompression()) {
+                        } else if (0 == strcasecmp(optarg, "lzss-chunked")) {
+                            toolArgs->compressionType = COMP_TYPE_LZSS_CHUNKED;
+                        } else if ((codec = compression_codec_for_name(optarg))) {
+                            if (codec->type == COMP_TYPE_FASTLIB &&
+                                !supportsFastLibCompression()) {
                                 OSKextLog(/* kext */ NULL,
                                           kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
                                           "Error - lzvn compression specified but not supported");
                                 goto finish;
                             }
-                            toolArgs->compressionType = COMP_TYPE_FASTLIB;
-                        } else if (0 == strcasecmp(optarg, "lzss")) {
-                            toolArgs->compressionType = COMP_TYPE_LZSS;
+                            toolArgs->compressionType = codec->type;
                         } else {
                             OSKextLog(/* kext */ NULL,
                                       kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -472,6 +475,10 @@ ExitStatus readArgs(
                         toolArgs->stripSymbols = true;
                         break;
 
+                    case kLongOptPrelinkIndex:
+                        toolArgs->writePrelinkIndex = true;
+                        break;
+
                     case kLongOptMaxSliceSize:
                         toolArgs->maxSliceSize = atol(optarg);
                         break;
@@ -735,6 +742,30 @@ ExitStatus checkArgs(KcgenArgs * toolArgs)
         goto finish;
     }
 
+    /* The booter can't uncompress lzss-chunked, so it mustn't end up
+     * anywhere a kernelcache is booted from.
+     */
+    if (toolArgs->compress &&
+        toolArgs->compressionType == COMP_TYPE_LZSS_CHUNKED)
+    {
+        if (toolArgs->prelinkedKernelPath &&
+            isBootPrelinkedKernelPath(toolArgs->prelinkedKernelPath))
+        {
+            OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                "Error - %s is a boot kernelcache location; "
+                "lzss-chunked kernelcaches can't be booted.",
+                toolArgs->prelinkedKernelPath);
+            goto finish;
+        }
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogWarningLevel | kOSKextLogGeneralFlag,
+            "WARNING: lzss-chunked kernelcaches can't be booted; "
+            "%s is only for use by kclist and kctool.",
+            toolArgs->prelinkedKernelPath ? toolArgs->prelinkedKernelPath :
+                "the prelinked kernel");
+    }
+
     if (!toolArgs->compress && !toolArgs->uncompress) {
         toolArgs->compress = true;
         toolArgs->compressionType = COMP_TYPE_LZSS;
@@ -756,6 +787,55 @@ finish:
     return result;
 }
 
+/*******************************************************************************
+* Returns true if path lies in a directory the booter loads kernelcaches from,
+* on this or any other volume.
+*******************************************************************************/
+Boolean isBootPrelinkedKernelPath(const char * path)
+{
+    Boolean       result        = true;
+    char        * pathCopy      = NULL;  // must free
+    char          dirPath[PATH_MAX];
+    const char  * bootDirs[]    = {
+        _kOSKextPrelinkedKernelsPath,
+        _kOSKextTemporaryPrelinkedKernelsPath,
+        _kOSKextCachesRootFolder,
+        "/com.apple.boot.",
+    };
+    size_t        i;
+
+    /* Resolve symlinks in the directory; the file itself needn't exist yet.
+     * If the directory can't be resolved, go by the path as given.
+     */
+    pathCopy = strdup(path);
+    if (!pathCopy) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    if (!realpath(dirname(pathCopy), dirPath) &&
+        strlcpy(dirPath, path, sizeof(dirPath)) >= sizeof(dirPath))
+    {
+        OSKextLogStringError(/* kext */ NULL);
+        goto finish;
+    }
+    if (strlcat(dirPath, "/", sizeof(dirPath)) >= sizeof(dirPath)) {
+        OSKextLogStringError(/* kext */ NULL);
+        goto finish;
+    }
+
+    result = false;
+    for (i = 0; i < sizeof(bootDirs) / sizeof(bootDirs[0]); i++) {
+        if (strstr(dirPath, bootDirs[i])) {
+            result = true;
+            break;
+        }
+    }
+
+finish:
+    SAFE_FREE(pathCopy);
+    return result;
+}
+
 /*******************************************************************************
 *******************************************************************************/
 typedef struct {
@@ -1096,6 +1176,13 @@ createPrelinkedKernel(
         goto finish;
     }
 
+    if (toolArgs->writePrelinkIndex) {
+        result = writePrelinkIndex(toolArgs->prelinkedKernelPath, prelinkSlices);
+        if (result != EX_OK) {
+            goto finish;
+        }
+    }
+
     if (toolArgs->symbolDirURL) {
         result = writePrelinkedSymbols(toolArgs->symbolDirURL,
             generatedSymbols, generatedArchs);
@@ -1271,13 +1358,21 @@ ExitStatus compressPrelinkedKernel(
     mode_t              fileMode        = 0;
     int                 i               = 0;
 
+    /* Compression streams each slice from the old file to the new one.
+     */
+    if (compress) {
+        result = compressPrelinkedKernelFile(prelinkPath, compressionType,
+                                             /* hasRelocs */ true);
+        goto finish;
+    }
+
     result = readMachOSlices(prelinkPath, &prelinkedSlices,
         &prelinkedArchs, &fileMode, prelinkedKernelTimes);
     if (result != EX_OK) {
         goto finish;
     }
 
-    /* Compress/uncompress each slice of the prelinked kernel.
+    /* Uncompress each slice of the prelinked kernel.
      */
 
     for (i = 0; i < CFArrayGetCount(prelinkedSlices); ++i) {
@@ -1285,20 +1380,10 @@ ExitStatus compressPrelinkedKernel(
         SAFE_RELEASE_NULL(prelinkedSlice);
         prelinkedSlice = CFArrayGetValueAtIndex(prelinkedSlices, i);
 
-        if (compress) {
-            prelinkedSlice = compressPrelinkedSlice(compressionType,
-                                                    prelinkedSlice,
-                                                    true);
-            if (!prelinkedSlice) {
-                result = EX_DATAERR;
-                goto finish;
-            }
-        } else {
-            prelinkedSlice = uncompressPrelinkedSlice(prelinkedSlice);
-            if (!prelinkedSlice) {
-                result = EX_DATAERR;
-                goto finish;
-            }
+        prelinkedSlice = uncompressPrelinkedSlice(prelinkedSlice);
+        if (!prelinkedSlice) {
+            result = EX_DATAERR;
+            goto finish;
         }
 
         CFArraySetValueAtIndex(prelinkedSlices, i, prelinkedSlice);
@@ -1629,6 +1714,18 @@ void usage(UsageLevel usageLevel)
         "        create/update prelinked kernel\n",
         kOptNamePrelinkedKernel, kOptPrelinkedKernel);
 
+    fprintf(stderr, "-%s:\n"
+        "        also write <filename>%s, an index of the prelinked kexts for kclist & kctool\n",
+        kOptNamePrelinkIndex, kPrelinkIndexSuffix);
+
+    fprintf(stderr, "-%s[=lzss|lzss-fast|lzss-optimal|lzvn|lzss-chunked]:\n"
+        "        compress the prelinked kernel (lzss by default); lzss-chunked\n"
+        "        is only for kclist & kctool and can't be booted\n",
+        kOptNameCompressed);
+    fprintf(stderr, "-%s:\n"
+        "        don't compress the prelinked kernel\n",
+        kOptNameUncompressed);
+
     fprintf(stderr, "-%s <filename>:\n"
         "        create load list of modules and dependencies\n",
         kOptNameLoadList);
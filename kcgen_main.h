@@ -66,6 +66,7 @@ enum {
 #define kOptNameAllPersonalities        "all-personalities"
 #define kOptNameNoLinkFailures          "no-link-failures"
 #define kOptNameStripSymbols            "strip-symbols"
+#define kOptNamePrelinkIndex            "prelink-index"
 
 #define kOptNameMaxSliceSize            "max-slice-size"
 
@@ -106,6 +107,7 @@ enum {
 #define kLongOptPLists                   (-15)
 #define kLongOptLoadList                 (-16)
 #define kLongOptKextVariant              (-17)
+#define kLongOptPrelinkIndex             (-18)
 
 #define kOptChars                ":a:b:c:ehK:lLnNqsStT:vz"
 
@@ -138,6 +140,7 @@ struct option sOptInfo[] = {
     { kOptNamePLists,                   required_argument,  &longopt, kLongOptPLists },
     { kOptNameLoadList,                 required_argument,  &longopt, kLongOptLoadList },
     { kOptNameKextVariant,              required_argument,  &longopt, kLongOptKextVariant },
+    { kOptNamePrelinkIndex,             no_argument,        &longopt, kLongOptPrelinkIndex },
 
     /* Always on for kcgen; can be removed at some point. */
     { kOptNameAllPersonalities,         no_argument,        &longopt, kLongOptAllPersonalities },
@@ -154,6 +157,7 @@ typedef struct {
     char    * prelinkedKernelPath;            // -c option
     Boolean   generatePrelinkedSymbols;     // -symbols option
     Boolean   stripSymbols;                 // -strip-symbols option
+    Boolean   writePrelinkIndex;            // -prelink-index option
     CFIndex   maxSliceSize;
 
     CFURLRef  compressedPrelinkedKernelURL; // -uncompress option
@@ -205,6 +209,7 @@ ExitStatus setPrelinkedKernelArgs(
     char          * filename);
 
 ExitStatus checkArgs(KcgenArgs * toolArgs);
+Boolean isBootPrelinkedKernelPath(const char * path);
 
 ExitStatus writeFatFile(
     const char                * filePath,
@@ -21,16 +21,23 @@
 #include <IOKit/IOCFUnserialize.h>
 #include <IOKit/kext/macho_util.h>
 
+#include <CommonCrypto/CommonDigest.h>
 #include <architecture/byte_order.h>
+#include <dispatch/dispatch.h>
 #include <errno.h>
 #include <libc.h>
+#include <limits.h>
 #include <mach-o/fat.h>
 #include <mach-o/loader.h>
+#include <stdatomic.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <uuid/uuid.h>
 
 #include "kclist_main.h"
 #include "compression.h"
+#include "macho_view.h"
+#include "prelink_info.h"
 
 // old SDKs...
 #ifndef kBuiltinInfoSection
@@ -63,10 +70,33 @@ struct fileset_entry_command {
 #define MH_FILESET 0xc
 #endif
 
+/* A kext queued by printKextInfo() for extractQueuedKexts(). */
+struct ExtractJob
+{
+    char          kextName[KMOD_MAX_NAME];
+    uint64_t      kextSourceAddress;
+    uint64_t      kextLoadAddress;
+    const void  * mh;
+    Boolean       is64Bit;
+    Boolean       isSplitKext;
+};
+
 struct ImageInfo
 {
+    CFDataRef     kcRawData;    // must release
+    CFDataRef     kcImageData;  // must release
     const UInt8 * kcImagePtr;
     CFIndex       kcImageSize;
+
+    /* Set when a compressed kernelcache is uncompressed on demand; only
+     * ranges returned by getKCBytes() are valid in kcImagePtr then. Only
+     * lzss-chunked caches (which kcgen writes for host tools) are really
+     * uncompressed piecemeal: shipped lzss and lzvn boot caches are still
+     * uncompressed in full on the first getKCBytes(), so kclist -u is no
+     * faster on those.
+     */
+    PrelinkedSliceReaderRef kcReader;  // must free
+    MachOViewRef  kcView;  // must machoViewFree()
     uint32_t      machoBits;
 
     void        * builtinInfoSect;
@@ -77,8 +107,15 @@ struct ImageInfo
     const char  * builtinStartBytes;
     uint64_t      builtinStartSize;
 
+    /* The 64-bit builtin tables with every pointer rebased, decoded once
+     * rather than each time a builtin kext is located.
+     */
+    uint64_t    * builtinInfoAddrs;   // must free
+    uint64_t    * builtinStartAddrs;  // must free
+
     void        * prelinkInfoSect;
     const char  * prelinkInfoBytes;
+    uint64_t      prelinkInfoSize;
 
     void        * prelinkTextSect;
 
@@ -89,6 +126,13 @@ struct ImageInfo
     void        * textSegment;
     uint64_t      baseAddress;
     bool          hasThreadedRebase;
+
+    /* Set by listPrelinkedKexts() to extract kexts in parallel once they
+     * have all been listed; NULL to extract each kext as it is listed.
+     */
+    struct ExtractJob * extractJobs;
+    CFIndex       extractJobCount;
+    CFIndex       extractJobCapacity;
 };
 
 
@@ -98,13 +142,23 @@ extern void printPList_new(FILE * stream, CFPropertyListRef plist, int style);
 
 static const char * getSegmentCommandName(uint32_t theSegCommand);
 
-static void createKCMap(const uint8_t *kernelcacheImage, Boolean verbose, struct kcmap **map);
+static void createKCMap(struct ImageInfo * ki, Boolean verbose, struct kcmap **map);
 static void printKernelCacheLayoutMap(KclistArgs *toolArgs, struct ImageInfo * ki, struct kcmap *kcmap, CFPropertyListRef kcInfoPlist);
 static void printPrelinkInfoDict(KclistArgs *toolArgs, CFDictionaryRef prelinkInfoDict);
 static void printJSON(KclistArgs *toolArgs, struct ImageInfo * ki, struct kcmap *kcmap, CFPropertyListRef kcInfoPlist);
-static void printJSONSegments(KclistArgs *toolArgs, void *mhpv, bool mh_is_64);
-static off_t getKCFileOffset(struct kcmap *kcmap, uint64_t va_ofst);
+static void printJSONSegments(KclistArgs *toolArgs, MachOViewRef view);
+static void getKCFileOffsets(struct kcmap *kcmap, uint32_t count, const uint64_t *va_ofsts, off_t *kc_ofsts);
+static const void * getKCBytes(struct ImageInfo * ki, uint64_t offset, uint64_t length);
+static const void * getKCMachHeader(struct ImageInfo * ki, uint64_t offset);
 static void printMachOHeader(KclistArgs *toolArgs, const UInt8 *imagePtr, CFIndex imageSize, const char *descrip, const char *_pfx);
+static ExitStatus writeKextSegments(int fd, struct iovec *iov, int iovcnt);
+static void extractQueuedKexts(KclistArgs *toolArgs, struct ImageInfo *ki, struct kcmap *kcmap);
+static CFDictionaryRef copyPrelinkInfoForKexts(KclistArgs *toolArgs, struct ImageInfo *ki);
+static Boolean openKernelcacheSlice(KclistArgs *toolArgs, const char *kernelcachePath, const NXArchInfo *archInfo, const char *decompressedPath, struct ImageInfo *ki);
+static void closeKernelcacheSlice(struct ImageInfo *ki);
+static CFPropertyListRef copyPrelinkInfoPlist(KclistArgs *toolArgs, struct ImageInfo *ki);
+static uint64_t * copyRebasedPointerArray(struct ImageInfo *ki, const char *bytes, uint64_t size);
+static void diffPrelinkedKexts(KclistArgs *toolArgs, struct ImageInfo *baseKi, struct kcmap *baseKcmap, CFPropertyListRef baseInfoPlist, struct ImageInfo *ki, struct kcmap *kcmap, CFPropertyListRef kcInfoPlist, const NXArchInfo *archInfo);
 
 /*******************************************************************************
 * Program Globals
@@ -120,22 +174,25 @@ int main(int argc, char * const argv[])
     int                  kernelcache_fd     = -1;  // must close()
     void               * fat_header         = NULL;  // must unmapFatHeaderPage()
     struct fat_arch    * fat_arch           = NULL;
-    CFDataRef            rawKernelcache     = NULL;  // must release
-    CFDataRef            kernelcacheImage   = NULL;  // must release
 
     CFPropertyListRef    prelinkInfoPlist = NULL;  // must release
+    CFPropertyListRef    basePrelinkInfoPlist = NULL;  // must release
 
     const NXArchInfo *   nextArchInfo       = NULL;
     CFMutableArrayRef    archInfoArray      = NULL;
     Boolean              userProvidedArch   = false;
 
     struct ImageInfo     _ki;
-    struct ImageInfo   * ki = &_ki;
+    struct ImageInfo   * ki = &_ki;  // must closeKernelcacheSlice()
+    struct ImageInfo     _baseKi;
+    struct ImageInfo   * baseKi = &_baseKi;  // must closeKernelcacheSlice()
 
     uint64_t             kextDataGap = 0;
     uint64_t             xnuTextStart = 0;
 
     bzero(&toolArgs, sizeof(toolArgs));
+    bzero(ki, sizeof(*ki));
+    bzero(baseKi, sizeof(*baseKi));
 
    /*****
     * Find out what the program was invoked as.
@@ -201,196 +258,45 @@ int main(int argc, char * const argv[])
         }
     }
 
+    /* Only read here, so map the kernelcache rather than copy it in. */
+    setMapMachOSlices(true);
+
     while (true) {
         // may not be any arch info, so pass through at least once
         SAFE_RELEASE_NULL(prelinkInfoPlist);
-        SAFE_RELEASE_NULL(kernelcacheImage);
-        SAFE_RELEASE_NULL(rawKernelcache);
-
-        rawKernelcache = readMachOSliceForArch(toolArgs.kernelcachePath,
-                                               nextArchInfo,
-                                               /* checkArch */ FALSE);
-        if (!rawKernelcache) {
-            OSKextLog(/* kext */ NULL,
-                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                      "Can't read arch %s from %s.",
-                      nextArchInfo ? nextArchInfo->name : "NONE",
-                      toolArgs.kernelcachePath);
-            goto finish;
-        }
-
-        if (MAGIC32(CFDataGetBytePtr(rawKernelcache)) == OSSwapHostToBigInt32('comp')) {
-            kernelcacheImage = uncompressPrelinkedSlice(rawKernelcache);
-            if (!kernelcacheImage) {
-                OSKextLog(/* kext */ NULL,
-                          kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                          "Can't uncompress kernelcache slice.");
-                goto finish;
-            }
-        } else {
-            kernelcacheImage = CFRetain(rawKernelcache);
-        }
-
-        bzero(ki, sizeof(*ki));
-        ki->kcImagePtr  = CFDataGetBytePtr(kernelcacheImage);
-        ki->kcImageSize = CFDataGetLength(kernelcacheImage);
-
-        if (toolArgs.printMachO)
-            printMachOHeader(&toolArgs, ki->kcImagePtr, CFDataGetLength(kernelcacheImage), "kernelcache", "");
-
-        if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
-            ki->machoBits = 64;
-            ki->prelinkInfoSect = (void *)
-            macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
-                                         kPrelinkInfoSegment,
-                                         kPrelinkInfoSection);
-            ki->prelinkTextSect = (void *)
-            macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
-                                         kPrelinkTextSegment,
-                                         kPrelinkTextSection);
-            ki->builtinInfoSect = (void *)
-            macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
-                                         kPrelinkInfoSegment,
-                                         kBuiltinInfoSection);
-            ki->builtinStartSect = (void *)
-            macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
-                                         kPrelinkInfoSegment,
-                                         kBuiltinStartSection);
-            ki->textSegment = (void *)
-            macho_get_segment_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
-                                         "__TEXT");
-            struct section_64 * sect;
-            sect = macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
-                                         "__TEXT",
-                                         "__thread_starts");
-            ki->hasThreadedRebase = (sect && sect->size);
-
-        } else {
-            ki->machoBits = 32;
-            ki->prelinkInfoSect = (void *)
-            macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
-                                      kPrelinkInfoSegment,
-                                      kPrelinkInfoSection);
-            ki->prelinkTextSect = (void *)
-            macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
-                                      kPrelinkTextSegment,
-                                      kPrelinkTextSection);
-            ki->builtinInfoSect = (void *)
-            macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
-                                         kPrelinkInfoSegment,
-                                         kBuiltinInfoSection);
-            ki->builtinStartSect = (void *)
-            macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
-                                         kPrelinkInfoSegment,
-                                         kBuiltinStartSection);
-            ki->textSegment = (void *)
-            macho_get_segment_by_name((struct mach_header *)ki->kcImagePtr,
-                                      "__TEXT");
-            ki->hasThreadedRebase = false;
-        }
-
-        if (!ki->prelinkInfoSect) {
-            OSKextLog(/* kext */ NULL,
-                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                      "Can't find prelink info section.");
-            goto finish;
-        }
+        SAFE_RELEASE_NULL(basePrelinkInfoPlist);
+        closeKernelcacheSlice(ki);
+        closeKernelcacheSlice(baseKi);
 
-        if (!ki->prelinkTextSect) {
-            OSKextLog(/* kext */ NULL,
-                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                      "Can't find prelink text section.");
+        if (!openKernelcacheSlice(&toolArgs, toolArgs.kernelcachePath,
+                                  nextArchInfo, toolArgs.decompressedPath, ki)) {
             goto finish;
         }
-
-        if (!ki->textSegment) {
-            OSKextLog(/* kext */ NULL,
-                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                      "Can't find text segment.");
+        prelinkInfoPlist = copyPrelinkInfoPlist(&toolArgs, ki);
+        if (!prelinkInfoPlist) {
             goto finish;
         }
 
-        if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
-            ki->prelinkInfoBytes = ((char *)ki->kcImagePtr) +
-            ((struct section_64 *)ki->prelinkInfoSect)->offset;
-            ki->prelinkTextBytes = ((char *)ki->kcImagePtr) +
-            ((struct section_64 *)ki->prelinkTextSect)->offset;
-            ki->prelinkTextSourceAddress = ((struct section_64 *)ki->prelinkTextSect)->addr;
-            ki->prelinkTextSourceSize = ((struct section_64 *)ki->prelinkTextSect)->size;
-            if (ki->builtinInfoSect) {
-                ki->builtinInfoBytes = ((char *)ki->kcImagePtr) +
-                                        ((struct section_64 *)ki->builtinInfoSect)->offset;
-                ki->builtinInfoSize = ((struct section_64 *)ki->builtinInfoSect)->size;
-            }
-            if (ki->builtinStartSect) {
-                ki->builtinStartBytes = ((char *)ki->kcImagePtr) +
-                                        ((struct section_64 *)ki->builtinStartSect)->offset;
-                ki->builtinStartSize = ((struct section_64 *)ki->builtinStartSect)->size;
-            }
-            // These conditions are what the linker uses to determine that this was the first
-            // segment in the file, ie, where the mach_header is offset from.
-            if (((struct segment_command_64 *)ki->textSegment)->fileoff != 0) {
-                OSKextLog(/* kext */ NULL,
-                          kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                          "Text segment should be first");
-                goto finish;
-            }
-            if (((struct segment_command_64 *)ki->textSegment)->filesize == 0) {
-                OSKextLog(/* kext */ NULL,
-                          kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                          "Text segment should have a file size");
-                goto finish;
-            }
-            ki->baseAddress = ((struct segment_command_64 *)ki->textSegment)->vmaddr;
-        } else {
-            ki->prelinkInfoBytes = ((char *)ki->kcImagePtr) +
-            ((struct section *)ki->prelinkInfoSect)->offset;
-            ki->prelinkTextBytes = ((char *)ki->kcImagePtr) +
-            ((struct section *)ki->prelinkTextSect)->offset;
-            ki->prelinkTextSourceAddress = ((struct section *)ki->prelinkTextSect)->addr;
-            ki->prelinkTextSourceSize = ((struct section *)ki->prelinkTextSect)->size;
-            if (ki->builtinInfoSect) {
-                ki->builtinInfoBytes = ((char *)ki->kcImagePtr) +
-                                        ((struct section *)ki->builtinInfoSect)->offset;
-                ki->builtinInfoSize = ((struct section *)ki->builtinInfoSect)->size;
-            }
-            if (ki->builtinStartSect) {
-                ki->builtinStartBytes = ((char *)ki->kcImagePtr) +
-                                        ((struct section *)ki->builtinStartSect)->offset;
-                ki->builtinStartSize = ((struct section *)ki->builtinStartSect)->size;
-            }
-            // These conditions are what the linker uses to determine that this was the first
-            // segment in the file, ie, where the mach_header is offset from.
-            if (((struct segment_command *)ki->textSegment)->fileoff != 0) {
-                OSKextLog(/* kext */ NULL,
-                          kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                          "Text segment should be first");
+        if (toolArgs.diffPath) {
+            if (!openKernelcacheSlice(&toolArgs, toolArgs.diffPath,
+                                      nextArchInfo, /* decompressedPath */ NULL, baseKi)) {
                 goto finish;
             }
-            if (((struct segment_command *)ki->textSegment)->filesize == 0) {
-                OSKextLog(/* kext */ NULL,
-                          kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                          "Text segment should have a file size");
+            basePrelinkInfoPlist = copyPrelinkInfoPlist(&toolArgs, baseKi);
+            if (!basePrelinkInfoPlist) {
                 goto finish;
             }
-            ki->baseAddress = ((struct segment_command *)ki->textSegment)->vmaddr;
-        }
-
-        prelinkInfoPlist = (CFPropertyListRef)
-        IOCFUnserialize(ki->prelinkInfoBytes,
-                        kCFAllocatorDefault, /* options */ 0,
-                        /* errorString */ NULL);
-        if (!prelinkInfoPlist) {
-            OSKextLog(/* kext */ NULL,
-                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                      "Can't unserialize prelink info.");
-            goto finish;
         }
 
         struct kcmap *kcmap = NULL;
-        createKCMap(ki->kcImagePtr, toolArgs.verbose, &kcmap);
-
-        if (toolArgs.printMap) {
+        struct kcmap *baseKcmap = NULL;
+        createKCMap(ki, toolArgs.verbose, &kcmap);
+
+        if (toolArgs.diffPath) {
+            createKCMap(baseKi, toolArgs.verbose, &baseKcmap);
+            diffPrelinkedKexts(&toolArgs, baseKi, baseKcmap, basePrelinkInfoPlist,
+                               ki, kcmap, prelinkInfoPlist, nextArchInfo);
+        } else if (toolArgs.printMap) {
             printKernelCacheLayoutMap(&toolArgs, ki, kcmap, prelinkInfoPlist);
         } else if (toolArgs.printJSON) {
             printJSON(&toolArgs, ki, kcmap, prelinkInfoPlist);
@@ -402,6 +308,8 @@ int main(int argc, char * const argv[])
 
         if (kcmap)
             free(kcmap);
+        if (baseKcmap)
+            free(baseKcmap);
 
         // process next arch or done if user specified an architecture,
         // fat_arch will be NULL if user passed in an arch via "-arch XXX"
@@ -423,8 +331,9 @@ int main(int argc, char * const argv[])
 finish:
 
     SAFE_RELEASE(prelinkInfoPlist);
-    SAFE_RELEASE(kernelcacheImage);
-    SAFE_RELEASE(rawKernelcache);
+    SAFE_RELEASE(basePrelinkInfoPlist);
+    closeKernelcacheSlice(ki);
+    closeKernelcacheSlice(baseKi);
 
     if (fat_header) {
         unmapFatHeaderPage(fat_header);
@@ -440,35 +349,427 @@ finish:
 }
 
 /*******************************************************************************
- *******************************************************************************/
-uint64_t getRebasedPointerValue(uint64_t rawValue, struct ImageInfo * ki)
+* Reads the slice of the kernelcache at kernelcachePath for archInfo (the only
+* slice if NULL) into ki and finds its prelink sections. ki owns what it reads
+* until closeKernelcacheSlice(). The slice is uncompressed into
+* decompressedPath if that is given.
+*******************************************************************************/
+static Boolean openKernelcacheSlice(
+    KclistArgs       * toolArgs,
+    const char       * kernelcachePath,
+    const NXArchInfo * archInfo,
+    const char       * decompressedPath,
+    struct ImageInfo * ki)
 {
-    if (!ki->hasThreadedRebase)
-        return rawValue;
-    bool isRebase = (rawValue & (1ULL << 62)) == 0;
-    if (!isRebase) {
-        fprintf(stderr, "value should be a rebase 0x016%llx\n", rawValue);
-        exit(1);
+    Boolean result = false;
+
+    bzero(ki, sizeof(*ki));
+
+    ki->kcRawData = readMachOSliceForArch(kernelcachePath,
+                                          archInfo,
+                                          /* checkArch */ FALSE);
+    if (!ki->kcRawData) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't read arch %s from %s.",
+                  archInfo ? archInfo->name : "NONE",
+                  kernelcachePath);
+        goto finish;
+    }
+
+    if (MAGIC32(CFDataGetBytePtr(ki->kcRawData)) == OSSwapHostToBigInt32('comp')) {
+        if (decompressedPath) {
+            char slicePath[PATH_MAX];
+
+            if (!toolArgs->archInfo && archInfo) {
+                snprintf(slicePath, sizeof(slicePath), "%s.%s",
+                         decompressedPath, archInfo->name);
+            } else {
+                strlcpy(slicePath, decompressedPath, sizeof(slicePath));
+            }
+            ki->kcImageData = uncompressPrelinkedSliceToFile(ki->kcRawData,
+                                                             slicePath);
+        } else {
+            /* Only the ranges we look at get uncompressed. */
+            ki->kcReader = prelinkedSliceReaderCreate(ki->kcRawData);
+        }
+        if (!ki->kcImageData && !ki->kcReader) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                      "Can't uncompress kernelcache slice.");
+            goto finish;
+        }
+    } else {
+        ki->kcImageData = CFRetain(ki->kcRawData);
+    }
+
+    if (ki->kcReader) {
+        ki->kcImagePtr  = prelinkedSliceReaderGetImage(ki->kcReader);
+        ki->kcImageSize = prelinkedSliceReaderGetSize(ki->kcReader);
+    } else {
+        ki->kcImagePtr  = CFDataGetBytePtr(ki->kcImageData);
+        ki->kcImageSize = CFDataGetLength(ki->kcImageData);
+    }
+
+    /* The layout map, JSON, extraction and diffs walk the whole image. */
+    if (ki->kcReader &&
+        (toolArgs->printMap || toolArgs->printJSON ||
+         toolArgs->extractedKextPath || toolArgs->diffPath) &&
+        !getKCBytes(ki, 0, ki->kcImageSize)) {
+        goto finish;
+    }
+    if (!getKCMachHeader(ki, 0)) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't read kernelcache Mach-O header.");
+        goto finish;
+    }
+    ki->kcView = machoViewCreate(ki->kcImagePtr, ki->kcImageSize);
+    if (!ki->kcView) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Kernelcache Mach-O load commands are malformed.");
+        goto finish;
+    }
+
+    if (toolArgs->printMachO)
+        printMachOHeader(toolArgs, ki->kcImagePtr, ki->kcImageSize, "kernelcache", "");
+
+    if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
+        ki->machoBits = 64;
+        ki->prelinkInfoSect = (void *)
+        macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
+                                     kPrelinkInfoSegment,
+                                     kPrelinkInfoSection);
+        ki->prelinkTextSect = (void *)
+        macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
+                                     kPrelinkTextSegment,
+                                     kPrelinkTextSection);
+        ki->builtinInfoSect = (void *)
+        macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
+                                     kPrelinkInfoSegment,
+                                     kBuiltinInfoSection);
+        ki->builtinStartSect = (void *)
+        macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
+                                     kPrelinkInfoSegment,
+                                     kBuiltinStartSection);
+        ki->textSegment = (void *)
+        macho_get_segment_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
+                                     "__TEXT");
+        struct section_64 * sect;
+        sect = macho_get_section_by_name_64((struct mach_header_64 *)ki->kcImagePtr,
+                                     "__TEXT",
+                                     "__thread_starts");
+        ki->hasThreadedRebase = (sect && sect->size);
+
+    } else {
+        ki->machoBits = 32;
+        ki->prelinkInfoSect = (void *)
+        macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
+                                  kPrelinkInfoSegment,
+                                  kPrelinkInfoSection);
+        ki->prelinkTextSect = (void *)
+        macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
+                                  kPrelinkTextSegment,
+                                  kPrelinkTextSection);
+        ki->builtinInfoSect = (void *)
+        macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
+                                     kPrelinkInfoSegment,
+                                     kBuiltinInfoSection);
+        ki->builtinStartSect = (void *)
+        macho_get_section_by_name((struct mach_header *)ki->kcImagePtr,
+                                     kPrelinkInfoSegment,
+                                     kBuiltinStartSection);
+        ki->textSegment = (void *)
+        macho_get_segment_by_name((struct mach_header *)ki->kcImagePtr,
+                                  "__TEXT");
+        ki->hasThreadedRebase = false;
+    }
+
+    if (!ki->prelinkInfoSect) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't find prelink info section.");
+        goto finish;
+    }
+
+    if (!ki->prelinkTextSect) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't find prelink text section.");
+        goto finish;
+    }
+
+    if (!ki->textSegment) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't find text segment.");
+        goto finish;
     }
-    bool isAuthenticated = (rawValue & (1ULL << 63)) != 0;
-    if (isAuthenticated) {
-        // The new value for a rebase is the low 32-bits of the threaded value plus the slide.
-        // Note there is no slide here as we are offline.
-        uint64_t newValue = (rawValue & 0xFFFFFFFF);
-        // Add in the offset from the mach_header
-        newValue += ki->baseAddress;
-        return (newValue);
+
+    if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
+        ki->prelinkInfoBytes = getKCBytes(ki,
+        ((struct section_64 *)ki->prelinkInfoSect)->offset,
+        ((struct section_64 *)ki->prelinkInfoSect)->size);
+        ki->prelinkInfoSize = ((struct section_64 *)ki->prelinkInfoSect)->size;
+        ki->prelinkTextBytes = ((char *)ki->kcImagePtr) +
+        ((struct section_64 *)ki->prelinkTextSect)->offset;
+        ki->prelinkTextSourceAddress = ((struct section_64 *)ki->prelinkTextSect)->addr;
+        ki->prelinkTextSourceSize = ((struct section_64 *)ki->prelinkTextSect)->size;
+        if (ki->builtinInfoSect) {
+            ki->builtinInfoBytes = getKCBytes(ki,
+                                    ((struct section_64 *)ki->builtinInfoSect)->offset,
+                                    ((struct section_64 *)ki->builtinInfoSect)->size);
+            ki->builtinInfoSize = ((struct section_64 *)ki->builtinInfoSect)->size;
+        }
+        if (ki->builtinStartSect) {
+            ki->builtinStartBytes = getKCBytes(ki,
+                                    ((struct section_64 *)ki->builtinStartSect)->offset,
+                                    ((struct section_64 *)ki->builtinStartSect)->size);
+            ki->builtinStartSize = ((struct section_64 *)ki->builtinStartSect)->size;
+        }
+        // These conditions are what the linker uses to determine that this was the first
+        // segment in the file, ie, where the mach_header is offset from.
+        if (((struct segment_command_64 *)ki->textSegment)->fileoff != 0) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                      "Text segment should be first");
+            goto finish;
+        }
+        if (((struct segment_command_64 *)ki->textSegment)->filesize == 0) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                      "Text segment should have a file size");
+            goto finish;
+        }
+        ki->baseAddress = ((struct segment_command_64 *)ki->textSegment)->vmaddr;
     } else {
+        ki->prelinkInfoBytes = getKCBytes(ki,
+        ((struct section *)ki->prelinkInfoSect)->offset,
+        ((struct section *)ki->prelinkInfoSect)->size);
+        ki->prelinkInfoSize = ((struct section *)ki->prelinkInfoSect)->size;
+        ki->prelinkTextBytes = ((char *)ki->kcImagePtr) +
+        ((struct section *)ki->prelinkTextSect)->offset;
+        ki->prelinkTextSourceAddress = ((struct section *)ki->prelinkTextSect)->addr;
+        ki->prelinkTextSourceSize = ((struct section *)ki->prelinkTextSect)->size;
+        if (ki->builtinInfoSect) {
+            ki->builtinInfoBytes = getKCBytes(ki,
+                                    ((struct section *)ki->builtinInfoSect)->offset,
+                                    ((struct section *)ki->builtinInfoSect)->size);
+            ki->builtinInfoSize = ((struct section *)ki->builtinInfoSect)->size;
+        }
+        if (ki->builtinStartSect) {
+            ki->builtinStartBytes = getKCBytes(ki,
+                                    ((struct section *)ki->builtinStartSect)->offset,
+                                    ((struct section *)ki->builtinStartSect)->size);
+            ki->builtinStartSize = ((struct section *)ki->builtinStartSect)->size;
+        }
+        // These conditions are what the linker uses to determine that this was the first
+        // segment in the file, ie, where the mach_header is offset from.
+        if (((struct segment_command *)ki->textSegment)->fileoff != 0) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                      "Text segment should be first");
+            goto finish;
+        }
+        if (((struct segment_command *)ki->textSegment)->filesize == 0) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                      "Text segment should have a file size");
+            goto finish;
+        }
+        ki->baseAddress = ((struct segment_command *)ki->textSegment)->vmaddr;
+    }
+
+    if (!ki->prelinkInfoBytes ||
+        (ki->builtinInfoSect && !ki->builtinInfoBytes) ||
+        (ki->builtinStartSect && !ki->builtinStartBytes)) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't read prelink info sections.");
+        goto finish;
+    }
+    if (64 == ki->machoBits && ki->builtinInfoBytes && ki->builtinStartBytes) {
+        ki->builtinInfoAddrs = copyRebasedPointerArray(ki,
+                                    ki->builtinInfoBytes, ki->builtinInfoSize);
+        ki->builtinStartAddrs = copyRebasedPointerArray(ki,
+                                    ki->builtinStartBytes, ki->builtinStartSize);
+    }
+
+    result = true;
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static void closeKernelcacheSlice(struct ImageInfo * ki)
+{
+    SAFE_RELEASE(ki->kcRawData);
+    SAFE_RELEASE(ki->kcImageData);
+    prelinkedSliceReaderFree(ki->kcReader);
+    machoViewFree(ki->kcView);
+    SAFE_FREE(ki->builtinInfoAddrs);
+    SAFE_FREE(ki->builtinStartAddrs);
+    bzero(ki, sizeof(*ki));
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static CFPropertyListRef copyPrelinkInfoPlist(KclistArgs *toolArgs, struct ImageInfo *ki)
+{
+    CFPropertyListRef result = NULL;
+
+   /* Listing kexts needs only a handful of their properties, so take
+    * them from the prelink index if kcgen/kextcache wrote a current one,
+    * or else pull them out of the XML rather than unserializing every
+    * kext's dictionary.
+    */
+    if (!toolArgs->printMap && !toolArgs->printJSON &&
+        !toolArgs->printPrelinkInfoDict && !toolArgs->diffPath) {
+
+        result = copyPrelinkInfoForKexts(toolArgs, ki);
+    }
+    if (!result) {
+        result = (CFPropertyListRef)
+        IOCFUnserialize(ki->prelinkInfoBytes,
+                        kCFAllocatorDefault, /* options */ 0,
+                        /* errorString */ NULL);
+    }
+    if (!result) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't unserialize prelink info.");
+    }
+    return result;
+}
+
+/*******************************************************************************
+ *******************************************************************************/
+/* Decodes count threaded-rebase values into values, which may be rawValues.
+ * Both pointer formats are computed for every value and the right one picked
+ * by mask, so there are no branches in the loop and it vectorizes. Returns
+ * false, leaving values undefined, if any value is a bind rather than a rebase.
+ */
+static bool rebasePointerValues(
+    struct ImageInfo * ki,
+    uint32_t           count,
+    const uint64_t   * rawValues,
+    uint64_t         * values)
+{
+    uint64_t binds = 0;
+    uint32_t i;
+
+    if (!ki->hasThreadedRebase) {
+        if (values != rawValues) {
+            memcpy(values, rawValues, count * sizeof(*values));
+        }
+        return true;
+    }
+    for (i = 0; i < count; i++) {
+        uint64_t rawValue = rawValues[i];
+
+        // All ones if the pointer is authenticated.
+        uint64_t authMask = 0 - (rawValue >> 63);
+
+        // The new value for an authenticated rebase is the low 32-bits of the
+        // threaded value plus the slide. Note there is no slide here as we are
+        // offline. Add in the offset from the mach_header.
+        uint64_t authValue = (rawValue & 0xFFFFFFFF) + ki->baseAddress;
+
         // Regular pointer which needs to fit in 51-bits of value.
         // C++ RTTI uses the top bit, so we'll allow the whole top-byte
         // and the bottom 43-bits to be fit in to 51-bits.
         uint64_t top8Bits = rawValue & 0x0007F80000000000ULL;
         uint64_t bottom43Bits = rawValue & 0x000007FFFFFFFFFFULL;
-        uint64_t targetValue = ( top8Bits << 13 ) | (((intptr_t)(bottom43Bits << 21) >> 21) & 0x00FFFFFFFFFFFFFF);
-        return targetValue;
+        uint64_t plainValue = ( top8Bits << 13 ) | (((int64_t)(bottom43Bits << 21) >> 21) & 0x00FFFFFFFFFFFFFF);
+
+        binds |= rawValue & (1ULL << 62);
+        values[i] = (authValue & authMask) | (plainValue & ~authMask);
+    }
+    return (binds == 0);
+}
+
+/*******************************************************************************
+ *******************************************************************************/
+uint64_t getRebasedPointerValue(uint64_t rawValue, struct ImageInfo * ki)
+{
+    uint64_t value;
+
+    if (!rebasePointerValues(ki, 1, &rawValue, &value)) {
+        fprintf(stderr, "value should be a rebase 0x016%llx\n", rawValue);
+        exit(1);
     }
+    return value;
 };
 
+/*******************************************************************************
+ * Rebases every pointer of a 64-bit __kmod_info or __kmod_start section in one
+ * pass, so LocateBuiltinModule() can index the decoded array.
+ *******************************************************************************/
+static uint64_t * copyRebasedPointerArray(
+    struct ImageInfo * ki,
+    const char       * bytes,
+    uint64_t           size)
+{
+    uint64_t * result = NULL;  // must free
+    uint32_t   count  = (uint32_t)(size / sizeof(*result));
+
+    if (!bytes || !count || count != size / sizeof(*result)) {
+        goto finish;
+    }
+    result = malloc(count * sizeof(*result));
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    memcpy(result, bytes, count * sizeof(*result));
+    if (!rebasePointerValues(ki, count, result, result)) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Builtin kext table holds a bind, not a rebase.");
+        SAFE_FREE_NULL(result);
+    }
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+ * Returns the rebased address of each of a kext's segments, in load command
+ * order, for the layout map, decoded in one batch rather than by calling
+ * getRebasedPointerValue() per segment.
+ *******************************************************************************/
+static uint64_t * copyRebasedSegmentAddresses(
+    struct ImageInfo * ki,
+    MachOViewRef       view)
+{
+    uint64_t * result = NULL;  // must free
+    uint32_t   count  = machoViewGetSegmentCount(view);
+    uint32_t   seg_i;
+
+    result = malloc((count + 1) * sizeof(*result));
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    for (seg_i = 0; seg_i < count; seg_i++) {
+        result[seg_i] = machoViewGetSegment(view, seg_i)->vmaddr;
+    }
+    if (machoViewIs64Bit(view) &&
+        !rebasePointerValues(ki, count, result, result)) {
+
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Kext segment address is a bind, not a rebase.");
+        SAFE_FREE_NULL(result);
+    }
+
+finish:
+    return result;
+}
+
 /*******************************************************************************
 *******************************************************************************/
 ExitStatus readArgs(
@@ -548,6 +849,14 @@ ExitStatus readArgs(
                 toolArgs->outputPath = optarg;
                 break;
 
+            case kOptDecompressed:
+                toolArgs->decompressedPath = optarg;
+                break;
+
+            case kOptDiff:
+                toolArgs->diffPath = optarg;
+                break;
+
             default:
                 OSKextLog(/* kext */ NULL,
                     kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -577,6 +886,18 @@ ExitStatus readArgs(
             break;
         }
 
+        if (toolArgs->diffPath &&
+            (toolArgs->printMap || toolArgs->printJSON ||
+             toolArgs->printPrelinkInfoDict || toolArgs->extractedKextPath)) {
+            OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                "cannot compare kernelcaches and print or extract kexts simultaneously "
+                "(-%c is mutually exclusive with -%c, -%c, -%c and -%c)", kOptDiff,
+                kOptLayoutMap, kOptJSON, kOptPrelinkInfoDict, kOptSaveKext);
+            goto finish;
+            break;
+        }
+
        /* Reset longindex, because getopt_long_only() is stupid and doesn't.
         */
         longindex = -1;
@@ -601,14 +922,6 @@ ExitStatus readArgs(
         }
     }
 
-    if (toolArgs->extractedKextPath != NULL && CFSetGetCount(toolArgs->kextIDs) <= 0) {
-        OSKextLog(/* kext */ NULL,
-                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                  "when extracting kexts (-%c), specific bundle IDs must be specified", kOptSaveKext);
-        result = EX_USAGE;
-        goto finish;
-    }
-
    /* Update the argc & argv seen by main() so that boot<>root calls
     * handle remaining args.
     */
@@ -715,6 +1028,52 @@ finish:
     return;
 }
 
+/*******************************************************************************
+* Builds a prelink info dictionary holding only the kexts to list, with only
+* the properties printKextInfo() reads. Returns NULL if there is no current
+* prelink index and either no kexts were named or the XML can't be indexed,
+* in which case the caller unserializes all of it.
+*******************************************************************************/
+static CFDictionaryRef copyPrelinkInfoForKexts(KclistArgs *toolArgs, struct ImageInfo *ki)
+{
+    CFDictionaryRef result = NULL;
+    PrelinkIndexRef prelinkIndex = NULL;  // must prelinkIndexClose()
+    PrelinkInfoRef  prelinkInfo = NULL;  // must prelinkInfoFree()
+    CFStringRef     keys[] = {
+        kCFBundleIdentifierKey,
+        kCFBundleVersionKey,
+        CFSTR("_PrelinkBundlePath"),
+        CFSTR(kPrelinkExecutableLoadKey),
+        CFSTR(kPrelinkExecutableSourceKey),
+        CFSTR(kPrelinkExecutableSizeKey),
+        CFSTR(kPrelinkKmodInfoKey),
+        CFSTR("ModuleIndex"),
+    };
+
+    prelinkIndex = prelinkIndexOpen(toolArgs->kernelcachePath,
+                                    machoViewGetUUID(ki->kcView),
+                                    ki->prelinkInfoBytes, (size_t)ki->prelinkInfoSize);
+    if (prelinkIndex) {
+        result = prelinkIndexCopyInfoForKexts(prelinkIndex, toolArgs->kextIDs);
+        goto finish;
+    }
+
+    if (!CFSetGetCount(toolArgs->kextIDs)) {
+        goto finish;
+    }
+    prelinkInfo = prelinkInfoCreate(ki->prelinkInfoBytes, (size_t)ki->prelinkInfoSize);
+    if (!prelinkInfo) {
+        goto finish;
+    }
+    result = prelinkInfoCopyInfoForKexts(prelinkInfo, toolArgs->kextIDs,
+                                         keys, sizeof(keys) / sizeof(keys[0]));
+
+finish:
+    prelinkIndexClose(prelinkIndex);
+    prelinkInfoFree(prelinkInfo);
+    return result;
+}
+
 /*******************************************************************************
 *******************************************************************************/
 void listPrelinkedKexts(KclistArgs * toolArgs,
@@ -744,7 +1103,15 @@ void listPrelinkedKexts(KclistArgs * toolArgs,
     }
 
     count = CFArrayGetCount(kextPlistArray);
-    for (i = 0; i < count; i++) {
+
+    /* Verbose extraction traces each load command, so keep that serial. */
+    if (toolArgs->extractedKextPath && !toolArgs->verbose) {
+        ki->extractJobs = calloc(count + 1, sizeof(*ki->extractJobs));
+        ki->extractJobCapacity = count;
+        ki->extractJobCount = 0;
+    }
+
+    for (i = 0; i < count; i++) {
         CFDictionaryRef kextPlist = (CFDictionaryRef)CFArrayGetValueAtIndex(kextPlistArray, i);
         CFStringRef kextIdentifier = (CFStringRef)CFDictionaryGetValue(kextPlist, kCFBundleIdentifierKey);
         if (haveIDs && !CFSetContainsValue(toolArgs->kextIDs, kextIdentifier)) {
@@ -754,6 +1121,12 @@ void listPrelinkedKexts(KclistArgs * toolArgs,
         printed++;
     }
 
+    if (ki->extractJobs) {
+        extractQueuedKexts(toolArgs, ki, kcmap);
+        SAFE_FREE_NULL(ki->extractJobs);
+        ki->extractJobCount = ki->extractJobCapacity = 0;
+    }
+
     if (haveIDs && printed != CFSetGetCount(toolArgs->kextIDs)) {
         OSKextLog(NULL,
                   kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -771,13 +1144,15 @@ finish:
  * Extract a 64-bit (possibly split) kext from the kernel cache
  *
  */
-static void extractKext(struct ImageInfo * ki,
-                        struct kcmap *kcmap,
-                        const char *kextName,
-                        uint64_t kextSourceAddress, uint64_t kextLoadAddress,
-                        void *mh, Boolean is64Bit,
-                        KclistArgs *toolArgs, Boolean isSplitKext)
+static ExitStatus extractKext(struct ImageInfo * ki,
+                              struct kcmap *kcmap,
+                              const char *kextName,
+                              uint64_t kextSourceAddress, uint64_t kextLoadAddress,
+                              void *mh, Boolean is64Bit,
+                              KclistArgs *toolArgs, Boolean isSplitKext,
+                              Boolean quiet)
 {
+    ExitStatus  result = EX_OSERR;
     int         fd = -1;
     mode_t      mode = 0644;
     char        tmpPath[PATH_MAX];
@@ -788,6 +1163,10 @@ static void extractKext(struct ImageInfo * ki,
     struct mach_header    *mhp32 = (struct mach_header *)mh;
     struct load_command *lcp;
     uint32_t ncmds = 0;
+    uint64_t *seg_vaddrs = NULL;  // must free
+    off_t    *seg_kcfileoffs = NULL;  // must free
+    struct iovec *seg_iov = NULL;  // must free
+    int       seg_iovcnt = 0;
     Boolean beVerbose = toolArgs->verbose;
 
     if (is64Bit) {
@@ -807,7 +1186,8 @@ static void extractKext(struct ImageInfo * ki,
     size_t copied = strlcpy(tmpPath, toolArgs->extractedKextPath, PATH_MAX);
     strlcat(tmpPath, kextName, PATH_MAX - copied);
 
-    printf("extracting%s%skext to: '%s'\n", is64Bit ? " 64bit" : " 32bit", isSplitKext ? " split " : " ", tmpPath);
+    if (!quiet)
+        printf("extracting%s%skext to: '%s'\n", is64Bit ? " 64bit" : " 32bit", isSplitKext ? " split " : " ", tmpPath);
 
     fd = open(tmpPath, O_WRONLY|O_CREAT|O_TRUNC, mode);
     if (fd == -1) {
@@ -822,6 +1202,44 @@ static void extractKext(struct ImageInfo * ki,
     off_t linkedit_ofst_kc  = 0;
     struct load_command *dysymtab_lc = NULL, *symtab_lc = NULL;
 
+    /* translate all segment addresses to KC file offsets in one batch */
+    seg_vaddrs = calloc(ncmds + 1, sizeof(*seg_vaddrs));
+    seg_kcfileoffs = calloc(ncmds + 1, sizeof(*seg_kcfileoffs));
+    seg_iov = calloc(ncmds + 1, sizeof(*seg_iov));
+    if (!seg_vaddrs || !seg_kcfileoffs || !seg_iov) {
+        OSKextLogMemError();
+        close(fd);
+        goto finish;
+    }
+    for (uint32_t cmd_i = 0; cmd_i < ncmds; cmd_i++) {
+        if (lcp->cmd == LC_SEGMENT_64) {
+            seg_vaddrs[cmd_i] = ((struct segment_command_64 *)lcp)->vmaddr;
+        } else if (lcp->cmd == LC_SEGMENT) {
+            seg_vaddrs[cmd_i] = ((struct segment_command *)lcp)->vmaddr;
+        }
+        lcp = (struct load_command *)((uintptr_t)lcp + lcp->cmdsize);
+    }
+    if (is64Bit && !rebasePointerValues(ki, ncmds, seg_vaddrs, seg_vaddrs)) {
+        printf("[ERROR] segment address of %s is not a rebase\n", kextName);
+        close(fd);
+        goto finish;
+    }
+    lcp = is64Bit ? (struct load_command *)(void *)(kextMH64 + 1) :
+                    (struct load_command *)(void *)(kextMH32 + 1);
+    for (uint32_t cmd_i = 0; cmd_i < ncmds; cmd_i++) {
+        if (lcp->cmd == LC_SEGMENT_64 || lcp->cmd == LC_SEGMENT) {
+            seg_vaddrs[cmd_i] = seg_vaddrs[cmd_i] - kextLoadAddress + kextSourceAddress;
+        }
+        lcp = (struct load_command *)((uintptr_t)lcp + lcp->cmdsize);
+    }
+    getKCFileOffsets(kcmap, ncmds, seg_vaddrs, seg_kcfileoffs);
+
+    if (is64Bit) {
+        lcp = (struct load_command *)(void *)(kextMH64 + 1);
+    } else {
+        lcp = (struct load_command *)(void *)(kextMH32 + 1);
+    }
+
     if (beVerbose)
         printf("\tPass 1/2 (%d load commands)\n", ncmds);
     for (uint32_t cmd_i = 0; cmd_i < ncmds; cmd_i++) {
@@ -833,11 +1251,10 @@ static void extractKext(struct ImageInfo * ki,
             if (!seg_cmd64->filesize) {
                 seg_cmd64->fileoff = 0;
             } else {
-                ssize_t wsize;
                 off_t kcfileoff;
 
                 /* calculate the KC file offset */
-                kcfileoff = getKCFileOffset(kcmap, getRebasedPointerValue(seg_cmd64->vmaddr, ki) - kextLoadAddress + kextSourceAddress);
+                kcfileoff = seg_kcfileoffs[cmd_i];
                 if (beVerbose) {
                     printf("\tcmd[%d]:%16s @0x%qx + %lld (%lld) [%lld bytes] -> %lld\n",
                            cmd_i, seg_cmd64->segname[0] ? seg_cmd64->segname : "none",
@@ -849,17 +1266,19 @@ static void extractKext(struct ImageInfo * ki,
                     break;
                 }
 
-                /* write out the segment to disk */
-                wsize = pwrite(fd, ki->kcImagePtr + kcfileoff, (size_t)(seg_cmd64->filesize), fileoff);
-                if (wsize < (ssize_t)(seg_cmd64->filesize)) {
+                /* queue the segment; they are all written out in one go below */
+                if ((uint64_t)kcfileoff + seg_cmd64->filesize > (uint64_t)ki->kcImageSize) {
                     OSKextLog(/* kext */ NULL,
                               kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                              "[ERROR] unable to write cmd[%d]:%16s (fileoff:%lld = %p) to ofst:%lld in %s: %d (errno=%d)",
+                              "[ERROR] cmd[%d]:%16s (fileoff:%lld, %lld bytes) lies outside the kernelcache",
                               cmd_i, seg_cmd64->segname[0] ? seg_cmd64->segname : "none",
-                              (uint64_t)kcfileoff, ki->kcImagePtr + kcfileoff, fileoff, tmpPath, (int)wsize, errno);
-                    my_err = EX_OSERR;
+                              (uint64_t)kcfileoff, (uint64_t)seg_cmd64->filesize);
+                    my_err = EX_DATAERR;
                     break;
                 }
+                seg_iov[seg_iovcnt].iov_base = (void *)(ki->kcImagePtr + kcfileoff);
+                seg_iov[seg_iovcnt].iov_len = (size_t)(seg_cmd64->filesize);
+                seg_iovcnt++;
 
                 /* reset the segment+section file offsets to the new output file */
                 struct section_64 *sect = (struct section_64 *)(&seg_cmd64[1]);
@@ -879,11 +1298,10 @@ static void extractKext(struct ImageInfo * ki,
             if (!seg_cmd32->filesize) {
                 seg_cmd32->fileoff = 0;
             } else {
-                ssize_t wsize;
                 off_t kcfileoff;
 
                 /* calculate the KC file offset */
-                kcfileoff = getKCFileOffset(kcmap, ((uint64_t)seg_cmd32->vmaddr) - kextLoadAddress + kextSourceAddress);
+                kcfileoff = seg_kcfileoffs[cmd_i];
                 if (beVerbose) {
                     printf("\tcmd[%d]:%16s @0x%x + %lld (%lld) [%lld bytes] -> %lld\n",
                            cmd_i, seg_cmd32->segname[0] ? seg_cmd32->segname : "none",
@@ -895,17 +1313,19 @@ static void extractKext(struct ImageInfo * ki,
                     break;
                 }
 
-                /* write out the segment to disk */
-                wsize = pwrite(fd, ki->kcImagePtr + kcfileoff, (size_t)(seg_cmd32->filesize), fileoff);
-                if (wsize < (ssize_t)(seg_cmd32->filesize)) {
+                /* queue the segment; they are all written out in one go below */
+                if ((uint64_t)kcfileoff + seg_cmd32->filesize > (uint64_t)ki->kcImageSize) {
                     OSKextLog(/* kext */ NULL,
                               kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
-                              "[ERROR] unable to write cmd[%d]:%16s (fileoff:%lld = %p) to ofst:%lld in %s: %d (errno=%d)",
+                              "[ERROR] cmd[%d]:%16s (fileoff:%lld, %lld bytes) lies outside the kernelcache",
                               cmd_i, seg_cmd32->segname[0] ? seg_cmd32->segname : "none",
-                              (uint64_t)kcfileoff, ki->kcImagePtr + kcfileoff, fileoff, tmpPath, (int)wsize, errno);
-                    my_err = EX_OSERR;
+                              (uint64_t)kcfileoff, (uint64_t)seg_cmd32->filesize);
+                    my_err = EX_DATAERR;
                     break;
                 }
+                seg_iov[seg_iovcnt].iov_base = (void *)(ki->kcImagePtr + kcfileoff);
+                seg_iov[seg_iovcnt].iov_len = (size_t)(seg_cmd32->filesize);
+                seg_iovcnt++;
 
                 /* reset the segment+section file offsets to the new output file */
                 struct section_64 *sect = (struct section_64 *)(&seg_cmd32[1]);
@@ -1042,6 +1462,17 @@ static void extractKext(struct ImageInfo * ki,
         }
     }
 
+    /* write out the segments back to back from offset 0 */
+    if (my_err == EX_OK) {
+        my_err = writeKextSegments(fd, seg_iov, seg_iovcnt);
+        if (my_err != EX_OK) {
+            OSKextLog(NULL,
+                      kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                      "[ERROR] unable to write %d segments to %s (errno=%d)",
+                      seg_iovcnt, tmpPath, errno);
+        }
+    }
+
     /* re-write the header with updated file offsets */
     if (my_err == EX_OK) {
         ssize_t wsize;
@@ -1063,12 +1494,99 @@ static void extractKext(struct ImageInfo * ki,
         printf("\t-> created file '%s'\n", tmpPath);
     }
     close(fd);
+    result = my_err;
 
 finish:
     if (kextMH64)
         free(kextMH64);
     if (kextMH32)
         free(kextMH32);
+    if (seg_vaddrs)
+        free(seg_vaddrs);
+    if (seg_kcfileoffs)
+        free(seg_kcfileoffs);
+    if (seg_iov)
+        free(seg_iov);
+    return result;
+}
+
+/*
+ * Writes iovcnt buffers back to back at the current file offset,
+ * IOV_MAX at a time and resuming after short writes.
+ */
+static ExitStatus writeKextSegments(int fd, struct iovec *iov, int iovcnt)
+{
+    int first = 0;
+
+    while (first < iovcnt) {
+        ssize_t wsize = writev(fd, &iov[first], MIN(iovcnt - first, IOV_MAX));
+        if (wsize < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wsize <= 0) {
+            return EX_OSERR;
+        }
+        while (first < iovcnt && (size_t)wsize >= iov[first].iov_len) {
+            wsize -= iov[first].iov_len;
+            first++;
+        }
+        if (wsize) {
+            iov[first].iov_base = (char *)iov[first].iov_base + wsize;
+            iov[first].iov_len -= wsize;
+        }
+    }
+    return EX_OK;
+}
+
+/*
+ * Extracts the kexts queued by printKextInfo() on a pool of worker threads,
+ * reporting progress from one shared counter.
+ */
+static void extractQueuedKexts(KclistArgs *toolArgs, struct ImageInfo *ki, struct kcmap *kcmap)
+{
+    CFIndex           jobCount = ki->extractJobCount;
+    struct ExtractJob *jobs = ki->extractJobs;
+    atomic_long       extracted = 0;
+    atomic_long       failed = 0;
+    atomic_long     * extractedPtr = &extracted;
+    atomic_long     * failedPtr = &failed;
+    dispatch_group_t  group = NULL;
+    dispatch_queue_t  queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+    if (!jobCount)
+        return;
+
+    group = dispatch_group_create();
+    if (!group) {
+        OSKextLogMemError();
+        return;
+    }
+
+    printf("extracting %ld kexts to: '%s*'\n", jobCount, toolArgs->extractedKextPath);
+    for (CFIndex i = 0; i < jobCount; i++) {
+        struct ExtractJob *job = &jobs[i];
+        dispatch_group_async(group, queue, ^{
+            if (extractKext(ki, kcmap, job->kextName,
+                            job->kextSourceAddress, job->kextLoadAddress,
+                            (void *)job->mh, job->is64Bit, toolArgs,
+                            job->isSplitKext, /* quiet */ true) != EX_OK) {
+                atomic_fetch_add(failedPtr, 1);
+            }
+            atomic_fetch_add(extractedPtr, 1);
+        });
+    }
+
+    while (dispatch_group_wait(group, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 2))) {
+        printf("\r\textracted %ld of %ld kexts", atomic_load(extractedPtr), jobCount);
+        fflush(stdout);
+    }
+    printf("\r\textracted %ld of %ld kexts", atomic_load(extractedPtr), jobCount);
+    if (atomic_load(failedPtr)) {
+        printf(" (%ld failed)", atomic_load(failedPtr));
+    }
+    printf("\n");
+
+    dispatch_release(group);
 }
 
 #define KCLAYOUTFORMATSTR   "%-12s 0x%-16x 0x%-16x %-38s %s\n"
@@ -1083,10 +1601,7 @@ static void printKernelCacheLayoutMap(KclistArgs *toolArgs,
     CFArrayRef kextPlistArray = NULL;
     CFDataRef  kcID = NULL;
     uint8_t    *kcID_val = NULL;
-    struct mach_header_64 *mhp64 = NULL;
-    struct mach_header *mhp = NULL;
-    struct load_command *lcp;
-    uint32_t ncmds, cmd_i;
+    uint32_t seg_i;
     uuid_string_t uuid_string = {'\0'};
 
     if (CFDictionaryGetTypeID() == CFGetTypeID(kcInfoPlist)){
@@ -1122,172 +1637,66 @@ static void printKernelCacheLayoutMap(KclistArgs *toolArgs,
     /* Print out the map of kernel segments */
 
     /* First look for the kernel UUID */
-    if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
-        mhp64 = (struct mach_header_64 *)ki->kcImagePtr;
-        ncmds = mhp64->ncmds;
-        lcp = (struct load_command *)(void *)(mhp64 + 1);
-    } else {
-        mhp = (struct mach_header *)ki->kcImagePtr;
-        ncmds = mhp->ncmds;
-        lcp = (struct load_command *)(void *)(mhp + 1);
-    }
-
-    for (cmd_i = 0; cmd_i < ncmds; cmd_i++) {
-        if (lcp->cmd == LC_UUID) {
-            uuid_unparse(((struct uuid_command *)lcp)->uuid, uuid_string);
-            break;
-        }
-
-        lcp = (struct load_command *)((uintptr_t)lcp + lcp->cmdsize);
+    if (machoViewGetUUID(ki->kcView)) {
+        uuid_unparse(machoViewGetUUID(ki->kcView), uuid_string);
     }
 
     /*
-     * Next walk the load commands and print out all except __PLK* and __PRELINK* sections
+     * Next walk the segments and print out all except __PLK* and __PRELINK* segments
      * since these are covered by the KEXT map above
      */
-    if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
-        struct mach_header_64 *     kext_header;
-        struct segment_command_64 * seg_cmd;
-        uintptr_t last_cmd;
-
-        kext_header = (struct mach_header_64 *)ki->kcImagePtr;
-        seg_cmd = (struct segment_command_64 *) ((uintptr_t)kext_header + sizeof(*kext_header));
-
-        last_cmd = (uintptr_t)seg_cmd + (kext_header->ncmds * sizeof(*seg_cmd));
-        if (last_cmd > (uintptr_t)ki->kcImagePtr + ki->kcImageSize) {
-            fprintf(stderr, "[macho] ERROR: header points off the end of the image!\n");
-            fprintf(stderr, "[macho] header@%p, sz:%d, ncmds:%d, last_cmd@%p\n",
-                    kext_header, (int)ki->kcImageSize, kext_header->ncmds, (void *)last_cmd);
-            return;
-        }
-
-        for (cmd_i = 0; cmd_i < kext_header->ncmds; cmd_i++) {
-            if (seg_cmd->cmd == LC_SEGMENT_64 && (!seg_cmd->segname[0] || (!strstr(seg_cmd->segname, "__PLK")
-                                                                           && !strstr(seg_cmd->segname, "__PRELINK")))) {
-                printf(KCLAYOUTFORMATSTR64, seg_cmd->segname,
-                       seg_cmd->vmaddr, seg_cmd->vmsize,
-                       uuid_string[0] ? uuid_string : "",
-                       "xnu");
-            }
-
-            seg_cmd = (struct segment_command_64 *) ((uintptr_t)seg_cmd + seg_cmd->cmdsize);
-        }
-    } else {
-        struct mach_header *kext_header;
-        struct segment_command *seg_cmd;
-        uintptr_t last_cmd;
+    for (seg_i = 0; seg_i < machoViewGetSegmentCount(ki->kcView); seg_i++) {
+        const MachOViewSegment *seg = machoViewGetSegment(ki->kcView, seg_i);
 
-        kext_header = (struct mach_header *)ki->kcImagePtr;
-        seg_cmd = (struct segment_command *)((uintptr_t)kext_header + sizeof(*kext_header));
-
-        last_cmd = (uintptr_t)seg_cmd + (kext_header->ncmds * sizeof(*seg_cmd));
-        if (last_cmd > (uintptr_t)ki->kcImagePtr + ki->kcImageSize) {
-            fprintf(stderr, "[macho] ERROR: header points off the end of the image!\n");
-            fprintf(stderr, "[macho] header@%p, sz:%d, ncmds:%d, last_cmd@%p\n",
-                    kext_header, (int)ki->kcImageSize, kext_header->ncmds, (void *)last_cmd);
-            return;
+        if (seg->segname[0] && (strstr(seg->segname, "__PLK") ||
+                                strstr(seg->segname, "__PRELINK"))) {
+            continue;
         }
-
-        for (cmd_i = 0; cmd_i < kext_header->ncmds; cmd_i++){
-            if (seg_cmd->cmd == LC_SEGMENT && (!seg_cmd->segname[0] || (!strstr(seg_cmd->segname, "__PLK")
-                                                                        && !strstr(seg_cmd->segname, "__PRELINK")))) {
-                printf(KCLAYOUTFORMATSTR, seg_cmd->segname,
-                       seg_cmd->vmaddr, seg_cmd->vmsize,
-                       uuid_string[0] ? uuid_string : "",
-                       "xnu");
-            }
-
-            seg_cmd = (struct segment_command *)((uintptr_t)seg_cmd + seg_cmd->cmdsize);
+        if (machoViewIs64Bit(ki->kcView)) {
+            printf(KCLAYOUTFORMATSTR64, seg->segname,
+                   seg->vmaddr, seg->vmsize,
+                   uuid_string[0] ? uuid_string : "",
+                   "xnu");
+        } else {
+            printf(KCLAYOUTFORMATSTR, seg->segname,
+                   (uint32_t)seg->vmaddr, (uint32_t)seg->vmsize,
+                   uuid_string[0] ? uuid_string : "",
+                   "xnu");
         }
     }
 
     return;
 }
 
-static void printJSONSegments(KclistArgs *toolArgs, void *mhpv, bool mh_is_64)
+static void printJSONSegments(KclistArgs *toolArgs, MachOViewRef view)
 {
-    struct mach_header_64 *mhp64 = NULL;
-    struct mach_header *mhp = NULL;
-    struct load_command *lcp;
-    uint32_t ncmds, cmd_i;
-    uuid_string_t uuid_string = {};
+    uint32_t seg_i, sect_i;
 
-    if (mh_is_64) {
-        struct segment_command_64 * seg_cmd;
-        bool printed_seg = false;
-
-        mhp64 = (struct mach_header_64 *)mhpv;
-        ncmds = mhp64->ncmds;
-        lcp = (struct load_command *)(void *)(mhp64 + 1);
-
-        seg_cmd = (struct segment_command_64 *) ((uintptr_t)mhp64 + sizeof(*mhp64));
-
-        for (cmd_i = 0; cmd_i < mhp64->ncmds; cmd_i++) {
-            if (seg_cmd->cmd == LC_SEGMENT_64) {
-                if (printed_seg) {
-                    printf(", ");
-                } else {
-                    printed_seg = true;
-                }
-                printf("{\"name\": \"%s\", ", seg_cmd->segname);
-                if (toolArgs->verbose) {
-                    printf("\"commands_size\": %d, ", seg_cmd->cmdsize);
-                }
-                printf("\"size\": %llu, ", seg_cmd->vmsize);
+    for (seg_i = 0; seg_i < machoViewGetSegmentCount(view); seg_i++) {
+        const MachOViewSegment *seg = machoViewGetSegment(view, seg_i);
 
-                struct section_64 *sect = NULL;
-                u_int j = 0;
-                sect = (struct section_64 *) (&seg_cmd[1]);
-                printf("\"sections\": [");
-                for (j = 0; j < seg_cmd->nsects; ++j, ++sect) {
-                    if (j != 0) {
-                        printf(", ");
-                    }
-                    printf("{\"name\": \"%s\", ", sect->sectname);
-                    printf("\"size\": %llu, ", sect->size);
-                    printf("\"offset\": %u}", sect->offset);
-                }
-                printf("]}");
-            }
-            seg_cmd = (struct segment_command_64 *) ((uintptr_t)seg_cmd + seg_cmd->cmdsize);
+        if (seg_i != 0) {
+            printf(", ");
         }
-    } else {
-        struct segment_command *    seg_cmd;
-        bool printed_seg = false;
-
-        mhp = (struct mach_header *)mhpv;
-        ncmds = mhp->ncmds;
-        lcp = (struct load_command *)(void *)(mhp + 1);
-
-        seg_cmd = (struct segment_command *) ((uintptr_t)mhp + sizeof(*mhp));
+        printf("{\"name\": \"%s\", ", seg->segname);
+        if (toolArgs->verbose || !machoViewIs64Bit(view)) {
+            printf("\"commands_size\": %d, ", seg->loadCommand->cmdsize);
+        }
+        printf("\"size\": %llu, ", seg->vmsize);
 
-        for (cmd_i = 0; cmd_i < mhp->ncmds; cmd_i++) {
-            if (seg_cmd->cmd == LC_SEGMENT) {
-                if (printed_seg) {
-                    printf(", ");
-                } else {
-                    printed_seg = true;
-                }
-                printf("{\"name\": \"%s\", ", seg_cmd->segname);
-                printf("\"commands_size\": %d, ", seg_cmd->cmdsize);
-                printf("\"size\": %u, ", seg_cmd->vmsize);
+        printf("\"sections\": [");
+        for (sect_i = 0; sect_i < seg->nsects; sect_i++) {
+            const MachOViewSection *sect =
+                machoViewGetSection(view, seg->firstSection + sect_i);
 
-                struct section *sect = NULL;
-                u_int j = 0;
-                sect = (struct section *) (&seg_cmd[1]);
-                printf("\"sections\": [");
-                for (j = 0; j < seg_cmd->nsects; ++j, ++sect) {
-                    if (j != 0) {
-                        printf(", ");
-                    }
-                    printf("{\"name\": \"%s\", ", sect->sectname);
-                    printf("\"size\": %u, ", sect->size);
-                    printf("\"offset\": %u}", sect->offset);
-                }
-                printf("]}");
+            if (sect_i != 0) {
+                printf(", ");
             }
-            seg_cmd = (struct segment_command *) ((uintptr_t)seg_cmd + seg_cmd->cmdsize);
+            printf("{\"name\": \"%s\", ", sect->sectname);
+            printf("\"size\": %llu, ", sect->size);
+            printf("\"offset\": %u}", sect->offset);
         }
+        printf("]}");
     }
 }
 
@@ -1298,10 +1707,6 @@ static void printJSON(KclistArgs *toolArgs,
 {
     CFIndex i, count = 0;
     CFArrayRef kextPlistArray = NULL;
-    struct mach_header_64 *mhp64 = NULL;
-    struct mach_header *mhp = NULL;
-    struct load_command *lcp;
-    uint32_t ncmds, cmd_i;
     uuid_string_t uuid_string = {};
 
     if (CFDictionaryGetTypeID() == CFGetTypeID(kcInfoPlist)){
@@ -1326,31 +1731,15 @@ static void printJSON(KclistArgs *toolArgs,
         printKextInfo(toolArgs, ki, kcmap, kextPlist);
     }
 
-    /* First look for the kernel UUID */
-    if (ISMACHO64(MAGIC32(ki->kcImagePtr))) {
-        mhp64 = (struct mach_header_64 *)ki->kcImagePtr;
-        ncmds = mhp64->ncmds;
-        lcp = (struct load_command *)(void *)(mhp64 + 1);
-    } else {
-        mhp = (struct mach_header *)ki->kcImagePtr;
-        ncmds = mhp->ncmds;
-        lcp = (struct load_command *)(void *)(mhp + 1);
-    }
-
     printf(", {\"name\": \"xnu\", ");
 
-    for (cmd_i = 0; cmd_i < ncmds; cmd_i++) {
-        if (lcp->cmd == LC_UUID) {
-            uuid_unparse(((struct uuid_command *)lcp)->uuid, uuid_string);
-            printf("\"uuid\": \"%s\", ", uuid_string);
-            break;
-        }
-
-        lcp = (struct load_command *)((uintptr_t)lcp + lcp->cmdsize);
+    if (machoViewGetUUID(ki->kcView)) {
+        uuid_unparse(machoViewGetUUID(ki->kcView), uuid_string);
+        printf("\"uuid\": \"%s\", ", uuid_string);
     }
 
     printf("\"segments\": [");
-    printJSONSegments(toolArgs, (void *)ki->kcImagePtr, ISMACHO64(MAGIC32(ki->kcImagePtr)));
+    printJSONSegments(toolArgs, ki->kcView);
     printf("]}");
     printf("]");
 }
@@ -1366,12 +1755,13 @@ LocateBuiltinModule(KclistArgs *toolArgs,
     Boolean          beVerbose = toolArgs->verbose;
     uint64_t         infoCount, startCount;
     uint64_t         infoAddress, kextAddress, kextLength;
-    off_t            offs;
-    kmod_info_t    * info;
+    uint64_t         addrs[2];
+    off_t            offs[2];
+    const kmod_info_t * info;
 
     if (64 == ki->machoBits) {
-        const uint64_t * infoArray  = (typeof(infoArray))  ki->builtinInfoBytes;
-        const uint64_t * startArray = (typeof(startArray)) ki->builtinStartBytes;
+        const uint64_t * infoArray  = ki->builtinInfoAddrs;
+        const uint64_t * startArray = ki->builtinStartAddrs;
         infoCount  = ki->builtinInfoSize  / sizeof(infoArray[0]);
         startCount = ki->builtinStartSize / sizeof(startArray[0]);
         if (!infoArray || !startArray) {
@@ -1380,9 +1770,9 @@ LocateBuiltinModule(KclistArgs *toolArgs,
         if ((kextModuleIndex >= infoCount) || ((kextModuleIndex + 1) >= startCount)) {
             return (NULL);
         }
-        infoAddress = getRebasedPointerValue(infoArray[kextModuleIndex], ki);
-        kextAddress = getRebasedPointerValue(startArray[kextModuleIndex], ki);
-        kextLength = getRebasedPointerValue(startArray[kextModuleIndex + 1], ki) - kextAddress;
+        infoAddress = infoArray[kextModuleIndex];
+        kextAddress = startArray[kextModuleIndex];
+        kextLength  = startArray[kextModuleIndex + 1] - kextAddress;
     } else {
         const uint32_t * infoArray  = (typeof(infoArray))  ki->builtinInfoBytes;
         const uint32_t * startArray = (typeof(startArray)) ki->builtinStartBytes;
@@ -1402,17 +1792,46 @@ LocateBuiltinModule(KclistArgs *toolArgs,
     if (beVerbose) {
         printf("[%qd] infocount %lld, %lld, 0x%qx\n", kextModuleIndex, infoCount, infoCount, infoAddress);
     }
-    offs = getKCFileOffset(kcmap, infoAddress);
-    info = (typeof(info)) (ki->kcImagePtr + offs);
+    addrs[0] = infoAddress;
+    addrs[1] = kextAddress;
+    getKCFileOffsets(kcmap, 2, addrs, offs);
+    info = getKCBytes(ki, offs[0], sizeof(*info));
+    if (!info) {
+        return (NULL);
+    }
 
-    offs = getKCFileOffset(kcmap, kextAddress);
     if (beVerbose) {
-        printf("%-80s 0x%08qx  0x%08qx  %qd\n", info->name, kextAddress, kextLength, offs);
+        printf("%-80s 0x%08qx  0x%08qx  %qd\n", info->name, kextAddress, kextLength, offs[1]);
     }
-    if (!offs) {
+    if (!offs[1]) {
         return (NULL);
     }
-    return (((const char *)ki->kcImagePtr) + offs);
+    return getKCMachHeader(ki, offs[1]);
+}
+
+/*******************************************************************************
+* Returns the Mach-O header of a kext in the cache, found from its executable's
+* source address or else from the builtin kext tables, or NULL if it has none.
+*******************************************************************************/
+static const void *
+getKextMachHeader(KclistArgs *toolArgs,
+                  struct ImageInfo *ki,
+                  struct kcmap *kcmap,
+                  uint64_t kextSourceAddress,
+                  uint64_t kextExecutableSize,
+                  uint64_t kextModuleIndex)
+{
+    if (kextExecutableSize && kextSourceAddress) {
+        if ((kextSourceAddress >= ki->prelinkTextSourceAddress) &&
+            ((kextSourceAddress+kextExecutableSize) <= (ki->prelinkTextSourceAddress + ki->prelinkTextSourceSize))) {
+            return getKCMachHeader(ki, (uint64_t)(ki->prelinkTextBytes - (const char *)ki->kcImagePtr) +
+                                       (kextSourceAddress - ki->prelinkTextSourceAddress));
+        }
+    }
+    else if (-1ULL != kextModuleIndex) {
+        return LocateBuiltinModule(toolArgs, ki, kcmap, kextModuleIndex);
+    }
+    return NULL;
 }
 
 /*******************************************************************************
@@ -1440,9 +1859,11 @@ void printKextInfo(KclistArgs *toolArgs,
 
     struct mach_header_64 *mhp64 = NULL;
     struct mach_header *mhp = NULL;
-    struct load_command *lcp;
-    struct uuid_command *uuid_cmd = NULL;
-    uint32_t ncmds, cmd_i;
+    MachOViewRef kextView = NULL;  // must machoViewFree()
+    uint64_t   * segAddrs = NULL;  // must free
+    const uint8_t *kextUUID = NULL;
+    CFDataRef uuidData = NULL;  // don't release
+    uint32_t cmd_i, seg_i;
     Boolean isSplitKext = false;
 
     Boolean beVerbose = toolArgs->verbose;
@@ -1474,43 +1895,37 @@ void printKextInfo(KclistArgs *toolArgs,
     if (NULL != (cfNum = CFDictionaryGetValue(kextPlist, CFSTR("ModuleIndex"))))
         CFNumberGetValue(cfNum, kCFNumberSInt64Type, &kextModuleIndex);
 
-    if (kextExecutableSize && kextSourceAddress) {
-        if ((kextSourceAddress >= ki->prelinkTextSourceAddress) &&
-            ((kextSourceAddress+kextExecutableSize) <= (ki->prelinkTextSourceAddress + ki->prelinkTextSourceSize))) {
-            kextTextBytes = ki->prelinkTextBytes + (ptrdiff_t)(kextSourceAddress - ki->prelinkTextSourceAddress);
-        }
-    }
-    else if (-1ULL != kextModuleIndex) {
-        kextTextBytes = LocateBuiltinModule(toolArgs, ki, kcmap, kextModuleIndex);
+    /* The prelink index records each executable's UUID, so a plain or -u
+     * listing from it needn't find and parse the kext's Mach-O header.
+     */
+    uuidData = (CFDataRef)CFDictionaryGetValue(kextPlist, CFSTR(kPrelinkIndexExecutableUUIDKey));
+    if (uuidData && CFDataGetLength(uuidData) == sizeof(uuid_t) &&
+        !layoutMap && !json && !beVerbose && !shouldExtractKext) {
+        kextUUID = CFDataGetBytePtr(uuidData);
+    } else {
+        kextTextBytes = getKextMachHeader(toolArgs, ki, kcmap, kextSourceAddress,
+                                          kextExecutableSize, kextModuleIndex);
     }
 
     if (kextTextBytes) {
-        if (ISMACHO64(MAGIC32(kextTextBytes))) {
+        kextView = machoViewCreate(kextTextBytes,
+            (size_t)(ki->kcImageSize - (kextTextBytes - (const char *)ki->kcImagePtr)));
+    }
+    if (kextView) {
+        if (machoViewIs64Bit(kextView)) {
             mhp64 = (struct mach_header_64 *)kextTextBytes;
-            ncmds = mhp64->ncmds;
-            lcp = (struct load_command *)(void *)(mhp64 + 1);
         } else {
             mhp = (struct mach_header *)kextTextBytes;
-            ncmds = mhp->ncmds;
-            lcp = (struct load_command *)(void *)(mhp + 1);
-        }
-
-        for (cmd_i = 0; cmd_i < ncmds; cmd_i++) {
-            if (lcp->cmd == LC_UUID) {
-                uuid_cmd = (struct uuid_command *)lcp;
-            }
-            if (lcp->cmd == LC_SEGMENT_SPLIT_INFO) {
-                isSplitKext = true;
-            }
-            lcp = (struct load_command *)((uintptr_t)lcp + lcp->cmdsize);
         }
+        kextUUID = machoViewGetUUID(kextView);
+        isSplitKext = (machoViewGetSplitInfo(kextView) != NULL);
     }
 
     if (printUUIDs) {
-        if (uuid_cmd) {
+        if (kextUUID) {
             uuid_string_t uuid_string;
 
-            uuid_unparse(*(uuid_t *)uuid_cmd->uuid, uuid_string);
+            uuid_unparse(kextUUID, uuid_string);
             printf("%s\t%s\t%s\t0x%llx\t0x%llx\t%s\n", idBuffer, versionBuffer, uuid_string, kextLoadAddress, kextExecutableSize, pathBuffer);
         } else {
             printf("%s\t%s\t\t\t\t%s\n", idBuffer, versionBuffer, pathBuffer);
@@ -1518,9 +1933,9 @@ void printKextInfo(KclistArgs *toolArgs,
     } else if (json) {
         printf("{\"name\": \"%s\", ", idBuffer);
         printf("\"version\": \"%s\", ", versionBuffer);
-        if (uuid_cmd) {
+        if (kextUUID) {
             uuid_string_t uuidBuffer;
-            uuid_unparse(*(uuid_t *)uuid_cmd->uuid, uuidBuffer);
+            uuid_unparse(kextUUID, uuidBuffer);
             printf("\"uuid\": \"%s\", ", uuidBuffer);
         }
         printf("\"path\": \"%s\", ", pathBuffer);
@@ -1532,45 +1947,31 @@ void printKextInfo(KclistArgs *toolArgs,
     if (layoutMap) {
         uuid_string_t uuid_string;
 
-        if (uuid_cmd) {
-            uuid_unparse(*(uuid_t *)uuid_cmd->uuid, uuid_string);
+        if (kextUUID) {
+            uuid_unparse(kextUUID, uuid_string);
         }
 
-        if (mhp64) {
-            struct segment_command_64 * seg_cmd;
-            seg_cmd = (struct segment_command_64 *) ((uintptr_t)mhp64 + sizeof(*mhp64));
-
-            for (cmd_i = 0; cmd_i < mhp64->ncmds; cmd_i++) {
-                if (seg_cmd->cmd == LC_SEGMENT_64) {
-                    printf(KCLAYOUTFORMATSTR64, seg_cmd->segname,
-                           seg_cmd->vmaddr, seg_cmd->vmsize,
-                           uuid_cmd ? uuid_string : "",
-                           idBuffer);
-                }
-                seg_cmd = (struct segment_command_64 *) ((uintptr_t)seg_cmd + seg_cmd->cmdsize);
-            }
-        } else if (mhp) {
-            struct segment_command *    seg_cmd;
-            seg_cmd = (struct segment_command *) ((uintptr_t)mhp + sizeof(*mhp));
-
-            for (cmd_i = 0; cmd_i < mhp->ncmds; cmd_i++) {
-                if (seg_cmd->cmd == LC_SEGMENT) {
-                    printf(KCLAYOUTFORMATSTR, seg_cmd->segname,
-                           seg_cmd->vmaddr, seg_cmd->vmsize,
-                           uuid_cmd ? uuid_string : "", idBuffer);
-                }
-
-                seg_cmd = (struct segment_command *) ((uintptr_t)seg_cmd + seg_cmd->cmdsize);
+        if (kextView && !(segAddrs = copyRebasedSegmentAddresses(ki, kextView))) {
+            goto finish;
+        }
+        for (seg_i = 0; kextView && seg_i < machoViewGetSegmentCount(kextView); seg_i++) {
+            const MachOViewSegment *seg = machoViewGetSegment(kextView, seg_i);
+
+            if (machoViewIs64Bit(kextView)) {
+                printf(KCLAYOUTFORMATSTR64, seg->segname,
+                       segAddrs[seg_i], seg->vmsize,
+                       kextUUID ? uuid_string : "",
+                       idBuffer);
+            } else {
+                printf(KCLAYOUTFORMATSTR, seg->segname,
+                       (uint32_t)segAddrs[seg_i], (uint32_t)seg->vmsize,
+                       kextUUID ? uuid_string : "", idBuffer);
             }
         }
     } else if (json) {
-        if (mhp64) {
+        if (kextView) {
             printf(", \"segments\": [");
-            printJSONSegments(toolArgs, mhp64, true);
-            printf("]");
-        } else if (mhp) {
-            printf(", \"segments\": [");
-            printJSONSegments(toolArgs, mhp, false);
+            printJSONSegments(toolArgs, kextView);
             printf("]");
         }
         printf("}");
@@ -1714,13 +2115,453 @@ void printKextInfo(KclistArgs *toolArgs,
     }
 
     /* extract the kext from the kernel cache */
-    if (shouldExtractKext && kextTextBytes) {
-        extractKext(ki, kcmap, idBuffer, kextSourceAddress, kextLoadAddress,
-                    (mhp64 ? (void *)mhp64 : (void *)mhp),
-                    (mhp64 ? true : false), toolArgs, isSplitKext);
+    if (shouldExtractKext && kextView) {
+        if (ki->extractJobs && ki->extractJobCount < ki->extractJobCapacity) {
+            struct ExtractJob *job = &ki->extractJobs[ki->extractJobCount++];
+
+            strlcpy(job->kextName, idBuffer, sizeof(job->kextName));
+            job->kextSourceAddress = kextSourceAddress;
+            job->kextLoadAddress = kextLoadAddress;
+            job->mh = kextTextBytes;
+            job->is64Bit = (mhp64 ? true : false);
+            job->isSplitKext = isSplitKext;
+        } else {
+            extractKext(ki, kcmap, idBuffer, kextSourceAddress, kextLoadAddress,
+                        (mhp64 ? (void *)mhp64 : (void *)mhp),
+                        (mhp64 ? true : false), toolArgs, isSplitKext,
+                        /* quiet */ false);
+        }
+    }
+
+finish:
+    machoViewFree(kextView);
+    SAFE_FREE(segAddrs);
+    return;
+}
+
+#pragma mark Kernelcache Diff
+/*******************************************************************************
+* -diff compares each kext of a base kernelcache with the kext of the same
+* bundle identifier in the kernelcache being listed. Kexts are compared by
+* SHA-256 digest: one of the kext's prelink info dictionary, less the
+* properties that only record where the kext was placed, and one of the
+* contents of each of its segments. The digests of both caches are computed
+* in parallel, then the two lists are merged by bundle identifier.
+*******************************************************************************/
+struct SegmentDigest
+{
+    char          segname[17];
+    uint64_t      vmaddr;
+    uint64_t      vmsize;
+    Boolean       hashed;  // false if the contents couldn't be read
+    unsigned char hash[CC_SHA256_DIGEST_LENGTH];
+};
+
+struct KextDigest
+{
+    CFDictionaryRef        kextPlist;
+    char                   bundleID[KMOD_MAX_NAME];
+    char                   version[KMOD_MAX_NAME];
+    Boolean                hasUUID;
+    uuid_t                 uuid;
+    unsigned char          infoHash[CC_SHA256_DIGEST_LENGTH];
+    uint32_t               segmentCount;
+    struct SegmentDigest * segments;  // must free
+};
+
+static int compareKextDigests(const void *a, const void *b)
+{
+    return strcmp(((const struct KextDigest *)a)->bundleID,
+                  ((const struct KextDigest *)b)->bundleID);
+}
+
+static void freeKextDigests(struct KextDigest *digests, CFIndex count)
+{
+    if (!digests) {
+        return;
+    }
+    for (CFIndex i = 0; i < count; i++) {
+        SAFE_FREE(digests[i].segments);
+    }
+    free(digests);
+}
+
+/*******************************************************************************
+* Returns the kexts to compare, sorted by bundle identifier, with only their
+* names filled in.
+*******************************************************************************/
+static struct KextDigest *
+createKextDigests(KclistArgs *toolArgs,
+                  CFPropertyListRef kcInfoPlist,
+                  CFIndex *countOut)
+{
+    struct KextDigest * result = NULL;
+    Boolean haveIDs = CFSetGetCount(toolArgs->kextIDs) > 0 ? TRUE : FALSE;
+    CFArrayRef kextPlistArray = NULL;
+    CFIndex i, count, kept = 0;
+
+    *countOut = 0;
+    if (CFArrayGetTypeID() == CFGetTypeID(kcInfoPlist)) {
+        kextPlistArray = (CFArrayRef)kcInfoPlist;
+    } else if (CFDictionaryGetTypeID() == CFGetTypeID(kcInfoPlist)){
+        kextPlistArray = (CFArrayRef)CFDictionaryGetValue(kcInfoPlist,
+            CFSTR("_PrelinkInfoDictionary"));
+    }
+    if (!kextPlistArray || CFArrayGetTypeID() != CFGetTypeID(kextPlistArray)) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+            "Unrecognized kernelcache plist data.");
+        goto finish;
+    }
+
+    count = CFArrayGetCount(kextPlistArray);
+    result = calloc(count + 1, sizeof(*result));
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    for (i = 0; i < count; i++) {
+        CFDictionaryRef kextPlist = (CFDictionaryRef)CFArrayGetValueAtIndex(kextPlistArray, i);
+        CFStringRef kextIdentifier = (CFStringRef)CFDictionaryGetValue(kextPlist, kCFBundleIdentifierKey);
+        CFStringRef kextVersion = (CFStringRef)CFDictionaryGetValue(kextPlist, kCFBundleVersionKey);
+        struct KextDigest *digest = &result[kept];
+
+        if (!kextIdentifier) {
+            continue;
+        }
+        if (haveIDs && !CFSetContainsValue(toolArgs->kextIDs, kextIdentifier)) {
+            continue;
+        }
+        digest->kextPlist = kextPlist;
+        CFStringGetCString(kextIdentifier, digest->bundleID, sizeof(digest->bundleID), kCFStringEncodingUTF8);
+        if (kextVersion) {
+            CFStringGetCString(kextVersion, digest->version, sizeof(digest->version), kCFStringEncodingUTF8);
+        }
+        kept++;
+    }
+    qsort(result, kept, sizeof(*result), compareKextDigests);
+    *countOut = kept;
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+* Fills in the hashes of one kext. Called concurrently for different kexts.
+*******************************************************************************/
+static void digestKext(KclistArgs *toolArgs,
+                       struct ImageInfo *ki,
+                       struct kcmap *kcmap,
+                       struct KextDigest *digest)
+{
+    CFDictionaryRef        kextPlist = digest->kextPlist;
+    CFMutableDictionaryRef infoCopy = NULL;  // must release
+    CFDataRef              infoData = NULL;  // must release
+    MachOViewRef           kextView = NULL;  // must machoViewFree()
+    uint64_t             * segAddrs = NULL;  // must free
+    off_t                * segOffsets = NULL;  // must free
+    const char           * kextTextBytes = NULL;
+    CFNumberRef            cfNum;
+    uint64_t               kextLoadAddress = 0x0;
+    uint64_t               kextSourceAddress = 0x0;
+    uint64_t               kextExecutableSize = 0;
+    uint64_t               kextModuleIndex = -1ULL;
+    uint32_t               segCount, seg_i;
+    CFStringRef            placementKeys[] = {
+        CFSTR(kPrelinkExecutableLoadKey),
+        CFSTR(kPrelinkExecutableSourceKey),
+        CFSTR(kPrelinkKmodInfoKey),
+        CFSTR("ModuleIndex"),
+    };
+
+   /* The XML form writes dictionary keys in sorted order, so equal
+    * dictionaries always serialize, and hash, the same.
+    */
+    infoCopy = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0, kextPlist);
+    if (!infoCopy) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    for (size_t key_i = 0; key_i < sizeof(placementKeys) / sizeof(placementKeys[0]); key_i++) {
+        CFDictionaryRemoveValue(infoCopy, placementKeys[key_i]);
+    }
+    infoData = CFPropertyListCreateData(kCFAllocatorDefault, infoCopy,
+                                        kCFPropertyListXMLFormat_v1_0,
+                                        /* options */ 0, /* error */ NULL);
+    if (!infoData) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                  "Can't serialize prelink info for %s.", digest->bundleID);
+        goto finish;
+    }
+    CC_SHA256(CFDataGetBytePtr(infoData), (CC_LONG)CFDataGetLength(infoData),
+              digest->infoHash);
+
+    if (NULL != (cfNum = CFDictionaryGetValue(kextPlist, CFSTR(kPrelinkExecutableLoadKey))))
+        CFNumberGetValue(cfNum, kCFNumberSInt64Type, &kextLoadAddress);
+    if (NULL != (cfNum = CFDictionaryGetValue(kextPlist, CFSTR(kPrelinkExecutableSourceKey))))
+        CFNumberGetValue(cfNum, kCFNumberSInt64Type, &kextSourceAddress);
+    if (NULL != (cfNum = CFDictionaryGetValue(kextPlist, CFSTR(kPrelinkExecutableSizeKey))))
+        CFNumberGetValue(cfNum, kCFNumberSInt64Type, &kextExecutableSize);
+    if (NULL != (cfNum = CFDictionaryGetValue(kextPlist, CFSTR("ModuleIndex"))))
+        CFNumberGetValue(cfNum, kCFNumberSInt64Type, &kextModuleIndex);
+
+    /* The prelink index records each executable's UUID, so a plain or -u
+     * listing from it needn't find and parse the kext's Mach-O header.
+     */
+    uuidData = (CFDataRef)CFDictionaryGetValue(kextPlist, CFSTR(kPrelinkIndexExecutableUUIDKey));
+    if (uuidData && CFDataGetLength(uuidData) == sizeof(uuid_t) &&
+        !layoutMap && !json && !beVerbose && !shouldExtractKext) {
+        kextUUID = CFDataGetBytePtr(uuidData);
+    } else {
+        kextTextBytes = getKextMachHeader(toolArgs, ki, kcmap, kextSourceAddress,
+                                          kextExecutableSize, kextModuleIndex);
+    }
+    if (kextTextBytes) {
+        kextView = machoViewCreate(kextTextBytes,
+            (size_t)(ki->kcImageSize - (kextTextBytes - (const char *)ki->kcImagePtr)));
+    }
+    if (!kextView) {
+        goto finish;
+    }
+    if (machoViewGetUUID(kextView)) {
+        digest->hasUUID = true;
+        uuid_copy(digest->uuid, machoViewGetUUID(kextView));
+    }
+
+    segCount = machoViewGetSegmentCount(kextView);
+    segAddrs = copyRebasedSegmentAddresses(ki, kextView);
+    segOffsets = calloc(segCount + 1, sizeof(*segOffsets));
+    digest->segments = calloc(segCount + 1, sizeof(*digest->segments));
+    if (!segAddrs || !segOffsets || !digest->segments) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    digest->segmentCount = segCount;
+
+   /* Look the segments up as extractKext() does, then hash their contents.
+    * A kext's __LINKEDIT is part of the kernelcache's, so it is compared by
+    * size only.
+    */
+    for (seg_i = 0; seg_i < segCount; seg_i++) {
+        const MachOViewSegment *seg = machoViewGetSegment(kextView, seg_i);
+        struct SegmentDigest *segDigest = &digest->segments[seg_i];
+
+        strlcpy(segDigest->segname, seg->segname, sizeof(segDigest->segname));
+        segDigest->vmaddr = segAddrs[seg_i];
+        segDigest->vmsize = seg->vmsize;
+        segAddrs[seg_i] = segAddrs[seg_i] - kextLoadAddress + kextSourceAddress;
+    }
+    getKCFileOffsets(kcmap, segCount, segAddrs, segOffsets);
+    for (seg_i = 0; seg_i < segCount; seg_i++) {
+        const MachOViewSegment *seg = machoViewGetSegment(kextView, seg_i);
+        struct SegmentDigest *segDigest = &digest->segments[seg_i];
+        const void *segBytes;
+
+        if (!segOffsets[seg_i] || !seg->filesize ||
+            !strcmp(seg->segname, SEG_LINKEDIT)) {
+            continue;
+        }
+        segBytes = getKCBytes(ki, segOffsets[seg_i], seg->filesize);
+        if (segBytes) {
+            CC_SHA256(segBytes, (CC_LONG)seg->filesize, segDigest->hash);
+            segDigest->hashed = true;
+        }
+    }
+
+finish:
+    SAFE_RELEASE(infoCopy);
+    SAFE_RELEASE(infoData);
+    SAFE_FREE(segAddrs);
+    SAFE_FREE(segOffsets);
+    machoViewFree(kextView);
+    return;
+}
+
+static const struct SegmentDigest *
+findSegmentDigest(const struct KextDigest *digest, const char *segname)
+{
+    for (uint32_t seg_i = 0; seg_i < digest->segmentCount; seg_i++) {
+        if (!strcmp(digest->segments[seg_i].segname, segname)) {
+            return &digest->segments[seg_i];
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* Compares the segments of two versions of a kext, printing how they differ
+* if print is set. A segment that only moved is not a change, but is printed
+* in verbose mode. Returns whether any segment changed.
+*******************************************************************************/
+static Boolean diffKextSegments(const struct KextDigest *base,
+                                const struct KextDigest *kext,
+                                Boolean print,
+                                Boolean beVerbose)
+{
+    Boolean changed = false;
+    uint32_t seg_i;
+
+    for (seg_i = 0; seg_i < kext->segmentCount; seg_i++) {
+        const struct SegmentDigest *seg = &kext->segments[seg_i];
+        const struct SegmentDigest *baseSeg = findSegmentDigest(base, seg->segname);
+        Boolean resized, rewritten, moved;
+
+        if (!baseSeg) {
+            changed = true;
+            if (print) {
+                printf("\t+ %s\n", seg->segname);
+            }
+            continue;
+        }
+        resized = (seg->vmsize != baseSeg->vmsize);
+        rewritten = (seg->hashed != baseSeg->hashed ||
+                     memcmp(seg->hash, baseSeg->hash, sizeof(seg->hash)));
+        moved = (seg->vmaddr != baseSeg->vmaddr);
+        changed = changed || resized || rewritten;
+        if (!print || !(resized || rewritten || (moved && beVerbose))) {
+            continue;
+        }
+        printf("\t%s:", seg->segname);
+        if (resized) {
+            printf(" size 0x%llx -> 0x%llx", baseSeg->vmsize, seg->vmsize);
+        }
+        if (rewritten) {
+            printf(" contents changed");
+        }
+        if (moved && beVerbose) {
+            printf(" address 0x%llx -> 0x%llx", baseSeg->vmaddr, seg->vmaddr);
+        }
+        printf("\n");
+    }
+    for (seg_i = 0; seg_i < base->segmentCount; seg_i++) {
+        const struct SegmentDigest *baseSeg = &base->segments[seg_i];
+
+        if (!findSegmentDigest(kext, baseSeg->segname)) {
+            changed = true;
+            if (print) {
+                printf("\t- %s\n", baseSeg->segname);
+            }
+        }
+    }
+    return changed;
+}
+
+/*******************************************************************************
+* Prints how a kext differs from its base version, if it does. Returns
+* whether it changed.
+*******************************************************************************/
+static Boolean printKextDiff(KclistArgs *toolArgs,
+                             const struct KextDigest *base,
+                             const struct KextDigest *kext)
+{
+    Boolean infoChanged = memcmp(base->infoHash, kext->infoHash, sizeof(kext->infoHash)) != 0;
+    Boolean uuidChanged = (base->hasUUID != kext->hasUUID) ||
+                          (kext->hasUUID && uuid_compare(base->uuid, kext->uuid));
+
+    if (!diffKextSegments(base, kext, /* print */ false, toolArgs->verbose) &&
+        !infoChanged && !uuidChanged) {
+        return false;
+    }
+
+    if (strcmp(base->version, kext->version)) {
+        printf("* %s\t%s -> %s\n", kext->bundleID, base->version, kext->version);
+    } else {
+        printf("* %s\t%s\n", kext->bundleID, kext->version);
+    }
+    if (infoChanged) {
+        printf("\tprelink info changed\n");
+    }
+    if (uuidChanged) {
+        uuid_string_t baseUUID = "none";
+        uuid_string_t kextUUID = "none";
+
+        if (base->hasUUID) {
+            uuid_unparse(base->uuid, baseUUID);
+        }
+        if (kext->hasUUID) {
+            uuid_unparse(kext->uuid, kextUUID);
+        }
+        printf("\tUUID %s -> %s\n", baseUUID, kextUUID);
+    }
+    diffKextSegments(base, kext, /* print */ true, toolArgs->verbose);
+    return true;
+}
+
+/*******************************************************************************
+* Prints the kexts added to, removed from and changed in the kernelcache being
+* listed relative to the base kernelcache given with -diff.
+*******************************************************************************/
+static void diffPrelinkedKexts(KclistArgs * toolArgs,
+                               struct ImageInfo * baseKi,
+                               struct kcmap *baseKcmap,
+                               CFPropertyListRef baseInfoPlist,
+                               struct ImageInfo * ki,
+                               struct kcmap *kcmap,
+                               CFPropertyListRef kcInfoPlist,
+                               const NXArchInfo * archInfo)
+{
+    struct KextDigest * baseDigests = NULL;  // must freeKextDigests()
+    struct KextDigest * digests = NULL;  // must freeKextDigests()
+    CFIndex baseCount = 0, count = 0;
+    CFIndex base_i = 0, i = 0;
+    CFIndex added = 0, removed = 0, changed = 0, unchanged = 0;
+
+    baseDigests = createKextDigests(toolArgs, baseInfoPlist, &baseCount);
+    digests = createKextDigests(toolArgs, kcInfoPlist, &count);
+    if (!baseDigests || !digests) {
+        goto finish;
+    }
+
+    if (archInfo) {
+        printf("Comparing architecture %s\n", archInfo->name);
     }
 
+    dispatch_apply(baseCount + count,
+                   dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                   ^(size_t n) {
+        if ((CFIndex)n < baseCount) {
+            digestKext(toolArgs, baseKi, baseKcmap, &baseDigests[n]);
+        } else {
+            digestKext(toolArgs, ki, kcmap, &digests[n - baseCount]);
+        }
+    });
+
+    while (base_i < baseCount || i < count) {
+        int order;
+
+        if (base_i == baseCount) {
+            order = 1;
+        } else if (i == count) {
+            order = -1;
+        } else {
+            order = strcmp(baseDigests[base_i].bundleID, digests[i].bundleID);
+        }
+
+        if (order < 0) {
+            printf("- %s\t%s\n", baseDigests[base_i].bundleID, baseDigests[base_i].version);
+            removed++;
+            base_i++;
+        } else if (order > 0) {
+            printf("+ %s\t%s\n", digests[i].bundleID, digests[i].version);
+            added++;
+            i++;
+        } else {
+            if (printKextDiff(toolArgs, &baseDigests[base_i], &digests[i])) {
+                changed++;
+            } else {
+                unchanged++;
+            }
+            base_i++;
+            i++;
+        }
+    }
+    printf("%ld added, %ld removed, %ld changed, %ld unchanged\n",
+           added, removed, changed, unchanged);
+
 finish:
+    freeKextDigests(baseDigests, baseCount);
+    freeKextDigests(digests, count);
     return;
 }
 
@@ -1794,7 +2635,8 @@ CFComparisonResult compareIdentifiers(const void * val1, const void * val2, void
 void usage(UsageLevel usageLevel)
 {
     fprintf(stderr,
-      "usage: %1$s [-arch archname] [-i] [-j] [-l] [-M] [-o] [-u] [-v] [-x prefix] [--] kernelcache [bundle-id ...]\n"
+      "usage: %1$s [-arch archname] [-d path] [-i] [-j] [-l] [-M] [-o] [-u] [-v] [-x prefix] [--] kernelcache [bundle-id ...]\n"
+      "usage: %1$s [-arch archname] [-v] -diff base-kernelcache [--] kernelcache [bundle-id ...]\n"
       "usage: %1$s -help\n"
       "\n",
       progname);
@@ -1818,7 +2660,8 @@ void usage(UsageLevel usageLevel)
         "        print kext load addresses and UUIDs\n",
             kOptNameUUID, kOptUUID);
     fprintf(stderr, "-%s (-%c) <prefix>:\n"
-        "        extract named kexts from the cache into files prefixed with <prefix>\n",
+        "        extract named kexts (all kexts if none are named) from the cache\n"
+        "        into files prefixed with <prefix>\n",
             kOptNameSaveKext, kOptSaveKext);
     fprintf(stderr, "-%s (-%c):\n"
         "        emit additional information about kext load addresses and sizes\n",
@@ -1835,6 +2678,14 @@ void usage(UsageLevel usageLevel)
     fprintf(stderr, "-%s (-%c):\n"
         "        file to print to (default stdout)\n",
             kOptNameOutput, kOptOutput);
+    fprintf(stderr, "-%s (-%c) <path>:\n"
+        "        uncompress into <path> (<path>.<archname> for each slice of a fat\n"
+        "        kernelcache) and reuse it on later runs if it is still current\n",
+            kOptNameDecompressed, kOptDecompressed);
+    fprintf(stderr, "-%s (-%c) <base-kernelcache>:\n"
+        "        list the kexts added, removed and changed since <base-kernelcache>,\n"
+        "        and how the segments of changed kexts differ\n",
+            kOptNameDiff, kOptDiff);
     fprintf(stderr, "\n");
 
     fprintf(stderr, "-%s (-%c): print this message and exit\n",
@@ -1843,108 +2694,186 @@ void usage(UsageLevel usageLevel)
     return;
 }
 
-static void createKCMap(const uint8_t *kernelcacheImage, Boolean verbose, struct kcmap **kcmap)
+static int compareKCMapEntries(const void *a, const void *b)
 {
-    struct load_command *lcp = NULL;
-    uint32_t ncmds = 0;
+    const struct kcmap_entry *entryA = (const struct kcmap_entry *)a;
+    const struct kcmap_entry *entryB = (const struct kcmap_entry *)b;
+
+    if (entryA->va_start != entryB->va_start)
+        return (entryA->va_start < entryB->va_start) ? -1 : 1;
+    /* keep load command order for segments starting at the same address */
+    return (entryA->kc_lcp < entryB->kc_lcp) ? -1 : (entryA->kc_lcp > entryB->kc_lcp);
+}
+
+static void createKCMap(struct ImageInfo * ki, Boolean verbose, struct kcmap **kcmap)
+{
+    MachOViewRef kcView = ki->kcView;
+    uint32_t nsegs = 0;
+    int nvalid = 0;
 
     if (kcmap == NULL)
         return;
 
-    if (ISMACHO64(MAGIC32(kernelcacheImage))) {
-        struct mach_header_64 *kext_header = (struct mach_header_64 *)((uintptr_t)kernelcacheImage);
-        ncmds = kext_header->ncmds;
-        lcp = (struct load_command *)((uintptr_t)kext_header + sizeof(*kext_header));
-    } else {
-        struct mach_header *kext_header = (struct mach_header *)((uintptr_t)kernelcacheImage);
-        ncmds = kext_header->ncmds;
-        lcp = (struct load_command *)((uintptr_t)kext_header + sizeof(*kext_header));
-    }
-
-    *kcmap = calloc(1, sizeof(*kcmap) + (ncmds * sizeof(struct kcmap_entry)));
+    nsegs = machoViewGetSegmentCount(kcView);
+    *kcmap = calloc(1, sizeof(**kcmap) + (nsegs * sizeof(struct kcmap_entry)));
     if (*kcmap == NULL)
         return;
 
     if (verbose)
-        printf("Building KC Map from %d load commands...\n", ncmds);
+        printf("Building KC Map from %d segments...\n", nsegs);
 
-    (*kcmap)->va_start = UINT64_MAX;
-    (*kcmap)->cache_start = kernelcacheImage;
+    (*kcmap)->va_start = machoViewGetLowestAddress(kcView);
+    (*kcmap)->cache_start = machoViewGetHeader(kcView);
     struct kcmap_entry *entry = &((*kcmap)->entries[0]);
 
-    for (uint32_t i = 0; i < ncmds; i++) {
-        if (lcp->cmd == LC_SEGMENT_64) {
-            struct segment_command_64 *seg_cmd;
-            seg_cmd = (struct segment_command_64 *)((uintptr_t)lcp);
-            entry->kc_lcp = lcp;
-            entry->kc_start = seg_cmd->fileoff;
-            entry->kc_end = entry->kc_start + seg_cmd->filesize;
-            entry->va_start = seg_cmd->vmaddr;
-            entry->va_end = entry->va_start + seg_cmd->vmsize;
-            if (entry->va_start < (*kcmap)->va_start)
-                (*kcmap)->va_start = entry->va_start;
-            if (verbose)
-                printf("\t`-> %16s [0x%llx,0x%llx] => [%lld,%lld]\n",
-                       seg_cmd->segname[0] ? seg_cmd->segname : "none",
-                       entry->va_start, entry->va_end,
-                       entry->kc_start, entry->kc_end);
-            entry++;
-            (*kcmap)->nentries++;
-        } else if (lcp->cmd == LC_SEGMENT) {
-            struct segment_command *seg_cmd;
-            seg_cmd = (struct segment_command *)((uintptr_t)lcp);
-            entry->kc_lcp = lcp;
-            entry->kc_start = seg_cmd->fileoff;
-            entry->kc_end = entry->kc_start + seg_cmd->filesize;
-            entry->va_start = seg_cmd->vmaddr;
-            entry->va_end = entry->va_start + seg_cmd->vmsize;
-            if (entry->va_start < (*kcmap)->va_start)
-                (*kcmap)->va_start = entry->va_start;
-            if (verbose)
-                printf("\t`-> %16s [0x%llx,0x%llx] => [%lld,%lld]\n",
-                       seg_cmd->segname[0] ? seg_cmd->segname : "none",
-                       entry->va_start, entry->va_end,
-                       entry->kc_start, entry->kc_end);
-            entry++;
-            (*kcmap)->nentries++;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        const MachOViewSegment *seg = machoViewGetSegment(kcView, i);
+
+        entry->kc_lcp = seg->loadCommand;
+        entry->kc_start = seg->fileoff;
+        entry->kc_end = entry->kc_start + seg->filesize;
+        entry->va_start = seg->vmaddr;
+        entry->va_end = entry->va_start + seg->vmsize;
+        if (verbose)
+            printf("\t`-> %16s [0x%llx,0x%llx] => [%lld,%lld]\n",
+                   seg->segname[0] ? seg->segname : "none",
+                   entry->va_start, entry->va_end,
+                   entry->kc_start, entry->kc_end);
+        entry++;
+        (*kcmap)->nentries++;
+    }
+
+    qsort((*kcmap)->entries, (*kcmap)->nentries, sizeof(struct kcmap_entry),
+          compareKCMapEntries);
+
+    /*
+     * Validate the sorted entries once, so lookups don't have to: only the
+     * file-backed part of a segment can be translated, segments must lie
+     * within the cache file, and an address belongs to at most one entry.
+     */
+    for (int i = 0; i < (*kcmap)->nentries; i++) {
+        entry = &((*kcmap)->entries[i]);
+
+        if (entry->va_end - entry->va_start > entry->kc_end - entry->kc_start) {
+            entry->va_end = entry->va_start + (entry->kc_end - entry->kc_start);
         }
-        lcp = (struct load_command *)((uintptr_t)lcp + lcp->cmdsize);
+        if (entry->va_end == entry->va_start) {
+            continue;
+        }
+        if (entry->kc_start > (uint64_t)ki->kcImageSize ||
+            entry->kc_end > (uint64_t)ki->kcImageSize) {
+            printf("[ERROR] KC map entry {%s: [0x%llx,0x%llx] => [%lld,%lld]}\n"
+                   "        lies outside the %lld byte kernelcache; ignoring it\n",
+                   getSegmentCommandName(entry->kc_lcp->cmd),
+                   entry->va_start, entry->va_end, entry->kc_start, entry->kc_end,
+                   (uint64_t)ki->kcImageSize);
+            continue;
+        }
+        if (nvalid && entry->va_start < (*kcmap)->entries[nvalid - 1].va_end) {
+            struct kcmap_entry *prev = &((*kcmap)->entries[nvalid - 1]);
+
+            printf("[ERROR] KC map entry {%s: [0x%llx,0x%llx] => [%lld,%lld]}\n"
+                   "        overlaps [0x%llx,0x%llx]; ignoring the overlap\n",
+                   getSegmentCommandName(entry->kc_lcp->cmd),
+                   entry->va_start, entry->va_end, entry->kc_start, entry->kc_end,
+                   prev->va_start, prev->va_end);
+            if (entry->va_end <= prev->va_end) {
+                continue;
+            }
+            entry->kc_start += prev->va_end - entry->va_start;
+            entry->va_start = prev->va_end;
+        }
+        (*kcmap)->entries[nvalid++] = *entry;
     }
+    (*kcmap)->nentries = nvalid;
 
     if (verbose)
-        printf("\tDONE: found %d segments, va_start:0x%llx\n",
-               (*kcmap)->nentries, (*kcmap)->va_start);
+        printf("\tDONE: found %d segments, %d mappable, va_start:0x%llx\n",
+               nsegs, (*kcmap)->nentries, (*kcmap)->va_start);
 }
 
+/*
+ * Returns the index of the entry containing va_ofst, or -1. Tries the hint
+ * and the entry after it before falling back to a binary search, as batched
+ * addresses are usually close together and ascending.
+ */
+static int findKCMapEntry(struct kcmap *kcmap, uint64_t va_ofst, int hint)
+{
+    int lo = 0, hi = kcmap->nentries;
+
+    for (int i = hint; i >= 0 && i < kcmap->nentries && i <= hint + 1; i++) {
+        if (va_ofst >= kcmap->entries[i].va_start && va_ofst < kcmap->entries[i].va_end)
+            return i;
+    }
+
+    /* find the last entry starting at or below va_ofst */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (kcmap->entries[mid].va_start <= va_ofst)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && va_ofst < kcmap->entries[lo - 1].va_end)
+        return lo - 1;
 
-static off_t getKCFileOffset(struct kcmap *kcmap, uint64_t va_ofst)
+    return -1;
+}
+
+/*
+ * Translates count addresses at once; addresses outside the map get 0.
+ */
+static void getKCFileOffsets(struct kcmap *kcmap, uint32_t count, const uint64_t *va_ofsts, off_t *kc_ofsts)
 {
-    struct kcmap_entry *entry = NULL;
-    if (!kcmap)
-        return 0;
-    /*
-     * The entries will most likely _not_ be sorted,
-     * so we have to do a simple linear search.
-     */
-    for (int i = 0; i < kcmap->nentries; i++) {
-        entry = &(kcmap->entries[i]);
-        if (va_ofst >= entry->va_start && va_ofst < entry->va_end) {
-            off_t kext_ofst = va_ofst - entry->va_start;
-            if (entry->kc_start + kext_ofst >= entry->kc_end) {
-                printf("[ERROR] mismatch in KC -> VA map: found 0x%llx in entry:\n"
-                       "        {%s: [0x%llx,0x%llx] => [%lld,%lld]}\n"
-                       "        but VA offset (%lld) doesn't fit in map KC range!\n",
-                       va_ofst,
-                       getSegmentCommandName(entry->kc_lcp->cmd),
-                       entry->va_start, entry->va_end, entry->kc_start, entry->kc_end,
-                       (uint64_t)kext_ofst);
-                return 0;
-            }
-            return entry->kc_start + kext_ofst;
-        }
+    int hint = -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct kcmap_entry *entry;
+        int index;
+
+        kc_ofsts[i] = 0;
+        if (!kcmap)
+            continue;
+        index = findKCMapEntry(kcmap, va_ofsts[i], hint);
+        if (index < 0)
+            continue;
+        entry = &(kcmap->entries[index]);
+        kc_ofsts[i] = entry->kc_start + (va_ofsts[i] - entry->va_start);
+        hint = index;
+    }
+}
+
+/*
+ * Returns a pointer to [offset, offset + length) of the kernelcache image,
+ * uncompressing that range first if the image is read on demand.
+ */
+static const void * getKCBytes(struct ImageInfo * ki, uint64_t offset, uint64_t length)
+{
+    if (offset > (uint64_t)ki->kcImageSize ||
+        length > (uint64_t)ki->kcImageSize - offset) {
+        return NULL;
+    }
+    if (ki->kcReader) {
+        return prelinkedSliceReaderGetBytes(ki->kcReader, (size_t)offset, (size_t)length);
     }
+    return ki->kcImagePtr + offset;
+}
 
-    return 0;
+/*
+ * Like getKCBytes() for the Mach-O header at offset and its load commands.
+ */
+static const void * getKCMachHeader(struct ImageInfo * ki, uint64_t offset)
+{
+    const struct mach_header * mhp;
+
+    mhp = getKCBytes(ki, offset, sizeof(struct mach_header));
+    if (!mhp) {
+        return NULL;
+    }
+    if (ISMACHO64(MAGIC32(mhp))) {
+        return getKCBytes(ki, offset, sizeof(struct mach_header_64) + mhp->sizeofcmds);
+    }
+    return getKCBytes(ki, offset, sizeof(struct mach_header) + mhp->sizeofcmds);
 }
 
 static void printMachOHeader(KclistArgs *toolArgs, const UInt8 *imagePtr, CFIndex imageSize, const char *descrip, const char *_pfx)
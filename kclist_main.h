@@ -54,7 +54,13 @@ enum {
 #define kOptOutput       'o'
 #define kOptNameOutput   "output"
 
-#define kOptChars  "a:hijlMo:uvx:"
+#define kOptDecompressed     'd'
+#define kOptNameDecompressed "decompressed"
+
+#define kOptDiff         'D'
+#define kOptNameDiff     "diff"
+
+#define kOptChars  "a:D:d:hijlMo:uvx:"
 
 int longopt = 0;
 
@@ -69,6 +75,8 @@ struct option sOptInfo[] = {
     { kOptNameJSON,                  no_argument,        NULL,     kOptJSON },
     { kOptNamePrelinkInfoDict,       no_argument,        NULL,     kOptPrelinkInfoDict },
     { kOptNameOutput,                required_argument,  NULL,     kOptOutput },
+    { kOptNameDecompressed,          required_argument,  NULL,     kOptDecompressed },
+    { kOptNameDiff,                  required_argument,  NULL,     kOptDiff },
 
     { NULL, 0, NULL, 0 }  // sentinel to terminate list
 };
@@ -85,6 +93,8 @@ typedef struct {
     Boolean            printJSON;
     Boolean            printPrelinkInfoDict;
     const char       * outputPath;
+    const char       * decompressedPath;
+    const char       * diffPath;
 } KclistArgs;
 
 /*
@@ -93,7 +103,7 @@ typedef struct {
  * has physically copied the kernel cache such that the physical to virtual mapping is a simple offset.
  */
 struct kcmap_entry {
-    struct load_command *kc_lcp;
+    const struct load_command *kc_lcp;
     /* offset and size in device memory as setup by iBoot */
     uint64_t             va_start;
     uint64_t             va_end;
@@ -102,6 +112,11 @@ struct kcmap_entry {
     uint64_t             kc_end;
 };
 
+/*
+ * The entries are sorted by va_start and do not overlap, so an address is
+ * translated with a binary search. createKCMap() validates the segments once
+ * and leaves out (or trims) any that overlap or fall outside the cache file.
+ */
 struct kcmap {
     const uint8_t *cache_start;
     uint64_t va_start;
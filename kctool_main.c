@@ -14,6 +14,7 @@
 
 #include "kctool_main.h"
 #include "compression.h"
+#include "prelink_info.h"
 
 /*******************************************************************************
 * Program Globals
@@ -32,10 +33,17 @@ int main(int argc, char * const argv[])
     CFDataRef            rawKernelcache     = NULL;  // must release
     CFDataRef            kernelcacheImage   = NULL;  // must release
 
-    void               * prelinkInfoSect    = NULL;
+    const MachOViewSection * prelinkInfoSect = NULL;
 
     const char         * prelinkInfoBytes   = NULL;
-    CFPropertyListRef    prelinkInfoPlist   = NULL;  // must release
+    PrelinkIndexRef      prelinkIndex       = NULL;  // must prelinkIndexClose()
+    PrelinkInfoRef       prelinkInfo        = NULL;  // must prelinkInfoFree()
+    CFSetRef             kextIDs            = NULL;  // must release
+    CFStringRef          kextInfoKeys[]     = {
+        kCFBundleIdentifierKey,
+        CFSTR(kPrelinkExecutableSourceKey),
+        CFSTR(kPrelinkExecutableSizeKey),
+    };
 
     bzero(&toolArgs, sizeof(toolArgs));
 
@@ -86,6 +94,8 @@ int main(int argc, char * const argv[])
         toolArgs.archInfo = NXGetArchInfoFromCpuType(fat_arch->cputype, fat_arch->cpusubtype);
     }
 
+    /* Only read here, so map the kernelcache rather than copy it in. */
+    setMapMachOSlices(true);
     rawKernelcache = readMachOSliceForArch(toolArgs.kernelcachePath, toolArgs.archInfo,
         /* checkArch */ FALSE);
     if (!rawKernelcache) {
@@ -96,7 +106,12 @@ int main(int argc, char * const argv[])
     }
 
     if (MAGIC32(CFDataGetBytePtr(rawKernelcache)) == OSSwapHostToBigInt32('comp')) {
-        kernelcacheImage = uncompressPrelinkedSlice(rawKernelcache);
+        if (toolArgs.decompressedPath) {
+            kernelcacheImage = uncompressPrelinkedSliceToFile(rawKernelcache,
+                toolArgs.decompressedPath);
+        } else {
+            kernelcacheImage = uncompressPrelinkedSlice(rawKernelcache);
+        }
         if (!kernelcacheImage) {
             OSKextLog(/* kext */ NULL,
                 kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -108,18 +123,19 @@ int main(int argc, char * const argv[])
     }
 
     toolArgs.kernelcacheImageBytes = CFDataGetBytePtr(kernelcacheImage);
+    toolArgs.kernelcacheImageSize = CFDataGetLength(kernelcacheImage);
 
-    if (ISMACHO64(MAGIC32(toolArgs.kernelcacheImageBytes))) {
-        prelinkInfoSect = (void *)macho_get_section_by_name_64(
-            (struct mach_header_64 *)toolArgs.kernelcacheImageBytes,
-            "__PRELINK_INFO", "__info");
-
-    } else {
-        prelinkInfoSect = (void *)macho_get_section_by_name(
-            (struct mach_header *)toolArgs.kernelcacheImageBytes,
-            "__PRELINK_INFO", "__info");
+    toolArgs.kernelcacheView = machoViewCreate(toolArgs.kernelcacheImageBytes,
+        toolArgs.kernelcacheImageSize);
+    if (!toolArgs.kernelcacheView) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+            "Kernelcache is not a valid Mach-O file.");
+        goto finish;
     }
 
+    prelinkInfoSect = machoViewGetSectionByName(toolArgs.kernelcacheView,
+        "__PRELINK_INFO", "__info");
     if (!prelinkInfoSect) {
         OSKextLog(/* kext */ NULL,
             kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -127,16 +143,36 @@ int main(int argc, char * const argv[])
         goto finish;
     }
 
-    if (ISMACHO64(MAGIC32(toolArgs.kernelcacheImageBytes))) {
-        prelinkInfoBytes = ((char *)toolArgs.kernelcacheImageBytes) +
-            ((struct section_64 *)prelinkInfoSect)->offset;
+    prelinkInfoBytes = ((char *)toolArgs.kernelcacheImageBytes) +
+        prelinkInfoSect->offset;
+
+   /* Only the one kext's address and size are needed, so take them from the
+    * prelink index if kcgen/kextcache wrote a current one, or else index the
+    * prelink info and copy out just those rather than unserializing all of it.
+    */
+    kextIDs = CFSetCreate(kCFAllocatorDefault, (const void **)&toolArgs.kextID,
+        1, &kCFTypeSetCallBacks);
+    if (!kextIDs) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    prelinkIndex = prelinkIndexOpen(toolArgs.kernelcachePath,
+        machoViewGetUUID(toolArgs.kernelcacheView),
+        prelinkInfoBytes, prelinkInfoSect->size);
+    if (prelinkIndex) {
+        toolArgs.kernelcacheInfoPlist = prelinkIndexCopyInfoForKexts(prelinkIndex,
+            kextIDs);
     } else {
-        prelinkInfoBytes = ((char *)toolArgs.kernelcacheImageBytes) +
-            ((struct section *)prelinkInfoSect)->offset;
+        prelinkInfo = prelinkInfoCreate(prelinkInfoBytes, prelinkInfoSect->size);
+        if (prelinkInfo) {
+            toolArgs.kernelcacheInfoPlist = prelinkInfoCopyInfoForKexts(prelinkInfo,
+                kextIDs, kextInfoKeys, sizeof(kextInfoKeys) / sizeof(kextInfoKeys[0]));
+        }
+    }
+    if (!toolArgs.kernelcacheInfoPlist) {
+        toolArgs.kernelcacheInfoPlist = (CFPropertyListRef)IOCFUnserialize(prelinkInfoBytes,
+            kCFAllocatorDefault, /* options */ 0, /* errorString */ NULL);
     }
-
-    toolArgs.kernelcacheInfoPlist = (CFPropertyListRef)IOCFUnserialize(prelinkInfoBytes,
-        kCFAllocatorDefault, /* options */ 0, /* errorString */ NULL);
     if (!toolArgs.kernelcacheInfoPlist) {
         OSKextLog(/* kext */ NULL,
             kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -154,6 +190,12 @@ int main(int argc, char * const argv[])
 finish:
 
     SAFE_RELEASE(toolArgs.kernelcacheInfoPlist);
+    SAFE_RELEASE(kextIDs);
+    prelinkIndexClose(prelinkIndex);
+    prelinkInfoFree(prelinkInfo);
+    if (toolArgs.kernelcacheView) {
+        machoViewFree(toolArgs.kernelcacheView);
+    }
     SAFE_RELEASE(kernelcacheImage);
     SAFE_RELEASE(rawKernelcache);
 
@@ -199,6 +241,10 @@ ExitStatus readArgs(
                 }
                 break;
 
+            case kOptDecompressed:
+                toolArgs->decompressedPath = optarg;
+                break;
+
             case kOptHelp:
                 usage(kUsageLevelFull);
                 result = kKctoolExitHelp;
@@ -254,40 +300,6 @@ finish:
     return result;
 }
 
-/*******************************************************************************
- *******************************************************************************/
-static struct section *
-getSectionByName(const UInt8 *file, const char *segname, const char *sectname)
-{
-    struct mach_header *machHeader;
-    struct load_command *cmdHeader;
-    struct segment_command *segmentHeader;
-    struct section *sectionHeader;
-    u_long offset;
-    u_int i, j;
-
-    machHeader = (struct mach_header *) file;
-    if (machHeader->magic != MH_MAGIC) return NULL;
-
-    offset = sizeof(*machHeader);
-    for (i = 0; i < machHeader->ncmds; ++i, offset+=cmdHeader->cmdsize) {
-        cmdHeader = (struct load_command *) (file + offset);
-        if (cmdHeader->cmd != LC_SEGMENT) continue;
-
-        segmentHeader = (struct segment_command *)cmdHeader;
-        sectionHeader = (struct section *) (file + offset + sizeof(*segmentHeader));
-        for (j = 0; j < segmentHeader->nsects; ++j, ++sectionHeader) {
-            if (!strncmp(sectionHeader->segname, segname, sizeof(sectionHeader->segname)) &&
-                !strncmp(sectionHeader->sectname, sectname, sizeof(sectionHeader->sectname)))
-            {
-                return sectionHeader;
-            }
-        }
-    }
-
-    return NULL;
-}
-
 /*******************************************************************************
 *******************************************************************************/
 ExitStatus printKextInfo(KctoolArgs * toolArgs)
@@ -318,23 +330,15 @@ ExitStatus printKextInfo(KctoolArgs * toolArgs)
             uint64_t      kextSize   = 0;
             u_long        kextOffset = 0;
             const UInt8 * kextMachO  = NULL;  // do not free
-            void        * section    = NULL;  // do not free
+            MachOViewRef  kextView   = NULL;  // must machoViewFree()
+            const MachOViewSection * section = NULL;  // do not free
 
             if (!getKextAddressAndSize(kextInfoDict, &kextAddr, &kextSize)) {
                 goto finish;
             }
 
-            if (ISMACHO64(MAGIC32(toolArgs->kernelcacheImageBytes))) {
-                section = (void *)macho_get_section_by_name_64(
-                    (struct mach_header_64 *)toolArgs->kernelcacheImageBytes,
-                    kPrelinkTextSegment, kPrelinkTextSection);
-
-            } else {
-                section = (void *)macho_get_section_by_name(
-                    (struct mach_header *)toolArgs->kernelcacheImageBytes,
-                    kPrelinkTextSegment, kPrelinkTextSection);
-            }
-
+            section = machoViewGetSectionByName(toolArgs->kernelcacheView,
+                kPrelinkTextSegment, kPrelinkTextSection);
             if (!section) {
                 OSKextLog(/* kext */ NULL,
                     kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
@@ -343,27 +347,28 @@ ExitStatus printKextInfo(KctoolArgs * toolArgs)
                 goto finish;
             }
 
-            if (ISMACHO64(MAGIC32(toolArgs->kernelcacheImageBytes))) {
-                kextOffset = ((struct section_64 *)section)->offset + (u_long)(kextAddr - ((struct section_64 *)section)->addr);
-            } else {
-                kextOffset = ((struct section *)section)->offset + (u_long)(kextAddr - ((struct section *)section)->addr);
+            kextOffset = section->offset + (u_long)(kextAddr - section->addr);
+            if (kextOffset >= (u_long)toolArgs->kernelcacheImageSize) {
+                OSKextLogCFString(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+                    CFSTR("Kext %@ lies outside the kernelcache."),
+                    toolArgs->kextID);
+                goto finish;
             }
             kextMachO = toolArgs->kernelcacheImageBytes + kextOffset;
 
-            /* Find the requested section's file offset and size */
-
-            if (ISMACHO64(MAGIC32(toolArgs->kernelcacheImageBytes))) {
-                section = (void *)macho_get_section_by_name_64(
-                    (struct mach_header_64 *)kextMachO,
+            /* Find the requested section's file offset and size. Sections
+             * are matched on their own segment name, as 32-bit kexts don't
+             * have a __TEXT segment; they just have a single segment named ""
+             * with all the sections dumped under it.
+             */
+            kextView = machoViewCreate(kextMachO,
+                (size_t)toolArgs->kernelcacheImageSize - kextOffset);
+            if (kextView) {
+                section = machoViewGetSectionByName(kextView,
                     toolArgs->segmentName, toolArgs->sectionName);
-
             } else {
-               /* macho_get_section_by_name doesn't work as the kexts don't have a __TEXT segment.
-                * They just have a single segment named "" with all the sections dumped under it.
-                */
-                section = (void *)getSectionByName(
-                    kextMachO,
-                    toolArgs->segmentName, toolArgs->sectionName);
+                section = NULL;
             }
 
             if (!section) {
@@ -371,20 +376,21 @@ ExitStatus printKextInfo(KctoolArgs * toolArgs)
                     kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
                     CFSTR("Cannot find %s,%s in kext %@\n"),
                     toolArgs->segmentName, toolArgs->sectionName, toolArgs->kextID);
+                if (kextView) {
+                    machoViewFree(kextView);
+                }
                 goto finish;
             }
 
-            if (ISMACHO64(MAGIC32(toolArgs->kernelcacheImageBytes))) {
+            if (machoViewIs64Bit(kextView)) {
                 printf("%#llx %#lx %#llx\n",
-                    ((struct section_64 *)section)->addr,
-                    kextOffset + ((struct section_64 *)section)->offset,
-                    ((struct section_64 *)section)->size);
+                    section->addr, kextOffset + section->offset, section->size);
             } else {
                 printf("%#x %#lx %#x\n",
-                    ((struct section *)section)->addr,
-                    kextOffset + ((struct section *)section)->offset,
-                    ((struct section *)section)->size);
+                    (uint32_t)section->addr, kextOffset + section->offset,
+                    (uint32_t)section->size);
             }
+            machoViewFree(kextView);
 
             result = EX_OK;
             break;
@@ -444,7 +450,7 @@ finish:
 void usage(UsageLevel usageLevel)
 {
     fprintf(stderr,
-      "usage: %1$s [-arch archname] [--] kernelcache bundle-id segment section\n"
+      "usage: %1$s [-arch archname] [-d path] [--] kernelcache bundle-id segment section\n"
       "usage: %1$s -help\n"
       "\n",
       progname);
@@ -461,6 +467,9 @@ void usage(UsageLevel usageLevel)
     fprintf(stderr, "-%s <archname>:\n"
         "        list info for architecture <archname>\n",
         kOptNameArch);
+    fprintf(stderr, "-%s (-%c) <path>:\n"
+        "        uncompress into <path> and reuse it on later runs if it is still current\n",
+        kOptNameDecompressed, kOptDecompressed);
     fprintf(stderr, "\n");
 
     fprintf(stderr, "-%s (-%c): print this message and exit\n",
@@ -11,6 +11,7 @@
 
 #include "kext_tools_util.h"
 #include "kernelcache.h"
+#include "macho_view.h"
 
 #pragma mark Basic Types & Constants
 /*******************************************************************************
@@ -36,13 +37,17 @@ enum {
 
 #define kOptArch   'a'
 
-#define kOptChars  "a:h"
+#define kOptDecompressed     'd'
+#define kOptNameDecompressed "decompressed"
+
+#define kOptChars  "a:d:h"
 
 int longopt = 0;
 
 struct option sOptInfo[] = {
     { kOptNameHelp,                  no_argument,        NULL,     kOptHelp },
     { kOptNameArch,                  required_argument,  NULL,     kOptArch },
+    { kOptNameDecompressed,          required_argument,  NULL,     kOptDecompressed },
 
     { NULL, 0, NULL, 0 }  // sentinel to terminate list
 };
@@ -54,8 +59,11 @@ typedef struct {
     CFStringRef        kextID;
     const char       * segmentName;
     const char       * sectionName;
+    const char       * decompressedPath;
 
     const UInt8      * kernelcacheImageBytes;
+    CFIndex            kernelcacheImageSize;
+    MachOViewRef       kernelcacheView;
     CFPropertyListRef  kernelcacheInfoPlist;
 
 } KctoolArgs;
@@ -11,18 +11,7 @@
 #include "compression.h"
 #include "bootcaches.h"
 
-#if EMBEDDED_HOST
-size_t lzvn_encode(void *       dst,
-                   size_t       dst_size,
-                   const void * src,
-                   size_t       src_size,
-                   void *       work);
-size_t lzvn_decode(void *       dst,
-                   size_t       dst_size,
-                   const void * src,
-                   size_t       src_size);
-size_t lzvn_encode_work_size(void);
-#else
+#if !(__i386__ || EMBEDDED_HOST)
 #include <FastCompression.h>
 #endif
 
@@ -30,6 +19,10 @@ size_t lzvn_encode_work_size(void);
 #include <mach-o/fat.h>
 #include <mach-o/swap.h>
 #include <sys/mman.h>
+#include <sys/xattr.h>
+#include <pthread.h>
+#include <dispatch/dispatch.h>
+#include <CommonCrypto/CommonDigest.h>
 
 #include <IOKit/kext/OSKext.h>
 #include <IOKit/kext/OSKextPrivate.h>
@@ -61,6 +54,48 @@ writeFatFile(
     return result;
 }
 
+/*******************************************************************************
+* Writes slice sliceIndex at sliceOffset and returns its length. Without
+* known slice sizes sliceOffset is also the file descriptor's current offset;
+* with them, writers run concurrently and must only pwrite() at sliceOffset.
+*******************************************************************************/
+typedef ExitStatus (*FatSliceWriter)(
+    int            fileDescriptor,
+    off_t          sliceOffset,
+    CFIndex        sliceIndex,
+    void         * context,
+    uint32_t     * sliceLengthOut);
+
+static ExitStatus
+writeFatFileWithSliceWriter(
+                           const char                * filePath,
+                           boolean_t                   doValidation,
+                           dev_t                       file_dev_t,
+                           ino_t                       file_ino_t,
+                           CFArrayRef                  fileArchs,
+                           FatSliceWriter              sliceWriter,
+                           void                      * sliceContext,
+                           const uint32_t            * sliceSizes,
+                           mode_t                      fileMode,
+                           const struct timeval        fileTimes[2]);
+
+/*******************************************************************************
+*******************************************************************************/
+static ExitStatus
+writeSliceData(
+    int            fileDescriptor,
+    off_t          sliceOffset,
+    CFIndex        sliceIndex,
+    void         * context,
+    uint32_t     * sliceLengthOut)
+{
+    CFDataRef sliceData = CFArrayGetValueAtIndex((CFArrayRef)context, sliceIndex);
+
+    *sliceLengthOut = (uint32_t)CFDataGetLength(sliceData);
+    return writeToFileAtOffset(fileDescriptor, CFDataGetBytePtr(sliceData),
+                               CFDataGetLength(sliceData), sliceOffset);
+}
+
 /*******************************************************************************
  *******************************************************************************/
 ExitStatus
@@ -73,13 +108,144 @@ writeFatFileWithValidation(
                            CFArrayRef                  fileArchs,
                            mode_t                      fileMode,
                            const struct timeval        fileTimes[2])
+{
+    ExitStatus   result     = EX_SOFTWARE;
+    uint32_t   * sliceSizes = NULL;  // must free
+    CFIndex      count      = CFArrayGetCount(fileSlices);
+    CFIndex      i          = 0;
+
+    sliceSizes = calloc(count ? count : 1, sizeof(*sliceSizes));
+    if (!sliceSizes) {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+    for (i = 0; i < count; i++) {
+        sliceSizes[i] = (uint32_t)CFDataGetLength(CFArrayGetValueAtIndex(fileSlices, i));
+    }
+
+    result = writeFatFileWithSliceWriter(filePath,
+                                         doValidation,
+                                         file_dev_t,
+                                         file_ino_t,
+                                         fileArchs,
+                                         &writeSliceData,
+                                         (void *)fileSlices,
+                                         sliceSizes,
+                                         fileMode,
+                                         fileTimes);
+
+finish:
+    SAFE_FREE(sliceSizes);
+    return result;
+}
+
+/*******************************************************************************
+* Reserves length bytes for a file about to be written, contiguously if the
+* volume can manage it, and sets its size. Allocation is only a hint.
+*******************************************************************************/
+static ExitStatus
+preallocateFile(
+    int     fileDescriptor,
+    off_t   length)
+{
+    fstore_t store;
+
+    bzero(&store, sizeof(store));
+    store.fst_flags = F_ALLOCATECONTIG | F_ALLOCATEALL;
+    store.fst_posmode = F_PEOFPOSMODE;
+    store.fst_length = length;
+    if (fcntl(fileDescriptor, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        (void)fcntl(fileDescriptor, F_PREALLOCATE, &store);
+    }
+
+    if (ftruncate(fileDescriptor, length) == -1) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                  "Can't size file - %s.", strerror(errno));
+        return EX_OSERR;
+    }
+    return EX_OK;
+}
+
+/*******************************************************************************
+* Runs sliceWriter for every slice at once, at the offsets already laid out
+* in fatArchs, and checks each slice came out at its expected size.
+*******************************************************************************/
+static ExitStatus
+writeFatSlicesConcurrently(
+    int                     fileDescriptor,
+    const struct fat_arch * fatArchs,
+    int                     numArchs,
+    FatSliceWriter          sliceWriter,
+    void                  * sliceContext,
+    const uint32_t        * sliceSizes)
+{
+    ExitStatus   result        = EX_SOFTWARE;
+    ExitStatus * sliceResults  = NULL;  // must free
+    int          i             = 0;
+
+    sliceResults = calloc(numArchs ? numArchs : 1, sizeof(*sliceResults));
+    if (!sliceResults) {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+
+    dispatch_apply(numArchs,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^(size_t slice) {
+            uint32_t sliceLength = 0;
+
+            sliceResults[slice] = sliceWriter(fileDescriptor,
+                OSSwapBigToHostInt32(fatArchs[slice].offset), slice,
+                sliceContext, &sliceLength);
+            if (sliceResults[slice] == EX_OK && sliceLength != sliceSizes[slice]) {
+                sliceResults[slice] = EX_SOFTWARE;
+            }
+        });
+
+    for (i = 0; i < numArchs; i++) {
+        if (sliceResults[i] != EX_OK) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                      "Failed to write slice %d of fat file.", i);
+            result = sliceResults[i];
+            goto finish;
+        }
+    }
+    result = EX_OK;
+
+finish:
+    SAFE_FREE(sliceResults);
+    return result;
+}
+
+/*******************************************************************************
+* Writes the fat header, then each slice in turn, then goes back to fill in
+* the slice sizes, so slices need not be in memory or of known size. When
+* sliceSizes is given the file is laid out and preallocated up front and the
+* slices are written concurrently instead. Either way the file is flushed to
+* disk once, just before it is renamed into place.
+*******************************************************************************/
+static ExitStatus
+writeFatFileWithSliceWriter(
+                           const char                * filePath,
+                           boolean_t                   doValidation,
+                           dev_t                       file_dev_t,
+                           ino_t                       file_ino_t,
+                           CFArrayRef                  fileArchs,
+                           FatSliceWriter              sliceWriter,
+                           void                      * sliceContext,
+                           const uint32_t            * sliceSizes,
+                           mode_t                      fileMode,
+                           const struct timeval        fileTimes[2])
 {
     ExitStatus        result               = EX_SOFTWARE;
     char              tmpPath[PATH_MAX];
     struct fat_header fatHeader;
-    struct fat_arch   fatArch;
-    CFDataRef         sliceData            = NULL;    // do not release
-    const uint8_t   * sliceDataPtr         = NULL;    // do not free
+    struct fat_arch * fatArchs             = NULL;    // must free
     const char *      tmpPathPtr           = tmpPath; // must unlink
     const NXArchInfo * targetArch          = NULL;    // do not free
     mode_t             procMode            = 0;
@@ -137,47 +303,103 @@ writeFatFileWithValidation(
     fatHeader.magic = OSSwapHostToBigInt32(FAT_MAGIC);
     fatHeader.nfat_arch = OSSwapHostToBigInt32(numArchs);
 
+    fatOffset = sizeof(struct fat_header) +
+    (sizeof(struct fat_arch) * numArchs);
+
+    /* Without known sizes the fat_arch table is a placeholder, filled in
+     * once slices are written.
+     */
+    fatArchs = calloc(numArchs ? numArchs : 1, sizeof(*fatArchs));
+    if (!fatArchs) {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+    if (sliceSizes) {
+        for (i = 0; i < numArchs; i++) {
+            targetArch = CFArrayGetValueAtIndex(fileArchs, i);
+
+            fatArchs[i].cputype = OSSwapHostToBigInt32(targetArch->cputype);
+            fatArchs[i].cpusubtype = OSSwapHostToBigInt32(targetArch->cpusubtype);
+            fatArchs[i].offset = OSSwapHostToBigInt32(fatOffset);
+            fatArchs[i].size = OSSwapHostToBigInt32(sliceSizes[i]);
+            fatArchs[i].align = OSSwapHostToBigInt32(0);
+
+            fatOffset += sliceSizes[i];
+        }
+        result = preallocateFile(fileDescriptor, fatOffset);
+        if (result != EX_OK) {
+            goto finish;
+        }
+    }
+
     result = writeToFile(fileDescriptor, (const UInt8 *)&fatHeader,
                          sizeof(fatHeader));
     if (result != EX_OK) {
         goto finish;
     }
+    result = writeToFile(fileDescriptor, (UInt8 *)fatArchs,
+                         sizeof(*fatArchs) * numArchs);
+    if (result != EX_OK) {
+        goto finish;
+    }
 
-    fatOffset = sizeof(struct fat_header) +
-    (sizeof(struct fat_arch) * numArchs);
-
-    for (i = 0; i < numArchs; i++) {
-        targetArch = CFArrayGetValueAtIndex(fileArchs, i);
-        sliceData = CFArrayGetValueAtIndex(fileSlices, i);
-        sliceLength = (uint32_t)CFDataGetLength(sliceData);
-
-        fatArch.cputype = OSSwapHostToBigInt32(targetArch->cputype);
-        fatArch.cpusubtype = OSSwapHostToBigInt32(targetArch->cpusubtype);
-        fatArch.offset = OSSwapHostToBigInt32(fatOffset);
-        fatArch.size = OSSwapHostToBigInt32(sliceLength);
-        fatArch.align = OSSwapHostToBigInt32(0);
-
-        result = writeToFile(fileDescriptor,
-                             (UInt8 *)&fatArch, sizeof(fatArch));
+    if (sliceSizes) {
+        result = writeFatSlicesConcurrently(fileDescriptor, fatArchs, numArchs,
+                                            sliceWriter, sliceContext, sliceSizes);
         if (result != EX_OK) {
             goto finish;
         }
+    } else {
+        /* Write out the file slices */
+        for (i = 0; i < numArchs; i++) {
+            targetArch = CFArrayGetValueAtIndex(fileArchs, i);
 
-        fatOffset += sliceLength;
-    }
+            result = sliceWriter(fileDescriptor, fatOffset, i, sliceContext,
+                                 &sliceLength);
+            if (result != EX_OK) {
+                goto finish;
+            }
 
-    /* Write out the file slices */
-    for (i = 0; i < numArchs; i++) {
-        sliceData = CFArrayGetValueAtIndex(fileSlices, i);
-        sliceDataPtr = CFDataGetBytePtr(sliceData);
-        sliceLength = (uint32_t)CFDataGetLength(sliceData);
+            fatArchs[i].cputype = OSSwapHostToBigInt32(targetArch->cputype);
+            fatArchs[i].cpusubtype = OSSwapHostToBigInt32(targetArch->cpusubtype);
+            fatArchs[i].offset = OSSwapHostToBigInt32(fatOffset);
+            fatArchs[i].size = OSSwapHostToBigInt32(sliceLength);
+            fatArchs[i].align = OSSwapHostToBigInt32(0);
 
-        result = writeToFile(fileDescriptor, sliceDataPtr, sliceLength);
-        if (result != EX_OK) {
+            fatOffset += sliceLength;
+
+            /* Writers may use pwrite(), which leaves the file offset alone. */
+            if (lseek(fileDescriptor, fatOffset, SEEK_SET) != fatOffset) {
+                OSKextLog(/* kext */ NULL,
+                          kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                          "Failed to seek in file.");
+                result = EX_OSERR;
+                goto finish;
+            }
+        }
+
+        if (pwrite(fileDescriptor, fatArchs, sizeof(*fatArchs) * numArchs,
+                   sizeof(fatHeader)) != (ssize_t)(sizeof(*fatArchs) * numArchs)) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                      "Write failed %d - %s", errno, strerror(errno));
+            result = EX_OSERR;
             goto finish;
         }
     }
 
+    /* One flush for the whole file, so the rename never exposes a file
+     * whose data isn't on disk. F_FULLFSYNC isn't supported everywhere.
+     */
+    if (fcntl(fileDescriptor, F_FULLFSYNC) == -1 && fsync(fileDescriptor) == -1) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                  "Can't flush %s - %s.", tmpPathPtr, strerror(errno));
+        result = EX_OSERR;
+        goto finish;
+    }
+
     from_base_name_size = strlen(basename((char *)tmpPathPtr)) + 1;
     if (from_base_name_size > sizeof(from_base_name)) {
         from_base_name_ptr = malloc(from_base_name_size);
@@ -260,6 +482,7 @@ writeFatFileWithValidation(
 
 finish:
 
+    SAFE_FREE(fatArchs);
     if (fileDescriptor >= 0) (void)close(fileDescriptor);
     if (tmpPathPtr) unlink(tmpPathPtr);
     if (from_dir_fd != -1) {
@@ -279,153 +502,513 @@ finish:
 }
 
 /*******************************************************************************
+* FatIndex: a file's fat header parsed once into host byte order, along with
+* each slice's arch and UUID. Thin files get a single slice covering the whole
+* file. Indexes are cached by file identity (device, inode, size and change
+* times), so opening the same file again reuses its index until it changes.
 *******************************************************************************/
-void *
-mapAndSwapFatHeaderPage(
-    int fileDescriptor)
+#define FAT_INDEX_CACHE_SIZE  (4)
+
+struct fat_index {
+    uint32_t            refCount;
+    dev_t               dev;
+    ino_t               ino;
+    off_t               fileSize;
+    struct timespec     mtime;
+    struct timespec     ctime;
+    u_char            * headerPage;     // first page, fat header swapped
+    Boolean             isFat;
+    CFIndex             sliceCount;
+    FatIndexSlice     * slices;
+};
+
+static pthread_mutex_t  sFatIndexLock = PTHREAD_MUTEX_INITIALIZER;
+static FatIndexRef      sFatIndexCache[FAT_INDEX_CACHE_SIZE];
+static unsigned int     sFatIndexNext = 0;
+
+/*******************************************************************************
+* Finds the LC_UUID of the (host byte order) Mach-O header at fileOffset.
+* Compressed prelinked slices have no readable header and so no UUID.
+*******************************************************************************/
+static Boolean
+readSliceUUID(
+    int         fileDescriptor,
+    off_t       fileOffset,
+    size_t      sliceSize,
+    uuid_t      uuidOut)
 {
-    void              * result          = NULL;
-    void              * headerPage      = NULL;  // must unmapFatHeaderPage()
-    struct fat_header * fatHeader       = NULL;  // do not free
-    struct fat_arch   * fatArch         = NULL;  // do not free
-    struct stat         sb              = {};
+    Boolean                 result      = false;
+    struct mach_header_64   machHdr;
+    u_char                * cmds        = NULL;  // must free
+    size_t                  headerSize  = 0;
+    size_t                  offset      = 0;
+    uint32_t                i           = 0;
+
+    if (sliceSize < sizeof(machHdr) ||
+        pread(fileDescriptor, &machHdr, sizeof(machHdr), fileOffset) !=
+            (ssize_t)sizeof(machHdr)) {
+        goto finish;
+    }
+    if (machHdr.magic == MH_MAGIC_64) {
+        headerSize = sizeof(struct mach_header_64);
+    } else if (machHdr.magic == MH_MAGIC) {
+        headerSize = sizeof(struct mach_header);
+    } else {
+        goto finish;
+    }
+    if (machHdr.sizeofcmds > sliceSize - headerSize) {
+        goto finish;
+    }
 
-    if (fstat(fileDescriptor, &sb)) {
-        OSKextLog(/* kext */ NULL,
-                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
-                "Failed to stat file header page: %d (%s)", errno, strerror(errno));
+    cmds = malloc(machHdr.sizeofcmds);
+    if (!cmds ||
+        pread(fileDescriptor, cmds, machHdr.sizeofcmds, fileOffset + headerSize) !=
+            (ssize_t)machHdr.sizeofcmds) {
         goto finish;
     }
 
-    /* mmap will happily lie if the file is there, but smaller than a page. */
-    if (sb.st_size < (long long)PAGE_SIZE) {
+    for (i = 0; i < machHdr.ncmds; i++) {
+        struct load_command * lc = (struct load_command *)(cmds + offset);
+
+        if (offset + sizeof(*lc) > machHdr.sizeofcmds ||
+            lc->cmdsize < sizeof(*lc) ||
+            lc->cmdsize > machHdr.sizeofcmds - offset) {
+            break;
+        }
+        if (lc->cmd == LC_UUID && lc->cmdsize >= sizeof(struct uuid_command)) {
+            memcpy(uuidOut, ((struct uuid_command *)lc)->uuid, sizeof(uuid_t));
+            result = true;
+            break;
+        }
+        offset += lc->cmdsize;
+    }
+
+finish:
+    SAFE_FREE(cmds);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static Boolean
+fatIndexMatchesStat(
+    FatIndexRef             index,
+    const struct stat     * statBuf)
+{
+    return index->dev == statBuf->st_dev &&
+           index->ino == statBuf->st_ino &&
+           index->fileSize == statBuf->st_size &&
+           index->mtime.tv_sec == statBuf->st_mtimespec.tv_sec &&
+           index->mtime.tv_nsec == statBuf->st_mtimespec.tv_nsec &&
+           index->ctime.tv_sec == statBuf->st_ctimespec.tv_sec &&
+           index->ctime.tv_nsec == statBuf->st_ctimespec.tv_nsec;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static void
+fatIndexFree(
+    FatIndexRef index)
+{
+    if (index) {
+        SAFE_FREE(index->headerPage);
+        SAFE_FREE(index->slices);
+        free(index);
+    }
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static FatIndexRef
+fatIndexCreate(
+    int                     fileDescriptor,
+    const struct stat     * statBuf)
+{
+    FatIndexRef         result      = NULL;
+    FatIndexRef         index       = NULL;  // must fatIndexFree()
+    struct fat_header * fatHeader   = NULL;  // do not free
+    struct fat_arch   * fatArch     = NULL;  // do not free
+    CFIndex             i           = 0;
+
+    /* mmap will happily lie if the file is there, but smaller than a page;
+     * keep the same limit now that the page is read.
+     */
+    if (statBuf->st_size < (long long)PAGE_SIZE) {
         OSKextLog(/* kext */ NULL,
                 kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
                 "Prelinked kernel looks invalid (smaller than a page?)");
         goto finish;
     }
 
-    /* Map the first page to read the fat headers. */
-    headerPage = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
-        MAP_FILE | MAP_PRIVATE, fileDescriptor, 0);
-    if (MAP_FAILED == headerPage) {
+    index = calloc(1, sizeof(*index));
+    if (!index) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    index->refCount = 1;
+    index->dev = statBuf->st_dev;
+    index->ino = statBuf->st_ino;
+    index->fileSize = statBuf->st_size;
+    index->mtime = statBuf->st_mtimespec;
+    index->ctime = statBuf->st_ctimespec;
+
+    index->headerPage = malloc(PAGE_SIZE);
+    if (!index->headerPage) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    if (pread(fileDescriptor, index->headerPage, PAGE_SIZE, 0) != (ssize_t)PAGE_SIZE) {
         OSKextLog(/* kext */ NULL,
                 kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
-                "Failed to map file header page.");
+                "Failed to read file header page: %d (%s)", errno, strerror(errno));
         goto finish;
     }
 
     /* Make sure that the fat header, if any, is swapped to the host's byte
      * order.
      */
-
-    fatHeader = (struct fat_header *) headerPage;
+    fatHeader = (struct fat_header *) index->headerPage;
     fatArch = (struct fat_arch *) (&fatHeader[1]);
 
     if (fatHeader->magic == FAT_CIGAM) {
         swap_fat_header(fatHeader, NXHostByteOrder());
+        if (fatHeader->nfat_arch >
+            (PAGE_SIZE - sizeof(*fatHeader)) / sizeof(*fatArch)) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "Fat header has too many archs: %u.", fatHeader->nfat_arch);
+            goto finish;
+        }
         swap_fat_arch(fatArch, fatHeader->nfat_arch, NXHostByteOrder());
     }
 
-    result = headerPage;
-    headerPage = NULL;
-
-finish:
-    if (headerPage && headerPage != MAP_FAILED) unmapFatHeaderPage(headerPage);
+    index->isFat = (fatHeader->magic == FAT_MAGIC && fatHeader->nfat_arch);
+    index->sliceCount = index->isFat ? fatHeader->nfat_arch : 1;
+    index->slices = calloc(index->sliceCount, sizeof(*index->slices));
+    if (!index->slices) {
+        OSKextLogMemError();
+        goto finish;
+    }
 
-    return result;
-}
+    if (index->isFat) {
+        for (i = 0; i < index->sliceCount; i++) {
+            FatIndexSlice * slice = &index->slices[i];
 
-/*******************************************************************************
-*******************************************************************************/
-void
-unmapFatHeaderPage(
-    void *headerPage)
-{
-    munmap(headerPage, PAGE_SIZE);
-}
+            slice->archInfo = NXGetArchInfoFromCpuType(fatArch[i].cputype,
+                fatArch[i].cpusubtype);
+            slice->offset = fatArch[i].offset;
+            slice->size = fatArch[i].size;
+            slice->align = fatArch[i].align;
+        }
+    } else {
+        /* getThinHeaderPageArch() swaps the mach header in place; do it
+         * here so later copies of the page are already in host order.
+         */
+        index->slices[0].archInfo = getThinHeaderPageArch(index->headerPage);
+        index->slices[0].offset = 0;
+        index->slices[0].size = (size_t)statBuf->st_size;
+    }
 
-/*******************************************************************************
-*******************************************************************************/
-struct fat_arch *
-getFirstFatArch(
-    u_char *headerPage)
-{
-    struct fat_header * fatHeader       = NULL;
-    struct fat_arch   * fatArch         = NULL;
+    for (i = 0; i < index->sliceCount; i++) {
+        FatIndexSlice * slice = &index->slices[i];
 
-    fatHeader = (struct fat_header *) headerPage;
-    if (fatHeader->magic != FAT_MAGIC || !fatHeader->nfat_arch) {
-            goto finish;
-        }
+        slice->hasUUID = readSliceUUID(fileDescriptor, slice->offset,
+                                       slice->size, slice->uuid);
+    }
 
-    fatArch = (struct fat_arch *) (&fatHeader[1]);
+    result = index;
+    index = NULL;
 
 finish:
-    return fatArch;
+    fatIndexFree(index);
+    return result;
 }
 
 /*******************************************************************************
+* Returns the index for the file open on fileDescriptor, parsing it only if
+* no cached index matches the file as it is now. Release with fatIndexRelease().
 *******************************************************************************/
-struct fat_arch *
-getNextFatArch(
-    u_char *headerPage,
-    struct fat_arch *prevArch)
+FatIndexRef
+fatIndexCopyWith_fd(
+    int fileDescriptor)
 {
-    struct fat_header * fatHeader       = NULL;
-    struct fat_arch   * firstArch       = NULL;
-    struct fat_arch   * nextArch        = NULL;
-    unsigned int numArchs;
+    FatIndexRef     result  = NULL;
+    FatIndexRef     evicted = NULL;  // must fatIndexRelease()
+    struct stat     statBuf = {};
+    unsigned int    i       = 0;
 
-    fatHeader = (struct fat_header *) headerPage;
-    if (fatHeader->magic != FAT_MAGIC) {
+    if (fstat(fileDescriptor, &statBuf)) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                "Failed to stat file header page: %d (%s)", errno, strerror(errno));
         goto finish;
     }
 
-    firstArch = (struct fat_arch *) (&fatHeader[1]);
-    nextArch = &prevArch[1];
-    numArchs = (unsigned int)(nextArch - firstArch);
+    pthread_mutex_lock(&sFatIndexLock);
+    for (i = 0; i < FAT_INDEX_CACHE_SIZE; i++) {
+        if (sFatIndexCache[i] && fatIndexMatchesStat(sFatIndexCache[i], &statBuf)) {
+            result = sFatIndexCache[i];
+            result->refCount++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sFatIndexLock);
+    if (result) {
+        goto finish;
+    }
 
-    if (numArchs >= fatHeader->nfat_arch) {
-        nextArch = NULL;
+    result = fatIndexCreate(fileDescriptor, &statBuf);
+    if (!result) {
         goto finish;
     }
 
+    pthread_mutex_lock(&sFatIndexLock);
+    evicted = sFatIndexCache[sFatIndexNext];
+    sFatIndexCache[sFatIndexNext] = result;
+    sFatIndexNext = (sFatIndexNext + 1) % FAT_INDEX_CACHE_SIZE;
+    result->refCount++;  // for the cache
+    pthread_mutex_unlock(&sFatIndexLock);
+
 finish:
-    return nextArch;
+    fatIndexRelease(evicted);
+    return result;
 }
 
 /*******************************************************************************
 *******************************************************************************/
-struct fat_arch *
-getFatArchForArchInfo(
-    u_char *headerPage,
-    const NXArchInfo *archInfo)
+void
+fatIndexRelease(
+    FatIndexRef index)
 {
-    struct fat_header * fatHeader       = NULL;
-    struct fat_arch   * fatArch         = NULL;
+    uint32_t refCount = 0;
 
-    fatHeader = (struct fat_header *)headerPage;
+    if (!index) {
+        return;
+    }
+    pthread_mutex_lock(&sFatIndexLock);
+    refCount = --index->refCount;
+    pthread_mutex_unlock(&sFatIndexLock);
 
-    if (fatHeader->magic != FAT_MAGIC) {
-        goto finish;
+    if (!refCount) {
+        fatIndexFree(index);
     }
+}
 
-    fatArch = (struct fat_arch *)(&fatHeader[1]);
-    fatArch = NXFindBestFatArch(archInfo->cputype, archInfo->cpusubtype,
-        fatArch, fatHeader->nfat_arch);
+/*******************************************************************************
+*******************************************************************************/
+Boolean
+fatIndexIsFat(
+    FatIndexRef index)
+{
+    return index->isFat;
+}
 
-finish:
-    return fatArch;
+/*******************************************************************************
+*******************************************************************************/
+CFIndex
+fatIndexGetSliceCount(
+    FatIndexRef index)
+{
+    return index->sliceCount;
 }
 
 /*******************************************************************************
 *******************************************************************************/
-const NXArchInfo *
-getThinHeaderPageArch(
-    const void *headerPage)
+const FatIndexSlice *
+fatIndexGetSlice(
+    FatIndexRef index,
+    CFIndex     sliceIndex)
 {
-    const NXArchInfo          * result          = NULL;
+    if (sliceIndex < 0 || sliceIndex >= index->sliceCount) {
+        return NULL;
+    }
+    return &index->slices[sliceIndex];
+}
+
+/*******************************************************************************
+* Returns the best slice for archInfo, or NULL for a thin file or if the fat
+* file has no slice that runs on archInfo.
+*******************************************************************************/
+const FatIndexSlice *
+fatIndexGetSliceForArch(
+    FatIndexRef         index,
+    const NXArchInfo  * archInfo)
+{
+    struct fat_header * fatHeader   = (struct fat_header *)index->headerPage;
+    struct fat_arch   * fatArch     = NULL;  // do not free
+
+    if (!index->isFat) {
+        return NULL;
+    }
+    fatArch = NXFindBestFatArch(archInfo->cputype, archInfo->cpusubtype,
+        (struct fat_arch *)(&fatHeader[1]), fatHeader->nfat_arch);
+    if (!fatArch) {
+        return NULL;
+    }
+    return &index->slices[fatArch - (struct fat_arch *)(&fatHeader[1])];
+}
+
+/*******************************************************************************
+* Returns the archs of the index's slices in the array readFatFileArchsWith*()
+* hand out, or EX_OK and no array if a thin file's arch can't be determined.
+*******************************************************************************/
+Boolean archInfoEqualityCallback(const void *v1, const void *v2);
+
+static ExitStatus
+copyFatIndexArchs(
+    FatIndexRef         index,
+    CFMutableArrayRef * archsOut)
+{
+    ExitStatus          result          = EX_SOFTWARE;
+    CFMutableArrayRef   fileArchs       = NULL;         // must release
+    CFArrayCallBacks    callbacks       = { 0, NULL, NULL, NULL, archInfoEqualityCallback };
+    CFIndex             i               = 0;
+
+    if (!createCFMutableArray(&fileArchs, &callbacks))
+    {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+
+    if (index->isFat) {
+        for (i = 0; i < index->sliceCount; i++) {
+            CFArrayAppendValue(fileArchs, index->slices[i].archInfo);
+        }
+    } else if (index->slices[0].archInfo) {
+        CFArrayAppendValue(fileArchs, index->slices[0].archInfo);
+    } else {
+        // We can't determine the arch information, so don't return any
+        archsOut = NULL;
+    }
+
+    if (archsOut) *archsOut = (CFMutableArrayRef) CFRetain(fileArchs);
+    result = EX_OK;
+
+finish:
+    SAFE_RELEASE(fileArchs);
+    return result;
+}
+
+/*******************************************************************************
+* Returns a private copy of the file's first page with any fat header swapped
+* to host byte order, taken from the file's FatIndex.
+*******************************************************************************/
+void *
+mapAndSwapFatHeaderPage(
+    int fileDescriptor)
+{
+    void              * result          = NULL;
+    FatIndexRef         index           = NULL;  // must fatIndexRelease()
+
+    index = fatIndexCopyWith_fd(fileDescriptor);
+    if (!index) {
+        goto finish;
+    }
+
+    result = malloc(PAGE_SIZE);
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    memcpy(result, index->headerPage, PAGE_SIZE);
+
+finish:
+    fatIndexRelease(index);
+
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+void
+unmapFatHeaderPage(
+    void *headerPage)
+{
+    free(headerPage);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+struct fat_arch *
+getFirstFatArch(
+    u_char *headerPage)
+{
+    struct fat_header * fatHeader       = NULL;
+    struct fat_arch   * fatArch         = NULL;
+
+    fatHeader = (struct fat_header *) headerPage;
+    if (fatHeader->magic != FAT_MAGIC || !fatHeader->nfat_arch) {
+            goto finish;
+        }
+
+    fatArch = (struct fat_arch *) (&fatHeader[1]);
+
+finish:
+    return fatArch;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+struct fat_arch *
+getNextFatArch(
+    u_char *headerPage,
+    struct fat_arch *prevArch)
+{
+    struct fat_header * fatHeader       = NULL;
+    struct fat_arch   * firstArch       = NULL;
+    struct fat_arch   * nextArch        = NULL;
+    unsigned int numArchs;
+
+    fatHeader = (struct fat_header *) headerPage;
+    if (fatHeader->magic != FAT_MAGIC) {
+        goto finish;
+    }
+
+    firstArch = (struct fat_arch *) (&fatHeader[1]);
+    nextArch = &prevArch[1];
+    numArchs = (unsigned int)(nextArch - firstArch);
+
+    if (numArchs >= fatHeader->nfat_arch) {
+        nextArch = NULL;
+        goto finish;
+    }
+
+finish:
+    return nextArch;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+struct fat_arch *
+getFatArchForArchInfo(
+    u_char *headerPage,
+    const NXArchInfo *archInfo)
+{
+    struct fat_header * fatHeader       = NULL;
+    struct fat_arch   * fatArch         = NULL;
+
+    fatHeader = (struct fat_header *)headerPage;
+
+    if (fatHeader->magic != FAT_MAGIC) {
+        goto finish;
+    }
+
+    fatArch = (struct fat_arch *)(&fatHeader[1]);
+    fatArch = NXFindBestFatArch(archInfo->cputype, archInfo->cpusubtype,
+        fatArch, fatHeader->nfat_arch);
+
+finish:
+    return fatArch;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+const NXArchInfo *
+getThinHeaderPageArch(
+    const void *headerPage)
+{
+    const NXArchInfo          * result          = NULL;
     struct mach_header        * machHdr         = NULL;
     struct mach_header_64     * machHdr64       = NULL;
     Boolean                     is32Bit         = true;
@@ -472,18 +1055,16 @@ readFatFileArchsWith_fd(
                          CFMutableArrayRef * archsOut)
 {
     ExitStatus          result          = EX_SOFTWARE;
-    void              * headerPage      = NULL;         // must unmapFatHeaderPage()
+    FatIndexRef         index           = NULL;         // must fatIndexRelease()
 
-    /* Map the fat headers in */
-
-    headerPage = mapAndSwapFatHeaderPage(the_fd);
-    if (!headerPage) {
+    index = fatIndexCopyWith_fd(the_fd);
+    if (!index) {
         goto finish;
     }
 
-    result = readFatFileArchsWithHeader(headerPage, archsOut);
+    result = copyFatIndexArchs(index, archsOut);
 finish:
-    if (headerPage) unmapFatHeaderPage(headerPage);
+    fatIndexRelease(index);
 
     return result;
 }
@@ -496,7 +1077,6 @@ readFatFileArchsWithPath(
                          CFMutableArrayRef * archsOut)
 {
     ExitStatus          result          = EX_SOFTWARE;
-    void              * headerPage      = NULL;         // must unmapFatHeaderPage()
     int                 fileDescriptor  = 0;            // must close()
 
     /* Open the file. */
@@ -506,17 +1086,9 @@ readFatFileArchsWithPath(
         goto finish;
     }
 
-    /* Map the fat headers in */
-
-    headerPage = mapAndSwapFatHeaderPage(fileDescriptor);
-    if (!headerPage) {
-        goto finish;
-    }
-
-    result = readFatFileArchsWithHeader(headerPage, archsOut);
+    result = readFatFileArchsWith_fd(fileDescriptor, archsOut);
 finish:
     if (fileDescriptor >= 0) close(fileDescriptor);
-    if (headerPage) unmapFatHeaderPage(headerPage);
 
     return result;
 }
@@ -627,8 +1199,9 @@ readMachOSlicesWith_fd(
     CFMutableArrayRef   fileArchs       = NULL;         // release
     CFDataRef           sliceData       = NULL;         // release
     u_char            * fileBuf         = NULL;         // must free
-    void              * headerPage      = NULL;         // must unmapFatHeaderPage()
-    struct fat_arch   * fatArch         = NULL;         // do not free
+    FatIndexRef         index           = NULL;         // must fatIndexRelease()
+    const FatIndexSlice * slice         = NULL;         // do not free
+    CFIndex             i               = 0;
 
     /* Create an array to hold the fat slices */
 
@@ -643,38 +1216,31 @@ readMachOSlicesWith_fd(
         goto finish;
     }
 
-    /* Map the fat headers in */
+    /* Get the file's fat index, parsing the headers only if this file
+     * hasn't been seen in its current state.
+     */
 
-    headerPage = mapAndSwapFatHeaderPage(the_fd);
-    if (!headerPage) {
+    index = fatIndexCopyWith_fd(the_fd);
+    if (!index) {
         goto finish;
     }
 
     /* If the file is fat, read the slices into separate objects.  If not,
-     * read the whole file into one large slice.
+     * the index has one slice covering the whole file.
      */
 
-    fatArch = getFirstFatArch(headerPage);
-    if (fatArch) {
-        while (fatArch) {
-            sliceData = readMachOSlice(the_fd,
-                                       fatArch->offset, fatArch->size);
-            if (!sliceData) goto finish;
-
-            CFArrayAppendValue(fileSlices, sliceData);
-            fatArch = getNextFatArch(headerPage, fatArch);
-            CFRelease(sliceData); // drop ref from readMachOSlice()
-            sliceData = NULL;
-        }
-    } else {
-        sliceData = readMachOSlice(the_fd, 0, (size_t)statBuf.st_size);
+    for (i = 0; i < fatIndexGetSliceCount(index); i++) {
+        slice = fatIndexGetSlice(index, i);
+        sliceData = readMachOSlice(the_fd, slice->offset, slice->size);
         if (!sliceData) goto finish;
 
         CFArrayAppendValue(fileSlices, sliceData);
+        CFRelease(sliceData); // drop ref from readMachOSlice()
+        sliceData = NULL;
     }
 
     if (archsOut) {
-        result = readFatFileArchsWithHeader(headerPage, &fileArchs);
+        result = copyFatIndexArchs(index, &fileArchs);
         if (result != EX_OK) {
             goto finish;
         }
@@ -696,7 +1262,7 @@ finish:
     SAFE_RELEASE(fileArchs);
     SAFE_RELEASE(sliceData);
     SAFE_FREE(fileBuf);
-    if (headerPage) unmapFatHeaderPage(headerPage);
+    fatIndexRelease(index);
 
     return result;
 }
@@ -738,28 +1304,21 @@ readMachOSliceForArchWith_fd(
 {
     CFDataRef           result          = NULL; // must release
     CFDataRef           fileData        = NULL; // must release
-    void              * headerPage      = NULL; // must unmapFatHeaderPage()
-    struct fat_header * fatHeader       = NULL; // do not free
-    struct fat_arch   * fatArch         = NULL; // do not free
+    FatIndexRef         index           = NULL; // must fatIndexRelease()
+    const FatIndexSlice * slice         = NULL; // do not free
     off_t               fileSliceOffset = 0;
     size_t              fileSliceSize   = 0;
-    struct stat statBuf;
 
-    /* Map the fat headers in */
-
-    headerPage = mapAndSwapFatHeaderPage(the_fd);
-    if (!headerPage) {
+    index = fatIndexCopyWith_fd(the_fd);
+    if (!index) {
         goto finish;
     }
 
     /* Find the slice for the target architecture */
 
-    fatHeader = (struct fat_header *)headerPage;
-
-    if (archInfo && fatHeader->magic == FAT_MAGIC) {
-        fatArch = NXFindBestFatArch(archInfo->cputype, archInfo->cpusubtype,
-                                    (struct fat_arch *)(&fatHeader[1]), fatHeader->nfat_arch);
-        if (!fatArch) {
+    if (archInfo && fatIndexIsFat(index)) {
+        slice = fatIndexGetSliceForArch(index, archInfo);
+        if (!slice) {
             OSKextLog(/* kext */ NULL,
                       kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
                       "Fat file does not contain requested architecture %s.",
@@ -767,15 +1326,12 @@ readMachOSliceForArchWith_fd(
             goto finish;
         }
 
-        fileSliceOffset = fatArch->offset;
-        fileSliceSize = fatArch->size;
+        fileSliceOffset = slice->offset;
+        fileSliceSize = slice->size;
     } else {
-        if (fstat(the_fd, &statBuf)) {
-            goto finish;
-        }
-
+        /* Thin file, or no arch requested: read the whole file. */
         fileSliceOffset = 0;
-        fileSliceSize = (size_t)statBuf.st_size;
+        fileSliceSize = (size_t)index->fileSize;
     }
 
     /* Read the file */
@@ -800,11 +1356,150 @@ readMachOSliceForArchWith_fd(
 
 finish:
     SAFE_RELEASE(fileData);
-    if (headerPage) unmapFatHeaderPage(headerPage);
+    fatIndexRelease(index);
+
+    return result;
+}
+
+/*******************************************************************************
+* When set, readMachOSlice() and everything built on it return slices that
+* are mapped from the file rather than read into malloc'd memory.
+*******************************************************************************/
+static Boolean sMapMachOSlices = false;
+
+void
+setMapMachOSlices(Boolean mapSlices)
+{
+    sMapMachOSlices = mapSlices;
+}
+
+typedef struct mapped_slice {
+    void      * mapAddress;
+    size_t      mapSize;
+} MappedSlice;
+
+static void
+mappedSliceDeallocate(void * ptr __unused, void * info)
+{
+    MappedSlice * mapping = (MappedSlice *)info;
+
+    (void)munmap(mapping->mapAddress, mapping->mapSize);
+}
+
+static void
+mappedSliceRelease(const void * info)
+{
+    free((void *)info);
+}
+
+/*******************************************************************************
+* Wraps length bytes at offset within a mapping in a no-copy CFData that
+* unmaps it when freed. Takes ownership of the mapping even on failure.
+*******************************************************************************/
+static CFDataRef
+createDataWithMapping(
+    void      * mapAddress,
+    size_t      mapSize,
+    size_t      offset,
+    size_t      length)
+{
+    CFDataRef           result      = NULL;  // do not release
+    CFAllocatorRef      deallocator = NULL;  // must release
+    MappedSlice       * mapping     = NULL;  // must free
+    CFAllocatorContext  context;
+
+    mapping = malloc(sizeof(*mapping));
+    if (!mapping) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    mapping->mapAddress = mapAddress;
+    mapping->mapSize = mapSize;
+
+    bzero(&context, sizeof(context));
+    context.info = mapping;
+    context.release = &mappedSliceRelease;
+    context.deallocate = &mappedSliceDeallocate;
+
+    deallocator = CFAllocatorCreate(kCFAllocatorDefault, &context);
+    if (!deallocator) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    mapping = NULL;  // owned by deallocator now
+
+    result = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault,
+            (UInt8 *)mapAddress + offset, length, deallocator);
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    mapAddress = NULL;  // unmapped by deallocator now
+
+finish:
+    if (mapAddress) {
+        (void)munmap(mapAddress, mapSize);
+    }
+    SAFE_RELEASE(deallocator);
+    SAFE_FREE(mapping);
 
     return result;
 }
 
+/*******************************************************************************
+* Returns a CFData that refers to the slice's pages in the file's mapping;
+* the mapping goes away when the CFData is freed. The mapping is private,
+* so callers that write to the bytes get their own copy of those pages.
+*******************************************************************************/
+CFDataRef
+readMachOSliceMapped(
+    int         fileDescriptor,
+    off_t       fileOffset,
+    size_t      fileSliceSize)
+{
+    off_t       pageOffset  = 0;
+    size_t      slop        = 0;
+    void      * mapAddress  = MAP_FAILED;  // owned by returned CFData
+    struct stat statBuf;
+
+    if (!fileSliceSize) {
+        return NULL;
+    }
+
+    /* The offset and size come from the fat header; touching a mapped page
+     * past end of file raises SIGBUS, so check them against the file first.
+     */
+    if (fstat(fileDescriptor, &statBuf) == -1) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                "Failed to stat file - %s.", strerror(errno));
+        return NULL;
+    }
+    if (fileOffset < 0 || fileOffset > statBuf.st_size ||
+        fileSliceSize > (uint64_t)(statBuf.st_size - fileOffset)) {
+
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                "Failed to read file - slice extends past end of file.");
+        return NULL;
+    }
+
+    pageOffset = fileOffset & ~((off_t)PAGE_SIZE - 1);
+    slop = (size_t)(fileOffset - pageOffset);
+
+    mapAddress = mmap(NULL, fileSliceSize + slop, PROT_READ | PROT_WRITE,
+                      MAP_FILE | MAP_PRIVATE, fileDescriptor, pageOffset);
+    if (MAP_FAILED == mapAddress) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                "Failed to map file - %s.", strerror(errno));
+        return NULL;
+    }
+
+    return createDataWithMapping(mapAddress, fileSliceSize + slop, slop,
+                                 fileSliceSize);
+}
+
 /*******************************************************************************
 *******************************************************************************/
 CFDataRef
@@ -819,6 +1514,10 @@ readMachOSlice(
     ssize_t     readBytes       = 0;
     size_t      totalReadBytes  = 0;
 
+    if (sMapMachOSlices && fileSliceSize) {
+        return readMachOSliceMapped(fileDescriptor, fileOffset, fileSliceSize);
+    }
+
     /* Allocate a buffer for the file */
 
     fileBuf = malloc(fileSliceSize);
@@ -927,32 +1626,332 @@ finish:
 
 /*********************************************************************
  *********************************************************************/
-CFDataRef
-uncompressPrelinkedSlice(
-    CFDataRef      prelinkImage)
+static size_t
+prelinkedChunkTableSize(size_t imageSize)
 {
-    CFDataRef                     result              = NULL;
-    CFMutableDataRef              uncompressedImage   = NULL;  // must release
-    const PrelinkedKernelHeader * prelinkHeader       = NULL;  // do not free
-    unsigned char               * buf                 = NULL;  // do not free
-    vm_size_t                     bufsize             = 0;
-    vm_size_t                     uncompsize          = 0;
-    uint32_t                      adler32             = 0;
+    size_t chunkCount = (imageSize + PRELINK_CHUNK_SIZE - 1) / PRELINK_CHUNK_SIZE;
 
-    prelinkHeader = (PrelinkedKernelHeader *) CFDataGetBytePtr(prelinkImage);
+    return sizeof(PrelinkedChunkTable) + (chunkCount + 1) * sizeof(uint32_t);
+}
 
-    /* Verify the header information.
-     */
-    if (prelinkHeader->signature != OSSwapHostToBigInt32('comp')) {
-        OSKextLog(/* kext */ NULL,
-                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+/*********************************************************************
+ * Compresses src as independent PRELINK_CHUNK_SIZE chunks on the global
+ * concurrent queue. Each chunk is first compressed into its own
+ * uncompressed-sized slot in the output, then the chunks are packed down
+ * in order behind the chunk table. Returns the end of the packed data.
+ *********************************************************************/
+static unsigned char *
+compressPrelinkedChunks(
+    unsigned char     * dst,
+    size_t              dstSize,
+    const u_int8_t    * src,
+    size_t              srcSize,
+    uint32_t          * adler32Out)
+{
+    unsigned char       * result      = NULL;
+    PrelinkedChunkTable * chunkTable  = (PrelinkedChunkTable *)dst;
+    unsigned char       * chunkData   = NULL;  // do not free
+    uint32_t            * chunkLens   = NULL;  // must free
+    uint32_t            * chunkAdlers = NULL;  // must free
+    size_t                chunkCount  = 0;
+    size_t                tableSize   = 0;
+    uint32_t              packedSize  = 0;
+    uint32_t              adler32     = 1;
+    size_t                i           = 0;
+
+    chunkCount = (srcSize + PRELINK_CHUNK_SIZE - 1) / PRELINK_CHUNK_SIZE;
+    tableSize = prelinkedChunkTableSize(srcSize);
+    if (!chunkCount || tableSize + srcSize > dstSize) {
+        goto finish;
+    }
+    chunkData = dst + tableSize;
+
+    chunkLens = calloc(chunkCount, sizeof(*chunkLens));
+    chunkAdlers = calloc(chunkCount, sizeof(*chunkAdlers));
+    if (!chunkLens || !chunkAdlers) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    dispatch_apply(chunkCount,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^(size_t chunk) {
+            const u_int8_t * chunkSrc = src + chunk * PRELINK_CHUNK_SIZE;
+            u_int8_t       * chunkDst = chunkData + chunk * PRELINK_CHUNK_SIZE;
+            u_int8_t       * chunkEnd = NULL;
+            size_t           chunkLen = MIN(PRELINK_CHUNK_SIZE,
+                                            srcSize - chunk * PRELINK_CHUNK_SIZE);
+
+            chunkAdlers[chunk] = local_adler32((u_int8_t *)chunkSrc,
+                                               (int32_t)chunkLen);
+
+            /* Leave one byte of headroom so a compressed chunk is always
+             * shorter than a raw one.
+             */
+            chunkEnd = compress_lzss(chunkDst, (u_int32_t)(chunkLen - 1),
+                                     (u_int8_t *)chunkSrc, (u_int32_t)chunkLen);
+            if (chunkEnd) {
+                chunkLens[chunk] = (uint32_t)(chunkEnd - chunkDst);
+            } else {
+                memcpy(chunkDst, chunkSrc, chunkLen);
+                chunkLens[chunk] = (uint32_t)chunkLen;
+            }
+        });
+
+    chunkTable->chunkSize = OSSwapHostToBigInt32(PRELINK_CHUNK_SIZE);
+    chunkTable->chunkCount = OSSwapHostToBigInt32((uint32_t)chunkCount);
+    for (i = 0; i < chunkCount; i++) {
+        size_t chunkLen = MIN(PRELINK_CHUNK_SIZE, srcSize - i * PRELINK_CHUNK_SIZE);
+
+        memmove(chunkData + packedSize, chunkData + i * PRELINK_CHUNK_SIZE,
+                chunkLens[i]);
+        chunkTable->chunkOffsets[i] = OSSwapHostToBigInt32(packedSize);
+        packedSize += chunkLens[i];
+        adler32 = local_adler32_combine(adler32, chunkAdlers[i],
+                                        (u_int32_t)chunkLen);
+    }
+    chunkTable->chunkOffsets[chunkCount] = OSSwapHostToBigInt32(packedSize);
+
+    *adler32Out = adler32;
+    result = chunkData + packedSize;
+
+finish:
+    SAFE_FREE(chunkLens);
+    SAFE_FREE(chunkAdlers);
+    return result;
+}
+
+/*********************************************************************
+ * Checks a chunk table against the sizes of the compressed data that
+ * holds it and of the image it uncompresses to. On success returns the
+ * chunk size and count and where the packed chunks start.
+ *********************************************************************/
+static Boolean
+validatePrelinkedChunkTable(
+    const u_int8_t       * src,
+    size_t                 srcSize,
+    size_t                 dstSize,
+    size_t               * chunkSizeOut,
+    size_t               * chunkCountOut,
+    const u_int8_t      ** chunkDataOut)
+{
+    const PrelinkedChunkTable * chunkTable  = (const PrelinkedChunkTable *)src;
+    size_t                      chunkSize   = 0;
+    size_t                      chunkCount  = 0;
+    size_t                      tableSize   = 0;
+    size_t                      i           = 0;
+
+    if (srcSize < sizeof(*chunkTable)) {
+        return false;
+    }
+    chunkSize = OSSwapBigToHostInt32(chunkTable->chunkSize);
+    chunkCount = OSSwapBigToHostInt32(chunkTable->chunkCount);
+    if (!chunkSize || !dstSize ||
+        chunkCount != (dstSize + chunkSize - 1) / chunkSize) {
+        return false;
+    }
+
+    tableSize = sizeof(*chunkTable) + (chunkCount + 1) * sizeof(uint32_t);
+    if (tableSize > srcSize) {
+        return false;
+    }
+
+    for (i = 0; i < chunkCount; i++) {
+        if (OSSwapBigToHostInt32(chunkTable->chunkOffsets[i]) >
+            OSSwapBigToHostInt32(chunkTable->chunkOffsets[i + 1])) {
+            return false;
+        }
+    }
+    if (OSSwapBigToHostInt32(chunkTable->chunkOffsets[chunkCount]) >
+        srcSize - tableSize) {
+        return false;
+    }
+
+    *chunkSizeOut = chunkSize;
+    *chunkCountOut = chunkCount;
+    *chunkDataOut = src + tableSize;
+    return true;
+}
+
+/*********************************************************************
+ * Uncompresses one chunk of a validated table into its place in dst
+ * and returns its adler32 in adler32Out.
+ *********************************************************************/
+static Boolean
+uncompressPrelinkedChunk(
+    const PrelinkedChunkTable * chunkTable,
+    const u_int8_t            * chunkData,
+    size_t                      chunkSize,
+    size_t                      chunk,
+    u_int8_t                  * dst,
+    size_t                      dstSize,
+    uint32_t                  * adler32Out)
+{
+    uint32_t   chunkOffset = OSSwapBigToHostInt32(chunkTable->chunkOffsets[chunk]);
+    uint32_t   storedLen   = OSSwapBigToHostInt32(chunkTable->chunkOffsets[chunk + 1]) -
+                             chunkOffset;
+    u_int8_t * chunkDst    = dst + chunk * chunkSize;
+    size_t     chunkLen    = MIN(chunkSize, dstSize - chunk * chunkSize);
+
+    if (storedLen == chunkLen) {
+        memcpy(chunkDst, chunkData + chunkOffset, chunkLen);
+    } else if (decompress_lzss_fast(chunkDst, (u_int32_t)chunkLen,
+                   (u_int8_t *)chunkData + chunkOffset, storedLen) !=
+               (int)chunkLen) {
+        return false;
+    }
+    *adler32Out = local_adler32(chunkDst, (int32_t)chunkLen);
+    return true;
+}
+
+/*********************************************************************
+ * Inverse of compressPrelinkedChunks(); chunks are decompressed and
+ * checksummed concurrently. Returns false if the table is malformed or
+ * any chunk doesn't decompress to its expected size.
+ *********************************************************************/
+static Boolean
+uncompressPrelinkedChunks(
+    u_int8_t          * dst,
+    size_t              dstSize,
+    const u_int8_t    * src,
+    size_t              srcSize,
+    uint32_t          * adler32Out)
+{
+    Boolean                     result      = false;
+    const PrelinkedChunkTable * chunkTable  = (const PrelinkedChunkTable *)src;
+    const u_int8_t            * chunkData   = NULL;  // do not free
+    uint32_t                  * chunkAdlers = NULL;  // must free
+    Boolean                   * chunkFailed = NULL;  // must free
+    size_t                      chunkSize   = 0;
+    size_t                      chunkCount  = 0;
+    uint32_t                    adler32     = 1;
+    size_t                      i           = 0;
+
+    if (!validatePrelinkedChunkTable(src, srcSize, dstSize,
+                                     &chunkSize, &chunkCount, &chunkData)) {
+        goto finish;
+    }
+
+    chunkAdlers = calloc(chunkCount, sizeof(*chunkAdlers));
+    chunkFailed = calloc(chunkCount, sizeof(*chunkFailed));
+    if (!chunkAdlers || !chunkFailed) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    dispatch_apply(chunkCount,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^(size_t chunk) {
+            if (!uncompressPrelinkedChunk(chunkTable, chunkData, chunkSize,
+                                          chunk, dst, dstSize,
+                                          &chunkAdlers[chunk])) {
+                chunkFailed[chunk] = true;
+            }
+        });
+
+    for (i = 0; i < chunkCount; i++) {
+        if (chunkFailed[i]) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                    "Compressed prelinked kernel chunk %zu failed to uncompress.",
+                    i);
+            goto finish;
+        }
+        adler32 = local_adler32_combine(adler32, chunkAdlers[i],
+            (u_int32_t)MIN(chunkSize, dstSize - i * chunkSize));
+    }
+
+    *adler32Out = adler32;
+    result = true;
+
+finish:
+    SAFE_FREE(chunkAdlers);
+    SAFE_FREE(chunkFailed);
+    return result;
+}
+
+/*********************************************************************
+ * Where the host has FastCompression, its LZVN replaces the portable
+ * one in the codec registry for whole-buffer encode and decode.
+ *********************************************************************/
+static void
+registerPrelinkedCodecs(void)
+{
+#if !(__i386__ || EMBEDDED_HOST)
+    static dispatch_once_t once;
+
+    dispatch_once(&once, ^{
+        CompressionCodec codec = *compression_codec_for_type(COMP_TYPE_FASTLIB);
+
+        codec.encodeWorkSize = &lzvn_encode_work_size;
+        codec.encode = &lzvn_encode;
+        codec.decode = &lzvn_decode;
+        (void)compression_codec_register(&codec);
+    });
+#endif
+}
+
+/*********************************************************************
+ * Returns the uncompressed size recorded in a compressed prelinked
+ * slice's header, or 0 if the header isn't valid.
+ *********************************************************************/
+size_t
+getPrelinkedSliceUncompressedSize(
+    CFDataRef      prelinkImage)
+{
+    const PrelinkedKernelHeader * prelinkHeader = NULL;  // do not free
+
+    prelinkHeader = (PrelinkedKernelHeader *) CFDataGetBytePtr(prelinkImage);
+    if (CFDataGetLength(prelinkImage) < (CFIndex)sizeof(*prelinkHeader) ||
+        prelinkHeader->signature != OSSwapHostToBigInt32('comp')) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                "Compressed prelinked kernel has an invalid header.");
+        return 0;
+    }
+    return OSSwapBigToHostInt32(prelinkHeader->uncompressedSize);
+}
+
+/*********************************************************************
+ * Uncompresses a prelinked slice into buf, which must be exactly the
+ * size given by getPrelinkedSliceUncompressedSize().
+ *********************************************************************/
+Boolean
+uncompressPrelinkedSliceIntoBuffer(
+    CFDataRef      prelinkImage,
+    void         * buf,
+    size_t         bufsize)
+{
+    Boolean                       result              = false;
+    const PrelinkedKernelHeader * prelinkHeader       = NULL;  // do not free
+    vm_size_t                     uncompsize          = 0;
+    uint32_t                      adler32             = 0;
+    Boolean                       haveAdler32         = false;
+    uint32_t                      compressType        = 0;
+    const CompressionCodec      * codec               = NULL;  // do not free
+
+    prelinkHeader = (PrelinkedKernelHeader *) CFDataGetBytePtr(prelinkImage);
+
+    /* Verify the header information.
+     */
+    if (prelinkHeader->signature != OSSwapHostToBigInt32('comp')) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
                 "Compressed prelinked kernel has invalid signature: 0x%x.",
                 prelinkHeader->signature);
         goto finish;
     }
 
-    if ( !(prelinkHeader->compressType == OSSwapHostToBigInt32(COMP_TYPE_LZSS) ||
-           prelinkHeader->compressType == OSSwapHostToBigInt32(COMP_TYPE_FASTLIB)) ) {
+    registerPrelinkedCodecs();
+    compressType = OSSwapBigToHostInt32(prelinkHeader->compressType);
+    if (compressType != COMP_TYPE_LZSS_CHUNKED) {
+        /* Encoder selectors like COMP_TYPE_LZSS_FAST never appear here. */
+        codec = compression_codec_for_type(compressType);
+        if (codec && codec->storedType != compressType) {
+            codec = NULL;
+        }
+    }
+    if (!codec && compressType != COMP_TYPE_LZSS_CHUNKED) {
         OSKextLog(/* kext */ NULL,
                   kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
                   "Compressed prelinked kernel has invalid compressType: 0x%x.",
@@ -960,9 +1959,76 @@ uncompressPrelinkedSlice(
         goto finish;
     }
 
+    if (bufsize != OSSwapBigToHostInt32(prelinkHeader->uncompressedSize)) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                "Buffer for compressed prelinked kernel has the wrong size: %zu.",
+                bufsize);
+        goto finish;
+    }
+
+    /* Uncompress the kernel.
+     */
+    if (compressType == COMP_TYPE_LZSS_CHUNKED) {
+        /* Chunks are checksummed as they are uncompressed. */
+        if (uncompressPrelinkedChunks(buf, bufsize,
+                                      ((u_int8_t *)(CFDataGetBytePtr(prelinkImage))) + sizeof(*prelinkHeader),
+                                      (CFDataGetLength(prelinkImage) - sizeof(*prelinkHeader)),
+                                      &adler32)) {
+            uncompsize = bufsize;
+            haveAdler32 = true;
+        }
+    }
+    else {
+        uncompsize = codec->decode(buf,
+                                   bufsize,
+                                   ((u_int8_t *)(CFDataGetBytePtr(prelinkImage))) + sizeof(*prelinkHeader),
+                                   (CFDataGetLength(prelinkImage) - sizeof(*prelinkHeader)));
+    }
+
+    if (uncompsize != bufsize) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                "Compressed prelinked kernel uncompressed to an unexpected size: %u.",
+                (unsigned)uncompsize);
+        goto finish;
+    }
+
+    /* Verify the adler32.
+     */
+    if (!haveAdler32) {
+        adler32 = local_adler32((u_int8_t *) buf, (int)bufsize);
+    }
+    if (prelinkHeader->adler32 != OSSwapHostToBigInt32(adler32)) {
+        OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                "Checksum error for compressed prelinked kernel.");
+        goto finish;
+    }
+    result = true;
+
+finish:
+    return result;
+}
+
+/*********************************************************************
+ *********************************************************************/
+CFDataRef
+uncompressPrelinkedSlice(
+    CFDataRef      prelinkImage)
+{
+    CFDataRef                     result              = NULL;
+    CFMutableDataRef              uncompressedImage   = NULL;  // must release
+    unsigned char               * buf                 = NULL;  // do not free
+    vm_size_t                     bufsize             = 0;
+
+    bufsize = getPrelinkedSliceUncompressedSize(prelinkImage);
+    if (!bufsize) {
+        goto finish;
+    }
+
     /* Create a buffer to hold the uncompressed kernel.
      */
-    bufsize = OSSwapBigToHostInt32(prelinkHeader->uncompressedSize);
     uncompressedImage = CFDataCreateMutable(kCFAllocatorDefault, bufsize);
     if (!uncompressedImage) {
         goto finish;
@@ -978,47 +2044,457 @@ uncompressPrelinkedSlice(
         goto finish;
     }
 
-    /* Uncompress the kernel.
-     */
-    if (prelinkHeader->compressType == OSSwapHostToBigInt32(COMP_TYPE_LZSS)) {
-        uncompsize = decompress_lzss(buf, (u_int32_t)bufsize,
-                                     ((u_int8_t *)(CFDataGetBytePtr(prelinkImage))) + sizeof(*prelinkHeader),
-                                     (u_int32_t)(CFDataGetLength(prelinkImage) - sizeof(*prelinkHeader)));
+    if (!uncompressPrelinkedSliceIntoBuffer(prelinkImage, buf, bufsize)) {
+        goto finish;
     }
-    else if (prelinkHeader->compressType == OSSwapHostToBigInt32(COMP_TYPE_FASTLIB)) {
-        uncompsize = lzvn_decode(buf,
-                                 bufsize,
-                                 ((u_int8_t *)(CFDataGetBytePtr(prelinkImage))) + sizeof(*prelinkHeader),
-                                 (CFDataGetLength(prelinkImage) - sizeof(*prelinkHeader)));
+    result = CFRetain(uncompressedImage);
+
+finish:
+    SAFE_RELEASE(uncompressedImage);
+    return result;
+}
+
+/*********************************************************************
+ * uncompressPrelinkedSliceToFile() records which compressed slice a
+ * file was uncompressed from in an extended attribute on the file, so
+ * that a later run can reuse it.
+ *********************************************************************/
+#define kPrelinkedSliceSourceXattr  "com.apple.kext_tools.uncompressed-from"
+#define kPrelinkedSliceSourceVersion 1
+
+typedef struct prelinked_slice_source {
+    uint32_t  version;
+    uint32_t  compressType;       // from the PrelinkedKernelHeader,
+    uint32_t  adler32;            // all big-endian
+    uint32_t  uncompressedSize;
+    uint32_t  compressedSize;
+    uint8_t   digest[CC_SHA256_DIGEST_LENGTH];  // of the whole compressed slice
+} PrelinkedSliceSource;
+
+static void
+getPrelinkedSliceSource(
+    CFDataRef              prelinkImage,
+    PrelinkedSliceSource * source)
+{
+    const PrelinkedKernelHeader * prelinkHeader =
+        (const PrelinkedKernelHeader *) CFDataGetBytePtr(prelinkImage);
+
+    bzero(source, sizeof(*source));
+    source->version          = OSSwapHostToBigInt32(kPrelinkedSliceSourceVersion);
+    source->compressType     = prelinkHeader->compressType;
+    source->adler32          = prelinkHeader->adler32;
+    source->uncompressedSize = prelinkHeader->uncompressedSize;
+    source->compressedSize   = prelinkHeader->compressedSize;
+    CC_SHA256(CFDataGetBytePtr(prelinkImage),
+              (CC_LONG)CFDataGetLength(prelinkImage), source->digest);
+    return;
+}
+
+/*********************************************************************
+ * Maps filePath if it's a regular file that was uncompressed from the
+ * same compressed slice, and still has the right size and checksum.
+ *********************************************************************/
+static void *
+mapReusablePrelinkedSlice(
+    const char                 * filePath,
+    const PrelinkedSliceSource * source,
+    size_t                       bufsize)
+{
+    void                        * result     = MAP_FAILED;
+    void                        * mapAddress = MAP_FAILED;  // must munmap
+    int                           fd         = -1;
+    PrelinkedSliceSource          fileSource;
+    struct stat                   statBuf;
+
+    fd = open(filePath, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1 || fstat(fd, &statBuf) == -1) {
+        goto finish;
     }
-    else {
+    if (!S_ISREG(statBuf.st_mode) || statBuf.st_size != (off_t)bufsize) {
         goto finish;
     }
+    if (fgetxattr(fd, kPrelinkedSliceSourceXattr, &fileSource,
+                  sizeof(fileSource), 0, 0) != sizeof(fileSource) ||
+        memcmp(&fileSource, source, sizeof(fileSource))) {
 
-    if (uncompsize != bufsize) {
+        goto finish;
+    }
+
+    mapAddress = mmap(NULL, bufsize, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    if (mapAddress == MAP_FAILED) {
+        goto finish;
+    }
+    if (source->adler32 !=
+        OSSwapHostToBigInt32(local_adler32(mapAddress, (int)bufsize))) {
+
+        goto finish;
+    }
+
+    result = mapAddress;
+    mapAddress = MAP_FAILED;
+
+finish:
+    if (mapAddress != MAP_FAILED) {
+        (void)munmap(mapAddress, bufsize);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    return result;
+}
+
+/*********************************************************************
+ * Uncompresses a prelinked slice into a shared mapping of filePath and
+ * returns a CFData over that mapping, so the image lives in the page
+ * cache rather than in anonymous memory. If filePath already holds the
+ * image uncompressed from this same slice, it is reused as is.
+ *
+ * The image is written to a temporary file next to filePath and renamed
+ * into place only once it has been uncompressed and checked, so a failed
+ * run never leaves a partial image behind. filePath is never written
+ * through; if it exists it must be a regular file.
+ *********************************************************************/
+CFDataRef
+uncompressPrelinkedSliceToFile(
+    CFDataRef      prelinkImage,
+    const char   * filePath)
+{
+    CFDataRef                     result        = NULL;
+    size_t                        bufsize       = 0;
+    int                           fd            = -1;
+    void                        * mapAddress    = MAP_FAILED;  // must munmap
+    Boolean                       removeTmpFile = false;
+    PrelinkedSliceSource          source;
+    struct stat                   statBuf;
+    char                          tmpPath[PATH_MAX];
+    mode_t                        procMode;
+
+    bufsize = getPrelinkedSliceUncompressedSize(prelinkImage);
+    if (!bufsize) {
+        goto finish;
+    }
+
+    if (lstat(filePath, &statBuf) == 0) {
+        if (!S_ISREG(statBuf.st_mode)) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "%s exists and is not a regular file.", filePath);
+            goto finish;
+        }
+    } else if (errno != ENOENT) {
         OSKextLog(/* kext */ NULL,
-                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
-                "Compressed prelinked kernel uncompressed to an unexpected size: %u.",
-                (unsigned)uncompsize);
+                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                "Can't stat %s - %s.", filePath, strerror(errno));
         goto finish;
     }
 
-    /* Verify the adler32.
+    /* Reuse a previous run's output if it came from this same slice.
      */
-    adler32 = local_adler32((u_int8_t *) buf, (int)bufsize);
+    getPrelinkedSliceSource(prelinkImage, &source);
+    mapAddress = mapReusablePrelinkedSlice(filePath, &source, bufsize);
+    if (mapAddress == MAP_FAILED) {
+        if (strlcpy(tmpPath, filePath, sizeof(tmpPath)) >= sizeof(tmpPath) ||
+            strlcat(tmpPath, ".XXXXXX", sizeof(tmpPath)) >= sizeof(tmpPath)) {
+
+            OSKextLogStringError(/* kext */ NULL);
+            goto finish;
+        }
+        fd = mkstemp(tmpPath);
+        if (fd == -1) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "Can't create %s - %s.", tmpPath, strerror(errno));
+            goto finish;
+        }
+        removeTmpFile = true;
+
+        /* mkstemp() creates the file 0600; give it the usual 0644 less umask.
+         */
+        procMode = umask(0);
+        umask(procMode);
+        (void)fchmod(fd, 0644 & ~procMode);
+
+        if (ftruncate(fd, (off_t)bufsize) == -1) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "Can't size %s - %s.", tmpPath, strerror(errno));
+            goto finish;
+        }
+        mapAddress = mmap(NULL, bufsize, PROT_READ | PROT_WRITE,
+                          MAP_FILE | MAP_SHARED, fd, 0);
+        if (mapAddress == MAP_FAILED) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "Failed to map %s - %s.", tmpPath, strerror(errno));
+            goto finish;
+        }
+        if (!uncompressPrelinkedSliceIntoBuffer(prelinkImage, mapAddress, bufsize)) {
+            goto finish;
+        }
+
+        /* Without the xattr the image is still good, just not reusable.
+         */
+        if (fsetxattr(fd, kPrelinkedSliceSourceXattr, &source,
+                      sizeof(source), 0, 0) == -1) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogWarningLevel | kOSKextLogFileAccessFlag,
+                    "Can't tag %s for reuse - %s.", tmpPath, strerror(errno));
+        }
+
+        if (rename(tmpPath, filePath) == -1) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "Can't rename %s to %s - %s.", tmpPath, filePath, strerror(errno));
+            goto finish;
+        }
+        removeTmpFile = false;
+    }
+
+    result = createDataWithMapping(mapAddress, bufsize, 0, bufsize);
+    mapAddress = MAP_FAILED;  // owned by result, or unmapped on failure
+
+finish:
+    if (mapAddress != MAP_FAILED) {
+        (void)munmap(mapAddress, bufsize);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (removeTmpFile) {
+        (void)unlink(tmpPath);
+    }
+    return result;
+}
+
+/*********************************************************************
+ * Random-access reader for compressed prelinked slices. The image is
+ * backed by an anonymous mapping of its full uncompressed size, so
+ * untouched pages cost nothing; COMP_TYPE_LZSS_CHUNKED slices have
+ * their chunks uncompressed as ranges covering them are requested,
+ * and other formats are uncompressed in full on first access.
+ *********************************************************************/
+struct prelinked_slice_reader {
+    CFDataRef                     prelinkImage;
+    u_int8_t                    * image;        // mapped, imageSize bytes
+    size_t                        imageSize;
+    pthread_mutex_t               lock;
+
+    /* Chunked slices only. */
+    const PrelinkedChunkTable   * chunkTable;
+    const u_int8_t              * chunkData;
+    size_t                        chunkSize;
+    size_t                        chunkCount;
+    size_t                        chunksLoaded;
+    Boolean                     * chunkLoaded;
+    uint32_t                    * chunkAdlers;
+
+    Boolean                       loaded;       // whole image present
+    Boolean                       failed;
+};
+
+/*********************************************************************
+ *********************************************************************/
+PrelinkedSliceReaderRef
+prelinkedSliceReaderCreate(
+    CFDataRef      prelinkImage)
+{
+    PrelinkedSliceReaderRef       result        = NULL;
+    PrelinkedSliceReaderRef       reader        = NULL;  // must free
+    const PrelinkedKernelHeader * prelinkHeader = NULL;  // do not free
+    size_t                        imageSize     = 0;
+
+    imageSize = getPrelinkedSliceUncompressedSize(prelinkImage);
+    if (!imageSize) {
+        goto finish;
+    }
+    prelinkHeader = (PrelinkedKernelHeader *) CFDataGetBytePtr(prelinkImage);
+
+    reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    reader->image = MAP_FAILED;
+    reader->imageSize = imageSize;
+    reader->prelinkImage = CFRetain(prelinkImage);
+    pthread_mutex_init(&reader->lock, NULL);
+
+    reader->image = mmap(NULL, imageSize, PROT_READ | PROT_WRITE,
+                         MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (reader->image == MAP_FAILED) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    if (OSSwapBigToHostInt32(prelinkHeader->compressType) == COMP_TYPE_LZSS_CHUNKED) {
+        const u_int8_t * src = (const u_int8_t *)prelinkHeader + sizeof(*prelinkHeader);
+
+        if (!validatePrelinkedChunkTable(src,
+                CFDataGetLength(prelinkImage) - sizeof(*prelinkHeader), imageSize,
+                &reader->chunkSize, &reader->chunkCount, &reader->chunkData)) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                    "Compressed prelinked kernel has an invalid chunk table.");
+            goto finish;
+        }
+        reader->chunkTable = (const PrelinkedChunkTable *)src;
+        reader->chunkLoaded = calloc(reader->chunkCount, sizeof(*reader->chunkLoaded));
+        reader->chunkAdlers = calloc(reader->chunkCount, sizeof(*reader->chunkAdlers));
+        if (!reader->chunkLoaded || !reader->chunkAdlers) {
+            OSKextLogMemError();
+            goto finish;
+        }
+    }
+
+    result = reader;
+    reader = NULL;
+
+finish:
+    prelinkedSliceReaderFree(reader);
+    return result;
+}
+
+/*********************************************************************
+ *********************************************************************/
+void
+prelinkedSliceReaderFree(
+    PrelinkedSliceReaderRef reader)
+{
+    if (!reader) {
+        return;
+    }
+    if (reader->image != MAP_FAILED) {
+        (void)munmap(reader->image, reader->imageSize);
+    }
+    SAFE_FREE(reader->chunkLoaded);
+    SAFE_FREE(reader->chunkAdlers);
+    SAFE_RELEASE(reader->prelinkImage);
+    pthread_mutex_destroy(&reader->lock);
+    free(reader);
+}
+
+/*********************************************************************
+ * Once every chunk has been uncompressed, checks the combined adler32
+ * against the header, as uncompressPrelinkedSlice() would have.
+ *********************************************************************/
+static Boolean
+prelinkedSliceReaderVerify(
+    PrelinkedSliceReaderRef reader)
+{
+    const PrelinkedKernelHeader * prelinkHeader = NULL;  // do not free
+    uint32_t                      adler32       = 1;
+    size_t                        i             = 0;
+
+    prelinkHeader = (PrelinkedKernelHeader *) CFDataGetBytePtr(reader->prelinkImage);
+    for (i = 0; i < reader->chunkCount; i++) {
+        adler32 = local_adler32_combine(adler32, reader->chunkAdlers[i],
+            (u_int32_t)MIN(reader->chunkSize, reader->imageSize - i * reader->chunkSize));
+    }
     if (prelinkHeader->adler32 != OSSwapHostToBigInt32(adler32)) {
         OSKextLog(/* kext */ NULL,
                 kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
                 "Checksum error for compressed prelinked kernel.");
+        return false;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * Makes [offset, offset + length) of the uncompressed image available
+ * and returns a pointer to it, or NULL if the range is out of bounds
+ * or fails to uncompress. Bytes outside requested ranges read as zero.
+ *********************************************************************/
+const UInt8 *
+prelinkedSliceReaderGetBytes(
+    PrelinkedSliceReaderRef reader,
+    size_t                  offset,
+    size_t                  length)
+{
+    const UInt8 * result     = NULL;
+    size_t        firstChunk = 0;
+    size_t        lastChunk  = 0;
+    size_t        chunk      = 0;
+
+    if (offset > reader->imageSize || length > reader->imageSize - offset) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+
+    if (reader->failed) {
+        goto finish;
+    }
+    if (reader->loaded || !length) {
+        result = reader->image + offset;
         goto finish;
     }
-    result = CFRetain(uncompressedImage);
+
+    if (!reader->chunkTable) {
+        if (!uncompressPrelinkedSliceIntoBuffer(reader->prelinkImage,
+                                                reader->image, reader->imageSize)) {
+            reader->failed = true;
+            goto finish;
+        }
+        reader->loaded = true;
+        result = reader->image + offset;
+        goto finish;
+    }
+
+    firstChunk = offset / reader->chunkSize;
+    lastChunk = (offset + length - 1) / reader->chunkSize;
+    for (chunk = firstChunk; chunk <= lastChunk; chunk++) {
+        if (reader->chunkLoaded[chunk]) {
+            continue;
+        }
+        if (!uncompressPrelinkedChunk(reader->chunkTable, reader->chunkData,
+                                      reader->chunkSize, chunk,
+                                      reader->image, reader->imageSize,
+                                      &reader->chunkAdlers[chunk])) {
+            OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                    "Compressed prelinked kernel chunk %zu failed to uncompress.",
+                    chunk);
+            reader->failed = true;
+            goto finish;
+        }
+        reader->chunkLoaded[chunk] = true;
+        reader->chunksLoaded++;
+    }
+
+    if (reader->chunksLoaded == reader->chunkCount) {
+        if (!prelinkedSliceReaderVerify(reader)) {
+            reader->failed = true;
+            goto finish;
+        }
+        reader->loaded = true;
+    }
+    result = reader->image + offset;
 
 finish:
-    SAFE_RELEASE(uncompressedImage);
+    pthread_mutex_unlock(&reader->lock);
     return result;
 }
 
+/*********************************************************************
+ * The base of the uncompressed image; only ranges returned by
+ * prelinkedSliceReaderGetBytes() hold the image's contents.
+ *********************************************************************/
+const UInt8 *
+prelinkedSliceReaderGetImage(
+    PrelinkedSliceReaderRef reader)
+{
+    return reader->image;
+}
+
+/*********************************************************************
+ *********************************************************************/
+size_t
+prelinkedSliceReaderGetSize(
+    PrelinkedSliceReaderRef reader)
+{
+    return reader->imageSize;
+}
+
 /*********************************************************************
  *********************************************************************/
 CFDataRef
@@ -1037,6 +2513,8 @@ compressPrelinkedSlice(
     vm_size_t               bufsize         = 0;
     vm_size_t               compsize        = 0;
     uint32_t                adler32         = 0;
+    const CompressionCodec * codec          = NULL;  // do not free
+    void                  * workSpace       = NULL;  // must free
 
     /* Check that the kernel is not already compressed */
 
@@ -1049,10 +2527,24 @@ compressPrelinkedSlice(
         goto finish;
     }
 
+    registerPrelinkedCodecs();
+    if (compressionType != COMP_TYPE_LZSS_CHUNKED) {
+        codec = compression_codec_for_type(compressionType);
+        if (!codec) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                      "Unrecognized compression algorithm.");
+            goto finish;
+        }
+    }
+
     /* Create a buffer to hold the compressed kernel */
 
     offset = sizeof(*kernelHeader);
     bufsize = CFDataGetLength(prelinkImage) + offset;
+    if (compressionType == COMP_TYPE_LZSS_CHUNKED) {
+        bufsize += prelinkedChunkTableSize(CFDataGetLength(prelinkImage));
+    }
     compressedImage = CFDataCreateMutable(kCFAllocatorDefault, bufsize);
     if (!compressedImage) {
         goto finish;
@@ -1075,41 +2567,44 @@ compressPrelinkedSlice(
     /* Fill in the compression information */
 
     kernelHeader->signature = OSSwapHostToBigInt32('comp');
-    adler32 = local_adler32((u_int8_t *)CFDataGetBytePtr(prelinkImage),
-            (int)CFDataGetLength(prelinkImage));
-    kernelHeader->adler32 = OSSwapHostToBigInt32(adler32);
+    if (compressionType != COMP_TYPE_LZSS_CHUNKED) {
+        /* The chunked encoder checksums each chunk as it goes. */
+        adler32 = local_adler32((u_int8_t *)CFDataGetBytePtr(prelinkImage),
+                (int)CFDataGetLength(prelinkImage));
+        kernelHeader->adler32 = OSSwapHostToBigInt32(adler32);
+    }
     kernelHeader->uncompressedSize =
         OSSwapHostToBigInt32(CFDataGetLength(prelinkImage));
 
     /* Compress the kernel */
-    if (compressionType == COMP_TYPE_FASTLIB) {
+    if (compressionType == COMP_TYPE_LZSS_CHUNKED) {
+        kernelHeader->compressType = OSSwapHostToBigInt32(COMP_TYPE_LZSS_CHUNKED);
+        bufend = compressPrelinkedChunks(buf + offset, bufsize - offset,
+                                         (u_int8_t *)CFDataGetBytePtr(prelinkImage),
+                                         CFDataGetLength(prelinkImage),
+                                         &adler32);
+        kernelHeader->adler32 = OSSwapHostToBigInt32(adler32);
+    }
+    else {
         size_t outSize = 0;
-        void * work_space = malloc(lzvn_encode_work_size());
-
-        if (work_space != NULL) {
-            kernelHeader->compressType = OSSwapHostToBigInt32(COMP_TYPE_FASTLIB);
-            outSize = lzvn_encode(buf + offset,
-            bufsize,
-            (u_int8_t *)CFDataGetBytePtr(prelinkImage),
-            CFDataGetLength(prelinkImage),
-            work_space);
-            free(work_space);
-            if (outSize != 0) {
-                bufend = buf + offset + outSize;
+        size_t workSize = codec->encodeWorkSize();
+
+        if (workSize) {
+            workSpace = malloc(workSize);
+            if (!workSpace) {
+                OSKextLogMemError();
+                goto finish;
             }
         }
-    }
-    else if (compressionType == COMP_TYPE_LZSS) {
-        kernelHeader->compressType = OSSwapHostToBigInt32(COMP_TYPE_LZSS);
-        bufend = compress_lzss(buf + offset, (u_int32_t)bufsize,
-                               (u_int8_t *)CFDataGetBytePtr(prelinkImage),
-                               (u_int32_t)CFDataGetLength(prelinkImage));
-    }
-    else {
-        OSKextLog(/* kext */ NULL,
-                  kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
-                  "Unrecognized compression algorithm.");
-        goto finish;
+        kernelHeader->compressType = OSSwapHostToBigInt32(codec->storedType);
+        outSize = codec->encode(buf + offset,
+                                bufsize - offset,
+                                (u_int8_t *)CFDataGetBytePtr(prelinkImage),
+                                CFDataGetLength(prelinkImage),
+                                workSpace);
+        if (outSize != 0) {
+            bufend = buf + offset + outSize;
+        }
     }
 
     if (!bufend) {
@@ -1126,10 +2621,308 @@ compressPrelinkedSlice(
     result = CFRetain(compressedImage);
 
 finish:
+    SAFE_FREE(workSpace);
     SAFE_RELEASE(compressedImage);
     return result;
 }
 
+/*********************************************************************
+ *********************************************************************/
+typedef struct prelink_stream_output {
+    int     fileDescriptor;
+    off_t   offset;
+} PrelinkStreamOutput;
+
+static int
+writePrelinkStreamOutput(
+    void       * context,
+    const void * buf,
+    size_t       length)
+{
+    PrelinkStreamOutput * output  = (PrelinkStreamOutput *)context;
+
+    if (writeToFileAtOffset(output->fileDescriptor, (const UInt8 *)buf,
+                            (CFIndex)length, output->offset) != EX_OK) {
+        return -1;
+    }
+    output->offset += length;
+    return 0;
+}
+
+/*********************************************************************
+ * Streaming counterpart to compressPrelinkedSlice(). Reads srcSize bytes
+ * of prelinked kernel from srcFd at srcOffset and writes the compressed
+ * slice to dstFd at dstOffset, holding only one block of input and one
+ * of output in memory. The header goes in last, once the checksum and
+ * sizes are known. COMP_TYPE_LZSS_CHUNKED can't be streamed.
+ *********************************************************************/
+ExitStatus
+compressPrelinkedSliceToFile(
+    uint32_t            compressionType,
+    int                 srcFd,
+    off_t               srcOffset,
+    size_t              srcSize,
+    Boolean             hasRelocs,
+    int                 dstFd,
+    off_t               dstOffset,
+    uint32_t          * compressedSizeOut)
+{
+    ExitStatus              result          = EX_SOFTWARE;
+    const CompressionCodec * codec          = NULL;  // do not free
+    CompressionStream     * stream          = NULL;  // must destroy
+    u_int8_t              * block           = NULL;  // must free
+    PrelinkedKernelHeader   kernelHeader;
+    PrelinkStreamOutput     output;
+    size_t                  done            = 0;
+    size_t                  blockSize       = 0;
+    ssize_t                 readBytes       = 0;
+
+    registerPrelinkedCodecs();
+    codec = compression_codec_for_type(compressionType);
+    if (!codec || !codec->streamCreate) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                  "Unrecognized compression algorithm.");
+        goto finish;
+    }
+    if (srcSize > UINT32_MAX) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                  "Prelinked kernel is too large to compress.");
+        goto finish;
+    }
+
+    block = malloc(PRELINK_STREAM_BLOCK_SIZE);
+    if (!block) {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+
+    /* Compressed data follows the header, which is filled in at the end. */
+    output.fileDescriptor = dstFd;
+    output.offset = dstOffset + sizeof(kernelHeader);
+
+    stream = compression_stream_create(codec, &writePrelinkStreamOutput, &output);
+    if (!stream) {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+
+    for (done = 0; done < srcSize; done += blockSize) {
+        blockSize = MIN(PRELINK_STREAM_BLOCK_SIZE, srcSize - done);
+        readBytes = pread(srcFd, block, blockSize, srcOffset + done);
+        if (readBytes < 0 && errno == EINTR) {
+            blockSize = 0;
+            continue;
+        }
+        if (readBytes <= 0) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                      "Failed to read file.");
+            result = EX_IOERR;
+            goto finish;
+        }
+        blockSize = (size_t)readBytes;
+
+        if (done == 0 && blockSize >= sizeof(uint32_t) &&
+            ((const PrelinkedKernelHeader *)block)->signature ==
+                OSSwapHostToBigInt32('comp')) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                      "Prelinked kernel is already compressed.");
+            goto finish;
+        }
+
+        if (compression_stream_write(stream, block, blockSize)) {
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                      "Failed to compress prelinked kernel.");
+            goto finish;
+        }
+    }
+
+    if (compression_stream_finish(stream) ||
+        compression_stream_total_out(stream) > UINT32_MAX - sizeof(kernelHeader)) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                  "Failed to compress prelinked kernel.");
+        goto finish;
+    }
+
+    bzero(&kernelHeader, sizeof(kernelHeader));
+    kernelHeader.signature = OSSwapHostToBigInt32('comp');
+    kernelHeader.compressType = OSSwapHostToBigInt32(codec->storedType);
+    kernelHeader.adler32 = OSSwapHostToBigInt32(compression_stream_adler32(stream));
+    kernelHeader.uncompressedSize = OSSwapHostToBigInt32((uint32_t)srcSize);
+    kernelHeader.compressedSize =
+        OSSwapHostToBigInt32((uint32_t)compression_stream_total_out(stream));
+    kernelHeader.prelinkVersion = OSSwapHostToBigInt32(hasRelocs ? 1 : 0);
+
+    output.offset = dstOffset;
+    if (writePrelinkStreamOutput(&output, &kernelHeader, sizeof(kernelHeader))) {
+        result = EX_IOERR;
+        goto finish;
+    }
+
+    *compressedSizeOut = (uint32_t)(sizeof(kernelHeader) +
+                                    compression_stream_total_out(stream));
+    result = EX_OK;
+
+finish:
+    compression_stream_destroy(stream);
+    SAFE_FREE(block);
+    return result;
+}
+
+/*********************************************************************
+ *********************************************************************/
+typedef struct prelink_file_slices {
+    int         fileDescriptor;
+    uint32_t    compressionType;
+    Boolean     hasRelocs;
+    CFIndex     count;
+    off_t     * offsets;  // must free
+    size_t    * sizes;    // must free
+} PrelinkFileSlices;
+
+static ExitStatus
+writeCompressedSlice(
+    int            fileDescriptor,
+    off_t          sliceOffset,
+    CFIndex        sliceIndex,
+    void         * context,
+    uint32_t     * sliceLengthOut)
+{
+    PrelinkFileSlices * slices       = (PrelinkFileSlices *)context;
+    ExitStatus          result       = EX_SOFTWARE;
+    CFDataRef           sliceData    = NULL;  // must release
+    CFDataRef           compressed   = NULL;  // must release
+
+    if (sliceIndex >= slices->count) {
+        goto finish;
+    }
+
+    if (compression_codec_for_type(slices->compressionType)) {
+        result = compressPrelinkedSliceToFile(slices->compressionType,
+                                              slices->fileDescriptor,
+                                              slices->offsets[sliceIndex],
+                                              slices->sizes[sliceIndex],
+                                              slices->hasRelocs,
+                                              fileDescriptor,
+                                              sliceOffset,
+                                              sliceLengthOut);
+        goto finish;
+    }
+
+    /* Containers like COMP_TYPE_LZSS_CHUNKED need the whole slice. */
+    sliceData = readMachOSlice(slices->fileDescriptor,
+                               slices->offsets[sliceIndex],
+                               slices->sizes[sliceIndex]);
+    if (!sliceData) {
+        goto finish;
+    }
+    compressed = compressPrelinkedSlice(slices->compressionType, sliceData,
+                                        slices->hasRelocs);
+    if (!compressed) {
+        result = EX_DATAERR;
+        goto finish;
+    }
+    *sliceLengthOut = (uint32_t)CFDataGetLength(compressed);
+    result = writeToFile(fileDescriptor, CFDataGetBytePtr(compressed),
+                         CFDataGetLength(compressed));
+
+finish:
+    SAFE_RELEASE(sliceData);
+    SAFE_RELEASE(compressed);
+    return result;
+}
+
+/*********************************************************************
+ * Compresses each slice of the uncompressed prelinked kernel at
+ * prelinkPath, replacing the file. Slices are streamed from the old
+ * file to the new one, so memory use doesn't grow with the kernel.
+ *********************************************************************/
+ExitStatus
+compressPrelinkedKernelFile(
+    const char        * prelinkPath,
+    uint32_t            compressionType,
+    Boolean             hasRelocs)
+{
+    ExitStatus          result          = EX_SOFTWARE;
+    PrelinkFileSlices   slices          = { -1, compressionType, hasRelocs, 0, NULL, NULL };
+    CFMutableArrayRef   fileArchs       = NULL;  // must release
+    FatIndexRef         index           = NULL;  // must fatIndexRelease()
+    struct stat         statBuf;
+    struct timeval      fileTimes[2];
+    CFIndex             i               = 0;
+
+    slices.fileDescriptor = open(prelinkPath, O_RDONLY);
+    if (slices.fileDescriptor < 0 || fstat(slices.fileDescriptor, &statBuf)) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                  "Can't open %s - %s.", prelinkPath, strerror(errno));
+        goto finish;
+    }
+    TIMESPEC_TO_TIMEVAL(&fileTimes[0], &statBuf.st_atimespec);
+    TIMESPEC_TO_TIMEVAL(&fileTimes[1], &statBuf.st_mtimespec);
+
+    index = fatIndexCopyWith_fd(slices.fileDescriptor);
+    if (!index) {
+        goto finish;
+    }
+
+    result = copyFatIndexArchs(index, &fileArchs);
+    if (result != EX_OK) {
+        goto finish;
+    }
+    result = EX_SOFTWARE;
+
+    /* Thin (Snow Leopard) prelinked kernels get their arch from the
+     * mach header.
+     */
+    if (!fileArchs) {
+        OSKextLog(/* kext */ NULL,
+                  kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                  "Couldn't determine prelinked kernel's architecture");
+        goto finish;
+    }
+    slices.count = CFArrayGetCount(fileArchs);
+
+    slices.offsets = calloc(slices.count, sizeof(*slices.offsets));
+    slices.sizes = calloc(slices.count, sizeof(*slices.sizes));
+    if (!slices.offsets || !slices.sizes) {
+        OSKextLogMemError();
+        result = EX_OSERR;
+        goto finish;
+    }
+
+    for (i = 0; i < slices.count; i++) {
+        slices.offsets[i] = fatIndexGetSlice(index, i)->offset;
+        slices.sizes[i] = fatIndexGetSlice(index, i)->size;
+    }
+
+    result = writeFatFileWithSliceWriter(prelinkPath,
+                                         FALSE,
+                                         0,
+                                         0,
+                                         fileArchs,
+                                         &writeCompressedSlice,
+                                         &slices,
+                                         /* sliceSizes */ NULL,
+                                         statBuf.st_mode,
+                                         fileTimes);
+
+finish:
+    fatIndexRelease(index);
+    if (slices.fileDescriptor >= 0) close(slices.fileDescriptor);
+    SAFE_FREE(slices.offsets);
+    SAFE_FREE(slices.sizes);
+    SAFE_RELEASE(fileArchs);
+    return result;
+}
+
 /*******************************************************************************
 *******************************************************************************/
 ExitStatus
@@ -1233,49 +3026,11 @@ finish:
     return result;
 }
 
-#if __i386__ || EMBEDDED_HOST // no lzvn for embedded host tools yet
-
-Boolean supportsFastLibCompression(void)
-{
-    return(false);
-}
-
-size_t lzvn_encode(void *       dst,
-                   size_t       dst_size,
-                   const void * src,
-                   size_t       src_size,
-                   void *       work)
-{
-#pragma unused(dst)
-#pragma unused(dst_size)
-#pragma unused(src)
-#pragma unused(src_size)
-#pragma unused(work)
-    return 0;
-}
-
-size_t lzvn_decode(void *       dst,
-                   size_t       dst_size,
-                   const void * src,
-                   size_t       src_size)
-{
-#pragma unused(dst)
-#pragma unused(dst_size)
-#pragma unused(src)
-#pragma unused(src_size)
-    return 0;
-}
-
-size_t lzvn_encode_work_size(void)
-{
-    return 0;
-}
-
-#else
-
+/*******************************************************************************
+* LZVN is always available: from FastCompression where the host has it,
+* otherwise from compression.c.
+*******************************************************************************/
 Boolean supportsFastLibCompression(void)
 {
     return(true);
 }
-
-#endif // __i386__ || EMBEDDED_HOST
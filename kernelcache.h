@@ -10,13 +10,17 @@
 #define _KERNELCACHE_H_
 
 #include <libc.h>
+#include <uuid/uuid.h>
 #include "kext_tools_util.h"
+#include "compression.h"
 
 #define PLATFORM_NAME_LEN  (64)
 #define ROOT_PATH_LEN     (256)
 
-#define COMP_TYPE_LZSS      'lzss'
-#define COMP_TYPE_FASTLIB   'lzvn'
+/* COMP_TYPE_LZSS, COMP_TYPE_FASTLIB and COMP_TYPE_LZSS_FAST come from
+ * compression.h along with their codecs.
+ */
+#define COMP_TYPE_LZSS_CHUNKED  'lzsc'  // independent LZSS chunks, see below
 
 
 // prelinkVersion value >= 1 means KASLR supported
@@ -33,11 +37,43 @@ typedef struct prelinked_kernel_header {
     char      data[0];
 } PrelinkedKernelHeader;
 
+/* Follows PrelinkedKernelHeader when compressType is COMP_TYPE_LZSS_CHUNKED.
+ * All fields are big-endian. chunkOffsets[] has chunkCount + 1 entries,
+ * relative to the end of the table, so chunk i occupies
+ * chunkOffsets[i + 1] - chunkOffsets[i] bytes. A chunk whose stored size
+ * equals its uncompressed size is stored raw. The header's adler32 covers
+ * the whole uncompressed image.
+ */
+#define PRELINK_CHUNK_SIZE  (1024 * 1024)
+
+/* Input block size for compressPrelinkedSliceToFile(). */
+#define PRELINK_STREAM_BLOCK_SIZE  (1024 * 1024)
+
+typedef struct prelinked_chunk_table {
+    uint32_t  chunkSize;
+    uint32_t  chunkCount;
+    uint32_t  chunkOffsets[0];
+} PrelinkedChunkTable;
+
 typedef struct platform_info {
     char platformName[PLATFORM_NAME_LEN];
     char rootPath[ROOT_PATH_LEN];
 } PlatformInfo;
 
+/* One slice of a file as recorded by its FatIndex; a thin file has one
+ * slice covering the whole file. Fields are in host byte order.
+ */
+typedef struct fat_index_slice {
+    const NXArchInfo  * archInfo;   // NULL if unknown
+    off_t               offset;
+    size_t              size;
+    uint32_t            align;
+    Boolean             hasUUID;
+    uuid_t              uuid;
+} FatIndexSlice;
+
+typedef struct fat_index * FatIndexRef;
+
 /*******************************************************************************
 *******************************************************************************/
 
@@ -59,6 +95,20 @@ writeFatFile(
     CFArrayRef                  fileArchs,
     mode_t                      fileMode,
     const struct timeval        fileTimes[2]);
+FatIndexRef fatIndexCopyWith_fd(
+    int fileDescriptor);
+void fatIndexRelease(
+    FatIndexRef index);
+Boolean fatIndexIsFat(
+    FatIndexRef index);
+CFIndex fatIndexGetSliceCount(
+    FatIndexRef index);
+const FatIndexSlice * fatIndexGetSlice(
+    FatIndexRef index,
+    CFIndex     sliceIndex);
+const FatIndexSlice * fatIndexGetSliceForArch(
+    FatIndexRef         index,
+    const NXArchInfo  * archInfo);
 void * mapAndSwapFatHeaderPage(
     int fileDescriptor);
 void unmapFatHeaderPage(
@@ -115,6 +165,17 @@ CFDataRef readMachOSlice(
     int         fileDescriptor,
     off_t       fileOffset,
     size_t      fileSliceSize);
+CF_RETURNS_RETAINED
+CFDataRef readMachOSliceMapped(
+    int         fileDescriptor,
+    off_t       fileOffset,
+    size_t      fileSliceSize);
+
+/* Makes readMachOSlice() and the readers built on it return mapped,
+ * no-copy slices (see readMachOSliceMapped()) instead of reading them.
+ */
+void setMapMachOSlices(
+    Boolean     mapSlices);
 int readFileAtOffset(
     int             fileDescriptor,
     off_t           fileOffset,
@@ -129,11 +190,52 @@ Boolean supportsFastLibCompression(
 CF_RETURNS_RETAINED
 CFDataRef uncompressPrelinkedSlice(
     CFDataRef prelinkImage);
+size_t getPrelinkedSliceUncompressedSize(
+    CFDataRef prelinkImage);
+Boolean uncompressPrelinkedSliceIntoBuffer(
+    CFDataRef prelinkImage,
+    void    * buf,
+    size_t    bufSize);
+CF_RETURNS_RETAINED
+CFDataRef uncompressPrelinkedSliceToFile(
+    CFDataRef    prelinkImage,
+    const char * filePath);
+
+/* Random-access reader over a compressed prelinked slice; see
+ * prelinkedSliceReaderCreate() in kernelcache.c.
+ */
+typedef struct prelinked_slice_reader * PrelinkedSliceReaderRef;
+
+PrelinkedSliceReaderRef prelinkedSliceReaderCreate(
+    CFDataRef prelinkImage);
+void prelinkedSliceReaderFree(
+    PrelinkedSliceReaderRef reader);
+const UInt8 * prelinkedSliceReaderGetBytes(
+    PrelinkedSliceReaderRef reader,
+    size_t                  offset,
+    size_t                  length);
+const UInt8 * prelinkedSliceReaderGetImage(
+    PrelinkedSliceReaderRef reader);
+size_t prelinkedSliceReaderGetSize(
+    PrelinkedSliceReaderRef reader);
 CF_RETURNS_RETAINED
 CFDataRef compressPrelinkedSlice(
     uint32_t            compressionType,
     CFDataRef           prelinkImage,
     Boolean             hasRelocs);
+ExitStatus compressPrelinkedSliceToFile(
+    uint32_t            compressionType,
+    int                 srcFd,
+    off_t               srcOffset,
+    size_t              srcSize,
+    Boolean             hasRelocs,
+    int                 dstFd,
+    off_t               dstOffset,
+    uint32_t          * compressedSizeOut);
+ExitStatus compressPrelinkedKernelFile(
+    const char        * prelinkPath,
+    uint32_t            compressionType,
+    Boolean             hasRelocs);
 ExitStatus writePrelinkedSymbols(
     CFURLRef    symbolDirURL,
     CFArrayRef  prelinkSymbols,
@@ -259,6 +259,41 @@ finish:
     return result;
 }
 
+/*******************************************************************************
+* Like writeToFile(), but with pwrite() at fileOffset, so several threads can
+* write disjoint ranges of one file descriptor at once.
+*******************************************************************************/
+ExitStatus writeToFileAtOffset(
+                               int           fileDescriptor,
+                               const UInt8 * data,
+                               CFIndex       length,
+                               off_t         fileOffset)
+{
+    ExitStatus result = EX_OSERR;
+    ssize_t bytesWritten = 0;
+    ssize_t totalBytesWritten = 0;
+
+    while (totalBytesWritten < length) {
+        bytesWritten = pwrite(fileDescriptor, data + totalBytesWritten,
+                              length - totalBytesWritten,
+                              fileOffset + totalBytesWritten);
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            OSKextLog(/* kext */ NULL,
+                      kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                      "Write failed %d - %s", errno, strerror(errno));
+            goto finish;
+        }
+        totalBytesWritten += bytesWritten;
+    }
+
+    result = EX_OK;
+finish:
+    return result;
+}
+
 #if !(TARGET_OS_IPHONE && !TARGET_OS_SIMULATOR)
 /******************************************************************************
  ******************************************************************************/
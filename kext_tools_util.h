@@ -247,6 +247,11 @@ ExitStatus writeToFile(
     int           fileDescriptor,
     const UInt8 * data,
     CFIndex       length);
+ExitStatus writeToFileAtOffset(
+    int           fileDescriptor,
+    const UInt8 * data,
+    CFIndex       length,
+    off_t         fileOffset);
 
 ExitStatus statURL(CFURLRef anURL, struct stat * statBuffer);
 ExitStatus statPath(const char *path, struct stat *statBuffer);
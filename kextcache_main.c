@@ -81,6 +81,7 @@
 #include "syspolicy.h"
 #include "driverkit.h"
 #include "kc_staging.h"
+#include "prelink_info.h"
 #include "KernelManagementShims/Shims.h"
 
 #if __has_include(<prelink.h>)
@@ -883,6 +884,10 @@ ExitStatus readArgs(
                         toolArgs->stripSymbols = true;
                         break;
 
+                    case kLongOptPrelinkIndex:
+                        toolArgs->writePrelinkIndex = true;
+                        break;
+
 #if !NO_BOOT_ROOT
                     case kLongOptInstaller:
                         toolArgs->updateOpts |= kBRUHelpersOptional;
@@ -2793,6 +2798,7 @@ static bool isValidPLKFile(KextcacheArgs *toolArgs)
     bool                myResult            = false;
     CFDataRef           plkRef              = NULL;  // must release
     CFDataRef           uncompressed_plkRef = NULL;  // must release
+    PrelinkedSliceReaderRef plkReader       = NULL;  // must free
     const UInt8 *       machoHeader         = NULL;
     const NXArchInfo *  archInfo            = NULL;
 
@@ -2815,15 +2821,29 @@ static bool isValidPLKFile(KextcacheArgs *toolArgs)
         }
 
         if (MAGIC32(CFDataGetBytePtr(plkRef)) == OSSwapHostToBigInt32('comp')) {
-            uncompressed_plkRef = uncompressPrelinkedSlice(plkRef);
-            if (uncompressed_plkRef == NULL) {
+            /* Only the load commands are looked at, so only uncompress
+             * the start of the image.
+             */
+            plkReader = prelinkedSliceReaderCreate(plkRef);
+            if (plkReader == NULL) {
+                break;
+            }
+            machoHeader = prelinkedSliceReaderGetBytes(plkReader, 0,
+                                                       sizeof(struct mach_header_64));
+            if (machoHeader == NULL) {
+                break;
+            }
+            machoHeader = prelinkedSliceReaderGetBytes(plkReader, 0,
+                sizeof(struct mach_header_64) +
+                ((const struct mach_header *)machoHeader)->sizeofcmds);
+            if (machoHeader == NULL) {
                 break;
             }
         } else {
             uncompressed_plkRef = CFRetain(plkRef);
+            machoHeader = CFDataGetBytePtr(uncompressed_plkRef);
         }
 
-        machoHeader = CFDataGetBytePtr(uncompressed_plkRef);
         if (ISMACHO64(MAGIC32(machoHeader))) {
             prelinkInfoSect = (void *)
             macho_get_section_by_name_64((struct mach_header_64 *)machoHeader,
@@ -2844,6 +2864,7 @@ static bool isValidPLKFile(KextcacheArgs *toolArgs)
 
     SAFE_RELEASE(plkRef);
     SAFE_RELEASE(uncompressed_plkRef);
+    prelinkedSliceReaderFree(plkReader);
 
     return(myResult);
 }
@@ -3580,6 +3601,13 @@ createPrelinkedKernel(
      */
     created_plk = false;
 
+    if (toolArgs->writePrelinkIndex) {
+        result = writePrelinkIndex(toolArgs->prelinkedKernelPath, prelinkSlices);
+        if (result != EX_OK) {
+            goto finish;
+        }
+    }
+
     if (toolArgs->symbolDirURL) {
         result = writePrelinkedSymbols(toolArgs->symbolDirURL,
                                        generatedSymbols, generatedArchs);
@@ -3908,6 +3936,13 @@ ExitStatus createPrelinkedKernelForArch(
         Boolean     wantsFastLib = wantsFastLibCompressionForTargetVolume(toolArgs->volumeRootURL);
         uint32_t    compressionType = wantsFastLib ? COMP_TYPE_FASTLIB : COMP_TYPE_LZSS;
 
+        /* Nobody is waiting on a low-priority build, so spend the extra
+         * time on the smallest LZSS stream; it's what the booter reads.
+         */
+        if (compressionType == COMP_TYPE_LZSS && toolArgs->lowPriorityFlag) {
+            compressionType = COMP_TYPE_LZSS_OPTIMAL;
+        }
+
         *prelinkedKernelOut = compressPrelinkedSlice(compressionType,
                                                      prelinkedKernel,
                                                      kernelSupportsKASLR);
@@ -4032,13 +4067,27 @@ compressPrelinkedKernel(
     mode_t              fileMode        = 0;
     int                 i               = 0;
 
+    /* Compression streams each slice from the old file to the new one.
+     */
+    if (compress) {
+        Boolean     wantsFastLib = wantsFastLibCompressionForTargetVolume(volumeRootURL);
+        uint32_t    compressionType = wantsFastLib ? COMP_TYPE_FASTLIB : COMP_TYPE_LZSS;
+
+        /* The slices are plain Mach-O with no PrelinkedKernelHeader, so
+         * there is no prelinkVersion to carry over.
+         */
+        result = compressPrelinkedKernelFile(prelinkPath, compressionType,
+                                             /* hasRelocs */ false);
+        goto finish;
+    }
+
     result = readMachOSlices(prelinkPath, &prelinkedSlices,
         &prelinkedArchs, &fileMode, prelinkedKernelTimes);
     if (result != EX_OK) {
         goto finish;
     }
 
-    /* Compress/uncompress each slice of the prelinked kernel.
+    /* Uncompress each slice of the prelinked kernel.
      */
 
     for (i = 0; i < CFArrayGetCount(prelinkedSlices); ++i) {
@@ -4046,26 +4095,10 @@ compressPrelinkedKernel(
         SAFE_RELEASE_NULL(prelinkedSlice);
         prelinkedSlice = CFArrayGetValueAtIndex(prelinkedSlices, i);
 
-        if (compress) {
-            const PrelinkedKernelHeader *header = (const PrelinkedKernelHeader *)
-                CFDataGetBytePtr(prelinkedSlice);
-            Boolean     wantsFastLib = wantsFastLibCompressionForTargetVolume(volumeRootURL);
-            uint32_t    compressionType = wantsFastLib ? COMP_TYPE_FASTLIB : COMP_TYPE_LZSS;
-
-
-            prelinkedSlice = compressPrelinkedSlice(compressionType,
-                                                    prelinkedSlice,
-                                                    (OSSwapHostToBigInt32(header->prelinkVersion) == 1));
-            if (!prelinkedSlice) {
-                result = EX_DATAERR;
-                goto finish;
-            }
-        } else {
-            prelinkedSlice = uncompressPrelinkedSlice(prelinkedSlice);
-            if (!prelinkedSlice) {
-                result = EX_DATAERR;
-                goto finish;
-            }
+        prelinkedSlice = uncompressPrelinkedSlice(prelinkedSlice);
+        if (!prelinkedSlice) {
+            result = EX_DATAERR;
+            goto finish;
         }
 
         CFArraySetValueAtIndex(prelinkedSlices, i, prelinkedSlice);
@@ -4316,6 +4349,9 @@ void usage(UsageLevel usageLevel)
         kOptNameKernel, kOptKernel);
     fprintf(stderr, "-%s (-%c): Include all kexts ever loaded in prelinked kernel\n",
         kOptNameAllLoaded, kOptAllLoaded);
+    fprintf(stderr, "-%s:\n"
+        "        also write <filename>%s, an index of the prelinked kexts for kclist & kctool\n",
+        kOptNamePrelinkIndex, kPrelinkIndexSuffix);
 #if !NO_BOOT_ROOT
     fprintf(stderr, "-%s (-%c): Update volumes even if they look up to date\n",
         kOptNameForce, kOptForce);
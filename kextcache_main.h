@@ -90,6 +90,7 @@ enum {
 #define kOptNameAllPersonalities        "all-personalities"
 #define kOptNameNoLinkFailures          "no-link-failures"
 #define kOptNameStripSymbols            "strip-symbols"
+#define kOptNamePrelinkIndex            "prelink-index"
 
 /* Misc. cache update flags.
  */
@@ -172,6 +173,7 @@ enum {
 #define kLongOptClearStaging             (-19)
 #define kLongOptPruneStaging             (-20)
 #define kLongOptLegacyBehavior           (-21)
+#define kLongOptPrelinkIndex             (-22)
 
 #if !NO_BOOT_ROOT
 #define kOptChars                ":a:b:cDefFhi:kK:lLm:nNqrsStT:u:U:vXz"
@@ -222,6 +224,7 @@ static struct option sOptInfo[] = {
     { kOptNameAllPersonalities,      no_argument,        &longopt, kLongOptAllPersonalities },
     { kOptNameNoLinkFailures,        no_argument,        &longopt, kLongOptNoLinkFailures },
     { kOptNameStripSymbols,          no_argument,        &longopt, kLongOptStripSymbols },
+    { kOptNamePrelinkIndex,          no_argument,        &longopt, kLongOptPrelinkIndex },
 
 #if !NO_BOOT_ROOT
     { kOptNameInvalidate,            required_argument,  NULL,     kOptInvalidate },
@@ -274,6 +277,7 @@ typedef struct KextcacheArgs_s {
     Boolean   includeAllPersonalities;      // -all-personalities option
     Boolean   noLinkFailures;               // -no-link-failures option
     Boolean   stripSymbols;                 // -strip-symbols option
+    Boolean   writePrelinkIndex;            // -prelink-index option
     CFURLRef  compressedPrelinkedKernelURL; // -uncompress option
 
     Boolean   isInstaller; // -Installer
@@ -25,6 +25,7 @@
 
 #include <IOKit/kext/OSKext.h>
 #include <IOKit/kext/OSKextPrivate.h>
+#include <IOKit/kext/macho_util.h>
 
 #include "kextfind_main.h"
 #include "kextfind_tables.h"
@@ -32,6 +33,7 @@
 #include "kextfind_commands.h"
 #include "kextfind_report.h"
 #include "QEQuery.h"
+#include "macho_view.h"
 
 /*******************************************************************************
 * Misc. macros.
@@ -689,6 +691,141 @@ finish:
     return result;
 }
 
+/*******************************************************************************
+* The executable and per-arch MachOViews of one kext, kept in
+* QueryContext.symbolTables so that every symbol lookup after the first on
+* an arch is a binary search of the view's sorted symbol index.
+*******************************************************************************/
+typedef struct {
+    struct mach_header * farch;
+    void               * farchEnd;
+    MachOViewRef         view;       // NULL if the arch can't be viewed
+} KextSymbolArch;
+
+typedef struct {
+    fat_iterator   fiter;
+    CFIndex        archCount;
+    KextSymbolArch archs[];
+} KextSymbolTables;
+
+static void releaseKextSymbolTables(
+    CFAllocatorRef allocator __unused,
+    const void   * value)
+{
+    KextSymbolTables * tables = (KextSymbolTables *)value;
+    CFIndex            i;
+
+    for (i = 0; i < tables->archCount; i++) {
+        if (tables->archs[i].view) machoViewFree(tables->archs[i].view);
+    }
+    if (tables->fiter) fat_iterator_close(tables->fiter);
+    free(tables);
+}
+
+static KextSymbolTables * createKextSymbolTables(OSKextRef aKext)
+{
+    KextSymbolTables   * result    = NULL;
+    KextSymbolTables   * tables    = NULL;  // must free
+    fat_iterator         fiter     = NULL;  // must close
+    struct mach_header * farch     = NULL;
+    void               * farchEnd  = NULL;
+    CFIndex              archCount = 0;
+
+    fiter = createFatIteratorForKext(aKext);
+    if (!fiter) {
+        goto finish;
+    }
+    while (fat_iterator_next_arch(fiter, NULL)) {
+        archCount++;
+    }
+    fat_iterator_reset(fiter);
+
+    tables = calloc(1, sizeof(*tables) + archCount * sizeof(tables->archs[0]));
+    if (!tables) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+   /* Views that can't be created (such as for a byte-swapped arch) are
+    * left NULL, and lookups on them fall back to macho_find_symbol().
+    */
+    while (tables->archCount < archCount &&
+        (farch = fat_iterator_next_arch(fiter, &farchEnd))) {
+
+        KextSymbolArch * arch = &tables->archs[tables->archCount++];
+
+        arch->farch = farch;
+        arch->farchEnd = farchEnd;
+        arch->view = machoViewCreate(farch,
+            (size_t)((char *)farchEnd - (char *)farch));
+    }
+    tables->fiter = fiter;
+    fiter = NULL;
+    result = tables;
+    tables = NULL;
+
+finish:
+    if (fiter)  fat_iterator_close(fiter);
+    if (tables) free(tables);
+    return result;
+}
+
+/*******************************************************************************
+* Looks up symbol in the archIndex'th arch of aKext's executable, setting
+* *found and, if it was found, *nlistType. Returns false once archIndex is
+* past the last arch, or if the executable can't be read.
+*******************************************************************************/
+Boolean kextFindSymbolInArch(
+    QueryContext * context,
+    OSKextRef      aKext,
+    CFIndex        archIndex,
+    const char   * symbol,
+    Boolean      * found,
+    uint8_t      * nlistType)
+{
+    KextSymbolTables * tables = NULL;  // owned by context->symbolTables
+    KextSymbolArch   * arch   = NULL;
+
+    *found = false;
+
+    if (!context->symbolTables) {
+        CFDictionaryValueCallBacks valueCallBacks = {
+            0, NULL, &releaseKextSymbolTables, NULL, NULL };
+
+        context->symbolTables = CFDictionaryCreateMutable(kCFAllocatorDefault,
+            0, &kCFTypeDictionaryKeyCallBacks, &valueCallBacks);
+        if (!context->symbolTables) {
+            OSKextLogMemError();
+            return false;
+        }
+    }
+
+    tables = (KextSymbolTables *)CFDictionaryGetValue(context->symbolTables,
+        aKext);
+    if (!tables) {
+        tables = createKextSymbolTables(aKext);
+        if (!tables) {
+            return false;
+        }
+        CFDictionarySetValue(context->symbolTables, aKext, tables);
+    }
+
+    if (archIndex < 0 || archIndex >= tables->archCount) {
+        return false;
+    }
+    arch = &tables->archs[archIndex];
+
+    if (arch->view) {
+        *found = machoViewFindSymbol(arch->view, symbol, nlistType);
+    } else {
+        macho_seek_result seek_result = macho_find_symbol(
+            arch->farch, arch->farchEnd, symbol, nlistType, NULL);
+        *found = (seek_result == macho_seek_result_found_no_value ||
+            seek_result == macho_seek_result_found);
+    }
+    return true;
+}
+
 /*******************************************************************************
 * usage()
 *******************************************************************************/
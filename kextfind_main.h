@@ -111,6 +111,11 @@ typedef struct {
     */
     Boolean reportRowStarted;
 
+   /* Symbol lookups keep each kext's executable open and a MachOView
+    * per arch here for the whole run; see kextFindSymbolInArch().
+    */
+    CFMutableDictionaryRef symbolTables;
+
 } QueryContext;
 
 /*******************************************************************************
@@ -123,6 +128,13 @@ ExitStatus readArgs(
 ExitStatus checkArgs(QueryContext * toolArgs);
 Boolean checkSearchItem(const char * pathname, Boolean logFlag);
 fat_iterator createFatIteratorForKext(OSKextRef aKext);
+Boolean kextFindSymbolInArch(
+    QueryContext * context,
+    OSKextRef      aKext,
+    CFIndex        archIndex,
+    const char   * symbol,
+    Boolean      * found,
+    uint8_t      * nlistType);
 void usage(UsageLevel level);
 
 
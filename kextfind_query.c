@@ -1411,17 +1411,17 @@ finish:
 Boolean evalDefinesOrReferencesSymbol(
     CFDictionaryRef   element,
     void            * object,
-    void            * user_data __unused,
+    void            * user_data,
     QEQueryError    * error __unused)
 {
     Boolean              result           = false;
     OSKextRef            theKext          = (OSKextRef)object;
+    QueryContext       * context          = (QueryContext *)user_data;
     CFStringRef          predicate        = NULL;  // don't release
     Boolean              seekingReference = false;
     char               * symbol           = NULL;  // must free
-    fat_iterator         fiter            = NULL;  // must close
-    struct mach_header * farch            = NULL;
-    void               * farch_end        = NULL;
+    CFIndex              archIndex;
+    Boolean              found;
     Boolean              isKernelComponent;
     uint8_t              nlist_type;
 
@@ -1435,11 +1435,6 @@ Boolean evalDefinesOrReferencesSymbol(
     if (!symbol) {
         goto finish;
     }
-    fiter = createFatIteratorForKext(theKext);
-    if (!fiter) {
-        goto finish;
-    }
-
    /* KPI kexts have the symbols listed as undefined, and won't have
     * any unresolved references to anything. So, if seekingReference
     * is true, we have nothing to do.
@@ -1449,12 +1444,12 @@ Boolean evalDefinesOrReferencesSymbol(
         goto finish;
     }
 
-    while ((farch = fat_iterator_next_arch(fiter, &farch_end))) {
-        macho_seek_result seek_result = macho_find_symbol(
-            farch, farch_end, symbol, &nlist_type, NULL);
+    for (archIndex = 0;
+        kextFindSymbolInArch(context, theKext, archIndex, symbol,
+            &found, &nlist_type);
+        archIndex++) {
 
-        if (seek_result == macho_seek_result_found_no_value ||
-            seek_result == macho_seek_result_found) {
+        if (found) {
 
             uint8_t n_type = N_TYPE & nlist_type;
 
@@ -1490,7 +1485,6 @@ Boolean evalDefinesOrReferencesSymbol(
         }
     }
 finish:
-    if (fiter)  fat_iterator_close(fiter);
     if (symbol) free(symbol);
     return result;
 }
@@ -499,9 +499,8 @@ Boolean reportEvalDefinesOrReferencesSymbol(
     CFStringRef symbol = QEQueryElementGetArgumentAtIndex(element, 0);
     char * cSymbol = NULL;   // must free
     const char * value = "";  // don't free
-    fat_iterator fiter = NULL;  // must close
-    struct mach_header * farch = NULL;
-    void * farch_end = NULL;
+    CFIndex archIndex;
+    Boolean found;
     uint8_t nlist_type;
 
     if (!symbol) {
@@ -519,17 +518,12 @@ Boolean reportEvalDefinesOrReferencesSymbol(
             cSymbol);
     } else {
 
-        fiter = createFatIteratorForKext(theKext);
-        if (!fiter) {
-            goto finish;
-        }
-
-        while ((farch = fat_iterator_next_arch(fiter, &farch_end))) {
-            macho_seek_result seek_result = macho_find_symbol(
-                farch, farch_end, cSymbol, &nlist_type, NULL);
+        for (archIndex = 0;
+            kextFindSymbolInArch(context, theKext, archIndex, cSymbol,
+                &found, &nlist_type);
+            archIndex++) {
 
-            if (seek_result == macho_seek_result_found_no_value ||
-                seek_result == macho_seek_result_found) {
+            if (found) {
 
                 if ((N_TYPE & nlist_type) == N_UNDF) {
                     value = OSKextIsKernelComponent(theKext) ?
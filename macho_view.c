@@ -0,0 +1,739 @@
+/*
+ *  macho_view.c
+ *  kext_tools
+ *
+ *  Copyright 2026 Apple Inc. All rights reserved.
+ *
+ */
+#include <mach-o/nlist.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kext_tools_util.h"
+#include "macho_view.h"
+
+typedef struct {
+    const char * name;
+    uint32_t     index;
+    uint8_t      type;
+} MachOViewSymbol;
+
+struct macho_view {
+    const UInt8                        * header;
+    size_t                               size;
+    Boolean                              is64Bit;
+
+    uint32_t                             segmentCount;
+    MachOViewSegment                   * segments;         // load command order
+    uint32_t                             sectionCount;
+    MachOViewSection                   * sections;         // load command order
+
+    /* Indexes into segments, skipping segments that map nothing. */
+    uint32_t                             addressCount;
+    uint32_t                           * segmentsByAddress;
+    uint32_t                             fileOffsetCount;
+    uint32_t                           * segmentsByFileOffset;
+
+    /* Open-addressed name tables holding index + 1, 0 when empty. */
+    uint32_t                             nameTableSize;    // power of 2
+    uint32_t                           * segmentNames;
+    uint32_t                           * sectionNames;
+
+    const struct symtab_command        * symtab;
+    const struct dysymtab_command      * dysymtab;
+    const struct linkedit_data_command * chainedFixups;
+    const struct linkedit_data_command * splitInfo;
+    const uint8_t                      * uuid;
+
+    /* Built on the second machoViewFindSymbol() call. */
+    uint32_t                             symbolLookups;
+    Boolean                              symbolsIndexed;
+    uint32_t                             symbolCount;
+    MachOViewSymbol                    * symbols;          // sorted by name
+};
+
+static Boolean walkLoadCommands(MachOViewRef view, Boolean fill);
+static void indexSegments(MachOViewRef view);
+static void copyName(char * dst, const char * src);
+static uint32_t hashName(const char * segname, const char * sectname);
+static Boolean indexSymbols(MachOViewRef view);
+
+/*******************************************************************************
+* machoViewCreate() parses the header and load commands of a Mach-O image in
+* host byte order. Nothing past the load commands is touched until a symbol
+* is looked up, so the image may be backed by a partially-loaded reader.
+* Returns NULL if the image is not a valid Mach-O.
+*******************************************************************************/
+MachOViewRef machoViewCreate(
+    const void * machHeader,
+    size_t       size)
+{
+    MachOViewRef result = NULL;
+    MachOViewRef view   = NULL;  // must machoViewFree() on error
+    uint32_t     magic;
+
+    if (!machHeader || size < sizeof(struct mach_header)) {
+        goto finish;
+    }
+    magic = *(const uint32_t *)machHeader;
+    if (magic != MH_MAGIC && magic != MH_MAGIC_64) {
+        goto finish;
+    }
+    if (magic == MH_MAGIC_64 && size < sizeof(struct mach_header_64)) {
+        goto finish;
+    }
+
+    view = calloc(1, sizeof(*view));
+    if (!view) {
+        goto finish;
+    }
+    view->header = (const UInt8 *)machHeader;
+    view->size = size;
+    view->is64Bit = (magic == MH_MAGIC_64);
+
+    /* First pass validates and counts, second pass records.
+     */
+    if (!walkLoadCommands(view, /* fill */ false)) {
+        goto finish;
+    }
+
+    view->nameTableSize = 4;
+    while (view->nameTableSize < 2 * (view->segmentCount + view->sectionCount)) {
+        view->nameTableSize <<= 1;
+    }
+    view->segments = calloc(view->segmentCount + 1, sizeof(*view->segments));
+    view->sections = calloc(view->sectionCount + 1, sizeof(*view->sections));
+    view->segmentsByAddress = calloc(view->segmentCount + 1, sizeof(uint32_t));
+    view->segmentsByFileOffset = calloc(view->segmentCount + 1, sizeof(uint32_t));
+    view->segmentNames = calloc(view->nameTableSize, sizeof(uint32_t));
+    view->sectionNames = calloc(view->nameTableSize, sizeof(uint32_t));
+    if (!view->segments || !view->sections ||
+        !view->segmentsByAddress || !view->segmentsByFileOffset ||
+        !view->segmentNames || !view->sectionNames) {
+        goto finish;
+    }
+
+    view->segmentCount = 0;
+    view->sectionCount = 0;
+    if (!walkLoadCommands(view, /* fill */ true)) {
+        goto finish;
+    }
+    indexSegments(view);
+
+    result = view;
+    view = NULL;
+finish:
+    machoViewFree(view);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+void machoViewFree(
+    MachOViewRef view)
+{
+    if (!view) {
+        return;
+    }
+    SAFE_FREE(view->segments);
+    SAFE_FREE(view->sections);
+    SAFE_FREE(view->segmentsByAddress);
+    SAFE_FREE(view->segmentsByFileOffset);
+    SAFE_FREE(view->segmentNames);
+    SAFE_FREE(view->sectionNames);
+    SAFE_FREE(view->symbols);
+    free(view);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static Boolean walkLoadCommands(
+    MachOViewRef view,
+    Boolean      fill)
+{
+    const struct mach_header * mh = (const struct mach_header *)view->header;
+    size_t   headerSize;
+    size_t   offset;
+    size_t   cmdsEnd;
+    uint32_t i, j;
+
+    headerSize = view->is64Bit ? sizeof(struct mach_header_64) :
+                                 sizeof(struct mach_header);
+    cmdsEnd = headerSize + (size_t)mh->sizeofcmds;
+    if (cmdsEnd > view->size) {
+        return false;
+    }
+
+    offset = headerSize;
+    for (i = 0; i < mh->ncmds; i++) {
+        const struct load_command * lc;
+
+        if (cmdsEnd - offset < sizeof(*lc)) {
+            return false;
+        }
+        lc = (const struct load_command *)(view->header + offset);
+        if (lc->cmdsize < sizeof(*lc) || lc->cmdsize > cmdsEnd - offset) {
+            return false;
+        }
+
+        if (lc->cmd == LC_SEGMENT_64 || lc->cmd == LC_SEGMENT) {
+            Boolean  is64 = (lc->cmd == LC_SEGMENT_64);
+            size_t   segSize  = is64 ? sizeof(struct segment_command_64) :
+                                       sizeof(struct segment_command);
+            size_t   sectSize = is64 ? sizeof(struct section_64) :
+                                       sizeof(struct section);
+            uint32_t nsects;
+
+            if (lc->cmdsize < segSize) {
+                return false;
+            }
+            nsects = is64 ? ((const struct segment_command_64 *)lc)->nsects :
+                            ((const struct segment_command *)lc)->nsects;
+            if ((lc->cmdsize - segSize) / sectSize < nsects) {
+                return false;
+            }
+
+            if (fill) {
+                MachOViewSegment * seg = &view->segments[view->segmentCount];
+
+                seg->loadCommand = lc;
+                seg->firstSection = view->sectionCount;
+                seg->nsects = nsects;
+                if (is64) {
+                    const struct segment_command_64 * sc =
+                        (const struct segment_command_64 *)lc;
+                    copyName(seg->segname, sc->segname);
+                    seg->vmaddr = sc->vmaddr;
+                    seg->vmsize = sc->vmsize;
+                    seg->fileoff = sc->fileoff;
+                    seg->filesize = sc->filesize;
+                } else {
+                    const struct segment_command * sc =
+                        (const struct segment_command *)lc;
+                    copyName(seg->segname, sc->segname);
+                    seg->vmaddr = sc->vmaddr;
+                    seg->vmsize = sc->vmsize;
+                    seg->fileoff = sc->fileoff;
+                    seg->filesize = sc->filesize;
+                }
+
+                for (j = 0; j < nsects; j++) {
+                    MachOViewSection * sect =
+                        &view->sections[view->sectionCount + j];
+                    const void * sh = (const UInt8 *)lc + segSize + j * sectSize;
+
+                    sect->header = sh;
+                    sect->segmentIndex = view->segmentCount;
+                    if (is64) {
+                        const struct section_64 * s = sh;
+                        copyName(sect->segname, s->segname);
+                        copyName(sect->sectname, s->sectname);
+                        sect->addr = s->addr;
+                        sect->size = s->size;
+                        sect->offset = s->offset;
+                    } else {
+                        const struct section * s = sh;
+                        copyName(sect->segname, s->segname);
+                        copyName(sect->sectname, s->sectname);
+                        sect->addr = s->addr;
+                        sect->size = s->size;
+                        sect->offset = s->offset;
+                    }
+                }
+            }
+            view->segmentCount++;
+            view->sectionCount += nsects;
+
+        } else if (lc->cmd == LC_SYMTAB) {
+            if (lc->cmdsize < sizeof(struct symtab_command)) {
+                return false;
+            }
+            view->symtab = (const struct symtab_command *)lc;
+        } else if (lc->cmd == LC_DYSYMTAB) {
+            if (lc->cmdsize < sizeof(struct dysymtab_command)) {
+                return false;
+            }
+            view->dysymtab = (const struct dysymtab_command *)lc;
+        } else if (lc->cmd == LC_DYLD_CHAINED_FIXUPS) {
+            if (lc->cmdsize < sizeof(struct linkedit_data_command)) {
+                return false;
+            }
+            view->chainedFixups = (const struct linkedit_data_command *)lc;
+        } else if (lc->cmd == LC_SEGMENT_SPLIT_INFO) {
+            if (lc->cmdsize < sizeof(struct linkedit_data_command)) {
+                return false;
+            }
+            view->splitInfo = (const struct linkedit_data_command *)lc;
+        } else if (lc->cmd == LC_UUID) {
+            if (lc->cmdsize < sizeof(struct uuid_command)) {
+                return false;
+            }
+            view->uuid = ((const struct uuid_command *)lc)->uuid;
+        }
+
+        offset += lc->cmdsize;
+    }
+
+    return true;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static void copyName(char * dst, const char * src)
+{
+    /* Mach-O segment and section names are 16 bytes, not always terminated. */
+    memcpy(dst, src, 16);
+    dst[16] = '\0';
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static uint32_t hashName(const char * segname, const char * sectname)
+{
+    uint32_t hash = 2166136261u;  // FNV-1a
+
+    for (; *segname; segname++) {
+        hash = (hash ^ (uint8_t)*segname) * 16777619u;
+    }
+    hash = (hash ^ ',') * 16777619u;
+    if (sectname) {
+        for (; *sectname; sectname++) {
+            hash = (hash ^ (uint8_t)*sectname) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+typedef struct {
+    uint64_t key;
+    uint32_t index;
+} MachOViewSortEntry;
+
+static int compareSortEntries(const void * a, const void * b)
+{
+    const MachOViewSortEntry * entryA = (const MachOViewSortEntry *)a;
+    const MachOViewSortEntry * entryB = (const MachOViewSortEntry *)b;
+
+    if (entryA->key != entryB->key) {
+        return (entryA->key < entryB->key) ? -1 : 1;
+    }
+    return (entryA->index < entryB->index) ? -1 : 1;
+}
+
+/* Sorts a list of segment indexes by vmaddr or fileoff, keeping load command
+ * order among equal keys.
+ */
+static void sortSegmentIndexes(
+    MachOViewRef view,
+    uint32_t   * indexes,
+    uint32_t     count,
+    Boolean      byAddress)
+{
+    MachOViewSortEntry * entries = NULL;  // must free
+    uint32_t i;
+
+    entries = malloc((count + 1) * sizeof(*entries));
+    if (!entries) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        const MachOViewSegment * seg = &view->segments[indexes[i]];
+        entries[i].key = byAddress ? seg->vmaddr : seg->fileoff;
+        entries[i].index = indexes[i];
+    }
+    qsort(entries, count, sizeof(*entries), compareSortEntries);
+    for (i = 0; i < count; i++) {
+        indexes[i] = entries[i].index;
+    }
+    free(entries);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static void indexSegments(MachOViewRef view)
+{
+    uint32_t mask = view->nameTableSize - 1;
+    uint32_t i;
+
+    for (i = 0; i < view->segmentCount; i++) {
+        const MachOViewSegment * seg = &view->segments[i];
+        uint32_t slot;
+
+        if (seg->vmsize) {
+            view->segmentsByAddress[view->addressCount++] = i;
+        }
+        if (seg->filesize) {
+            view->segmentsByFileOffset[view->fileOffsetCount++] = i;
+        }
+
+        /* Keep the first segment of a given name, as a linear walk would. */
+        slot = hashName(seg->segname, NULL) & mask;
+        while (view->segmentNames[slot] &&
+               strcmp(view->segments[view->segmentNames[slot] - 1].segname,
+                      seg->segname)) {
+            slot = (slot + 1) & mask;
+        }
+        if (!view->segmentNames[slot]) {
+            view->segmentNames[slot] = i + 1;
+        }
+    }
+
+    for (i = 0; i < view->sectionCount; i++) {
+        const MachOViewSection * sect = &view->sections[i];
+        uint32_t slot;
+
+        slot = hashName(sect->segname, sect->sectname) & mask;
+        while (view->sectionNames[slot]) {
+            const MachOViewSection * other =
+                &view->sections[view->sectionNames[slot] - 1];
+            if (!strcmp(other->segname, sect->segname) &&
+                !strcmp(other->sectname, sect->sectname)) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        if (!view->sectionNames[slot]) {
+            view->sectionNames[slot] = i + 1;
+        }
+    }
+
+    sortSegmentIndexes(view, view->segmentsByAddress,
+        view->addressCount, /* byAddress */ true);
+    sortSegmentIndexes(view, view->segmentsByFileOffset,
+        view->fileOffsetCount, /* byAddress */ false);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+Boolean machoViewIs64Bit(MachOViewRef view)
+{
+    return view->is64Bit;
+}
+
+const void * machoViewGetHeader(MachOViewRef view)
+{
+    return view->header;
+}
+
+uint32_t machoViewGetSegmentCount(MachOViewRef view)
+{
+    return view->segmentCount;
+}
+
+const MachOViewSegment * machoViewGetSegment(MachOViewRef view, uint32_t index)
+{
+    return (index < view->segmentCount) ? &view->segments[index] : NULL;
+}
+
+uint32_t machoViewGetSectionCount(MachOViewRef view)
+{
+    return view->sectionCount;
+}
+
+const MachOViewSection * machoViewGetSection(MachOViewRef view, uint32_t index)
+{
+    return (index < view->sectionCount) ? &view->sections[index] : NULL;
+}
+
+const struct symtab_command * machoViewGetSymtab(MachOViewRef view)
+{
+    return view->symtab;
+}
+
+const struct dysymtab_command * machoViewGetDysymtab(MachOViewRef view)
+{
+    return view->dysymtab;
+}
+
+const struct linkedit_data_command * machoViewGetChainedFixups(MachOViewRef view)
+{
+    return view->chainedFixups;
+}
+
+const struct linkedit_data_command * machoViewGetSplitInfo(MachOViewRef view)
+{
+    return view->splitInfo;
+}
+
+const uint8_t * machoViewGetUUID(MachOViewRef view)
+{
+    return view->uuid;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+const MachOViewSegment * machoViewGetSegmentByName(
+    MachOViewRef view,
+    const char * segname)
+{
+    uint32_t mask = view->nameTableSize - 1;
+    uint32_t slot = hashName(segname, NULL) & mask;
+
+    while (view->segmentNames[slot]) {
+        const MachOViewSegment * seg =
+            &view->segments[view->segmentNames[slot] - 1];
+        if (!strncmp(seg->segname, segname, 16)) {
+            return seg;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* Sections are matched on the segment name recorded in the section itself,
+* which is what 32-bit kexts with a single unnamed segment need.
+*******************************************************************************/
+const MachOViewSection * machoViewGetSectionByName(
+    MachOViewRef view,
+    const char * segname,
+    const char * sectname)
+{
+    uint32_t mask = view->nameTableSize - 1;
+    uint32_t slot = hashName(segname, sectname) & mask;
+
+    while (view->sectionNames[slot]) {
+        const MachOViewSection * sect =
+            &view->sections[view->sectionNames[slot] - 1];
+        if (!strncmp(sect->segname, segname, 16) &&
+            !strncmp(sect->sectname, sectname, 16)) {
+            return sect;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+const MachOViewSegment * machoViewGetSegmentForAddress(
+    MachOViewRef view,
+    uint64_t     address)
+{
+    uint32_t lo = 0;
+    uint32_t hi = view->addressCount;
+
+    /* Find the last segment starting at or below address. */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (view->segments[view->segmentsByAddress[mid]].vmaddr <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0) {
+        const MachOViewSegment * seg =
+            &view->segments[view->segmentsByAddress[lo - 1]];
+        if (address - seg->vmaddr < seg->vmsize) {
+            return seg;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+const MachOViewSegment * machoViewGetSegmentForFileOffset(
+    MachOViewRef view,
+    uint64_t     fileOffset)
+{
+    uint32_t lo = 0;
+    uint32_t hi = view->fileOffsetCount;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (view->segments[view->segmentsByFileOffset[mid]].fileoff <= fileOffset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0) {
+        const MachOViewSegment * seg =
+            &view->segments[view->segmentsByFileOffset[lo - 1]];
+        if (fileOffset - seg->fileoff < seg->filesize) {
+            return seg;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+uint64_t machoViewGetLowestAddress(MachOViewRef view)
+{
+    uint32_t i;
+    uint64_t lowest = UINT64_MAX;
+
+    /* Unlike segmentsByAddress this counts empty segments, as kclist did. */
+    for (i = 0; i < view->segmentCount; i++) {
+        if (view->segments[i].vmaddr < lowest) {
+            lowest = view->segments[i].vmaddr;
+        }
+    }
+    return lowest;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static int compareSymbols(const void * a, const void * b)
+{
+    const MachOViewSymbol * symA = (const MachOViewSymbol *)a;
+    const MachOViewSymbol * symB = (const MachOViewSymbol *)b;
+    int result = strcmp(symA->name, symB->name);
+
+    if (result) {
+        return result;
+    }
+    return (symA->index < symB->index) ? -1 : (symA->index > symB->index);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static Boolean getSymbolTables(
+    MachOViewRef   view,
+    const UInt8 ** symbolsOut,
+    const char  ** strtabOut)
+{
+    const struct symtab_command * symtab = view->symtab;
+    size_t nlistSize = view->is64Bit ? sizeof(struct nlist_64) :
+                                       sizeof(struct nlist);
+
+    if (!symtab ||
+        symtab->symoff > view->size ||
+        (view->size - symtab->symoff) / nlistSize < symtab->nsyms ||
+        symtab->stroff > view->size ||
+        view->size - symtab->stroff < symtab->strsize) {
+        return false;
+    }
+    *symbolsOut = view->header + symtab->symoff;
+    *strtabOut = (const char *)view->header + symtab->stroff;
+    return true;
+}
+
+/*******************************************************************************
+* Returns the name of a non-debug symbol, or NULL.
+*******************************************************************************/
+static const char * getSymbolName(
+    MachOViewRef  view,
+    const UInt8 * symbols,
+    const char  * strtab,
+    uint32_t      index,
+    uint8_t     * typeOut)
+{
+    uint32_t strsize = view->symtab->strsize;
+    uint32_t strx;
+    uint8_t  type;
+
+    if (view->is64Bit) {
+        const struct nlist_64 * entry = (const struct nlist_64 *)symbols + index;
+        strx = entry->n_un.n_strx;
+        type = entry->n_type;
+    } else {
+        const struct nlist * entry = (const struct nlist *)symbols + index;
+        strx = (uint32_t)entry->n_un.n_strx;
+        type = entry->n_type;
+    }
+
+    if ((type & N_STAB) || strx >= strsize ||
+        !memchr(strtab + strx, '\0', strsize - strx)) {
+        return NULL;
+    }
+    *typeOut = type;
+    return strtab + strx;
+}
+
+/*******************************************************************************
+* Sorts the non-debug symbols of LC_SYMTAB by name.
+*******************************************************************************/
+static Boolean indexSymbols(MachOViewRef view)
+{
+    const UInt8 * symbols;
+    const char  * strtab;
+    uint32_t      i;
+
+    view->symbolsIndexed = true;
+    if (!getSymbolTables(view, &symbols, &strtab)) {
+        return false;
+    }
+
+    view->symbols = calloc(view->symtab->nsyms + 1, sizeof(*view->symbols));
+    if (!view->symbols) {
+        return false;
+    }
+
+    for (i = 0; i < view->symtab->nsyms; i++) {
+        MachOViewSymbol * symbol = &view->symbols[view->symbolCount];
+
+        symbol->name = getSymbolName(view, symbols, strtab, i, &symbol->type);
+        if (symbol->name) {
+            symbol->index = i;
+            view->symbolCount++;
+        }
+    }
+
+    qsort(view->symbols, view->symbolCount, sizeof(*view->symbols),
+        compareSymbols);
+    return true;
+}
+
+/*******************************************************************************
+* Looks up a symbol by name, returning the n_type of its first entry in the
+* symbol table. The first lookup on a view scans the symbol table; the
+* second sorts it, so that any further lookups are a binary search.
+*******************************************************************************/
+Boolean machoViewFindSymbol(
+    MachOViewRef view,
+    const char * symbolName,
+    uint8_t    * nlistType)
+{
+    uint32_t lo = 0;
+    uint32_t hi;
+    uint8_t  type;
+
+    if (!view->symbolLookups++) {
+        const UInt8 * symbols;
+        const char  * strtab;
+        const char  * name;
+        uint32_t      i;
+
+        if (!getSymbolTables(view, &symbols, &strtab)) {
+            return false;
+        }
+        for (i = 0; i < view->symtab->nsyms; i++) {
+            name = getSymbolName(view, symbols, strtab, i, &type);
+            if (name && !strcmp(name, symbolName)) {
+                if (nlistType) {
+                    *nlistType = type;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (!view->symbolsIndexed) {
+        indexSymbols(view);
+    }
+
+    /* Find the first entry not below symbolName. */
+    hi = view->symbolCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(view->symbols[mid].name, symbolName) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < view->symbolCount && !strcmp(view->symbols[lo].name, symbolName)) {
+        if (nlistType) {
+            *nlistType = view->symbols[lo].type;
+        }
+        return true;
+    }
+    return false;
+}
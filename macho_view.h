@@ -0,0 +1,103 @@
+/*
+ *  macho_view.h
+ *  kext_tools
+ *
+ *  Copyright 2026 Apple Inc. All rights reserved.
+ *
+ */
+#ifndef _MACHO_VIEW_H_
+#define _MACHO_VIEW_H_
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <mach-o/loader.h>
+
+#ifndef LC_DYLD_CHAINED_FIXUPS
+#define LC_DYLD_CHAINED_FIXUPS (0x34 | LC_REQ_DYLD) /* used with linkedit_data_command */
+#endif
+
+/* A MachOView parses the header and load commands of a 32- or 64-bit
+ * Mach-O image once, so that segments, sections and the linkedit load
+ * commands can be looked up by name or address without walking the
+ * load commands again. Only the header and load commands are read when
+ * the view is created; see machoViewCreate() in macho_view.c.
+ */
+typedef struct macho_view * MachOViewRef;
+
+typedef struct {
+    char                        segname[17];   // NUL-terminated
+    uint64_t                    vmaddr;
+    uint64_t                    vmsize;
+    uint64_t                    fileoff;
+    uint64_t                    filesize;
+    uint32_t                    firstSection;  // index into the section list
+    uint32_t                    nsects;
+    const struct load_command * loadCommand;   // LC_SEGMENT or LC_SEGMENT_64
+} MachOViewSegment;
+
+typedef struct {
+    char                        segname[17];   // as recorded in the section
+    char                        sectname[17];
+    uint64_t                    addr;
+    uint64_t                    size;
+    uint32_t                    offset;
+    uint32_t                    segmentIndex;
+    const void                * header;        // struct section or section_64
+} MachOViewSection;
+
+MachOViewRef machoViewCreate(
+    const void * machHeader,
+    size_t       size);
+void machoViewFree(
+    MachOViewRef view);
+
+Boolean machoViewIs64Bit(
+    MachOViewRef view);
+const void * machoViewGetHeader(
+    MachOViewRef view);
+
+/* Segments and sections are indexed in load command order.
+ */
+uint32_t machoViewGetSegmentCount(
+    MachOViewRef view);
+const MachOViewSegment * machoViewGetSegment(
+    MachOViewRef view,
+    uint32_t     index);
+uint32_t machoViewGetSectionCount(
+    MachOViewRef view);
+const MachOViewSection * machoViewGetSection(
+    MachOViewRef view,
+    uint32_t     index);
+
+const MachOViewSegment * machoViewGetSegmentByName(
+    MachOViewRef view,
+    const char * segname);
+const MachOViewSection * machoViewGetSectionByName(
+    MachOViewRef view,
+    const char * segname,
+    const char * sectname);
+const MachOViewSegment * machoViewGetSegmentForAddress(
+    MachOViewRef view,
+    uint64_t     address);
+const MachOViewSegment * machoViewGetSegmentForFileOffset(
+    MachOViewRef view,
+    uint64_t     fileOffset);
+uint64_t machoViewGetLowestAddress(
+    MachOViewRef view);
+
+const struct symtab_command * machoViewGetSymtab(
+    MachOViewRef view);
+const struct dysymtab_command * machoViewGetDysymtab(
+    MachOViewRef view);
+const struct linkedit_data_command * machoViewGetChainedFixups(
+    MachOViewRef view);
+const struct linkedit_data_command * machoViewGetSplitInfo(
+    MachOViewRef view);
+const uint8_t * machoViewGetUUID(
+    MachOViewRef view);
+
+Boolean machoViewFindSymbol(
+    MachOViewRef view,
+    const char * symbolName,
+    uint8_t    * nlistType);
+
+#endif /* _MACHO_VIEW_H_ */
@@ -33,6 +33,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <CommonCrypto/CommonDigest.h>
+#include <dispatch/dispatch.h>
+
 #include <mach/mach.h>
 #include <mach/mach_error.h>
 
@@ -44,17 +47,55 @@
 
 #include "kext_tools_util.h"
 #include "compression.h"
+#include "mkext1_file.h"
 
 
 /*******************************************************************************
+* An mkext1 is built in three passes. The kexts' info dictionaries and
+* executables are first read into a list of entries, one file each, which
+* gives the size of every file and an upper bound on the mkext's. The entries
+* are then compressed concurrently, each into its own buffer and with the
+* adler32 of the bytes that will be stored. Finally the entries are copied
+* in order into a buffer allocated once at its final size, and the header
+* checksum is combined from the entries' checksums.
+*
+* When deduplicating, each entry is hashed before compression and an entry
+* whose contents match an earlier one's is neither compressed nor stored;
+* its descriptor just points at the earlier entry's data. mkext1 readers go
+* by the descriptors' offsets, so they never notice.
 *******************************************************************************/
+typedef enum {
+    kMkext1EntryCompressed = 0,
+    kMkext1EntryStored,           // copied in as is
+    kMkext1EntryIncompressible,   // didn't compress; copied in as is
+    kMkext1EntryNoMemory,
+    kMkext1EntryBadSize,          // didn't decompress to its original size
+    kMkext1EntryBadData,          // didn't decompress to its original data
+} Mkext1EntryStatus;
+
 typedef struct {
-    CFMutableDataRef   mkext;
+    CFDataRef         data;            // must release
+    char            * kextPath;        // must free
+    uint32_t          kextIndex;
+    Boolean           isInfoDict;
+
+    uint8_t           digest[CC_SHA256_DIGEST_LENGTH];
+    CFIndex           duplicateOf;     // earlier entry with the same data, or -1
+
+    uint8_t         * compressedData;  // must free; NULL if stored as is
+    uint32_t          compressedLength;
+    uint32_t          checkLength;     // for kMkext1EntryBadSize
+    uint32_t          adler32;         // of the bytes stored in the mkext
+    uint32_t          offset;          // in the mkext, once laid out
+    Mkext1EntryStatus status;
+} Mkext1Entry;
+
+typedef struct {
+    Mkext1Entry      * entries;
+    uint32_t           numEntries;
     uint32_t           kextIndex;
-    uint32_t           compressOffset;
     const NXArchInfo * arch;
     Boolean            fatal;
-    Boolean            compress;
 } Mkext1Context;
 
 void addToMkext1(
@@ -68,20 +109,38 @@ Boolean addDataToMkext(
     char          * kextPath,
     Boolean         isInfoDict);
 
+void compressMkext1Entry(
+    Mkext1Entry * entry,
+    Boolean       compress);
+
+Boolean checkMkext1Entry(
+    Mkext1Entry * entry);
+
+uint32_t findDuplicateMkext1Entries(
+    Mkext1Entry * entries,
+    uint32_t      numEntries);
+
 /*******************************************************************************
 *******************************************************************************/
 CFDataRef createMkext1ForArch(const NXArchInfo * arch, CFArrayRef archiveKexts,
-    boolean_t compress)
+    Boolean compress, Boolean dedup)
 {
     CFMutableDataRef       result            = NULL;
     CFMutableDictionaryRef kextsByIdentifier = NULL;
     Mkext1Context          context;
+    Mkext1Entry          * entries           = NULL;  // must free
     mkext1_header        * mkextHeader       = NULL;  // do not free
+    uint8_t              * mkextStart        = NULL;  // do not free
     const uint8_t        * adler_point = 0;
+    uint32_t               headerLength;
+    uint64_t               mkextLength;
+    uint32_t               adler32;
+    uint32_t               numDuplicates     = 0;
     CFIndex count, i;
 
-    result = CFDataCreateMutable(kCFAllocatorDefault, /* capaacity */ 0);
-    if (!result || !createCFMutableDictionary(&kextsByIdentifier)) {
+    bzero(&context, sizeof(context));
+
+    if (!createCFMutableDictionary(&kextsByIdentifier)) {
         OSKextLogMemError();
         goto finish;
     }
@@ -115,44 +174,171 @@ CFDataRef createMkext1ForArch(const NXArchInfo * arch, CFArrayRef archiveKexts,
         }
     }
 
-   /* Add room for the mkext header and kext descriptors.
+   /* Each kext contributes an info dictionary and at most one executable.
     */
-    CFDataSetLength(result, sizeof(mkext1_header) +
-        CFDictionaryGetCount(kextsByIdentifier) * sizeof(mkext_kext));
+    count = CFDictionaryGetCount(kextsByIdentifier);
+    entries = (Mkext1Entry *)calloc(2 * count + 1, sizeof(Mkext1Entry));
+    if (!entries) {
+        OSKextLogMemError();
+        goto finish;
+    }
 
-    context.mkext = result;
+   /* Pass 1: read every file into an entry. OSKext isn't thread-safe, so
+    * this is done one kext at a time.
+    */
+    context.entries = entries;
+    context.numEntries = 0;
     context.kextIndex = 0;
-    context.compressOffset = (uint32_t)CFDataGetLength(result);
     context.arch = arch;
     context.fatal = false;
-    context.compress = compress;
     CFDictionaryApplyFunction(kextsByIdentifier, addToMkext1, &context);
     if (context.fatal) {
+        goto finish;
+    }
+
+   /* Pass 2: compress the entries concurrently, after hashing them to find
+    * duplicates if asked.
+    */
+    for (i = 0; i < context.numEntries; i++) {
+        entries[i].duplicateOf = -1;
+    }
+    if (dedup) {
+        dispatch_apply(context.numEntries,
+            dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+            ^(size_t n) {
+                CC_SHA256(CFDataGetBytePtr(entries[n].data),
+                    (CC_LONG)CFDataGetLength(entries[n].data), entries[n].digest);
+            });
+        numDuplicates = findDuplicateMkext1Entries(entries, context.numEntries);
+    }
+
+    dispatch_apply(context.numEntries,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^(size_t n) {
+            if (entries[n].duplicateOf < 0) {
+                compressMkext1Entry(&entries[n], compress);
+            }
+        });
+
+   /* Pass 3: lay the entries out behind the header and kext descriptors and
+    * copy them into a buffer made at its final size.
+    */
+    headerLength = (uint32_t)(sizeof(mkext1_header) + count * sizeof(mkext_kext));
+    mkextLength = headerLength;
+    for (i = 0; i < context.numEntries; i++) {
+        if (entries[i].duplicateOf >= 0) {
+            continue;
+        }
+        if (!checkMkext1Entry(&entries[i])) {
+            goto finish;
+        }
+        mkextLength += entries[i].compressedData ?
+            entries[i].compressedLength : CFDataGetLength(entries[i].data);
+    }
+    if (mkextLength > UINT32_MAX) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Mkext for %s is too large.", arch->name);
+        goto finish;
+    }
+
+    result = CFDataCreateMutable(kCFAllocatorDefault, /* capacity */ 0);
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    CFDataSetLength(result, (CFIndex)mkextLength);
+    if (CFDataGetLength(result) != (CFIndex)mkextLength) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Can't resize mkext buffer.");
         SAFE_RELEASE_NULL(result);
         goto finish;
     }
 
-    mkextHeader = (mkext1_header *)CFDataGetBytePtr(result);
+    mkextStart = CFDataGetMutableBytePtr(result);
+    mkextHeader = (mkext1_header *)mkextStart;
     mkextHeader->magic = OSSwapHostToBigInt32(MKEXT_MAGIC);
     mkextHeader->signature = OSSwapHostToBigInt32(MKEXT_SIGN);
     mkextHeader->version = OSSwapHostToBigInt32(0x01008000);   // 'vers' 1.0.0
-    mkextHeader->numkexts =
-        OSSwapHostToBigInt32(CFDictionaryGetCount(kextsByIdentifier));
+    mkextHeader->numkexts = OSSwapHostToBigInt32(count);
     mkextHeader->cputype = OSSwapHostToBigInt32(arch->cputype);
     mkextHeader->cpusubtype = OSSwapHostToBigInt32(arch->cpusubtype);
-    mkextHeader->length = OSSwapHostToBigInt32(CFDataGetLength(result));
+    mkextHeader->length = OSSwapHostToBigInt32((uint32_t)mkextLength);
+
+    mkextLength = headerLength;
+    for (i = 0; i < context.numEntries; i++) {
+        Mkext1Entry * entry          = &entries[i];
+        mkext_kext  * mkextKextEntry = &(mkextHeader->kext[entry->kextIndex]);
+        mkext_file  * mkextFileEntry = NULL;  // do not free
+        uint32_t      realLength     = (uint32_t)CFDataGetLength(entry->data);
+
+        if (entry->isInfoDict) {
+            mkextFileEntry = &(mkextKextEntry->plist);
+        } else {
+            mkextFileEntry = &(mkextKextEntry->module);
+        }
+        mkextFileEntry->realsize = OSSwapHostToBigInt32(realLength);
+        mkextFileEntry->modifiedsecs = 0;  // we never use this anyway
+
+        if (entry->duplicateOf >= 0) {
+            Mkext1Entry * original = &entries[entry->duplicateOf];
+
+            mkextFileEntry->offset = OSSwapHostToBigInt32(original->offset);
+            mkextFileEntry->compsize = original->compressedData ?
+                OSSwapHostToBigInt32(original->compressedLength) : 0;
+            continue;
+        }
 
+        entry->offset = (uint32_t)mkextLength;
+        mkextFileEntry->offset = OSSwapHostToBigInt32((uint32_t)mkextLength);
+
+        if (entry->compressedData) {
+            mkextFileEntry->compsize = OSSwapHostToBigInt32(entry->compressedLength);
+            memcpy(mkextStart + mkextLength, entry->compressedData,
+                entry->compressedLength);
+            mkextLength += entry->compressedLength;
+        } else {
+            mkextFileEntry->compsize = 0;
+            memcpy(mkextStart + mkextLength, CFDataGetBytePtr(entry->data),
+                realLength);
+            mkextLength += realLength;
+        }
+    }
+
+   /* The checksum runs from the version field to the end of the mkext; the
+    * entries' checksums were taken as they were compressed.
+    */
     adler_point = (UInt8 *)&mkextHeader->version;
-    mkextHeader->adler32 = OSSwapHostToBigInt32(local_adler32(
-        (UInt8 *)&mkextHeader->version,
-        (int)(CFDataGetLength(result) - (adler_point - (uint8_t *)mkextHeader))));
+    adler32 = local_adler32((UInt8 *)&mkextHeader->version,
+        (int)(headerLength - (adler_point - (uint8_t *)mkextHeader)));
+    for (i = 0; i < context.numEntries; i++) {
+        if (entries[i].duplicateOf >= 0) {
+            continue;
+        }
+        adler32 = local_adler32_combine(adler32, entries[i].adler32,
+            entries[i].compressedData ? entries[i].compressedLength :
+            (uint32_t)CFDataGetLength(entries[i].data));
+    }
+    mkextHeader->adler32 = OSSwapHostToBigInt32(adler32);
 
     OSKextLog(/* kext */ NULL, kOSKextLogProgressLevel | kOSKextLogArchiveFlag,
         "Created mkext for %s containing %lu kexts.",
         arch->name,
         CFDictionaryGetCount(kextsByIdentifier));
+    if (numDuplicates) {
+        OSKextLog(/* kext */ NULL, kOSKextLogProgressLevel | kOSKextLogArchiveFlag,
+            "Left out %u duplicate files; their entries point to "
+            "identical files already in the mkext.", numDuplicates);
+    }
 
 finish:
+    for (i = 0; entries && i < context.numEntries; i++) {
+        SAFE_RELEASE(entries[i].data);
+        SAFE_FREE(entries[i].kextPath);
+        SAFE_FREE(entries[i].compressedData);
+    }
+    SAFE_FREE(entries);
     SAFE_RELEASE(kextsByIdentifier);
     return result;
 }
@@ -267,6 +453,8 @@ finish:
 }
 
 /*******************************************************************************
+* Queues a file of the current kext; it's compressed and copied into the
+* mkext once every kext has been read.
 *******************************************************************************/
 Boolean addDataToMkext(
     CFDataRef       data,
@@ -275,115 +463,220 @@ Boolean addDataToMkext(
     Boolean         isInfoDict)
 {
     Boolean         result             = false;
-    CFIndex         newMkextLength;
-    uint32_t        origCompressOffset;
-    const UInt8   * mkextStart         = NULL;  // must calc after changing length!
-    UInt8         * addedDataStart     = NULL;  // must calc after changing length!
-    UInt8         * addedDataEnd       = NULL;  // do not free
-    uint32_t        addedDataFullLength;
-    uint32_t        compressedLength;
-
-    uint8_t       * checkBuffer        = NULL;  // must free
-
-    mkext1_header * mkextHeader        = NULL;  // do not free
-    mkext_kext    * mkextKextEntry     = NULL;  // do not free
-    mkext_file    * mkextFileEntry     = NULL;  // do not free
-
-   /* Add enough to the mkext buffer to append the whole uncompressed file.
-    * If the file can't be compressed, we'll just copy it in; if it can
-    * be compressed, we'll set the mkext buffer length to fit exactly.
-    */
-    addedDataFullLength = (uint32_t)CFDataGetLength(data);
-    newMkextLength = CFDataGetLength(context->mkext) + addedDataFullLength;
-    CFDataSetLength(context->mkext, newMkextLength);
-    if (CFDataGetLength(context->mkext) != newMkextLength) {
+    Mkext1Entry   * entry              = &context->entries[context->numEntries];
+
+    if (CFDataGetLength(data) > UINT32_MAX) {
         OSKextLog(/* kext */ NULL,
             kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
-            "Can't resize mkext buffer.");
+            "%s - %s is too large for an mkext.",
+            kextPath,
+            isInfoDict ? "info dictionary" : "executable");
         goto finish;
     }
-    mkextStart = CFDataGetBytePtr(context->mkext);
 
-    origCompressOffset = context->compressOffset;
-    addedDataStart = (UInt8 *)mkextStart + origCompressOffset;
-
-    if (context->compress) {
-        addedDataEnd = compress_lzss((uint8_t *)addedDataStart, addedDataFullLength,
-            (uint8_t *)CFDataGetBytePtr(data), addedDataFullLength);
-        if (!addedDataEnd) {
-            OSKextLog(/* kext */ NULL,
-                kOSKextLogWarningLevel | kOSKextLogArchiveFlag,
-                "%s did not compress; copying file (%d bytes).",
-                isInfoDict ? "info dictionary" : "executable",
-                addedDataFullLength);
-        }
+    entry->kextPath = strdup(kextPath);
+    if (!entry->kextPath) {
+        OSKextLogMemError();
+        goto finish;
     }
+    entry->data = CFRetain(data);
+    entry->kextIndex = context->kextIndex;
+    entry->isInfoDict = isInfoDict;
+    context->numEntries++;
 
-    if (!addedDataEnd) {
-        memcpy(addedDataStart, (const void *)CFDataGetBytePtr(data),
-            addedDataFullLength);
-        addedDataEnd = addedDataStart + addedDataFullLength;
-        compressedLength = 0;
-        context->compressOffset += addedDataFullLength;
-    } else {
-        size_t checkLength;
+    result = true;
 
-        compressedLength = (uint32_t)(addedDataEnd - addedDataStart);
-        context->compressOffset += compressedLength;
+finish:
+    return result;
+}
 
-        checkBuffer = (uint8_t *)malloc(addedDataFullLength);
-        if (!checkBuffer) {
-            OSKextLogMemError();
+/*******************************************************************************
+* Runs concurrently for all entries, so it records what happened in the entry
+* for checkMkext1Entry() to log afterward.
+*******************************************************************************/
+void compressMkext1Entry(
+    Mkext1Entry * entry,
+    Boolean       compress)
+{
+    const UInt8            * rawData     = CFDataGetBytePtr(entry->data);
+    uint32_t                 rawLength   = (uint32_t)CFDataGetLength(entry->data);
+    uint8_t                * compressed  = NULL;  // must free
+    uint8_t                * checkBuffer = NULL;  // must free
+    size_t                   compressedLength = 0;
+    size_t                   checkLength;
+    const CompressionCodec * codec       = NULL;  // do not free
+
+    /* mkext1 entries are always LZSS. */
+    codec = compression_codec_for_type(COMP_TYPE_LZSS);
+
+    if (compress && rawLength) {
+        compressed = (uint8_t *)malloc(rawLength);
+        if (!compressed) {
+            entry->status = kMkext1EntryNoMemory;
             goto finish;
         }
+        compressedLength = codec->encode(compressed, rawLength,
+            rawData, rawLength, NULL);
+    }
 
-        checkLength = decompress_lzss(checkBuffer, addedDataFullLength,
-            addedDataStart, compressedLength);
-        if (checkLength != addedDataFullLength) {
-            OSKextLog(/* kext */ NULL,
-                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
-                "%s - %s decompressed size %d differs from original size %d",
-                kextPath,
-                isInfoDict ? "info dictionary" : "executable",
-                (int)checkLength, (int)addedDataFullLength);
-            goto finish;
-        }
-        if (0 != memcmp(checkBuffer, CFDataGetBytePtr(data), checkLength)) {
-            OSKextLog(/* kext */ NULL,
-                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
-                "%s - %s decompressed data differs from input",
-                kextPath,
-                isInfoDict ? "info dictionary" : "executable");
-            goto finish;
-        }
+    if (!compressedLength) {
+        entry->adler32 = local_adler32((u_int8_t *)rawData, (int32_t)rawLength);
+        entry->status = compress ?
+            kMkext1EntryIncompressible : kMkext1EntryStored;
+        goto finish;
+    }
 
+    checkBuffer = (uint8_t *)malloc(rawLength);
+    if (!checkBuffer) {
+        entry->status = kMkext1EntryNoMemory;
+        goto finish;
+    }
+
+    checkLength = codec->decode(checkBuffer, rawLength,
+        compressed, compressedLength);
+    if (checkLength != rawLength) {
+        entry->checkLength = (uint32_t)checkLength;
+        entry->status = kMkext1EntryBadSize;
+        goto finish;
+    }
+    if (0 != memcmp(checkBuffer, rawData, checkLength)) {
+        entry->status = kMkext1EntryBadData;
+        goto finish;
+    }
+
+    entry->adler32 = local_adler32(compressed, (int32_t)compressedLength);
+    entry->compressedData = compressed;
+    entry->compressedLength = (uint32_t)compressedLength;
+    entry->status = kMkext1EntryCompressed;
+    compressed = NULL;
+
+finish:
+    SAFE_FREE(compressed);
+    SAFE_FREE(checkBuffer);
+    return;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+Boolean checkMkext1Entry(
+    Mkext1Entry * entry)
+{
+    Boolean         result             = false;
+    uint32_t        rawLength          = (uint32_t)CFDataGetLength(entry->data);
+
+    switch (entry->status) {
+      case kMkext1EntryCompressed:
         OSKextLog(/* kext */ NULL,
             kOSKextLogDetailLevel | kOSKextLogArchiveFlag,
             "Compressed %s from %u to %u bytes (%.2f%%).",
-            isInfoDict ? "info dict" : "executable",
-            addedDataFullLength, compressedLength,
-            (100.0 * (float)compressedLength/(float)addedDataFullLength));
+            entry->isInfoDict ? "info dict" : "executable",
+            rawLength, entry->compressedLength,
+            (100.0 * (float)entry->compressedLength/(float)rawLength));
+        break;
+      case kMkext1EntryStored:
+        break;
+      case kMkext1EntryIncompressible:
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogWarningLevel | kOSKextLogArchiveFlag,
+            "%s did not compress; copying file (%d bytes).",
+            entry->isInfoDict ? "info dictionary" : "executable",
+            rawLength);
+        break;
+      case kMkext1EntryNoMemory:
+        OSKextLogMemError();
+        goto finish;
+      case kMkext1EntryBadSize:
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "%s - %s decompressed size %d differs from original size %d",
+            entry->kextPath,
+            entry->isInfoDict ? "info dictionary" : "executable",
+            (int)entry->checkLength, (int)rawLength);
+        goto finish;
+      case kMkext1EntryBadData:
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "%s - %s decompressed data differs from input",
+            entry->kextPath,
+            entry->isInfoDict ? "info dictionary" : "executable");
+        goto finish;
     }
 
-   /* Truncate the mkext to exactly fit the new total size.
-    */
-    CFDataSetLength(context->mkext, addedDataEnd - mkextStart);
+    result = true;
+
+finish:
+    return result;
+}
 
-    mkextHeader = (mkext1_header *)CFDataGetBytePtr(context->mkext);
-    mkextKextEntry = &(mkextHeader->kext[context->kextIndex]);
-    if (isInfoDict) {
-        mkextFileEntry = &(mkextKextEntry->plist);
-    } else {
-        mkextFileEntry = &(mkextKextEntry->module);
+/*******************************************************************************
+* Points each entry whose digest and contents match an earlier entry's at that
+* entry. Returns the number of duplicates found.
+*******************************************************************************/
+uint32_t findDuplicateMkext1Entries(
+    Mkext1Entry * entries,
+    uint32_t      numEntries)
+{
+    uint32_t               result          = 0;
+    CFMutableDictionaryRef entriesByDigest = NULL;  // must release
+    CFDataRef              digest          = NULL;  // must release
+    CFNumberRef            entryIndexNum   = NULL;  // must release
+    CFIndex                i;
+
+    if (!createCFMutableDictionary(&entriesByDigest)) {
+        OSKextLogMemError();
+        goto finish;
     }
-    mkextFileEntry->offset = OSSwapHostToBigInt32(origCompressOffset);
-    mkextFileEntry->realsize = OSSwapHostToBigInt32(addedDataFullLength);
-    mkextFileEntry->compsize = OSSwapHostToBigInt32(compressedLength);
-    mkextFileEntry->modifiedsecs = 0;  // we never use this anyway
 
-    result = true;
+    for (i = 0; i < numEntries; i++) {
+        Mkext1Entry * entry    = &entries[i];
+        Mkext1Entry * original = NULL;  // do not free
+        CFNumberRef   foundNum = NULL;  // do not release
+        CFIndex       originalIndex;
+
+        SAFE_RELEASE_NULL(digest);
+        SAFE_RELEASE_NULL(entryIndexNum);
+
+        digest = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault,
+            entry->digest, sizeof(entry->digest), kCFAllocatorNull);
+        if (!digest) {
+            OSKextLogMemError();
+            goto finish;
+        }
+
+        foundNum = CFDictionaryGetValue(entriesByDigest, digest);
+        if (!foundNum) {
+            entryIndexNum = CFNumberCreate(kCFAllocatorDefault,
+                kCFNumberCFIndexType, &i);
+            if (!entryIndexNum) {
+                OSKextLogMemError();
+                goto finish;
+            }
+            CFDictionarySetValue(entriesByDigest, digest, entryIndexNum);
+            continue;
+        }
+
+       /* Don't trust the hash alone with what goes into the archive.
+        */
+        CFNumberGetValue(foundNum, kCFNumberCFIndexType, &originalIndex);
+        original = &entries[originalIndex];
+        if (!CFEqual(original->data, entry->data)) {
+            continue;
+        }
+
+        entry->duplicateOf = originalIndex;
+        result++;
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogDetailLevel | kOSKextLogArchiveFlag,
+            "%s - %s is the same as that of %s; storing it once.",
+            entry->kextPath,
+            entry->isInfoDict ? "info dictionary" : "executable",
+            original->kextPath);
+    }
 
 finish:
-    SAFE_FREE(checkBuffer);
+    SAFE_RELEASE(entriesByDigest);
+    SAFE_RELEASE(digest);
+    SAFE_RELEASE(entryIndexNum);
     return result;
 }
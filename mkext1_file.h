@@ -24,7 +24,9 @@
 #ifndef __MKEXT1_FILE_H__
 #define __MKEXT1_FILE_H__
 
+/* If dedup is true, files with identical contents are stored once.
+ */
 CFDataRef createMkext1ForArch(const NXArchInfo * arch, CFArrayRef archiveKexts,
-    Boolean compress);
+    Boolean compress, Boolean dedup);
 
 #endif /* __MKEXT1_FILE_H__ */
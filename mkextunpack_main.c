@@ -21,11 +21,14 @@
  * @APPLE_LICENSE_HEADER_END@
  */
 #include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOCFUnserialize.h>
 #include <IOKit/kext/OSKext.h>
 #include <IOKit/kext/OSKextPrivate.h>
 #include <IOKit/kext/fat_util.h>
 
 #include <System/libkern/mkext.h>
+#include <dispatch/dispatch.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -33,17 +36,46 @@
 #include <libc.h>
 #include <mach-o/arch.h>
 #include <mach-o/fat.h>
+#include <zlib.h>
 
 #include <mach/mach.h>
 #include <mach/mach_types.h>
 #include <mach/kmod.h>
 #include "kext_tools_util.h"
+#include "compression.h"
 
 // not a utility.[ch] customer yet
 static const char * progname = "mkextunpack";
 static Boolean gVerbose = false;
 
-u_int32_t local_adler32(u_int8_t *buffer, int32_t length);
+/* Files are queued as the mkext is read and then written by
+ * writeUnpackedFiles(), which makes their directories in one pass and writes
+ * the files from a pool of worker threads.
+ */
+typedef struct {
+    char      * subPath;   // must free; directory under the output directory
+    char      * fileName;  // must free
+    CFDataRef   data;      // must release
+} UnpackedFile;
+
+typedef struct {
+    UnpackedFile * files;  // must free
+    CFIndex        count;
+    CFIndex        capacity;
+} UnpackedFiles;
+
+/* An Mkext2Index maps bundle identifiers to entries in an mkext2's info
+ * dictionary list without creating any OSKexts, so that one kext's info
+ * dictionary and executable can be pulled out of the archive without
+ * reading the other kexts' executables.
+ */
+typedef struct {
+    const uint8_t   * mkextStart;
+    const uint8_t   * mkextEnd;
+    CFDictionaryRef   mkextPlist;  // must release
+    CFArrayRef        infoDicts;   // do not release; in mkextPlist
+    CFDictionaryRef   kextsByID;   // must release; bundle ID -> CFNumber index
+} Mkext2Index;
 
 Boolean getMkextDataForArch(
     u_int8_t         * fileData,
@@ -60,10 +92,36 @@ CFArrayRef copyKextsFromMkext2(
 Boolean writeMkext2EntriesToDirectory(
     CFArrayRef   kexts,
     char       * outputDirectory);
-Boolean writeMkext2ToDirectory(
-    OSKextRef aKext,
-    const char * outputDirectory,
-    CFMutableSetRef kextNames);
+Boolean queueMkext2Files(
+    OSKextRef       aKext,
+    CFMutableSetRef kextNames,
+    UnpackedFiles * unpackedFiles);
+
+Boolean mkext2IndexInit(
+    Mkext2Index * index,
+    void        * mkextStart,
+    void        * mkextEnd);
+void mkext2IndexFree(
+    Mkext2Index * index);
+CFIndex mkext2IndexFindKext(
+    Mkext2Index * index,
+    CFStringRef   bundleID);
+CFDictionaryRef mkext2IndexCopyInfoDictionary(
+    Mkext2Index * index,
+    CFIndex       kextIndex);
+Boolean mkext2IndexCopyExecutable(
+    Mkext2Index * index,
+    CFIndex       kextIndex,
+    CFDataRef   * executable);
+Boolean uncompressMkext2Data(
+    uint8_t       * dst,
+    uint32_t        fullSize,
+    const uint8_t * src,
+    uint32_t        compressedSize);
+Boolean writeMkext2KextToDirectory(
+    Mkext2Index * index,
+    CFStringRef   bundleID,
+    char        * outputDirectory);
 
 CFDictionaryRef extractEntriesFromMkext1(
     void * mkextStart,
@@ -74,15 +132,29 @@ Boolean uncompressMkext1Entry(
     CFDataRef * uncompressedEntry);
 Boolean writeMkext1EntriesToDirectory(CFDictionaryRef entries,
     char * outputDirectory);
+CFDictionaryRef copyMkext1EntriesForBundleID(CFDictionaryRef entries,
+    CFStringRef bundleID);
 CFStringRef createKextNameFromPlist(
     CFDictionaryRef entries, CFDictionaryRef kextPlist);
 int getBundleIDAndVersion(CFDictionaryRef kextPlist, unsigned index,
     char ** bundle_id_out, char ** bundle_version_out);
 
-Boolean writeFileInDirectory(
+Boolean queueUnpackedFile(
+    UnpackedFiles * unpackedFiles,
+    const char    * subPath,
+    const char    * fileName,
+    CFDataRef       data);
+void freeUnpackedFiles(
+    UnpackedFiles * unpackedFiles);
+Boolean writeUnpackedFiles(
+    const char    * outputDirectory,
+    UnpackedFiles * unpackedFiles);
+
+Boolean makeDirectoryInDirectory(
     const char * basePath,
-    char       * subPath,
-    const char * fileName,
+    char       * subPath);
+Boolean writeFileAtPath(
+    const char * path,
     const char * fileData,
     size_t       fileLength);
 
@@ -110,9 +182,10 @@ For each arch:
 /*******************************************************************************
 *******************************************************************************/
 void usage(int num) {
-    fprintf(stderr, "usage: %s [-v] [-a arch] [-d output_dir] mkextfile\n", progname);
+    fprintf(stderr, "usage: %s [-v] [-a arch] [-b bundle_id] [-d output_dir] mkextfile\n", progname);
     fprintf(stderr, "    -d output_dir: where to put kexts (must exist)\n");
     fprintf(stderr, "    -a arch: pick architecture from fat mkext file\n");
+    fprintf(stderr, "    -b bundle_id: list or unpack only the kext with this identifier\n");
     fprintf(stderr, "    -v: verbose output; list kexts in mkextfile\n");
     return;
 }
@@ -131,18 +204,39 @@ int main (int argc, const char * argv[]) {
     void             * mkextStart        = NULL;
     void             * mkextEnd          = NULL;
     CFDictionaryRef    entries           = NULL;
+    CFDictionaryRef    bundleEntries     = NULL;
     CFArrayRef         oskexts           = NULL;
+    CFStringRef        bundleID          = NULL;
+    Mkext2Index        mkext2Index;
     const NXArchInfo * archInfo          = NULL;
     uint32_t           mkextVersion;
 
+    bzero(&mkext2Index, sizeof(mkext2Index));
+
     progname = argv[0];
 
    /* Set the OSKext log callback right away.
     */
     OSKextSetLogOutputFunction(&tool_log);
 
-    while ((optchar = getopt(argc, (char * const *)argv, "a:d:hv")) != -1) {
+    while ((optchar = getopt(argc, (char * const *)argv, "a:b:d:hv")) != -1) {
         switch (optchar) {
+          case 'b':
+            if (!optarg) {
+                fprintf(stderr, "no argument for -b\n");
+                usage(0);
+                exit_code = 1;
+                goto finish;
+            }
+            SAFE_RELEASE_NULL(bundleID);
+            bundleID = CFStringCreateWithCString(kCFAllocatorDefault, optarg,
+                kCFStringEncodingUTF8);
+            if (!bundleID) {
+                OSKextLogMemError();
+                exit_code = 1;
+                goto finish;
+            }
+            break;
           case 'd':
             if (!optarg) {
                 fprintf(stderr, "no argument for -d\n");
@@ -279,7 +373,14 @@ int main (int argc, const char * argv[]) {
         goto finish;
     }
 
-    if (mkextVersion == MKEXT_VERS_2) {
+    if (mkextVersion == MKEXT_VERS_2 && bundleID) {
+        if (!mkext2IndexInit(&mkext2Index, mkextStart, mkextEnd) ||
+            !writeMkext2KextToDirectory(&mkext2Index, bundleID, outputDirectory)) {
+
+            exit_code = 1;
+            goto finish;
+        }
+    } else if (mkextVersion == MKEXT_VERS_2) {
         oskexts = copyKextsFromMkext2(mkextStart, mkextEnd, archInfo);
         if (!oskexts) {
             exit_code = 1;
@@ -299,6 +400,15 @@ int main (int argc, const char * argv[]) {
             goto finish;
         }
 
+        if (bundleID) {
+            bundleEntries = copyMkext1EntriesForBundleID(entries, bundleID);
+            if (!bundleEntries) {
+                exit_code = 1;
+                goto finish;
+            }
+            entries = bundleEntries;
+        }
+
         if (outputDirectory &&
             !writeMkext1EntriesToDirectory(entries, outputDirectory)) {
 
@@ -309,6 +419,9 @@ int main (int argc, const char * argv[]) {
 
 finish:
     SAFE_RELEASE(oskexts);
+    SAFE_RELEASE(bundleID);
+    SAFE_RELEASE(bundleEntries);
+    mkext2IndexFree(&mkext2Index);
     exit(exit_code);
     return exit_code;
 }
@@ -482,6 +595,463 @@ finish:
     return result;
 }
 
+/*******************************************************************************
+* Unserializes the mkext2's plist, which is all that's needed to find a kext;
+* executables are only read when asked for.
+*******************************************************************************/
+Boolean mkext2IndexInit(
+    Mkext2Index * index,
+    void        * mkextStart,
+    void        * mkextEnd)
+{
+    Boolean                result         = false;
+    mkext2_header        * mkextHeader    = (mkext2_header *)mkextStart;
+    CFMutableDictionaryRef kextsByID      = NULL;  // must release
+    char                 * plistXML       = NULL;  // must free
+    CFStringRef            errorString    = NULL;  // must release
+    CFNumberRef            kextIndexNum   = NULL;  // must release
+    size_t                 mkextLength    = (uint8_t *)mkextEnd - (uint8_t *)mkextStart;
+    uint32_t               plistOffset;
+    uint32_t               plistCompSize;
+    uint32_t               plistFullSize;
+    CFIndex                count, i;
+
+    bzero(index, sizeof(*index));
+    index->mkextStart = mkextStart;
+    index->mkextEnd = mkextEnd;
+
+    if (mkextLength < sizeof(*mkextHeader)) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Bad mkext data; header is truncated.");
+        goto finish;
+    }
+
+    plistOffset = MKEXT2_GET_PLIST(mkextHeader);
+    plistCompSize = MKEXT2_GET_PLIST_COMPSIZE(mkextHeader);
+    plistFullSize = MKEXT2_GET_PLIST_FULLSIZE(mkextHeader);
+    if (plistOffset > mkextLength ||
+        (plistCompSize ? plistCompSize : plistFullSize) >
+            mkextLength - plistOffset) {
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Bad mkext data; plist lies outside the archive.");
+        goto finish;
+    }
+
+   /* IOCFUnserialize() wants a C string.
+    */
+    plistXML = (char *)malloc(plistFullSize + 1);
+    if (!plistXML) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    if (plistCompSize) {
+        if (!uncompressMkext2Data((uint8_t *)plistXML, plistFullSize,
+            index->mkextStart + plistOffset, plistCompSize)) {
+
+            goto finish;
+        }
+    } else {
+        memcpy(plistXML, index->mkextStart + plistOffset, plistFullSize);
+    }
+    plistXML[plistFullSize] = '\0';
+
+    index->mkextPlist = (CFDictionaryRef)IOCFUnserialize(plistXML,
+        kCFAllocatorDefault, /* options */ 0, &errorString);
+    if (!index->mkextPlist ||
+        CFGetTypeID(index->mkextPlist) != CFDictionaryGetTypeID()) {
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Can't read mkext2 plist.");
+        goto finish;
+    }
+
+    index->infoDicts = (CFArrayRef)CFDictionaryGetValue(index->mkextPlist,
+        CFSTR(kMKEXTInfoDictionariesKey));
+    if (!index->infoDicts ||
+        CFGetTypeID(index->infoDicts) != CFArrayGetTypeID()) {
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Bad mkext data; no info dictionaries.");
+        goto finish;
+    }
+
+    if (!createCFMutableDictionary(&kextsByID)) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+   /* If the archive holds more than one kext with an identifier, take the
+    * first.
+    */
+    count = CFArrayGetCount(index->infoDicts);
+    for (i = 0; i < count; i++) {
+        CFDictionaryRef infoDict = (CFDictionaryRef)
+            CFArrayGetValueAtIndex(index->infoDicts, i);
+        CFStringRef     kextID   = NULL;  // do not release
+
+        if (CFGetTypeID(infoDict) != CFDictionaryGetTypeID()) {
+            continue;
+        }
+        kextID = (CFStringRef)CFDictionaryGetValue(infoDict,
+            kCFBundleIdentifierKey);
+        if (!kextID || CFGetTypeID(kextID) != CFStringGetTypeID() ||
+            CFDictionaryContainsKey(kextsByID, kextID)) {
+
+            continue;
+        }
+
+        SAFE_RELEASE_NULL(kextIndexNum);
+        kextIndexNum = CFNumberCreate(kCFAllocatorDefault, kCFNumberCFIndexType, &i);
+        if (!kextIndexNum) {
+            OSKextLogMemError();
+            goto finish;
+        }
+        CFDictionarySetValue(kextsByID, kextID, kextIndexNum);
+    }
+
+    index->kextsByID = kextsByID;
+    kextsByID = NULL;
+
+    result = true;
+
+finish:
+    SAFE_RELEASE(kextsByID);
+    SAFE_RELEASE(errorString);
+    SAFE_RELEASE(kextIndexNum);
+    SAFE_FREE(plistXML);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+void mkext2IndexFree(
+    Mkext2Index * index)
+{
+    SAFE_RELEASE_NULL(index->mkextPlist);
+    SAFE_RELEASE_NULL(index->kextsByID);
+    index->infoDicts = NULL;
+    return;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFIndex mkext2IndexFindKext(
+    Mkext2Index * index,
+    CFStringRef   bundleID)
+{
+    CFIndex     result       = kCFNotFound;
+    CFNumberRef kextIndexNum = NULL;  // do not release
+
+    kextIndexNum = CFDictionaryGetValue(index->kextsByID, bundleID);
+    if (kextIndexNum) {
+        CFNumberGetValue(kextIndexNum, kCFNumberCFIndexType, &result);
+    }
+    return result;
+}
+
+/*******************************************************************************
+* Returns the kext's info dictionary without the _MKEXT keys the archive
+* adds, as OSKextCopyInfoDictionary() would.
+*******************************************************************************/
+CFDictionaryRef mkext2IndexCopyInfoDictionary(
+    Mkext2Index * index,
+    CFIndex       kextIndex)
+{
+    CFMutableDictionaryRef result = NULL;
+
+    result = CFDictionaryCreateMutableCopy(kCFAllocatorDefault, 0,
+        (CFDictionaryRef)CFArrayGetValueAtIndex(index->infoDicts, kextIndex));
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    CFDictionaryRemoveValue(result, CFSTR(kMKEXTBundlePathKey));
+    CFDictionaryRemoveValue(result, CFSTR(kMKEXTExecutableRelativePathKey));
+    CFDictionaryRemoveValue(result, CFSTR(kMKEXTExecutableKey));
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+* Reads just the one file entry the kext's info dictionary points to.
+* Sets *executable to NULL and returns true if the kext has no executable.
+*******************************************************************************/
+Boolean mkext2IndexCopyExecutable(
+    Mkext2Index * index,
+    CFIndex       kextIndex,
+    CFDataRef   * executable)
+{
+    Boolean             result         = false;
+    CFDictionaryRef     infoDict       = NULL;  // do not release
+    CFNumberRef         offsetNum      = NULL;  // do not release
+    mkext2_file_entry * fileEntry      = NULL;  // do not free
+    uint8_t           * fileData       = NULL;  // must free
+    size_t              mkextLength    = index->mkextEnd - index->mkextStart;
+    uint64_t            entryOffset    = 0;
+    uint32_t            compressedSize;
+    uint32_t            fullSize;
+
+    *executable = NULL;
+
+    infoDict = (CFDictionaryRef)CFArrayGetValueAtIndex(index->infoDicts, kextIndex);
+    offsetNum = (CFNumberRef)CFDictionaryGetValue(infoDict,
+        CFSTR(kMKEXTExecutableKey));
+    if (!offsetNum) {
+        result = true;
+        goto finish;
+    }
+    if (CFGetTypeID(offsetNum) != CFNumberGetTypeID() ||
+        !CFNumberGetValue(offsetNum, kCFNumberSInt64Type, &entryOffset) ||
+        entryOffset > mkextLength ||
+        mkextLength - entryOffset < sizeof(*fileEntry)) {
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Bad mkext data; executable lies outside the archive.");
+        goto finish;
+    }
+
+    fileEntry = (mkext2_file_entry *)(index->mkextStart + entryOffset);
+    compressedSize = MKEXT2_GET_ENTRY_COMPSIZE(fileEntry);
+    fullSize = MKEXT2_GET_ENTRY_FULLSIZE(fileEntry);
+    if ((compressedSize ? compressedSize : fullSize) >
+        mkextLength - entryOffset - sizeof(*fileEntry)) {
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Bad mkext data; executable lies outside the archive.");
+        goto finish;
+    }
+
+    fileData = (uint8_t *)malloc(fullSize ? fullSize : 1);
+    if (!fileData) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    if (compressedSize) {
+        if (!uncompressMkext2Data(fileData, fullSize,
+            MKEXT2_GET_ENTRY_DATA(fileEntry), compressedSize)) {
+
+            goto finish;
+        }
+    } else {
+        memcpy(fileData, MKEXT2_GET_ENTRY_DATA(fileEntry), fullSize);
+    }
+
+    *executable = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault,
+        fileData, fullSize, kCFAllocatorMalloc);
+    if (!*executable) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    fileData = NULL;  // the CFData owns it now
+
+    result = true;
+
+finish:
+    SAFE_FREE(fileData);
+    return result;
+}
+
+/*******************************************************************************
+* mkext2 files are compressed with zlib.
+*******************************************************************************/
+Boolean uncompressMkext2Data(
+    uint8_t       * dst,
+    uint32_t        fullSize,
+    const uint8_t * src,
+    uint32_t        compressedSize)
+{
+    Boolean result   = false;
+    uLongf  dstSize  = fullSize;
+    int     zlibResult;
+
+    zlibResult = uncompress(dst, &dstSize, src, compressedSize);
+    if (zlibResult != Z_OK) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Can't uncompress mkext data - zlib error %d.", zlibResult);
+        goto finish;
+    }
+    if (dstSize != fullSize) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Uncompressed mkext data is not the length recorded.");
+        goto finish;
+    }
+
+    result = true;
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+* Lists (-v) or writes out the kext with bundleID, reading nothing from the
+* archive but its plist and that kext's executable.
+*******************************************************************************/
+Boolean writeMkext2KextToDirectory(
+    Mkext2Index * index,
+    CFStringRef   bundleID,
+    char        * outputDirectory)
+{
+    Boolean         result             = false;
+    CFIndex         kextIndex;
+    CFDictionaryRef rawInfoDict        = NULL;  // do not release
+    CFDictionaryRef infoDict           = NULL;  // must release
+    CFDataRef       infoDictData       = NULL;  // must release
+    CFDataRef       executable         = NULL;  // must release
+    CFErrorRef      error              = NULL;  // must release
+    CFStringRef     bundlePath         = NULL;  // do not release
+    CFStringRef     kextVersion        = NULL;  // do not release
+    CFStringRef     executableName     = NULL;  // do not release
+    char          * bundleIDCString    = NULL;  // must free
+    char          * bundlePathCString  = NULL;  // must free
+    char          * kextVersionCString = NULL;  // must free
+    char          * executableNameCString = NULL;  // must free
+    const char    * kextName           = NULL;  // do not free
+    UnpackedFiles   unpackedFiles      = { 0 };  // must freeUnpackedFiles()
+    char            subPath[PATH_MAX];
+
+    bundleIDCString = createUTF8CStringForCFString(bundleID);
+    if (!bundleIDCString) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    kextIndex = mkext2IndexFindKext(index, bundleID);
+    if (kextIndex == kCFNotFound) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Kext %s not found in mkext.", bundleIDCString);
+        goto finish;
+    }
+
+    rawInfoDict = (CFDictionaryRef)CFArrayGetValueAtIndex(index->infoDicts,
+        kextIndex);
+    bundlePath = (CFStringRef)CFDictionaryGetValue(rawInfoDict,
+        CFSTR(kMKEXTBundlePathKey));
+    if (bundlePath && CFGetTypeID(bundlePath) == CFStringGetTypeID()) {
+        bundlePathCString = createUTF8CStringForCFString(bundlePath);
+    }
+
+    if (gVerbose) {
+        kextVersion = (CFStringRef)CFDictionaryGetValue(rawInfoDict,
+            kCFBundleVersionKey);
+        if (kextVersion && CFGetTypeID(kextVersion) == CFStringGetTypeID()) {
+            kextVersionCString = createUTF8CStringForCFString(kextVersion);
+        }
+        fprintf(stdout, "%s - %s (%s)\n",
+            bundlePathCString ? bundlePathCString : "(unknown)",
+            bundleIDCString,
+            kextVersionCString ? kextVersionCString : "(unknown)");
+    }
+
+    if (!outputDirectory) {
+        result = true;
+        goto finish;
+    }
+
+    if (bundlePathCString) {
+        size_t pathLength = strlen(bundlePathCString);
+
+        if (pathLength && bundlePathCString[pathLength - 1] == '/') {
+            bundlePathCString[pathLength - 1] = '\0';
+        }
+        kextName = rindex(bundlePathCString, '/');
+        kextName = kextName ? kextName + 1 : bundlePathCString;
+    }
+
+   /*****
+    * Queue the plist file.
+    */
+    infoDict = mkext2IndexCopyInfoDictionary(index, kextIndex);
+    if (!infoDict) {
+        goto finish;
+    }
+    infoDictData = CFPropertyListCreateData(kCFAllocatorDefault,
+        infoDict, kCFPropertyListXMLFormat_v1_0, /* options */ 0, &error);
+    if (!infoDictData) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Can't serialize kext info dictionary.");
+        goto finish;
+    }
+
+    if (kextName && *kextName) {
+        if (snprintf(subPath, sizeof(subPath),
+                "%s/Contents", kextName) >= sizeof(subPath) - 1) {
+            subPath[0] = '\0';
+        }
+    } else if (snprintf(subPath, sizeof(subPath),
+            "%s.kext/Contents", bundleIDCString) >= sizeof(subPath) - 1) {
+        subPath[0] = '\0';
+    }
+    if (!subPath[0]) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag | kOSKextLogFileAccessFlag,
+            "Output path is too long for %s.", bundleIDCString);
+        goto finish;
+    }
+    if (!queueUnpackedFile(&unpackedFiles, subPath, "Info.plist", infoDictData)) {
+        goto finish;
+    }
+
+   /*****
+    * Queue the executable file.
+    */
+    if (!mkext2IndexCopyExecutable(index, kextIndex, &executable)) {
+        goto finish;
+    }
+    if (executable) {
+        executableName = (CFStringRef)CFDictionaryGetValue(infoDict,
+            kCFBundleExecutableKey);
+        if (!executableName || CFGetTypeID(executableName) != CFStringGetTypeID()) {
+            OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+                "Kext %s has an executable but no CFBundleExecutable property.",
+                bundleIDCString);
+            goto finish;
+        }
+        executableNameCString = createUTF8CStringForCFString(executableName);
+        if (!executableNameCString) {
+            OSKextLogMemError();
+            goto finish;
+        }
+        if (strlcat(subPath, "/MacOS", sizeof(subPath)) >= sizeof(subPath)) {
+            OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogArchiveFlag | kOSKextLogFileAccessFlag,
+                "Output path is too long - %s.", subPath);
+            goto finish;
+        }
+        if (!queueUnpackedFile(&unpackedFiles, subPath,
+            executableNameCString, executable)) {
+
+            goto finish;
+        }
+    }
+
+    result = writeUnpackedFiles(outputDirectory, &unpackedFiles);
+
+finish:
+    SAFE_RELEASE(infoDict);
+    SAFE_RELEASE(infoDictData);
+    SAFE_RELEASE(executable);
+    SAFE_RELEASE(error);
+    SAFE_FREE(bundleIDCString);
+    SAFE_FREE(bundlePathCString);
+    SAFE_FREE(kextVersionCString);
+    SAFE_FREE(executableNameCString);
+    freeUnpackedFiles(&unpackedFiles);
+    return result;
+}
+
 /*******************************************************************************
 *******************************************************************************/
 Boolean writeMkext2EntriesToDirectory(
@@ -490,31 +1060,40 @@ Boolean writeMkext2EntriesToDirectory(
 {
     Boolean         result          = false;
     CFMutableSetRef kextNames       = NULL;  // must release
+    UnpackedFiles   unpackedFiles   = { 0 };  // must freeUnpackedFiles()
     CFIndex         count, i;
 
     if (!createCFMutableSet(&kextNames, &kCFTypeSetCallBacks)) {
         OSKextLogMemError();
+        goto finish;
     }
 
+   /* OSKext isn't thread-safe, so the kexts are read out of the mkext here
+    * one at a time; only the writing is spread over threads.
+    */
     count = CFArrayGetCount(kexts);
     for (i = 0; i < count; i++) {
         OSKextRef theKext = (OSKextRef)CFArrayGetValueAtIndex(kexts, i);
 
-        if (!writeMkext2ToDirectory(theKext, outputDirectory, kextNames)) {
+        if (!queueMkext2Files(theKext, kextNames, &unpackedFiles)) {
             goto finish;
         }
     }
 
+    result = writeUnpackedFiles(outputDirectory, &unpackedFiles);
+
 finish:
+    SAFE_RELEASE(kextNames);
+    freeUnpackedFiles(&unpackedFiles);
     return result;
 }
 
 /*******************************************************************************
 *******************************************************************************/
-Boolean writeMkext2ToDirectory(
-    OSKextRef aKext,
-    const char * outputDirectory,
-    CFMutableSetRef kextNames)
+Boolean queueMkext2Files(
+    OSKextRef       aKext,
+    CFMutableSetRef kextNames,
+    UnpackedFiles * unpackedFiles)
 {
     Boolean         result                 = false;
     CFDictionaryRef infoDict               = NULL;  // must release
@@ -592,7 +1171,7 @@ Boolean writeMkext2ToDirectory(
     kextNameCStringAlloced = createUTF8CStringForCFString(kextName);
 
    /*****
-    * Write the plist file.
+    * Queue the plist file.
     */
     infoDictData = CFPropertyListCreateData(kCFAllocatorDefault,
         infoDict, kCFPropertyListXMLFormat_v1_0, /* options */ 0, &error);
@@ -618,9 +1197,7 @@ Boolean writeMkext2ToDirectory(
             "Output path is too long - %s.", subPath);
         goto finish;
     }
-    if (!writeFileInDirectory(outputDirectory, subPath, "Info.plist",
-        file_data, CFDataGetLength(infoDictData))) {
-
+    if (!queueUnpackedFile(unpackedFiles, subPath, "Info.plist", infoDictData)) {
         goto finish;
     }
 
@@ -630,7 +1207,7 @@ Boolean writeMkext2ToDirectory(
     }
 
    /*****
-    * Write the executable file.
+    * Queue the executable file.
     */
     file_data = (u_int8_t *)CFDataGetBytePtr(executable);
     if (!file_data) {
@@ -660,9 +1237,8 @@ Boolean writeMkext2ToDirectory(
         OSKextLogMemError();
         goto finish;
     }
-    if (!writeFileInDirectory(outputDirectory, subPath,
-        executableNameCStringAlloced,
-        file_data, CFDataGetLength(executable))) {
+    if (!queueUnpackedFile(unpackedFiles, subPath,
+        executableNameCStringAlloced, executable)) {
 
         goto finish;
     }
@@ -713,7 +1289,6 @@ CFDictionaryRef extractEntriesFromMkext1(
 
     mkext1_header          * mkextHeader = NULL;  // don't free
     mkext_kext             * onekext_data = 0;     // don't free
-    mkext_file             * plist_file = 0;       // don't free
     mkext_file             * module_file = 0;      // don't free
     CFStringRef              entryName = NULL;     // must release
     CFMutableDictionaryRef   entryDict = NULL; // must release
@@ -722,7 +1297,11 @@ CFDictionaryRef extractEntriesFromMkext1(
     CFStringRef              errorString = NULL;   // must release
     CFDataRef                kextExecutable = 0;   // must release
     CFDictionaryKeyCallBacks keyCallBacks;
-
+    unsigned int             count = 0;
+    CFDataRef              * plistDatas = NULL;    // must release each & free
+    CFDataRef              * executables = NULL;   // must release each & free
+    Boolean                * plistOK = NULL;       // must free
+    Boolean                * executableOK = NULL;  // must free
 
     keyCallBacks = kCFTypeDictionaryKeyCallBacks;
     keyCallBacks.equal = &CaseInsensitiveEqual;
@@ -736,11 +1315,47 @@ CFDictionaryRef extractEntriesFromMkext1(
 
     mkextHeader = (mkext1_header *)mkextStart;
 
+    count = MKEXT_GET_COUNT(mkextHeader);
+
     if (gVerbose) {
-        fprintf(stdout, "Found %u kexts:\n", MKEXT_GET_COUNT(mkextHeader));
+        fprintf(stdout, "Found %u kexts:\n", count);
+    }
+
+    plistDatas = (CFDataRef *)calloc(count, sizeof(CFDataRef));
+    executables = (CFDataRef *)calloc(count, sizeof(CFDataRef));
+    plistOK = (Boolean *)calloc(count, sizeof(Boolean));
+    executableOK = (Boolean *)calloc(count, sizeof(Boolean));
+    if (count && (!plistDatas || !executables || !plistOK || !executableOK)) {
+        fprintf(stderr, "memory allocation failure\n");
+        error = true;
+        goto finish;
     }
 
-    for (i = 0; i < MKEXT_GET_COUNT(mkextHeader); i++) {
+   /* Uncompressing is most of the work of reading an mkext and each entry
+    * stands alone, so uncompress them all at once up front. Parsing and
+    * naming the entries stays serial below since the names depend on order.
+    */
+    dispatch_apply(count,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^(size_t n) {
+            mkext_file * plist  = &mkextHeader->kext[n].plist;
+            mkext_file * module = &mkextHeader->kext[n].module;
+
+            plistOK[n] = uncompressMkext1Entry(mkextStart, plist,
+                &plistDatas[n]) && plistDatas[n];
+
+            executableOK[n] = true;
+            if (OSSwapBigToHostInt32(module->offset) ||
+                OSSwapBigToHostInt32(module->compsize) ||
+                OSSwapBigToHostInt32(module->realsize) ||
+                OSSwapBigToHostInt32(module->modifiedsecs)) {
+
+                executableOK[n] = uncompressMkext1Entry(mkextStart, module,
+                    &executables[n]);
+            }
+        });
+
+    for (i = 0; i < count; i++) {
         if (entryName) {
             CFRelease(entryName);
             entryName = NULL;
@@ -776,15 +1391,14 @@ CFDictionaryRef extractEntriesFromMkext1(
         }
 
         onekext_data = &mkextHeader->kext[i];
-        plist_file = &onekext_data->plist;
         module_file = &onekext_data->module;
 
        /*****
         * Get the plist
         */
-        if (!uncompressMkext1Entry(mkextStart,
-            plist_file, &kextPlistDataObject) || !kextPlistDataObject) {
-
+        kextPlistDataObject = plistDatas[i];
+        plistDatas[i] = NULL;
+        if (!plistOK[i]) {
             fprintf(stderr, "couldn't uncompress plist at index %d.\n", i);
             continue;
         }
@@ -864,9 +1478,9 @@ CFDictionaryRef extractEntriesFromMkext1(
             OSSwapBigToHostInt32(module_file->realsize) ||
             OSSwapBigToHostInt32(module_file->modifiedsecs)) {
 
-            if (!uncompressMkext1Entry(mkextStart,
-                module_file, &kextExecutable)) {
-
+            kextExecutable = executables[i];
+            executables[i] = NULL;
+            if (!executableOK[i]) {
                 fprintf(stderr, "couldn't uncompress executable at index %d.\n",
                     i);
                 continue;
@@ -894,6 +1508,14 @@ finish:
     if (kextPlist)       CFRelease(kextPlist);
     if (errorString)     CFRelease(errorString);
     if (kextExecutable)  CFRelease(kextExecutable);
+    for (i = 0; i < count; i++) {
+        if (plistDatas && plistDatas[i])   CFRelease(plistDatas[i]);
+        if (executables && executables[i]) CFRelease(executables[i]);
+    }
+    SAFE_FREE(plistDatas);
+    SAFE_FREE(executables);
+    SAFE_FREE(plistOK);
+    SAFE_FREE(executableOK);
 
     return entries;
 }
@@ -934,10 +1556,12 @@ Boolean uncompressMkext1Entry(
     }
 
     if (compsize != 0) {
-        uncompressed_size = decompress_lzss(uncompressed_data,
-            (u_int32_t)realsize,
+        /* mkext1 entries are always LZSS. */
+        uncompressed_size = compression_codec_for_type(COMP_TYPE_LZSS)->decode(
+            uncompressed_data,
+            realsize,
             mkext_base_address + offset,
-            (u_int32_t)compsize);
+            compsize);
         if (uncompressed_size != realsize) {
             fprintf(stderr, "uncompressed file is not the length "
                   "recorded.\n");
@@ -974,6 +1598,7 @@ Boolean writeMkext1EntriesToDirectory(CFDictionaryRef entryDict,
     CFDictionaryRef * entries         = NULL;  // must free
     char            * kext_name       = NULL;  // must free
     char            * executable_name = NULL;  // must free
+    UnpackedFiles     unpackedFiles   = { 0 };  // must freeUnpackedFiles()
     char              subPath[PATH_MAX];
     unsigned int      count, i;
 
@@ -1009,7 +1634,7 @@ Boolean writeMkext1EntriesToDirectory(CFDictionaryRef entryDict,
         }
 
        /*****
-        * Write the plist file.
+        * Queue the plist file.
         */
         fileData = CFDictionaryGetValue(kextEntry, CFSTR("plistData"));
         if (!fileData) {
@@ -1033,14 +1658,14 @@ Boolean writeMkext1EntriesToDirectory(CFDictionaryRef entryDict,
                 "Output path is too long - %s.", subPath);
             goto finish;
         }
-        if (!writeFileInDirectory(outputDirectory, subPath, "Info.plist",
-            file_data, CFDataGetLength(fileData))) {
+        if (!queueUnpackedFile(&unpackedFiles, subPath, "Info.plist",
+            fileData)) {
 
             goto finish;
         }
 
        /*****
-        * Write the executable file.
+        * Queue the executable file.
         */
         fileData = CFDictionaryGetValue(kextEntry, CFSTR("executable"));
         if (!fileData) {
@@ -1076,18 +1701,76 @@ Boolean writeMkext1EntriesToDirectory(CFDictionaryRef entryDict,
             OSKextLogMemError();
             goto finish;
         }
-        if (!writeFileInDirectory(outputDirectory, subPath, executable_name,
-            file_data, CFDataGetLength(fileData))) {
+        if (!queueUnpackedFile(&unpackedFiles, subPath, executable_name,
+            fileData)) {
 
             goto finish;
         }
     }
 
-    result = true;
+    result = writeUnpackedFiles(outputDirectory, &unpackedFiles);
 
 finish:
     if (kextNames) free(kextNames);
     if (entries)   free(entries);
+    SAFE_FREE(kext_name);
+    SAFE_FREE(executable_name);
+    freeUnpackedFiles(&unpackedFiles);
+    return result;
+}
+
+/*******************************************************************************
+* mkext1 has no index to speak of; every entry has already been read, so
+* this just drops the ones that don't match.
+*******************************************************************************/
+CFDictionaryRef copyMkext1EntriesForBundleID(CFDictionaryRef entries,
+    CFStringRef bundleID)
+{
+    CFMutableDictionaryRef result    = NULL;
+    CFStringRef          * kextNames = NULL;  // must free
+    CFDictionaryRef      * kextEntries = NULL;  // must free
+    char                 * bundleIDCString = NULL;  // must free
+    CFIndex                count, i;
+
+    count = CFDictionaryGetCount(entries);
+    result = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    kextNames = (CFStringRef *)malloc((count + 1) * sizeof(CFStringRef));
+    kextEntries = (CFDictionaryRef *)malloc((count + 1) * sizeof(CFDictionaryRef));
+    if (!result || !kextNames || !kextEntries) {
+        OSKextLogMemError();
+        SAFE_RELEASE_NULL(result);
+        goto finish;
+    }
+
+    CFDictionaryGetKeysAndValues(entries, (const void **)kextNames,
+        (const void **)kextEntries);
+    for (i = 0; i < count; i++) {
+        CFDictionaryRef plist = CFDictionaryGetValue(kextEntries[i], CFSTR("plist"));
+        CFTypeRef       kextID = NULL;  // do not release
+
+        if (plist) {
+            kextID = CFDictionaryGetValue(plist, kCFBundleIdentifierKey);
+        }
+        if (kextID && CFEqual(kextID, bundleID)) {
+            CFDictionarySetValue(result, kextNames[i], kextEntries[i]);
+        }
+    }
+
+    if (!CFDictionaryGetCount(result)) {
+        bundleIDCString = createUTF8CStringForCFString(bundleID);
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogArchiveFlag,
+            "Kext %s not found in mkext.",
+            bundleIDCString ? bundleIDCString : "(unknown)");
+        SAFE_RELEASE_NULL(result);
+        goto finish;
+    }
+
+finish:
+    SAFE_FREE(kextNames);
+    SAFE_FREE(kextEntries);
+    SAFE_FREE(bundleIDCString);
     return result;
 }
 
@@ -1225,19 +1908,138 @@ finish:
 
 /*******************************************************************************
 *******************************************************************************/
-Boolean writeFileInDirectory(
+Boolean queueUnpackedFile(
+    UnpackedFiles * unpackedFiles,
+    const char    * subPath,
+    const char    * fileName,
+    CFDataRef       data)
+{
+    Boolean        result = false;
+    UnpackedFile * file   = NULL;  // do not free
+
+    if (unpackedFiles->count == unpackedFiles->capacity) {
+        CFIndex        newCapacity = unpackedFiles->capacity ?
+            2 * unpackedFiles->capacity : 64;
+        UnpackedFile * newFiles    = realloc(unpackedFiles->files,
+            newCapacity * sizeof(UnpackedFile));
+
+        if (!newFiles) {
+            OSKextLogMemError();
+            goto finish;
+        }
+        unpackedFiles->files = newFiles;
+        unpackedFiles->capacity = newCapacity;
+    }
+
+    file = &unpackedFiles->files[unpackedFiles->count];
+    file->subPath = strdup(subPath);
+    file->fileName = strdup(fileName);
+    if (!file->subPath || !file->fileName) {
+        SAFE_FREE(file->subPath);
+        SAFE_FREE(file->fileName);
+        OSKextLogMemError();
+        goto finish;
+    }
+    file->data = CFRetain(data);
+    unpackedFiles->count++;
+
+    result = true;
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+void freeUnpackedFiles(
+    UnpackedFiles * unpackedFiles)
+{
+    CFIndex i;
+
+    for (i = 0; i < unpackedFiles->count; i++) {
+        SAFE_FREE(unpackedFiles->files[i].subPath);
+        SAFE_FREE(unpackedFiles->files[i].fileName);
+        SAFE_RELEASE(unpackedFiles->files[i].data);
+    }
+    SAFE_FREE_NULL(unpackedFiles->files);
+    unpackedFiles->count = 0;
+    unpackedFiles->capacity = 0;
+    return;
+}
+
+/*******************************************************************************
+* Files are queued a kext at a time, so the directories are made in a single
+* serial pass, once per run of files sharing a directory. The files are then
+* written concurrently, each with a single write of its whole contents.
+*******************************************************************************/
+Boolean writeUnpackedFiles(
+    const char    * outputDirectory,
+    UnpackedFiles * unpackedFiles)
+{
+    Boolean       result      = false;
+    const char  * lastSubPath = NULL;  // do not free
+    char          subPath[PATH_MAX];
+    atomic_bool   writeFailed = false;
+    atomic_bool * writeFailedPtr = &writeFailed;
+    CFIndex       i;
+
+    for (i = 0; i < unpackedFiles->count; i++) {
+        UnpackedFile * file = &unpackedFiles->files[i];
+
+        if (lastSubPath && !strcmp(lastSubPath, file->subPath)) {
+            continue;
+        }
+        if (strlcpy(subPath, file->subPath, sizeof(subPath)) >= sizeof(subPath)) {
+            OSKextLog(/* kext */ NULL,
+                kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                "Output path is too long - %s.", file->subPath);
+            goto finish;
+        }
+        if (!makeDirectoryInDirectory(outputDirectory, subPath)) {
+            goto finish;
+        }
+        lastSubPath = file->subPath;
+    }
+
+    dispatch_apply(unpackedFiles->count,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+        ^(size_t n) {
+            UnpackedFile * file = &unpackedFiles->files[n];
+            char           path[PATH_MAX];
+
+            if (snprintf(path, sizeof(path), "%s/%s/%s", outputDirectory,
+                    file->subPath, file->fileName) >= sizeof(path)) {
+
+                OSKextLog(/* kext */ NULL,
+                    kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
+                    "Output path is too long - %s.", path);
+                atomic_store(writeFailedPtr, true);
+                return;
+            }
+            if (!writeFileAtPath(path,
+                    (const char *)CFDataGetBytePtr(file->data),
+                    CFDataGetLength(file->data))) {
+
+                atomic_store(writeFailedPtr, true);
+            }
+        });
+
+    result = !atomic_load(&writeFailed);
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+Boolean makeDirectoryInDirectory(
     const char * basePath,
-    char       * subPath,
-    const char * fileName,
-    const char * fileData,
-    size_t       fileLength)
+    char       * subPath)
 {
     Boolean  result = false;
     char     path[PATH_MAX];
     char   * pathComponent = NULL;     // do not free
     char   * pathComponentEnd = NULL;  // do not free
-    int      fd = -1;
-    uint32_t bytesWritten;
 
     if (strlcpy(path, basePath, sizeof(path)) >= sizeof(path)) {
         OSKextLog(/* kext */ NULL,
@@ -1276,14 +2078,22 @@ Boolean writeFileInDirectory(
         }
     }
 
-    if (strlcat(path, "/", sizeof(path)) >= sizeof(path) ||
-        strlcat(path, fileName, sizeof(path)) >= sizeof(path)) {
+    result = true;
 
-        OSKextLog(/* kext */ NULL,
-            kOSKextLogErrorLevel | kOSKextLogFileAccessFlag,
-            "Output path is too long - %s.", path);
-        goto finish;
-    }
+finish:
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+Boolean writeFileAtPath(
+    const char * path,
+    const char * fileData,
+    size_t       fileLength)
+{
+    Boolean  result = false;
+    int      fd = -1;
+    size_t   bytesWritten;
 
     fd = open(path, O_WRONLY | O_CREAT, 0777);
     if (fd < 0) {
@@ -1295,8 +2105,8 @@ Boolean writeFileInDirectory(
 
     bytesWritten = 0;
     while (bytesWritten < fileLength) {
-        int writeResult;
-        writeResult = (int)write(fd, fileData + bytesWritten,
+        ssize_t writeResult;
+        writeResult = write(fd, fileData + bytesWritten,
             fileLength - bytesWritten);
         if (writeResult < 0) {
             OSKextLog(/* kext */ NULL,
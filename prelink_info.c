@@ -0,0 +1,1852 @@
+/*
+ *  prelink_info.c
+ *  kext_tools
+ *
+ *  Copyright 2026 Apple Inc. All rights reserved.
+ *
+ */
+#if __has_include(<prelink.h>)
+/* take prelink.h from host side tools SDK */
+#include <prelink.h>
+#else
+#include <System/libkern/prelink.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libkern/OSByteOrder.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kernelcache.h"
+#include "kext_tools_util.h"
+#include "macho_view.h"
+#include "prelink_info.h"
+
+/* Deepest nesting followed when scanning or copying a value. The prelink
+ * info is only a few levels deep; this just bounds recursion on bad input.
+ */
+#define kPrelinkInfoMaxDepth  (64)
+
+#define kPrelinkInfoBundleIDKey  "CFBundleIdentifier"
+
+/* Not in prelink.h; kclist reads it for builtin kexts. */
+#define kPrelinkIndexModuleIndexKey  "ModuleIndex"
+
+typedef struct {
+    const char * start;      // the '<'
+    const char * end;        // one past the '>'
+    const char * name;
+    size_t       nameLength;
+    const char * attrs;      // attribute text after the name
+    const char * attrsEnd;
+    Boolean      isClose;    // </name>
+    Boolean      isEmpty;    // <name/>
+} PrelinkInfoTag;
+
+typedef struct {
+    const char * start;
+    const char * end;
+} PrelinkInfoRange;
+
+typedef struct {
+    PrelinkInfoRange   dict;         // the kext's <dict> element
+    char             * bundleID;     // decoded, may be NULL
+} PrelinkInfoKext;
+
+typedef struct {
+    const char * bundleID;
+    CFIndex      index;
+} PrelinkInfoKextID;
+
+struct prelink_info {
+    const char        * xml;
+    const char        * limit;
+
+    CFIndex             kextCount;
+    CFIndex             kextCapacity;
+    PrelinkInfoKext   * kexts;          // in serialized order
+    PrelinkInfoKextID * kextsByID;      // sorted by bundle ID
+
+    /* Element ranges by serializer ID, to resolve IDREF="n". */
+    CFIndex             idCount;
+    PrelinkInfoRange  * ids;
+};
+
+static Boolean readTag(
+    const char     * p,
+    const char     * limit,
+    PrelinkInfoTag * tag);
+static Boolean tagIs(const PrelinkInfoTag * tag, const char * name);
+static Boolean getTagAttribute(
+    const PrelinkInfoTag * tag,
+    const char           * attrName,
+    long                 * value);
+static const char * skipElement(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    Boolean                recordIDs,
+    int                    depth);
+static Boolean recordID(
+    PrelinkInfoRef         info,
+    long                   elementID,
+    const PrelinkInfoTag * tag,
+    const char           * end);
+static Boolean textEquals(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    const char           * string);
+static char * copyDecodedText(const char * start, const char * end);
+static char * copyStringElement(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    int                    depth);
+static CFTypeRef copyValue(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    int                    depth);
+static CFDataRef copyBase64Data(const char * start, const char * end);
+static Boolean findKextValue(
+    PrelinkInfoRef   info,
+    CFIndex          kextIndex,
+    const char     * key,
+    PrelinkInfoTag * valueTag);
+static char * copyUTF8String(CFStringRef string);
+static int compareKextIDs(const void * a, const void * b);
+static int compareKextIndexes(const void * a, const void * b);
+
+/*******************************************************************************
+* prelinkInfoCreate() scans the XML once. Every element is stepped over
+* rather than parsed; the only things kept are the range of each kext
+* dictionary under _PrelinkInfoDictionary, its bundle identifier, and the
+* range of each element carrying an ID attribute. Returns NULL if the XML
+* does not hold a _PrelinkInfoDictionary array.
+*******************************************************************************/
+PrelinkInfoRef prelinkInfoCreate(
+    const char * xml,
+    size_t       length)
+{
+    PrelinkInfoRef  result     = NULL;
+    PrelinkInfoRef  info       = NULL;  // must prelinkInfoFree() on error
+    PrelinkInfoTag  tag;
+    PrelinkInfoTag  keyTag;
+    const char    * p          = NULL;
+    const char    * keyEnd     = NULL;
+    Boolean         foundKexts = false;
+    CFIndex         i;
+
+    if (!xml) {
+        goto finish;
+    }
+
+    info = (PrelinkInfoRef)calloc(1, sizeof(*info));
+    if (!info) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    info->xml = xml;
+    info->limit = xml + strnlen(xml, length);
+
+   /* Skip the XML declaration and <plist> wrapper, if any, to the root dict.
+    */
+    p = info->xml;
+    do {
+        if (!readTag(p, info->limit, &tag)) {
+            goto finish;
+        }
+        p = tag.end;
+    } while (tag.isClose || !tagIs(&tag, "dict"));
+
+    if (tag.isEmpty) {
+        goto finish;
+    }
+
+    while (1) {
+        if (!readTag(p, info->limit, &keyTag) || keyTag.isEmpty) {
+            goto finish;
+        }
+        if (keyTag.isClose) {
+            break;
+        }
+        if (!tagIs(&keyTag, "key")) {
+            goto finish;
+        }
+        keyEnd = skipElement(info, &keyTag, true, 1);
+        if (!keyEnd || !readTag(keyEnd, info->limit, &tag) || tag.isClose) {
+            goto finish;
+        }
+
+        if (!foundKexts && tagIs(&tag, "array") && !tag.isEmpty &&
+            textEquals(info, &keyTag, kPrelinkInfoDictionaryKey)) {
+
+            foundKexts = true;
+            p = tag.end;
+            while (1) {
+                PrelinkInfoKext * kext = NULL;
+                PrelinkInfoTag    dictTag;
+
+                if (!readTag(p, info->limit, &dictTag)) {
+                    goto finish;
+                }
+                if (dictTag.isClose) {
+                    p = dictTag.end;
+                    break;
+                }
+                if (!tagIs(&dictTag, "dict")) {
+                    goto finish;
+                }
+
+                if (info->kextCount == info->kextCapacity) {
+                    CFIndex           newCapacity = info->kextCapacity ?
+                                                    info->kextCapacity * 2 : 256;
+                    PrelinkInfoKext * newKexts    = realloc(info->kexts,
+                                                    newCapacity * sizeof(*newKexts));
+                    if (!newKexts) {
+                        OSKextLogMemError();
+                        goto finish;
+                    }
+                    info->kexts = newKexts;
+                    info->kextCapacity = newCapacity;
+                }
+                kext = &info->kexts[info->kextCount];
+                kext->dict.start = dictTag.start;
+                kext->dict.end = skipElement(info, &dictTag, true, 2);
+                kext->bundleID = NULL;
+                if (!kext->dict.end) {
+                    goto finish;
+                }
+                info->kextCount++;
+                p = kext->dict.end;
+            }
+        } else {
+            p = skipElement(info, &tag, true, 1);
+            if (!p) {
+                goto finish;
+            }
+        }
+    }
+
+    if (!foundKexts) {
+        goto finish;
+    }
+
+   /* Now that every ID is known, pull out the bundle identifiers, resolving
+    * references, and sort an index by them for prelinkInfoFindKext().
+    */
+    info->kextsByID = (PrelinkInfoKextID *)malloc(
+        (info->kextCount + 1) * sizeof(*info->kextsByID));
+    if (!info->kextsByID) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    for (i = 0; i < info->kextCount; i++) {
+        PrelinkInfoTag valueTag;
+
+        if (findKextValue(info, i, kPrelinkInfoBundleIDKey, &valueTag)) {
+            info->kexts[i].bundleID = copyStringElement(info, &valueTag, 0);
+        }
+        info->kextsByID[i].bundleID = info->kexts[i].bundleID;
+        info->kextsByID[i].index = i;
+    }
+    qsort(info->kextsByID, info->kextCount, sizeof(*info->kextsByID),
+        compareKextIDs);
+
+    result = info;
+    info = NULL;
+
+finish:
+    prelinkInfoFree(info);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+void prelinkInfoFree(
+    PrelinkInfoRef info)
+{
+    CFIndex i;
+
+    if (!info) {
+        return;
+    }
+    for (i = 0; i < info->kextCount; i++) {
+        SAFE_FREE(info->kexts[i].bundleID);
+    }
+    SAFE_FREE(info->kexts);
+    SAFE_FREE(info->kextsByID);
+    SAFE_FREE(info->ids);
+    free(info);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFIndex prelinkInfoGetKextCount(
+    PrelinkInfoRef info)
+{
+    return info->kextCount;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFIndex prelinkInfoFindKext(
+    PrelinkInfoRef info,
+    CFStringRef    bundleID)
+{
+    CFIndex   result          = kCFNotFound;
+    char    * bundleIDCString = NULL;  // must free
+    CFIndex   low             = 0;
+    CFIndex   high            = info->kextCount;
+
+    bundleIDCString = copyUTF8String(bundleID);
+    if (!bundleIDCString) {
+        goto finish;
+    }
+
+    while (low < high) {
+        CFIndex      mid     = low + (high - low) / 2;
+        const char * midID   = info->kextsByID[mid].bundleID;
+        int          compare = midID ? strcmp(midID, bundleIDCString) : 1;
+
+        if (compare == 0) {
+            result = info->kextsByID[mid].index;
+            break;
+        } else if (compare < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+finish:
+    SAFE_FREE(bundleIDCString);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFTypeRef prelinkInfoCopyKextProperty(
+    PrelinkInfoRef info,
+    CFIndex        kextIndex,
+    CFStringRef    key)
+{
+    CFTypeRef        result     = NULL;
+    char           * keyCString = NULL;  // must free
+    PrelinkInfoTag   valueTag;
+
+    if (kextIndex < 0 || kextIndex >= info->kextCount) {
+        goto finish;
+    }
+    keyCString = copyUTF8String(key);
+    if (!keyCString) {
+        goto finish;
+    }
+    if (findKextValue(info, kextIndex, keyCString, &valueTag)) {
+        result = copyValue(info, &valueTag, 0);
+    }
+
+finish:
+    SAFE_FREE(keyCString);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFDictionaryRef prelinkInfoCopyKextProperties(
+    PrelinkInfoRef      info,
+    CFIndex             kextIndex,
+    const CFStringRef * keys,
+    CFIndex             numKeys)
+{
+    CFDictionaryRef        result     = NULL;
+    CFMutableDictionaryRef properties = NULL;  // must release
+    CFTypeRef              value      = NULL;  // must release
+    PrelinkInfoTag         dictTag;
+    CFIndex                i;
+
+    if (kextIndex < 0 || kextIndex >= info->kextCount) {
+        goto finish;
+    }
+
+    if (!keys) {
+        if (readTag(info->kexts[kextIndex].dict.start, info->limit, &dictTag)) {
+            value = copyValue(info, &dictTag, 0);
+        }
+        if (value && CFGetTypeID(value) == CFDictionaryGetTypeID()) {
+            result = (CFDictionaryRef)value;
+            value = NULL;
+        }
+        goto finish;
+    }
+
+    properties = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    if (!properties) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    for (i = 0; i < numKeys; i++) {
+        value = prelinkInfoCopyKextProperty(info, kextIndex, keys[i]);
+        if (value) {
+            CFDictionarySetValue(properties, keys[i], value);
+            SAFE_RELEASE_NULL(value);
+        }
+    }
+    result = properties;
+    properties = NULL;
+
+finish:
+    SAFE_RELEASE(properties);
+    SAFE_RELEASE(value);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFDictionaryRef prelinkInfoCopyInfoForKexts(
+    PrelinkInfoRef      info,
+    CFSetRef            bundleIDs,
+    const CFStringRef * keys,
+    CFIndex             numKeys)
+{
+    CFDictionaryRef        result     = NULL;
+    CFMutableDictionaryRef infoDict   = NULL;  // must release
+    CFMutableArrayRef      kextArray  = NULL;  // must release
+    CFDictionaryRef        kextDict   = NULL;  // must release
+    CFStringRef          * ids        = NULL;  // must free
+    CFIndex              * found      = NULL;  // must free
+    CFIndex                numIDs;
+    CFIndex                numFound   = 0;
+    CFIndex                i;
+
+    infoDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    kextArray = CFArrayCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeArrayCallBacks);
+    if (!infoDict || !kextArray) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    numIDs = CFSetGetCount(bundleIDs);
+    ids = (CFStringRef *)malloc((numIDs + 1) * sizeof(CFStringRef));
+    found = (CFIndex *)malloc((numIDs + 1) * sizeof(CFIndex));
+    if (!ids || !found) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    CFSetGetValues(bundleIDs, (const void **)ids);
+    for (i = 0; i < numIDs; i++) {
+        CFIndex kextIndex = prelinkInfoFindKext(info, ids[i]);
+
+        if (kextIndex != kCFNotFound) {
+            found[numFound++] = kextIndex;
+        }
+    }
+
+   /* Keep the kexts in the order they were serialized in, as a full
+    * unserialize would have listed them.
+    */
+    qsort(found, numFound, sizeof(CFIndex), compareKextIndexes);
+    for (i = 0; i < numFound; i++) {
+        kextDict = prelinkInfoCopyKextProperties(info, found[i],
+            keys, numKeys);
+        if (kextDict) {
+            CFArrayAppendValue(kextArray, kextDict);
+            SAFE_RELEASE_NULL(kextDict);
+        }
+    }
+
+    CFDictionarySetValue(infoDict, CFSTR(kPrelinkInfoDictionaryKey), kextArray);
+    result = infoDict;
+    infoDict = NULL;
+
+finish:
+    SAFE_RELEASE(infoDict);
+    SAFE_RELEASE(kextArray);
+    SAFE_RELEASE(kextDict);
+    SAFE_FREE(ids);
+    SAFE_FREE(found);
+    return result;
+}
+
+#pragma mark Scanning
+
+/*******************************************************************************
+* readTag() finds the next element tag at or after p, stepping over character
+* data, comments, processing instructions and DOCTYPE declarations.
+*******************************************************************************/
+static Boolean readTag(
+    const char     * p,
+    const char     * limit,
+    PrelinkInfoTag * tag)
+{
+    const char * nameEnd;
+
+    while (1) {
+        p = memchr(p, '<', limit - p);
+        if (!p || limit - p < 3) {
+            return false;
+        }
+        if (p[1] == '?' || p[1] == '!') {
+            const char * close = NULL;
+
+            if (limit - p >= 4 && !strncmp(p, "<!--", 4)) {
+                for (close = p + 4; close + 3 <= limit; close++) {
+                    if (!strncmp(close, "-->", 3)) {
+                        break;
+                    }
+                }
+                if (close + 3 > limit) {
+                    return false;
+                }
+                p = close + 3;
+            } else {
+                close = memchr(p, '>', limit - p);
+                if (!close) {
+                    return false;
+                }
+                p = close + 1;
+            }
+            continue;
+        }
+        break;
+    }
+
+    tag->start = p;
+    tag->end = memchr(p, '>', limit - p);
+    if (!tag->end) {
+        return false;
+    }
+    tag->end++;
+
+    p++;
+    tag->isClose = (*p == '/');
+    if (tag->isClose) {
+        p++;
+    }
+    tag->isEmpty = (tag->end[-2] == '/');
+
+    tag->name = p;
+    for (nameEnd = p; nameEnd < tag->end - 1; nameEnd++) {
+        if (*nameEnd == ' ' || *nameEnd == '/' || *nameEnd == '\t' ||
+            *nameEnd == '\n' || *nameEnd == '\r') {
+
+            break;
+        }
+    }
+    tag->nameLength = nameEnd - p;
+    tag->attrs = nameEnd;
+    tag->attrsEnd = tag->end - (tag->isEmpty ? 2 : 1);
+    if (tag->nameLength == 0 || (tag->isClose && tag->isEmpty)) {
+        return false;
+    }
+    return true;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static Boolean tagIs(const PrelinkInfoTag * tag, const char * name)
+{
+    size_t length = strlen(name);
+
+    return tag->nameLength == length && !strncmp(tag->name, name, length);
+}
+
+/*******************************************************************************
+* getTagAttribute() reads a numeric attribute such as ID="12" or size="64".
+*******************************************************************************/
+static Boolean getTagAttribute(
+    const PrelinkInfoTag * tag,
+    const char           * attrName,
+    long                 * value)
+{
+    size_t       nameLength = strlen(attrName);
+    const char * p;
+
+    for (p = tag->attrs; p + nameLength + 2 < tag->attrsEnd; p++) {
+        if ((p == tag->attrs || p[-1] == ' ') &&
+            !strncmp(p, attrName, nameLength) &&
+            p[nameLength] == '=' &&
+            (p[nameLength + 1] == '"' || p[nameLength + 1] == '\'')) {
+
+            *value = strtol(p + nameLength + 2, NULL, 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*******************************************************************************
+* skipElement() returns the end of the element opened by tag, or NULL if the
+* XML is malformed. Scalar elements hold no markup, so only containers are
+* walked tag by tag.
+*******************************************************************************/
+static const char * skipElement(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    Boolean                recordIDs,
+    int                    depth)
+{
+    const char     * result = NULL;
+    const char     * p      = NULL;
+    PrelinkInfoTag   child;
+    long             elementID;
+
+    if (tag->isClose || depth > kPrelinkInfoMaxDepth) {
+        goto finish;
+    }
+
+    if (tag->isEmpty) {
+        p = tag->end;
+    } else if (tagIs(tag, "dict") || tagIs(tag, "array")) {
+        p = tag->end;
+        while (1) {
+            if (!readTag(p, info->limit, &child)) {
+                goto finish;
+            }
+            if (child.isClose) {
+                p = child.end;
+                break;
+            }
+            p = skipElement(info, &child, recordIDs, depth + 1);
+            if (!p) {
+                goto finish;
+            }
+        }
+    } else {
+        if (!readTag(tag->end, info->limit, &child) || !child.isClose) {
+            goto finish;
+        }
+        p = child.end;
+    }
+
+    if (recordIDs && getTagAttribute(tag, "ID", &elementID)) {
+        if (!recordID(info, elementID, tag, p)) {
+            goto finish;
+        }
+    }
+    result = p;
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static Boolean recordID(
+    PrelinkInfoRef         info,
+    long                   elementID,
+    const PrelinkInfoTag * tag,
+    const char           * end)
+{
+    if (elementID < 0 || elementID > info->limit - info->xml) {
+        return false;
+    }
+    if (elementID >= info->idCount) {
+        CFIndex            newCount = info->idCount ? info->idCount : 1024;
+        PrelinkInfoRange * newIDs   = NULL;
+
+        while (newCount <= elementID) {
+            newCount *= 2;
+        }
+        newIDs = realloc(info->ids, newCount * sizeof(*newIDs));
+        if (!newIDs) {
+            OSKextLogMemError();
+            return false;
+        }
+        bzero(newIDs + info->idCount,
+            (newCount - info->idCount) * sizeof(*newIDs));
+        info->ids = newIDs;
+        info->idCount = newCount;
+    }
+    info->ids[elementID].start = tag->start;
+    info->ids[elementID].end = end;
+    return true;
+}
+
+/*******************************************************************************
+* findKextValue() walks the top level of a kext dictionary for key and reads
+* the opening tag of its value.
+*******************************************************************************/
+static Boolean findKextValue(
+    PrelinkInfoRef   info,
+    CFIndex          kextIndex,
+    const char     * key,
+    PrelinkInfoTag * valueTag)
+{
+    PrelinkInfoTag   tag;
+    const char     * p      = info->kexts[kextIndex].dict.start;
+    const char     * keyEnd = NULL;
+
+    if (!readTag(p, info->limit, &tag) || tag.isEmpty) {
+        return false;
+    }
+    p = tag.end;
+    while (1) {
+        if (!readTag(p, info->limit, &tag) || tag.isClose) {
+            return false;
+        }
+        keyEnd = skipElement(info, &tag, false, 0);
+        if (!keyEnd || !readTag(keyEnd, info->limit, valueTag) ||
+            valueTag->isClose) {
+
+            return false;
+        }
+        if (textEquals(info, &tag, key)) {
+            return true;
+        }
+        p = skipElement(info, valueTag, false, 0);
+        if (!p) {
+            return false;
+        }
+    }
+}
+
+#pragma mark Values
+
+/*******************************************************************************
+* textEquals() compares the character data of the <key> element opened by tag
+* with a C string, decoding only if the text holds a reference.
+*******************************************************************************/
+static Boolean textEquals(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    const char           * string)
+{
+    Boolean          result  = false;
+    char           * decoded = NULL;  // must free
+    size_t           length  = strlen(string);
+    const char     * start   = tag->end;
+    const char     * end     = NULL;
+    PrelinkInfoTag   close;
+
+    if (tag->isEmpty) {
+        result = (length == 0);
+        goto finish;
+    }
+    if (!readTag(start, info->limit, &close) || !close.isClose) {
+        goto finish;
+    }
+    end = close.start;
+    if (!memchr(start, '&', end - start)) {
+        result = ((size_t)(end - start) == length &&
+            !strncmp(start, string, length));
+        goto finish;
+    }
+    decoded = copyDecodedText(start, end);
+    result = decoded && !strcmp(decoded, string);
+
+finish:
+    SAFE_FREE(decoded);
+    return result;
+}
+
+/*******************************************************************************
+* copyDecodedText() returns the character data in [start, end) with entity and
+* character references replaced.
+*******************************************************************************/
+static char * copyDecodedText(const char * start, const char * end)
+{
+    char * result = NULL;
+    char * out    = NULL;
+
+    result = (char *)malloc(end - start + 1);
+    if (!result) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    for (out = result; start < end; start++) {
+        if (*start != '&') {
+            *out++ = *start;
+            continue;
+        }
+        if (end - start >= 4 && !strncmp(start, "&lt;", 4)) {
+            *out++ = '<';
+            start += 3;
+        } else if (end - start >= 4 && !strncmp(start, "&gt;", 4)) {
+            *out++ = '>';
+            start += 3;
+        } else if (end - start >= 5 && !strncmp(start, "&amp;", 5)) {
+            *out++ = '&';
+            start += 4;
+        } else if (end - start >= 6 && !strncmp(start, "&quot;", 6)) {
+            *out++ = '"';
+            start += 5;
+        } else if (end - start >= 6 && !strncmp(start, "&apos;", 6)) {
+            *out++ = '\'';
+            start += 5;
+        } else if (end - start >= 4 && start[1] == '#') {
+            const char * semi = memchr(start, ';', end - start);
+            long         c    = (start[2] == 'x') ?
+                                strtol(start + 3, NULL, 16) :
+                                strtol(start + 2, NULL, 10);
+
+            if (!semi || c <= 0 || c > 0x7f) {
+                *out++ = *start;
+                continue;
+            }
+            *out++ = (char)c;
+            start = semi;
+        } else {
+            *out++ = *start;
+        }
+    }
+    *out = '\0';
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+* copyStringElement() decodes a <string> or <key> element, following IDREF.
+*******************************************************************************/
+static char * copyStringElement(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    int                    depth)
+{
+    PrelinkInfoTag close;
+    long           elementID;
+
+    if (depth > kPrelinkInfoMaxDepth) {
+        return NULL;
+    }
+    if (getTagAttribute(tag, "IDREF", &elementID)) {
+        PrelinkInfoTag refTag;
+
+        if (elementID < 0 || elementID >= info->idCount ||
+            !info->ids[elementID].start ||
+            !readTag(info->ids[elementID].start, info->limit, &refTag)) {
+
+            return NULL;
+        }
+        return copyStringElement(info, &refTag, depth + 1);
+    }
+    if (!tagIs(tag, "string") && !tagIs(tag, "key")) {
+        return NULL;
+    }
+    if (tag->isEmpty) {
+        return strdup("");
+    }
+    if (!readTag(tag->end, info->limit, &close) || !close.isClose) {
+        return NULL;
+    }
+    return copyDecodedText(tag->end, close.start);
+}
+
+/*******************************************************************************
+* copyValue() builds the CF object for the element opened by tag, creating
+* the same types IOCFUnserialize() would.
+*******************************************************************************/
+static CFTypeRef copyValue(
+    PrelinkInfoRef         info,
+    const PrelinkInfoTag * tag,
+    int                    depth)
+{
+    CFTypeRef        result   = NULL;
+    char           * text     = NULL;  // must free
+    CFTypeRef        value    = NULL;  // must release
+    CFStringRef      key      = NULL;  // must release
+    PrelinkInfoTag   child;
+    PrelinkInfoTag   close;
+    const char     * p        = NULL;
+    long             elementID;
+    long             size;
+
+    if (depth > kPrelinkInfoMaxDepth || tag->isClose) {
+        goto finish;
+    }
+
+    if (getTagAttribute(tag, "IDREF", &elementID)) {
+        if (elementID >= 0 && elementID < info->idCount &&
+            info->ids[elementID].start &&
+            readTag(info->ids[elementID].start, info->limit, &child)) {
+
+            result = copyValue(info, &child, depth + 1);
+        }
+        goto finish;
+    }
+
+    if (tagIs(tag, "string") || tagIs(tag, "key")) {
+        text = copyStringElement(info, tag, depth);
+        if (text) {
+            result = CFStringCreateWithCString(kCFAllocatorDefault, text,
+                kCFStringEncodingUTF8);
+        }
+    } else if (tagIs(tag, "integer")) {
+        long long number = 0;
+
+        if (!tag->isEmpty) {
+            if (!readTag(tag->end, info->limit, &close) || !close.isClose) {
+                goto finish;
+            }
+            text = copyDecodedText(tag->end, close.start);
+            if (!text) {
+                goto finish;
+            }
+            number = (long long)strtoull(text, NULL, 0);
+        }
+        if (getTagAttribute(tag, "size", &size) && size <= 32) {
+            SInt32 number32 = (SInt32)number;
+            result = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type,
+                &number32);
+        } else {
+            SInt64 number64 = (SInt64)number;
+            result = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type,
+                &number64);
+        }
+    } else if (tagIs(tag, "true")) {
+        result = CFRetain(kCFBooleanTrue);
+    } else if (tagIs(tag, "false")) {
+        result = CFRetain(kCFBooleanFalse);
+    } else if (tagIs(tag, "data")) {
+        if (tag->isEmpty) {
+            result = CFDataCreate(kCFAllocatorDefault, NULL, 0);
+        } else if (readTag(tag->end, info->limit, &close) && close.isClose) {
+            result = copyBase64Data(tag->end, close.start);
+        }
+    } else if (tagIs(tag, "dict")) {
+        CFMutableDictionaryRef dict = CFDictionaryCreateMutable(
+            kCFAllocatorDefault, 0,
+            &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        if (!dict) {
+            OSKextLogMemError();
+            goto finish;
+        }
+        p = tag->end;
+        while (!tag->isEmpty) {
+            if (!readTag(p, info->limit, &child)) {
+                SAFE_RELEASE(dict);
+                goto finish;
+            }
+            if (child.isClose) {
+                break;
+            }
+            key = (CFStringRef)copyValue(info, &child, depth + 1);
+            p = skipElement(info, &child, false, 0);
+            if (!key || CFGetTypeID(key) != CFStringGetTypeID() || !p ||
+                !readTag(p, info->limit, &child) || child.isClose) {
+
+                SAFE_RELEASE(dict);
+                goto finish;
+            }
+            value = copyValue(info, &child, depth + 1);
+            p = skipElement(info, &child, false, 0);
+            if (!value || !p) {
+                SAFE_RELEASE(dict);
+                goto finish;
+            }
+            CFDictionarySetValue(dict, key, value);
+            SAFE_RELEASE_NULL(key);
+            SAFE_RELEASE_NULL(value);
+        }
+        result = dict;
+    } else if (tagIs(tag, "array")) {
+        CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 0,
+            &kCFTypeArrayCallBacks);
+        if (!array) {
+            OSKextLogMemError();
+            goto finish;
+        }
+        p = tag->end;
+        while (!tag->isEmpty) {
+            if (!readTag(p, info->limit, &child)) {
+                SAFE_RELEASE(array);
+                goto finish;
+            }
+            if (child.isClose) {
+                break;
+            }
+            value = copyValue(info, &child, depth + 1);
+            p = skipElement(info, &child, false, 0);
+            if (!value || !p) {
+                SAFE_RELEASE(array);
+                goto finish;
+            }
+            CFArrayAppendValue(array, value);
+            SAFE_RELEASE_NULL(value);
+        }
+        result = array;
+    }
+
+finish:
+    SAFE_FREE(text);
+    SAFE_RELEASE(value);
+    SAFE_RELEASE(key);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static CFDataRef copyBase64Data(const char * start, const char * end)
+{
+    CFDataRef   result  = NULL;
+    UInt8     * bytes   = NULL;  // must free
+    CFIndex     length  = 0;
+    uint32_t    accum   = 0;
+    int         bits    = 0;
+
+    bytes = (UInt8 *)malloc((end - start) * 3 / 4 + 1);
+    if (!bytes) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    for (; start < end; start++) {
+        int c = *start;
+        int sextet;
+
+        if (c >= 'A' && c <= 'Z') {
+            sextet = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            sextet = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            sextet = c - '0' + 52;
+        } else if (c == '+') {
+            sextet = 62;
+        } else if (c == '/') {
+            sextet = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            continue;  // whitespace
+        }
+        accum = (accum << 6) | sextet;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes[length++] = (UInt8)(accum >> bits);
+        }
+    }
+
+    result = CFDataCreate(kCFAllocatorDefault, bytes, length);
+
+finish:
+    SAFE_FREE(bytes);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static char * copyUTF8String(CFStringRef string)
+{
+    char    * result = NULL;
+    CFIndex   size;
+
+    if (!string) {
+        return NULL;
+    }
+    size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string),
+        kCFStringEncodingUTF8) + 1;
+    result = (char *)malloc(size);
+    if (!result) {
+        OSKextLogMemError();
+        return NULL;
+    }
+    if (!CFStringGetCString(string, result, size, kCFStringEncodingUTF8)) {
+        SAFE_FREE_NULL(result);
+    }
+    return result;
+}
+
+/*******************************************************************************
+* Kexts without a bundle identifier sort last.
+*******************************************************************************/
+static int compareKextIDs(const void * a, const void * b)
+{
+    const char * idA = ((const PrelinkInfoKextID *)a)->bundleID;
+    const char * idB = ((const PrelinkInfoKextID *)b)->bundleID;
+
+    if (!idA || !idB) {
+        return (idA ? -1 : 0) + (idB ? 1 : 0);
+    }
+    return strcmp(idA, idB);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static int compareKextIndexes(const void * a, const void * b)
+{
+    CFIndex indexA = *(const CFIndex *)a;
+    CFIndex indexB = *(const CFIndex *)b;
+
+    return (indexA > indexB) - (indexA < indexB);
+}
+
+#pragma mark Binary Index
+
+/*******************************************************************************
+* Sidecar layout, in host byte order: a file header, one slice header per
+* kernelcache slice, then each slice's kext records and string table.
+* Offsets are from the start of the file.
+*******************************************************************************/
+#define kPrelinkIndexMagic     (0x706c6b78)  // 'plkx'
+#define kPrelinkIndexVersion   (1)
+#define kPrelinkIndexNoString  (UINT32_MAX)
+
+#define kPrelinkIndexHasLoadAddress    (1 << 0)
+#define kPrelinkIndexHasSourceAddress  (1 << 1)
+#define kPrelinkIndexHasSize           (1 << 2)
+#define kPrelinkIndexHasKmodInfo       (1 << 3)
+#define kPrelinkIndexHasModuleIndex    (1 << 4)
+#define kPrelinkIndexHasUUID           (1 << 5)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sliceCount;
+    uint32_t reserved;
+} PrelinkIndexHeader;
+
+typedef struct {
+    uint8_t  uuid[16];            // of the kernelcache slice
+    uint64_t prelinkInfoSize;
+    uint64_t prelinkInfoHash;     // FNV-1a of the __PRELINK_INFO section
+    uint32_t kextCount;
+    uint32_t stringsSize;
+    uint64_t kextsOffset;
+    uint64_t stringsOffset;
+} PrelinkIndexSlice;
+
+typedef struct {
+    uint32_t bundleID;            // string table offsets
+    uint32_t version;
+    uint32_t bundlePath;
+    uint32_t flags;               // kPrelinkIndexHas...
+    uint32_t serialIndex;         // position in _PrelinkInfoDictionary
+    uint32_t moduleIndex;
+    uint8_t  uuid[16];            // of the kext executable
+    uint64_t loadAddress;
+    uint64_t sourceAddress;
+    uint64_t size;
+    uint64_t kmodInfo;
+} PrelinkIndexKext;
+
+typedef struct {
+    PrelinkIndexSlice  slice;
+    CFMutableDataRef   kexts;     // PrelinkIndexKext, sorted by bundle ID
+    CFMutableDataRef   strings;
+} PrelinkIndexSliceData;
+
+typedef struct {
+    const char       * bundleID;  // points into the slice's string table
+    PrelinkIndexKext   record;
+} PrelinkIndexSortEntry;
+
+struct prelink_index {
+    void                      * map;
+    size_t                      mapSize;
+    const PrelinkIndexKext    * kexts;
+    uint32_t                    kextCount;
+    const char                * strings;
+    uint32_t                    stringsSize;
+};
+
+static Boolean buildPrelinkIndexSlice(
+    CFDataRef               slice,
+    PrelinkIndexSliceData * sliceData);
+static uint32_t addPrelinkIndexString(
+    CFMutableDataRef strings,
+    CFTypeRef        string);
+static Boolean getPrelinkIndexNumber(
+    CFDictionaryRef   kextInfo,
+    CFStringRef       key,
+    uint64_t        * value);
+static uint64_t hashPrelinkInfo(const char * bytes, size_t size);
+static const char * getPrelinkIndexString(
+    PrelinkIndexRef index,
+    uint32_t        offset);
+static int comparePrelinkIndexSortEntries(const void * a, const void * b);
+static int comparePrelinkIndexSerial(const void * a, const void * b);
+
+/*******************************************************************************
+* writePrelinkIndex() writes <kernelcachePath>.plkindex for the slices just
+* written to kernelcachePath. Compressed slices are uncompressed to read them.
+* The index is written to a temporary file and renamed into place, so readers
+* never see a partial one.
+*******************************************************************************/
+ExitStatus writePrelinkIndex(
+    const char * kernelcachePath,
+    CFArrayRef   prelinkSlices)
+{
+    ExitStatus              result      = EX_OSERR;
+    PrelinkIndexSliceData * slices      = NULL;  // must free, release members
+    PrelinkIndexHeader      header;
+    char                    indexPath[PATH_MAX];
+    char                    tmpPath[PATH_MAX];
+    int                     fd          = -1;    // must close()
+    Boolean                 tmpCreated  = false;
+    CFIndex                 numSlices   = CFArrayGetCount(prelinkSlices);
+    CFIndex                 sliceCount  = 0;
+    uint64_t                offset      = 0;
+    CFIndex                 i;
+
+    if (strlcpy(indexPath, kernelcachePath, sizeof(indexPath)) >= sizeof(indexPath) ||
+        strlcat(indexPath, kPrelinkIndexSuffix, sizeof(indexPath)) >= sizeof(indexPath) ||
+        strlcpy(tmpPath, indexPath, sizeof(tmpPath)) >= sizeof(tmpPath) ||
+        strlcat(tmpPath, ".XXXXXX", sizeof(tmpPath)) >= sizeof(tmpPath)) {
+
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+            "Prelink index path for %s is too long.", kernelcachePath);
+        goto finish;
+    }
+
+    slices = (PrelinkIndexSliceData *)calloc(numSlices + 1, sizeof(*slices));
+    if (!slices) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    for (i = 0; i < numSlices; i++) {
+        if (buildPrelinkIndexSlice(CFArrayGetValueAtIndex(prelinkSlices, i),
+            &slices[sliceCount])) {
+
+            sliceCount++;
+        }
+    }
+    if (!sliceCount) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogGeneralFlag,
+            "Can't index prelink info for %s.", kernelcachePath);
+        result = EX_SOFTWARE;
+        goto finish;
+    }
+
+   /* Lay the slices' tables out one after the other, 8-byte aligned.
+    */
+    offset = sizeof(header) + sliceCount * sizeof(PrelinkIndexSlice);
+    for (i = 0; i < sliceCount; i++) {
+        PrelinkIndexSlice * slice = &slices[i].slice;
+
+        slice->kextsOffset = offset;
+        offset += CFDataGetLength(slices[i].kexts);
+        slice->stringsOffset = offset;
+        offset += (slice->stringsSize + 7) & ~7ULL;
+    }
+
+    fd = mkstemp(tmpPath);
+    if (fd == -1) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogErrorLevel | kOSKextLogGeneralFlag | kOSKextLogFileAccessFlag,
+            "Can't create %s: %s.", tmpPath, strerror(errno));
+        goto finish;
+    }
+    tmpCreated = true;
+
+    bzero(&header, sizeof(header));
+    header.magic = kPrelinkIndexMagic;
+    header.version = kPrelinkIndexVersion;
+    header.sliceCount = (uint32_t)sliceCount;
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        goto write_error;
+    }
+    for (i = 0; i < sliceCount; i++) {
+        if (write(fd, &slices[i].slice, sizeof(PrelinkIndexSlice)) !=
+            sizeof(PrelinkIndexSlice)) {
+
+            goto write_error;
+        }
+    }
+    for (i = 0; i < sliceCount; i++) {
+        static const uint8_t padding[8] = { 0 };
+        CFDataRef tables[] = { slices[i].kexts, slices[i].strings };
+        size_t    padSize  = ((slices[i].slice.stringsSize + 7) & ~7UL) -
+                             slices[i].slice.stringsSize;
+        int       t;
+
+        for (t = 0; t < 2; t++) {
+            ssize_t length = CFDataGetLength(tables[t]);
+
+            if (write(fd, CFDataGetBytePtr(tables[t]), length) != length) {
+                goto write_error;
+            }
+        }
+        if (padSize && write(fd, padding, padSize) != (ssize_t)padSize) {
+            goto write_error;
+        }
+    }
+
+    if (fchmod(fd, 0644) == -1 || close(fd) == -1) {
+        fd = -1;
+        goto write_error;
+    }
+    fd = -1;
+
+    if (rename(tmpPath, indexPath) == -1) {
+        goto write_error;
+    }
+    tmpCreated = false;
+
+    OSKextLog(/* kext */ NULL,
+        kOSKextLogDetailLevel | kOSKextLogGeneralFlag | kOSKextLogArchiveFlag,
+        "Created prelink index %s.", indexPath);
+
+    result = EX_OK;
+    goto finish;
+
+write_error:
+    OSKextLog(/* kext */ NULL,
+        kOSKextLogErrorLevel | kOSKextLogGeneralFlag | kOSKextLogFileAccessFlag,
+        "Can't write %s: %s.", indexPath, strerror(errno));
+
+finish:
+    if (fd != -1) {
+        close(fd);
+    }
+    if (tmpCreated) {
+        unlink(tmpPath);
+    }
+    if (slices) {
+        for (i = 0; i < numSlices; i++) {
+            SAFE_RELEASE(slices[i].kexts);
+            SAFE_RELEASE(slices[i].strings);
+        }
+        free(slices);
+    }
+    return result;
+}
+
+/*******************************************************************************
+* buildPrelinkIndexSlice() reads one kernelcache slice's prelink info and
+* each kext's executable header into sliceData. Returns false, logging why,
+* if the slice can't be indexed; the other slices are still written.
+*******************************************************************************/
+static Boolean buildPrelinkIndexSlice(
+    CFDataRef               slice,
+    PrelinkIndexSliceData * sliceData)
+{
+    Boolean                  result      = false;
+    CFDataRef                image       = NULL;  // must release
+    MachOViewRef             kcView      = NULL;  // must machoViewFree()
+    PrelinkInfoRef           prelinkInfo = NULL;  // must prelinkInfoFree()
+    CFDictionaryRef          kextInfo    = NULL;  // must release
+    PrelinkIndexSortEntry  * entries     = NULL;  // must free
+    const MachOViewSection * infoSect    = NULL;  // do not free
+    const UInt8            * imageBytes  = NULL;
+    size_t                   imageSize   = 0;
+    const char             * infoBytes   = NULL;
+    CFIndex                  kextCount   = 0;
+    CFIndex                  i;
+    CFStringRef              keys[]      = {
+        kCFBundleIdentifierKey,
+        kCFBundleVersionKey,
+        CFSTR(kPrelinkBundlePathKey),
+        CFSTR(kPrelinkExecutableLoadKey),
+        CFSTR(kPrelinkExecutableSourceKey),
+        CFSTR(kPrelinkExecutableSizeKey),
+        CFSTR(kPrelinkKmodInfoKey),
+        CFSTR(kPrelinkIndexModuleIndexKey),
+    };
+
+    if (CFDataGetLength(slice) >= (CFIndex)sizeof(uint32_t) &&
+        *(const uint32_t *)CFDataGetBytePtr(slice) == OSSwapHostToBigInt32('comp')) {
+
+        image = uncompressPrelinkedSlice(slice);
+    } else {
+        image = CFRetain(slice);
+    }
+    if (!image) {
+        goto finish;
+    }
+    imageBytes = CFDataGetBytePtr(image);
+    imageSize = (size_t)CFDataGetLength(image);
+
+    kcView = machoViewCreate(imageBytes, imageSize);
+    if (!kcView) {
+        goto finish;
+    }
+    infoSect = machoViewGetSectionByName(kcView, "__PRELINK_INFO", "__info");
+    if (!infoSect || !machoViewGetUUID(kcView) ||
+        infoSect->offset + infoSect->size > imageSize) {
+
+        goto finish;
+    }
+    infoBytes = (const char *)imageBytes + infoSect->offset;
+
+    prelinkInfo = prelinkInfoCreate(infoBytes, (size_t)infoSect->size);
+    if (!prelinkInfo) {
+        goto finish;
+    }
+
+    sliceData->kexts = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    sliceData->strings = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    kextCount = prelinkInfoGetKextCount(prelinkInfo);
+    entries = (PrelinkIndexSortEntry *)calloc(kextCount + 1, sizeof(*entries));
+    if (!sliceData->kexts || !sliceData->strings || !entries) {
+
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    for (i = 0; i < kextCount; i++) {
+        PrelinkIndexKext * record   = &entries[i].record;
+        MachOViewRef       kextView = NULL;  // must machoViewFree()
+        uint64_t           moduleIndex;
+
+        SAFE_RELEASE_NULL(kextInfo);
+        kextInfo = prelinkInfoCopyKextProperties(prelinkInfo, i,
+            keys, sizeof(keys) / sizeof(keys[0]));
+        if (!kextInfo) {
+            goto finish;
+        }
+
+        record->serialIndex = (uint32_t)i;
+        record->bundleID = addPrelinkIndexString(sliceData->strings,
+            CFDictionaryGetValue(kextInfo, kCFBundleIdentifierKey));
+        record->version = addPrelinkIndexString(sliceData->strings,
+            CFDictionaryGetValue(kextInfo, kCFBundleVersionKey));
+        record->bundlePath = addPrelinkIndexString(sliceData->strings,
+            CFDictionaryGetValue(kextInfo, CFSTR(kPrelinkBundlePathKey)));
+
+        if (getPrelinkIndexNumber(kextInfo, CFSTR(kPrelinkExecutableLoadKey),
+            &record->loadAddress)) {
+            record->flags |= kPrelinkIndexHasLoadAddress;
+        }
+        if (getPrelinkIndexNumber(kextInfo, CFSTR(kPrelinkExecutableSourceKey),
+            &record->sourceAddress)) {
+            record->flags |= kPrelinkIndexHasSourceAddress;
+        }
+        if (getPrelinkIndexNumber(kextInfo, CFSTR(kPrelinkExecutableSizeKey),
+            &record->size)) {
+            record->flags |= kPrelinkIndexHasSize;
+        }
+        if (getPrelinkIndexNumber(kextInfo, CFSTR(kPrelinkKmodInfoKey),
+            &record->kmodInfo)) {
+            record->flags |= kPrelinkIndexHasKmodInfo;
+        }
+        if (getPrelinkIndexNumber(kextInfo, CFSTR(kPrelinkIndexModuleIndexKey),
+            &moduleIndex)) {
+            record->moduleIndex = (uint32_t)moduleIndex;
+            record->flags |= kPrelinkIndexHasModuleIndex;
+        }
+
+       /* Codeless kexts have no executable; the rest get their UUID from
+        * the executable's own load commands.
+        */
+        if (record->flags & kPrelinkIndexHasSourceAddress) {
+            const MachOViewSegment * kcSeg = machoViewGetSegmentForAddress(kcView,
+                record->sourceAddress);
+
+            if (kcSeg && record->sourceAddress - kcSeg->vmaddr < kcSeg->filesize) {
+                uint64_t kextOffset = kcSeg->fileoff +
+                    (record->sourceAddress - kcSeg->vmaddr);
+
+                if (kextOffset < imageSize) {
+                    kextView = machoViewCreate(imageBytes + kextOffset,
+                        imageSize - (size_t)kextOffset);
+                }
+            }
+        }
+        if (kextView) {
+            if (machoViewGetUUID(kextView)) {
+                memcpy(record->uuid, machoViewGetUUID(kextView), sizeof(record->uuid));
+                record->flags |= kPrelinkIndexHasUUID;
+            }
+            machoViewFree(kextView);
+        }
+    }
+
+   /* Sort by bundle identifier now that the string table is complete, as
+    * appending to it may have moved it.
+    */
+    for (i = 0; i < kextCount; i++) {
+        uint32_t bundleID = entries[i].record.bundleID;
+
+        entries[i].bundleID = (bundleID == kPrelinkIndexNoString) ? NULL :
+            (const char *)CFDataGetBytePtr(sliceData->strings) + bundleID;
+    }
+    qsort(entries, kextCount, sizeof(*entries), comparePrelinkIndexSortEntries);
+    for (i = 0; i < kextCount; i++) {
+        CFDataAppendBytes(sliceData->kexts, (const UInt8 *)&entries[i].record,
+            sizeof(entries[i].record));
+    }
+
+    memcpy(sliceData->slice.uuid, machoViewGetUUID(kcView), sizeof(sliceData->slice.uuid));
+    sliceData->slice.prelinkInfoSize = infoSect->size;
+    sliceData->slice.prelinkInfoHash = hashPrelinkInfo(infoBytes, (size_t)infoSect->size);
+    sliceData->slice.kextCount = (uint32_t)kextCount;
+    sliceData->slice.stringsSize = (uint32_t)CFDataGetLength(sliceData->strings);
+
+    result = true;
+
+finish:
+    if (!result) {
+        OSKextLog(/* kext */ NULL,
+            kOSKextLogWarningLevel | kOSKextLogGeneralFlag,
+            "Can't index prelink info for a kernelcache slice; skipping it.");
+        SAFE_RELEASE_NULL(sliceData->kexts);
+        SAFE_RELEASE_NULL(sliceData->strings);
+    }
+    SAFE_RELEASE(image);
+    SAFE_RELEASE(kextInfo);
+    SAFE_FREE(entries);
+    machoViewFree(kcView);
+    prelinkInfoFree(prelinkInfo);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static uint32_t addPrelinkIndexString(
+    CFMutableDataRef strings,
+    CFTypeRef        string)
+{
+    uint32_t   result  = kPrelinkIndexNoString;
+    char     * cString = NULL;  // must free
+
+    if (!string || CFGetTypeID(string) != CFStringGetTypeID()) {
+        goto finish;
+    }
+    cString = copyUTF8String((CFStringRef)string);
+    if (!cString) {
+        goto finish;
+    }
+    result = (uint32_t)CFDataGetLength(strings);
+    CFDataAppendBytes(strings, (const UInt8 *)cString, strlen(cString) + 1);
+
+finish:
+    SAFE_FREE(cString);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static Boolean getPrelinkIndexNumber(
+    CFDictionaryRef   kextInfo,
+    CFStringRef       key,
+    uint64_t        * value)
+{
+    CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(kextInfo, key);
+
+    if (!number || CFGetTypeID(number) != CFNumberGetTypeID()) {
+        return false;
+    }
+    return CFNumberGetValue(number, kCFNumberSInt64Type, value);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static uint64_t hashPrelinkInfo(const char * bytes, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t   i;
+
+    for (i = 0; i < size; i++) {
+        hash ^= (uint8_t)bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*******************************************************************************
+* prelinkIndexOpen() maps the sidecar and picks the slice built from this
+* kernelcache. Matching the UUID alone isn't enough, as every kernelcache
+* built from one kernel shares its UUID, so the prelink info must hash the
+* same too; that is still far cheaper than unserializing it.
+*******************************************************************************/
+PrelinkIndexRef prelinkIndexOpen(
+    const char    * kernelcachePath,
+    const uint8_t * kernelcacheUUID,
+    const char    * prelinkInfo,
+    size_t          prelinkInfoSize)
+{
+    PrelinkIndexRef            result     = NULL;
+    PrelinkIndexRef            index      = NULL;  // must prelinkIndexClose()
+    const PrelinkIndexHeader * header     = NULL;
+    const PrelinkIndexSlice  * slices     = NULL;
+    char                       indexPath[PATH_MAX];
+    struct stat                statBuf;
+    int                        fd         = -1;    // must close()
+    uint64_t                   infoHash   = 0;
+    Boolean                    haveHash   = false;
+    uint32_t                   i;
+
+    if (!kernelcachePath || !kernelcacheUUID || !prelinkInfo) {
+        goto finish;
+    }
+    if (strlcpy(indexPath, kernelcachePath, sizeof(indexPath)) >= sizeof(indexPath) ||
+        strlcat(indexPath, kPrelinkIndexSuffix, sizeof(indexPath)) >= sizeof(indexPath)) {
+        goto finish;
+    }
+
+    fd = open(indexPath, O_RDONLY);
+    if (fd == -1) {
+        goto finish;
+    }
+    if (fstat(fd, &statBuf) == -1 ||
+        statBuf.st_size < (off_t)sizeof(PrelinkIndexHeader)) {
+        goto finish;
+    }
+
+    index = (PrelinkIndexRef)calloc(1, sizeof(*index));
+    if (!index) {
+        OSKextLogMemError();
+        goto finish;
+    }
+    index->mapSize = (size_t)statBuf.st_size;
+    index->map = mmap(NULL, index->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        goto finish;
+    }
+
+    header = (const PrelinkIndexHeader *)index->map;
+    if (header->magic != kPrelinkIndexMagic ||
+        header->version != kPrelinkIndexVersion ||
+        header->sliceCount > (index->mapSize - sizeof(*header)) / sizeof(*slices)) {
+
+        goto finish;
+    }
+    slices = (const PrelinkIndexSlice *)(header + 1);
+
+    for (i = 0; i < header->sliceCount; i++) {
+        const PrelinkIndexSlice * slice = &slices[i];
+
+        if (memcmp(slice->uuid, kernelcacheUUID, sizeof(slice->uuid)) ||
+            slice->prelinkInfoSize != prelinkInfoSize) {
+            continue;
+        }
+        if (!haveHash) {
+            infoHash = hashPrelinkInfo(prelinkInfo, prelinkInfoSize);
+            haveHash = true;
+        }
+        if (slice->prelinkInfoHash != infoHash) {
+            continue;
+        }
+
+        if (slice->kextsOffset > index->mapSize ||
+            slice->kextCount > (index->mapSize - slice->kextsOffset) /
+                sizeof(PrelinkIndexKext) ||
+            slice->stringsOffset > index->mapSize ||
+            slice->stringsSize > index->mapSize - slice->stringsOffset ||
+            slice->stringsSize == 0 ||
+            ((const char *)index->map)[slice->stringsOffset +
+                slice->stringsSize - 1] != '\0') {
+
+            OSKextLog(/* kext */ NULL,
+                kOSKextLogWarningLevel | kOSKextLogGeneralFlag,
+                "Prelink index %s is damaged; ignoring it.", indexPath);
+            goto finish;
+        }
+
+        index->kexts = (const PrelinkIndexKext *)
+            ((const char *)index->map + slice->kextsOffset);
+        index->kextCount = slice->kextCount;
+        index->strings = (const char *)index->map + slice->stringsOffset;
+        index->stringsSize = slice->stringsSize;
+
+        result = index;
+        index = NULL;
+        break;
+    }
+
+finish:
+    if (fd != -1) {
+        close(fd);
+    }
+    prelinkIndexClose(index);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+void prelinkIndexClose(
+    PrelinkIndexRef index)
+{
+    if (!index) {
+        return;
+    }
+    if (index->map) {
+        munmap(index->map, index->mapSize);
+    }
+    free(index);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+CFDictionaryRef prelinkIndexCopyInfoForKexts(
+    PrelinkIndexRef index,
+    CFSetRef        bundleIDs)
+{
+    CFDictionaryRef           result     = NULL;
+    CFMutableDictionaryRef    infoDict   = NULL;  // must release
+    CFMutableArrayRef         kextArray  = NULL;  // must release
+    CFMutableDictionaryRef    kextDict   = NULL;  // must release
+    CFTypeRef                 value      = NULL;  // must release
+    const PrelinkIndexKext ** found      = NULL;  // must free
+    CFStringRef             * ids        = NULL;  // must free
+    char                    * idCString  = NULL;  // must free
+    CFIndex                   numIDs     = bundleIDs ? CFSetGetCount(bundleIDs) : 0;
+    CFIndex                   numFound   = 0;
+    CFIndex                   i;
+
+    infoDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    kextArray = CFArrayCreateMutable(kCFAllocatorDefault, 0,
+        &kCFTypeArrayCallBacks);
+    found = (const PrelinkIndexKext **)malloc((index->kextCount + 1) * sizeof(*found));
+    ids = (CFStringRef *)malloc((numIDs + 1) * sizeof(*ids));
+    if (!infoDict || !kextArray || !found || !ids) {
+        OSKextLogMemError();
+        goto finish;
+    }
+
+    if (!numIDs) {
+        for (i = 0; i < index->kextCount; i++) {
+            found[numFound++] = &index->kexts[i];
+        }
+    } else {
+        CFSetGetValues(bundleIDs, (const void **)ids);
+        for (i = 0; i < numIDs; i++) {
+            uint32_t low  = 0;
+            uint32_t high = index->kextCount;
+
+            SAFE_FREE_NULL(idCString);
+            idCString = copyUTF8String(ids[i]);
+            if (!idCString) {
+                continue;
+            }
+            while (low < high) {
+                uint32_t     mid     = low + (high - low) / 2;
+                const char * midID   = getPrelinkIndexString(index,
+                                           index->kexts[mid].bundleID);
+                int          compare = midID ? strcmp(midID, idCString) : 1;
+
+                if (compare == 0) {
+                    found[numFound++] = &index->kexts[mid];
+                    break;
+                } else if (compare < 0) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+        }
+    }
+
+   /* List the kexts in prelink info order, as the XML would.
+    */
+    qsort(found, numFound, sizeof(*found), comparePrelinkIndexSerial);
+
+    for (i = 0; i < numFound; i++) {
+        const PrelinkIndexKext * record = found[i];
+        const char             * string = NULL;
+        struct {
+            uint32_t     flag;
+            CFStringRef  key;
+            uint64_t     value;
+        } numbers[] = {
+            { kPrelinkIndexHasLoadAddress,   CFSTR(kPrelinkExecutableLoadKey),   record->loadAddress },
+            { kPrelinkIndexHasSourceAddress, CFSTR(kPrelinkExecutableSourceKey), record->sourceAddress },
+            { kPrelinkIndexHasSize,          CFSTR(kPrelinkExecutableSizeKey),   record->size },
+            { kPrelinkIndexHasKmodInfo,      CFSTR(kPrelinkKmodInfoKey),         record->kmodInfo },
+            { kPrelinkIndexHasModuleIndex,   CFSTR(kPrelinkIndexModuleIndexKey),      record->moduleIndex },
+        };
+        struct {
+            uint32_t     offset;
+            CFStringRef  key;
+        } strings[] = {
+            { record->bundleID,   kCFBundleIdentifierKey },
+            { record->version,    kCFBundleVersionKey },
+            { record->bundlePath, CFSTR(kPrelinkBundlePathKey) },
+        };
+        size_t n;
+
+        kextDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0,
+            &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        if (!kextDict) {
+            OSKextLogMemError();
+            goto finish;
+        }
+        for (n = 0; n < sizeof(strings) / sizeof(strings[0]); n++) {
+            string = getPrelinkIndexString(index, strings[n].offset);
+            if (!string) {
+                continue;
+            }
+            value = CFStringCreateWithCString(kCFAllocatorDefault, string,
+                kCFStringEncodingUTF8);
+            if (value) {
+                CFDictionarySetValue(kextDict, strings[n].key, value);
+                SAFE_RELEASE_NULL(value);
+            }
+        }
+        for (n = 0; n < sizeof(numbers) / sizeof(numbers[0]); n++) {
+            if (!(record->flags & numbers[n].flag)) {
+                continue;
+            }
+            value = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type,
+                &numbers[n].value);
+            if (value) {
+                CFDictionarySetValue(kextDict, numbers[n].key, value);
+                SAFE_RELEASE_NULL(value);
+            }
+        }
+        if (record->flags & kPrelinkIndexHasUUID) {
+            value = CFDataCreate(kCFAllocatorDefault, record->uuid,
+                sizeof(record->uuid));
+            if (value) {
+                CFDictionarySetValue(kextDict,
+                    CFSTR(kPrelinkIndexExecutableUUIDKey), value);
+                SAFE_RELEASE_NULL(value);
+            }
+        }
+        CFArrayAppendValue(kextArray, kextDict);
+        SAFE_RELEASE_NULL(kextDict);
+    }
+
+    CFDictionarySetValue(infoDict, CFSTR(kPrelinkInfoDictionaryKey), kextArray);
+    result = infoDict;
+    infoDict = NULL;
+
+finish:
+    SAFE_RELEASE(infoDict);
+    SAFE_RELEASE(kextArray);
+    SAFE_RELEASE(kextDict);
+    SAFE_RELEASE(value);
+    SAFE_FREE(found);
+    SAFE_FREE(ids);
+    SAFE_FREE(idCString);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static const char * getPrelinkIndexString(
+    PrelinkIndexRef index,
+    uint32_t        offset)
+{
+    if (offset == kPrelinkIndexNoString || offset >= index->stringsSize) {
+        return NULL;
+    }
+    return index->strings + offset;
+}
+
+/*******************************************************************************
+* Kexts without a bundle identifier sort last, as in the XML index.
+*******************************************************************************/
+static int comparePrelinkIndexSortEntries(const void * a, const void * b)
+{
+    const char * idA = ((const PrelinkIndexSortEntry *)a)->bundleID;
+    const char * idB = ((const PrelinkIndexSortEntry *)b)->bundleID;
+
+    if (!idA || !idB) {
+        return (idA ? -1 : 0) + (idB ? 1 : 0);
+    }
+    return strcmp(idA, idB);
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static int comparePrelinkIndexSerial(const void * a, const void * b)
+{
+    uint32_t serialA = (*(const PrelinkIndexKext * const *)a)->serialIndex;
+    uint32_t serialB = (*(const PrelinkIndexKext * const *)b)->serialIndex;
+
+    return (serialA > serialB) - (serialA < serialB);
+}
@@ -0,0 +1,101 @@
+/*
+ *  prelink_info.h
+ *  kext_tools
+ *
+ *  Copyright 2026 Apple Inc. All rights reserved.
+ *
+ */
+#ifndef _PRELINK_INFO_H_
+#define _PRELINK_INFO_H_
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "kext_tools_util.h"
+
+/* A PrelinkInfo indexes the serialized __PRELINK_INFO dictionary of a
+ * kernelcache without unserializing it. Creating one makes a single pass
+ * over the XML recording where each kext's dictionary lies and its
+ * CFBundleIdentifier; properties are turned into CF objects only when they
+ * are asked for. The XML must stay mapped for the life of the PrelinkInfo.
+ */
+typedef struct prelink_info * PrelinkInfoRef;
+
+PrelinkInfoRef prelinkInfoCreate(
+    const char * xml,
+    size_t       length);
+void prelinkInfoFree(
+    PrelinkInfoRef info);
+
+CFIndex prelinkInfoGetKextCount(
+    PrelinkInfoRef info);
+
+/* Returns the index of the kext with the given bundle identifier, or
+ * kCFNotFound.
+ */
+CFIndex prelinkInfoFindKext(
+    PrelinkInfoRef info,
+    CFStringRef    bundleID);
+
+CFTypeRef prelinkInfoCopyKextProperty(
+    PrelinkInfoRef info,
+    CFIndex        kextIndex,
+    CFStringRef    key);
+
+/* Pass NULL keys to copy every property of the kext.
+ */
+CFDictionaryRef prelinkInfoCopyKextProperties(
+    PrelinkInfoRef      info,
+    CFIndex             kextIndex,
+    const CFStringRef * keys,
+    CFIndex             numKeys);
+
+/* Returns a dictionary shaped like the unserialized __PRELINK_INFO, holding
+ * under _PrelinkInfoDictionary only the named kexts, each with only the
+ * given properties (all of them if keys is NULL).
+ */
+CFDictionaryRef prelinkInfoCopyInfoForKexts(
+    PrelinkInfoRef      info,
+    CFSetRef            bundleIDs,
+    const CFStringRef * keys,
+    CFIndex             numKeys);
+
+/* A PrelinkIndex is a compact binary sidecar written next to a kernelcache
+ * (see writePrelinkIndex()) so that tools listing kexts need not read the
+ * XML at all. Each slice's kexts are kept as fixed-width records sorted by
+ * bundle identifier, with their version, path, addresses and executable
+ * UUID, plus a string table. A slice's records are only used if the
+ * kernelcache's UUID and __PRELINK_INFO contents still match.
+ */
+#define kPrelinkIndexSuffix  ".plkindex"
+
+/* The executable's LC_UUID, as 16 bytes of CFData, in kext dictionaries
+ * returned by prelinkIndexCopyInfoForKexts(). It isn't in the XML.
+ */
+#define kPrelinkIndexExecutableUUIDKey  "_PrelinkIndexExecutableUUID"
+
+typedef struct prelink_index * PrelinkIndexRef;
+
+ExitStatus writePrelinkIndex(
+    const char * kernelcachePath,
+    CFArrayRef   prelinkSlices);
+
+/* Returns NULL if there is no index for the kernelcache at kernelcachePath,
+ * or it was written for a different build.
+ */
+PrelinkIndexRef prelinkIndexOpen(
+    const char    * kernelcachePath,
+    const uint8_t * kernelcacheUUID,
+    const char    * prelinkInfo,
+    size_t          prelinkInfoSize);
+void prelinkIndexClose(
+    PrelinkIndexRef index);
+
+/* As prelinkInfoCopyInfoForKexts(), with the properties kclist and kctool
+ * read plus kPrelinkIndexExecutableUUIDKey for kexts with a UUID. Pass NULL
+ * or an empty set for every kext.
+ */
+CFDictionaryRef prelinkIndexCopyInfoForKexts(
+    PrelinkIndexRef index,
+    CFSetRef        bundleIDs);
+
+#endif /* _PRELINK_INFO_H_ */
@@ -0,0 +1,571 @@
+/*
+ *  compression_test.c
+ *  kext_tools
+ *
+ *  Copyright 2020 Apple Inc. All rights reserved.
+ *
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "unit_test.h"
+#include "compression.h"
+
+#if __has_include(<FastCompression.h>)
+#include <FastCompression.h>
+#define HAVE_FAST_COMPRESSION 1
+#endif
+
+#pragma mark Reference Implementations
+/* The byte-at-a-time adler32 that local_adler32() replaced. */
+static u_int32_t
+reference_adler32(u_int8_t *buffer, int32_t length)
+{
+    int32_t cnt;
+    u_int32_t  result, lowHalf, highHalf;
+
+    lowHalf = 1;
+    highHalf = 0;
+
+    for (cnt = 0; cnt < length; cnt++) {
+        if ((cnt % 5000) == 0) {
+            lowHalf  %= 65521L;
+            highHalf %= 65521L;
+        }
+
+        lowHalf += buffer[cnt];
+        highHalf += lowHalf;
+    }
+
+    lowHalf  %= 65521L;
+    highHalf %= 65521L;
+
+    result = (highHalf << 16) | lowHalf;
+
+    return result;
+}
+
+#pragma mark Helpers
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Fills buf with data that looks vaguely like code: short repeats mixed
+ * with noise, so both literals and matches get exercised.
+ */
+static void
+fill_test_data(u_int8_t *buf, size_t len, unsigned int seed)
+{
+    size_t i;
+
+    srandom(seed);
+    for (i = 0; i < len; i++) {
+        if (i < 32 || (random() % 4) == 0) {
+            buf[i] = (u_int8_t)random();
+        } else {
+            buf[i] = buf[i - 1 - (random() % 32)];
+        }
+    }
+}
+
+#pragma mark Test Functions
+static void
+test_adler32_matches_reference(void)
+{
+    const size_t bufSize = 256 * 1024;
+    u_int8_t    *buf = NULL;
+    size_t       len, offset;
+    bool         identical = true;
+    bool         combines = true;
+
+    TEST_START("adler32 matches reference");
+
+    buf = malloc(bufSize);
+    if (!buf) {
+        TEST_RESULT("allocate test buffer", false);
+        return;
+    }
+
+    /* All-0xff input is the worst case for the deferred modulo. */
+    memset(buf, 0xff, bufSize);
+    TEST_CASE("all 0xff input", local_adler32(buf, (int32_t)bufSize) ==
+        reference_adler32(buf, (int32_t)bufSize));
+
+    fill_test_data(buf, bufSize, 1);
+    for (len = 0; len < 300 && identical; len++) {
+        for (offset = 0; offset < 33; offset++) {
+            if (local_adler32(buf + offset, (int32_t)len) !=
+                reference_adler32(buf + offset, (int32_t)len)) {
+                TEST_LOG("mismatch at offset %zu length %zu", offset, len);
+                identical = false;
+                break;
+            }
+        }
+    }
+    for (len = 5000; len < 12000 && identical; len += 7) {
+        if (local_adler32(buf, (int32_t)len) != reference_adler32(buf, (int32_t)len)) {
+            TEST_LOG("mismatch at length %zu", len);
+            identical = false;
+        }
+    }
+    TEST_CASE("short and block-boundary lengths, all alignments", identical);
+
+    for (len = 0; len < bufSize && combines; len += 4093) {
+        u_int32_t whole = local_adler32(buf, (int32_t)bufSize);
+        u_int32_t first = local_adler32(buf, (int32_t)len);
+        u_int32_t second = local_adler32(buf + len, (int32_t)(bufSize - len));
+
+        if (local_adler32_combine(first, second, (u_int32_t)(bufSize - len)) != whole) {
+            TEST_LOG("combine mismatch splitting at %zu", len);
+            combines = false;
+        }
+    }
+    TEST_CASE("adler32_combine of split buffer", combines);
+
+    free(buf);
+}
+
+/* Runs both LZSS decoders on the same input and checks that they report
+ * the same length and produce the same bytes.
+ */
+static bool
+lzss_decoders_agree(u_int8_t *src, u_int32_t srclen, u_int32_t dstlen)
+{
+    u_int8_t *expected = malloc(dstlen + 1);
+    u_int8_t *actual = malloc(dstlen + 1);
+    int       expectedLen, actualLen;
+    bool      result = false;
+
+    if (!expected || !actual) {
+        goto finish;
+    }
+
+    expectedLen = decompress_lzss(expected, dstlen, src, srclen);
+    actualLen = decompress_lzss_fast(actual, dstlen, src, srclen);
+    if (expectedLen != actualLen) {
+        TEST_LOG("decoded length %d, expected %d (srclen %u, dstlen %u)",
+            actualLen, expectedLen, srclen, dstlen);
+        goto finish;
+    }
+    if (memcmp(expected, actual, expectedLen) != 0) {
+        TEST_LOG("decoded bytes differ (srclen %u, dstlen %u)", srclen, dstlen);
+        goto finish;
+    }
+    result = true;
+
+finish:
+    free(expected);
+    free(actual);
+    return result;
+}
+
+static void
+test_lzss_fast_decoder(void)
+{
+    const u_int32_t maxLen = 64 * 1024;
+    u_int8_t       *plain = malloc(maxLen);
+    u_int8_t       *comp = malloc(maxLen * 2);
+    u_int8_t       *compEnd = NULL;
+    u_int32_t       len, compLen, i;
+    int             iteration;
+    bool            roundTrips = true;
+    bool            fuzzAgrees = true;
+    bool            mutantsAgree = true;
+
+    TEST_START("fast LZSS decoder");
+
+    if (!plain || !comp) {
+        TEST_RESULT("allocate test buffers", false);
+        goto finish;
+    }
+
+    /* Streams from both encoders, decoded in full and into short buffers. */
+    for (iteration = 0; iteration < 200 && roundTrips; iteration++) {
+        len = (u_int32_t)(random() % maxLen);
+        fill_test_data(plain, len, iteration);
+        if (iteration % 10 == 0) {
+            memset(plain, ' ', len / 2);
+        }
+
+        compEnd = (iteration & 1) ?
+            compress_lzss_hashchain(comp, maxLen * 2, plain, len, 0) :
+            compress_lzss(comp, maxLen * 2, plain, len);
+        if (!compEnd) {
+            continue;
+        }
+        compLen = (u_int32_t)(compEnd - comp);
+
+        roundTrips = lzss_decoders_agree(comp, compLen, len) &&
+            lzss_decoders_agree(comp, compLen, len / 3) &&
+            lzss_decoders_agree(comp, compLen / 2, len);
+        if (roundTrips) {
+            u_int8_t *check = malloc(len + 1);
+
+            roundTrips = check &&
+                decompress_lzss_fast(check, len, comp, compLen) == (int)len &&
+                memcmp(check, plain, len) == 0;
+            free(check);
+        }
+    }
+    TEST_CASE("round trips match decompress_lzss", roundTrips);
+
+    /* Arbitrary bytes, including references into the preset ring. */
+    for (iteration = 0; iteration < 2000 && fuzzAgrees; iteration++) {
+        compLen = (u_int32_t)(random() % 4096);
+        for (i = 0; i < compLen; i++) {
+            comp[i] = (u_int8_t)random();
+        }
+        fuzzAgrees = lzss_decoders_agree(comp, compLen,
+            (u_int32_t)(random() % (maxLen + 1)));
+    }
+    TEST_CASE("random streams match decompress_lzss", fuzzAgrees);
+
+    /* Valid streams with a few bytes flipped. */
+    fill_test_data(plain, maxLen, 99);
+    compEnd = compress_lzss(comp, maxLen * 2, plain, maxLen);
+    compLen = compEnd ? (u_int32_t)(compEnd - comp) : 0;
+    for (iteration = 0; iteration < 500 && compLen && mutantsAgree; iteration++) {
+        u_int32_t at = (u_int32_t)(random() % compLen);
+        u_int8_t  saved = comp[at];
+
+        comp[at] ^= (u_int8_t)(1 + random() % 255);
+        mutantsAgree = lzss_decoders_agree(comp, compLen, maxLen);
+        comp[at] = saved;
+    }
+    TEST_CASE("mutated streams match decompress_lzss", mutantsAgree);
+
+finish:
+    free(plain);
+    free(comp);
+}
+
+/* The optimal parser must never lose to the greedy tree encoder, including
+ * on the repetitive and space-filled input where it used to.
+ */
+static void
+test_lzss_optimal_never_larger(void)
+{
+    const u_int32_t maxLen = 512 * 1024;
+    u_int8_t       *plain = malloc(maxLen);
+    u_int8_t       *greedy = malloc(maxLen * 2);
+    u_int8_t       *optimal = malloc(maxLen * 2);
+    u_int8_t       *check = malloc(maxLen);
+    u_int8_t       *greedyEnd, *optimalEnd;
+    u_int32_t       len, i;
+    int             iteration;
+    bool            neverLarger = true;
+    bool            roundTrips = true;
+
+    TEST_START("optimal LZSS never larger than compress_lzss");
+
+    if (!plain || !greedy || !optimal || !check) {
+        TEST_RESULT("allocate test buffers", false);
+        goto finish;
+    }
+
+    for (iteration = 0; iteration < 60 && neverLarger && roundTrips; iteration++) {
+        len = (iteration < 10) ? (u_int32_t)iteration * 7 + 1 :
+            (u_int32_t)(random() % maxLen) + 1;
+
+        switch (iteration % 4) {
+        case 0:
+            fill_test_data(plain, len, 3000 + iteration);
+            break;
+        case 1:
+            for (i = 0; i < len; i++) {
+                plain[i] = "abcabcabd"[i % 9];
+            }
+            break;
+        case 2:
+            memset(plain, ' ', len);
+            break;
+        case 3:
+            fill_test_data(plain, len, 3000 + iteration);
+            memset(plain, ' ', len / 2);
+            break;
+        }
+
+        greedyEnd = compress_lzss(greedy, maxLen * 2, plain, len);
+        optimalEnd = compress_lzss_optimal(optimal, maxLen * 2, plain, len);
+        if (!greedyEnd || !optimalEnd) {
+            TEST_LOG("encoding failed for length %u", len);
+            roundTrips = false;
+            break;
+        }
+        if (optimalEnd - optimal > greedyEnd - greedy) {
+            TEST_LOG("length %u (pattern %d): optimal %ld bytes, greedy %ld",
+                len, iteration % 4, (long)(optimalEnd - optimal),
+                (long)(greedyEnd - greedy));
+            neverLarger = false;
+        }
+        roundTrips = decompress_lzss(check, len, optimal,
+                (u_int32_t)(optimalEnd - optimal)) == (int)len &&
+            memcmp(check, plain, len) == 0;
+        if (!roundTrips) {
+            TEST_LOG("round trip failed for length %u", len);
+        }
+    }
+    TEST_CASE("output is never larger", neverLarger);
+    TEST_CASE("round trips", roundTrips);
+
+finish:
+    free(plain);
+    free(greedy);
+    free(optimal);
+    free(check);
+}
+
+static void
+test_lzvn_codec(void)
+{
+    /* sml_l "abc", sml_d L=0 M=6 D=3, sml_m M=2 (previous D), eos */
+    static const u_int8_t knownStream[] = {
+        0xE3, 'a', 'b', 'c', 0x18, 0x03, 0xF2,
+        0x06, 0, 0, 0, 0, 0, 0, 0 };
+    static const char knownOutput[] = "abcabcabcab";
+    const size_t maxLen = 512 * 1024;
+    u_int8_t    *plain = malloc(maxLen);
+    u_int8_t    *comp = malloc(maxLen + maxLen / 8 + 64);
+    u_int8_t    *check = malloc(maxLen);
+    void        *work = malloc(local_lzvn_encode_work_size());
+    u_int8_t     knownCheck[sizeof(knownOutput)];
+    size_t       len, compLen;
+    int          iteration;
+    bool         roundTrips = true;
+    bool         fuzzSafe = true;
+
+    TEST_START("LZVN codec");
+
+    if (!plain || !comp || !check || !work) {
+        TEST_RESULT("allocate test buffers", false);
+        goto finish;
+    }
+
+    TEST_CASE("decodes a hand-assembled stream",
+        local_lzvn_decode(knownCheck, sizeof(knownCheck), knownStream,
+            sizeof(knownStream)) == strlen(knownOutput) &&
+        memcmp(knownCheck, knownOutput, strlen(knownOutput)) == 0);
+
+    for (iteration = 0; iteration < 100 && roundTrips; iteration++) {
+        len = (iteration == 0) ? 0 : (size_t)(random() % maxLen);
+        fill_test_data(plain, len, 1000 + iteration);
+        if (iteration % 5 == 0) {
+            memset(plain + len / 3, 0, len / 3);
+        }
+
+        compLen = local_lzvn_encode(comp, maxLen + maxLen / 8 + 64,
+            plain, len, work);
+        roundTrips = compLen != 0 &&
+            local_lzvn_decode(check, maxLen, comp, compLen) == len &&
+            memcmp(check, plain, len) == 0;
+        if (!roundTrips) {
+            TEST_LOG("round trip failed for length %zu", len);
+        }
+#if HAVE_FAST_COMPRESSION
+        /* Cross-check against the system codec in both directions. */
+        if (roundTrips && len) {
+            roundTrips = lzvn_decode(check, maxLen, comp, compLen) == len &&
+                memcmp(check, plain, len) == 0;
+            compLen = lzvn_encode(comp, maxLen + maxLen / 8 + 64,
+                plain, len, work);
+            roundTrips = roundTrips && compLen != 0 &&
+                local_lzvn_decode(check, maxLen, comp, compLen) == len &&
+                memcmp(check, plain, len) == 0;
+            if (!roundTrips) {
+                TEST_LOG("FastCompression cross-check failed for length %zu", len);
+            }
+        }
+#endif
+    }
+    TEST_CASE("round trips", roundTrips);
+
+    fill_test_data(plain, maxLen, 7);
+    TEST_CASE("reports failure when output is too small",
+        local_lzvn_encode(comp, 1024, plain, maxLen, work) == 0);
+
+    /* Random streams must not read or write out of bounds. */
+    for (iteration = 0; iteration < 2000 && fuzzSafe; iteration++) {
+        size_t i;
+
+        compLen = (size_t)(random() % 2048);
+        for (i = 0; i < compLen; i++) {
+            comp[i] = (u_int8_t)random();
+        }
+        fuzzSafe = local_lzvn_decode(check, (size_t)(random() % 4096),
+            comp, compLen) <= 4096;
+    }
+    TEST_CASE("random streams decode within bounds", fuzzSafe);
+
+finish:
+    free(plain);
+    free(comp);
+    free(check);
+    free(work);
+}
+
+typedef struct {
+    u_int8_t * buf;
+    size_t     length;
+    size_t     capacity;
+} StreamSink;
+
+static int
+stream_sink_write(void *context, const void *buf, size_t length)
+{
+    StreamSink *sink = (StreamSink *)context;
+
+    if (sink->capacity - sink->length < length) {
+        return -1;
+    }
+    memcpy(sink->buf + sink->length, buf, length);
+    sink->length += length;
+    return 0;
+}
+
+static void
+test_codec_registry(void)
+{
+    static const u_int32_t types[] = {
+        COMP_TYPE_LZSS, COMP_TYPE_LZSS_FAST, COMP_TYPE_LZSS_OPTIMAL,
+        COMP_TYPE_FASTLIB };
+    const size_t maxLen = 512 * 1024;
+    const size_t compMax = maxLen + maxLen / 8 + 64;
+    u_int8_t    *plain = malloc(maxLen);
+    u_int8_t    *comp = malloc(compMax);
+    u_int8_t    *check = malloc(maxLen);
+    StreamSink   sink = { malloc(compMax), 0, compMax };
+    size_t       t, len, compLen, offset, piece;
+    int          iteration;
+    bool         roundTrips = true;
+    bool         streamsMatch = true;
+
+    TEST_START("codec registry");
+
+    if (!plain || !comp || !check || !sink.buf) {
+        TEST_RESULT("allocate test buffers", false);
+        goto finish;
+    }
+
+    TEST_CASE("finds codecs by type and name",
+        compression_codec_for_type(COMP_TYPE_LZSS) ==
+            compression_codec_for_name("lzss") &&
+        compression_codec_for_name("LZVN") != NULL &&
+        compression_codec_for_type(COMP_TYPE_LZSS_FAST)->storedType ==
+            COMP_TYPE_LZSS &&
+        compression_codec_for_type('none') == NULL);
+
+    for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        const CompressionCodec *codec = compression_codec_for_type(types[t]);
+        void *work = malloc(codec->encodeWorkSize() + 1);
+
+        for (iteration = 0; iteration < 12 && roundTrips && streamsMatch;
+             iteration++) {
+            CompressionStream *stream;
+
+            len = (size_t)(random() % maxLen) + 1;
+            fill_test_data(plain, len, 2000 + iteration);
+
+            compLen = codec->encode(comp, compMax, plain, len, work);
+            roundTrips = compLen != 0 &&
+                codec->decode(check, maxLen, comp, compLen) == len &&
+                memcmp(check, plain, len) == 0;
+            if (!roundTrips) {
+                TEST_LOG("%s round trip failed for length %zu", codec->name, len);
+                break;
+            }
+
+            /* Feeding the stream in odd-sized pieces must not change the output. */
+            sink.length = 0;
+            stream = compression_stream_create(codec, &stream_sink_write, &sink);
+            for (offset = 0; stream && offset < len; offset += piece) {
+                piece = (size_t)(random() % 100000) + 1;
+                if (piece > len - offset) {
+                    piece = len - offset;
+                }
+                if (compression_stream_write(stream, plain + offset, piece)) {
+                    break;
+                }
+            }
+            streamsMatch = stream && offset == len &&
+                compression_stream_finish(stream) == 0 &&
+                compression_stream_total_in(stream) == len &&
+                compression_stream_total_out(stream) == sink.length &&
+                compression_stream_adler32(stream) == local_adler32(plain, (int32_t)len) &&
+                sink.length == compLen &&
+                memcmp(sink.buf, comp, compLen) == 0;
+            if (!streamsMatch) {
+                TEST_LOG("%s stream differs for length %zu", codec->name, len);
+            }
+            compression_stream_destroy(stream);
+        }
+        free(work);
+    }
+    TEST_CASE("codecs round trip", roundTrips);
+    TEST_CASE("streams match whole-buffer encoding", streamsMatch);
+
+finish:
+    free(plain);
+    free(comp);
+    free(check);
+    free(sink.buf);
+}
+
+static void
+bench_adler32(void)
+{
+    const size_t bufSize = 64 * 1024 * 1024;
+    const int    iterations = 5;
+    u_int8_t    *buf = NULL;
+    u_int32_t    expected = 0, actual = 0;
+    double       start, refTime, newTime;
+    int          i;
+
+    TEST_START("adler32 benchmark");
+
+    buf = malloc(bufSize);
+    if (!buf) {
+        TEST_RESULT("allocate benchmark buffer", false);
+        return;
+    }
+    fill_test_data(buf, bufSize, 2);
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++) {
+        expected = reference_adler32(buf, (int32_t)bufSize);
+    }
+    refTime = now_seconds() - start;
+
+    start = now_seconds();
+    for (i = 0; i < iterations; i++) {
+        actual = local_adler32(buf, (int32_t)bufSize);
+    }
+    newTime = now_seconds() - start;
+
+    TEST_LOG("reference: %.1f MB/s, local_adler32: %.1f MB/s (%.1fx)",
+        iterations * bufSize / refTime / 1e6,
+        iterations * bufSize / newTime / 1e6,
+        refTime / newTime);
+    TEST_CASE("benchmark results are bit-identical", actual == expected);
+
+    free(buf);
+}
+
+int main(void)
+{
+    test_adler32_matches_reference();
+    bench_adler32();
+    test_lzss_fast_decoder();
+    test_lzss_optimal_never_larger();
+    test_lzvn_codec();
+    test_codec_registry();
+    exit(0);
+}
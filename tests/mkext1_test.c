@@ -0,0 +1,467 @@
+/*
+ *  mkext1_test.c
+ *  kext_tools
+ *
+ *  Copyright 2026 Apple Inc. All rights reserved.
+ *
+ */
+#include <fcntl.h>
+#include <libgen.h>
+#include <removefile.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/kext/OSKext.h>
+#include <mach-o/arch.h>
+#include <mach-o/loader.h>
+#include <System/libkern/mkext.h>
+
+#include "../kext_tools_util.h"
+#include "../compression.h"
+#include "../mkext1_file.h"
+
+#include "unit_test.h"
+
+extern char ** environ;
+
+/* Archives are built from kexts made up on the fly in a scratch directory:
+ * two whose executables have the same contents and one with no executable.
+ * Each is checked for layout and then unpacked with mkextunpack, whose
+ * files must match the ones the kexts were built from.
+ */
+#define kTestExecutableSize  (16 * 1024)
+
+static const struct {
+    const char * name;
+    const char * bundleID;
+    Boolean      hasExecutable;
+} gTestKexts[] = {
+    { "One",      "com.apple.test.mkext1.one",      true  },
+    { "Two",      "com.apple.test.mkext1.two",      true  },
+    { "codeless", "com.apple.test.mkext1.codeless", false },
+};
+#define kNumTestKexts   (sizeof(gTestKexts) / sizeof(gTestKexts[0]))
+#define kNumTestFiles   (5)   // an info dictionary each, two executables
+
+static char gScratchDir[PATH_MAX];
+static char gMkextunpackPath[PATH_MAX];
+
+/*******************************************************************************
+*******************************************************************************/
+static bool write_file(const char * path, const void * bytes, size_t length)
+{
+    bool result = false;
+    int  fd     = -1;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        goto finish;
+    }
+    if (write(fd, bytes, length) != (ssize_t)length) {
+        goto finish;
+    }
+    result = true;
+
+finish:
+    if (fd != -1) {
+        close(fd);
+    }
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static bool files_match(const char * pathA, const char * pathB)
+{
+    bool      result = false;
+    CFDataRef dataA  = NULL;  // must release
+    CFDataRef dataB  = NULL;  // must release
+
+    if (createCFDataFromFile(&dataA, pathA) &&
+        createCFDataFromFile(&dataB, pathB)) {
+
+        result = CFEqual(dataA, dataB);
+    }
+    SAFE_RELEASE(dataA);
+    SAFE_RELEASE(dataB);
+    return result;
+}
+
+/*******************************************************************************
+* The executables are a bare x86_64 kext bundle header followed by text that
+* compresses well, so both stored and compressed entries get exercised.
+*******************************************************************************/
+static bool make_test_kexts(const char * kextsDir)
+{
+    bool                    result     = false;
+    uint8_t               * executable = NULL;  // must free
+    struct mach_header_64 * header     = NULL;
+    char                    path[PATH_MAX];
+    char                    plist[2048];
+    size_t                  i;
+
+    executable = calloc(1, kTestExecutableSize);
+    if (!executable) {
+        goto finish;
+    }
+    header = (struct mach_header_64 *)executable;
+    header->magic = MH_MAGIC_64;
+    header->cputype = CPU_TYPE_X86_64;
+    header->cpusubtype = CPU_SUBTYPE_X86_64_ALL;
+    header->filetype = MH_KEXT_BUNDLE;
+    for (i = sizeof(*header); i < kTestExecutableSize; i++) {
+        executable[i] = "kext_tools mkext1 test "[i % 23];
+    }
+
+    if (mkdir(kextsDir, 0755) == -1) {
+        goto finish;
+    }
+    for (i = 0; i < kNumTestKexts; i++) {
+        char executableKey[256] = "";
+
+        if (gTestKexts[i].hasExecutable) {
+            snprintf(executableKey, sizeof(executableKey),
+                "\t<key>CFBundleExecutable</key>\n\t<string>%s</string>\n",
+                gTestKexts[i].name);
+        }
+        snprintf(plist, sizeof(plist),
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<!DOCTYPE plist PUBLIC \"-//Apple//DTD PLIST 1.0//EN\" "
+            "\"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+            "<plist version=\"1.0\">\n"
+            "<dict>\n"
+            "%s"
+            "\t<key>CFBundleIdentifier</key>\n\t<string>%s</string>\n"
+            "\t<key>CFBundleInfoDictionaryVersion</key>\n\t<string>6.0</string>\n"
+            "\t<key>CFBundleName</key>\n\t<string>%s</string>\n"
+            "\t<key>CFBundlePackageType</key>\n\t<string>KEXT</string>\n"
+            "\t<key>CFBundleVersion</key>\n\t<string>1.0.0</string>\n"
+            "\t<key>OSBundleLibraries</key>\n\t<dict>\n"
+            "\t\t<key>com.apple.kpi.libkern</key>\n\t\t<string>8.0</string>\n"
+            "\t</dict>\n"
+            "</dict>\n"
+            "</plist>\n",
+            executableKey, gTestKexts[i].bundleID, gTestKexts[i].name);
+
+        snprintf(path, sizeof(path), "%s/%s.kext", kextsDir, gTestKexts[i].name);
+        if (mkdir(path, 0755) == -1) {
+            goto finish;
+        }
+        snprintf(path, sizeof(path), "%s/%s.kext/Contents", kextsDir,
+            gTestKexts[i].name);
+        if (mkdir(path, 0755) == -1) {
+            goto finish;
+        }
+        snprintf(path, sizeof(path), "%s/%s.kext/Contents/Info.plist", kextsDir,
+            gTestKexts[i].name);
+        if (!write_file(path, plist, strlen(plist))) {
+            goto finish;
+        }
+        if (!gTestKexts[i].hasExecutable) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s.kext/Contents/MacOS", kextsDir,
+            gTestKexts[i].name);
+        if (mkdir(path, 0755) == -1) {
+            goto finish;
+        }
+        snprintf(path, sizeof(path), "%s/%s.kext/Contents/MacOS/%s", kextsDir,
+            gTestKexts[i].name, gTestKexts[i].name);
+        if (!write_file(path, executable, kTestExecutableSize)) {
+            goto finish;
+        }
+    }
+
+    result = true;
+
+finish:
+    SAFE_FREE(executable);
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static CFDataRef create_test_mkext(Boolean compress, Boolean dedup)
+{
+    CFDataRef          result   = NULL;
+    CFURLRef           kextsURL = NULL;  // must release
+    CFArrayRef         kexts    = NULL;  // must release
+    const NXArchInfo * arch     = NXGetArchInfoFromName("x86_64");
+    char               kextsDir[PATH_MAX];
+
+    snprintf(kextsDir, sizeof(kextsDir), "%s/kexts", gScratchDir);
+    kextsURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault,
+        (const UInt8 *)kextsDir, strlen(kextsDir), /* isDirectory */ true);
+    if (!kextsURL || !arch) {
+        goto finish;
+    }
+    kexts = OSKextCreateKextsFromURL(kCFAllocatorDefault, kextsURL);
+    if (!kexts || CFArrayGetCount(kexts) != kNumTestKexts) {
+        goto finish;
+    }
+    result = createMkext1ForArch(arch, kexts, compress, dedup);
+
+finish:
+    SAFE_RELEASE(kextsURL);
+    SAFE_RELEASE(kexts);
+    return result;
+}
+
+/*******************************************************************************
+* Every file must lie behind the kext descriptors and inside the archive, and
+* the distinct files must be packed back to back from the end of the
+* descriptors to the end of the archive. Sets *numStored to the number of
+* distinct files.
+*******************************************************************************/
+static int compare_ranges(const void * a, const void * b)
+{
+    uint32_t offsetA = ((const uint32_t *)a)[0];
+    uint32_t offsetB = ((const uint32_t *)b)[0];
+
+    return (offsetA > offsetB) - (offsetA < offsetB);
+}
+
+static bool check_mkext1_layout(CFDataRef mkext, uint32_t * numStored)
+{
+    bool                  result       = true;
+    const uint8_t       * bytes        = CFDataGetBytePtr(mkext);
+    uint32_t              length       = (uint32_t)CFDataGetLength(mkext);
+    const mkext1_header * header       = (const mkext1_header *)bytes;
+    uint32_t              headerLength = (uint32_t)(sizeof(mkext1_header) +
+                                             kNumTestKexts * sizeof(mkext_kext));
+    uint32_t              ranges[kNumTestFiles][2];  // offset, stored size
+    uint32_t              numRanges    = 0;
+    uint32_t              expected;
+    uint32_t              i;
+
+    *numStored = 0;
+
+    TEST_REQUIRE("archive holds the header and kext descriptors",
+        length >= headerLength, result, false, finish);
+    TEST_REQUIRE("header magic and signature",
+        OSSwapBigToHostInt32(header->magic) == MKEXT_MAGIC &&
+        OSSwapBigToHostInt32(header->signature) == MKEXT_SIGN,
+        result, false, finish);
+    TEST_REQUIRE("header length is the archive's length",
+        OSSwapBigToHostInt32(header->length) == length, result, false, finish);
+    TEST_REQUIRE("header counts every kext",
+        OSSwapBigToHostInt32(header->numkexts) == kNumTestKexts,
+        result, false, finish);
+
+    expected = local_adler32((u_int8_t *)&header->version,
+        (int32_t)(length - offsetof(mkext1_header, version)));
+    TEST_REQUIRE("header adler32 matches the archive's bytes",
+        OSSwapBigToHostInt32(header->adler32) == expected,
+        result, false, finish);
+
+    for (i = 0; i < kNumTestKexts; i++) {
+        const mkext_file * files[] = { &header->kext[i].plist,
+                                       &header->kext[i].module };
+        int                f;
+
+        for (f = 0; f < 2; f++) {
+            uint32_t offset   = OSSwapBigToHostInt32(files[f]->offset);
+            uint32_t compsize = OSSwapBigToHostInt32(files[f]->compsize);
+            uint32_t realsize = OSSwapBigToHostInt32(files[f]->realsize);
+            uint32_t stored   = compsize ? compsize : realsize;
+
+            if (!offset && !compsize && !realsize) {
+                continue;   // no executable
+            }
+            TEST_REQUIRE("file lies between the descriptors and the end",
+                numRanges < kNumTestFiles &&
+                offset >= headerLength && offset <= length &&
+                stored <= length - offset,
+                result, false, finish);
+            ranges[numRanges][0] = offset;
+            ranges[numRanges][1] = stored;
+            numRanges++;
+        }
+    }
+    TEST_REQUIRE("every file has a descriptor", numRanges == kNumTestFiles,
+        result, false, finish);
+
+    qsort(ranges, numRanges, sizeof(ranges[0]), compare_ranges);
+    expected = headerLength;
+    for (i = 0; i < numRanges; i++) {
+        if (i && ranges[i][0] == ranges[i - 1][0]) {
+            TEST_REQUIRE("files sharing an offset share a size",
+                ranges[i][1] == ranges[i - 1][1], result, false, finish);
+            continue;
+        }
+        TEST_REQUIRE("files are packed back to back",
+            ranges[i][0] == expected, result, false, finish);
+        expected += ranges[i][1];
+        (*numStored)++;
+    }
+    TEST_REQUIRE("last file ends the archive", expected == length,
+        result, false, finish);
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+* Writes the archive out, unpacks it with mkextunpack (which checks the
+* header adler32 and each file's size on its own), and compares what it
+* unpacked with the kexts the archive was built from.
+*******************************************************************************/
+static bool check_mkextunpack_round_trip(CFDataRef mkext, const char * label)
+{
+    bool   result = true;
+    pid_t  pid;
+    int    status = 0;
+    size_t i;
+    char   mkextPath[PATH_MAX];
+    char   outDir[PATH_MAX];
+    char   original[PATH_MAX];
+    char   unpacked[PATH_MAX];
+    char * argv[] = { gMkextunpackPath, "-d", outDir, mkextPath, NULL };
+
+    snprintf(mkextPath, sizeof(mkextPath), "%s/%s.mkext", gScratchDir, label);
+    snprintf(outDir, sizeof(outDir), "%s/%s.out", gScratchDir, label);
+
+    TEST_REQUIRE("write mkext",
+        write_file(mkextPath, CFDataGetBytePtr(mkext), CFDataGetLength(mkext)),
+        result, false, finish);
+    TEST_REQUIRE("make output directory", mkdir(outDir, 0755) == 0,
+        result, false, finish);
+    TEST_REQUIRE("mkextunpack unpacks the archive",
+        posix_spawn(&pid, gMkextunpackPath, NULL, NULL, argv, environ) == 0 &&
+        waitpid(pid, &status, 0) == pid &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        result, false, finish);
+
+    for (i = 0; i < kNumTestKexts; i++) {
+        snprintf(original, sizeof(original), "%s/kexts/%s.kext/Contents/Info.plist",
+            gScratchDir, gTestKexts[i].name);
+        snprintf(unpacked, sizeof(unpacked), "%s/%s.kext/Contents/Info.plist",
+            outDir, gTestKexts[i].name);
+        TEST_REQUIRE("unpacked info dictionary matches the original",
+            files_match(original, unpacked), result, false, finish);
+
+        if (!gTestKexts[i].hasExecutable) {
+            continue;
+        }
+        snprintf(original, sizeof(original), "%s/kexts/%s.kext/Contents/MacOS/%s",
+            gScratchDir, gTestKexts[i].name, gTestKexts[i].name);
+        snprintf(unpacked, sizeof(unpacked), "%s/%s.kext/Contents/MacOS/%s",
+            outDir, gTestKexts[i].name, gTestKexts[i].name);
+        TEST_REQUIRE("unpacked executable matches the original",
+            files_match(original, unpacked), result, false, finish);
+    }
+
+finish:
+    return result;
+}
+
+/*******************************************************************************
+*******************************************************************************/
+static void test_mkext1_layout(void)
+{
+    CFDataRef mkext     = NULL;  // must release
+    uint32_t  numStored = 0;
+    int       pass;
+
+    TEST_START("mkext1 layout and round trip");
+
+    for (pass = 0; pass < 2; pass++) {
+        Boolean      compress = (pass == 1);
+        const char * label    = compress ? "compressed" : "stored";
+
+        SAFE_RELEASE_NULL(mkext);
+        mkext = create_test_mkext(compress, /* dedup */ false);
+        TEST_RESULT(compress ? "build compressed mkext" : "build uncompressed mkext",
+            mkext != NULL);
+        if (!mkext) {
+            continue;
+        }
+        TEST_CASE("descriptors and checksum are consistent",
+            check_mkext1_layout(mkext, &numStored));
+        TEST_CASE("every file is stored when not deduplicating",
+            numStored == kNumTestFiles);
+        TEST_CASE("mkextunpack recovers every file",
+            check_mkextunpack_round_trip(mkext, label));
+    }
+
+    SAFE_RELEASE(mkext);
+}
+
+/*******************************************************************************
+* The two identical executables must be stored once, with both kexts'
+* descriptors pointing at that one copy, and still unpack to both kexts.
+*******************************************************************************/
+static void test_mkext1_dedup(void)
+{
+    CFDataRef mkext     = NULL;  // must release
+    CFDataRef plain     = NULL;  // must release
+    uint32_t  numStored = 0;
+
+    TEST_START("mkext1 duplicate files");
+
+    mkext = create_test_mkext(/* compress */ true, /* dedup */ true);
+    plain = create_test_mkext(/* compress */ true, /* dedup */ false);
+    TEST_RESULT("build deduplicated mkext", mkext != NULL && plain != NULL);
+    if (!mkext || !plain) {
+        goto finish;
+    }
+    TEST_CASE("descriptors and checksum are consistent",
+        check_mkext1_layout(mkext, &numStored));
+    TEST_CASE("identical executables are stored once",
+        numStored == kNumTestFiles - 1);
+    TEST_CASE("deduplicated mkext is smaller",
+        CFDataGetLength(mkext) < CFDataGetLength(plain));
+    TEST_CASE("mkextunpack recovers every file",
+        check_mkextunpack_round_trip(mkext, "dedup"));
+
+finish:
+    SAFE_RELEASE(mkext);
+    SAFE_RELEASE(plain);
+}
+
+/*******************************************************************************
+* mkextunpack is looked for beside this tool, where a local build puts it,
+* and then where it is installed.
+*******************************************************************************/
+int main(int argc __unused, char * argv[])
+{
+    bool kextsMade;
+    char kextsDir[PATH_MAX];
+    char toolDir[PATH_MAX];
+
+    strlcpy(toolDir, argv[0], sizeof(toolDir));
+    snprintf(gMkextunpackPath, sizeof(gMkextunpackPath), "%s/mkextunpack",
+        dirname(toolDir));
+    if (access(gMkextunpackPath, X_OK) == -1) {
+        strlcpy(gMkextunpackPath, "/usr/sbin/mkextunpack",
+            sizeof(gMkextunpackPath));
+    }
+
+    strlcpy(gScratchDir, "/tmp/mkext1_test.XXXXXX", sizeof(gScratchDir));
+    if (!mkdtemp(gScratchDir)) {
+        TEST_LOG("can't create scratch directory");
+        exit(0);
+    }
+    snprintf(kextsDir, sizeof(kextsDir), "%s/kexts", gScratchDir);
+    kextsMade = make_test_kexts(kextsDir);
+    TEST_CASE("make test kexts", kextsMade);
+
+    if (kextsMade) {
+        test_mkext1_layout();
+        test_mkext1_dedup();
+    }
+
+    removefile(gScratchDir, NULL, REMOVEFILE_RECURSIVE);
+    exit(0);
+}